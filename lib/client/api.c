@@ -107,7 +107,9 @@
 #include "mem.h"
 #include "client.h"
 
-static void omlc_ms_process(OmlMStream* ms);
+static void omlc_ms_process(OmlMStream* ms, int n);
+static void omlc_ms_deadband_sample(OmlMStream* ms, OmlValue* v, OmlValueU* values);
+static void omlc_instrument(OmlMP *mp, uint64_t written, uint64_t dropped);
 
 extern OmlMP* schema0;
 
@@ -174,13 +176,147 @@ omlc_inject(OmlMP *mp, OmlValueU *values)
 
       f->input(f, &v);
     }
-    omlc_ms_process(ms);
+    omlc_ms_deadband_sample(ms, &v, values);
+    omlc_ms_process(ms, 1);
     written += ms->written;
     dropped += ms->dropped;
   }
   mp_unlock(mp);
   oml_value_reset(&v);
 
+  omlc_instrument(mp, written, dropped);
+
+  return 0;
+}
+
+/** Copy one numeric field of a batch of samples into a contiguous array.
+ *
+ * \param[out] column array of n elements of the native C type of type
+ * \param type OmlValueT of the field
+ * \param values first value of the field in the batch
+ * \param stride number of OmlValueU between two values of the field
+ * \param n number of values to copy
+ * \return 0 on success, -1 if type is not numeric
+ * \see oml_filter_input_batch
+ */
+static int
+gather_column(void *column, OmlValueT type, const OmlValueU *values, int stride, int n)
+{
+  int i;
+
+  switch(type) {
+#define GATHER(ctype, getter)                             \
+    for (i = 0; i < n; i++) {                             \
+      ((ctype*)column)[i] = getter(values[i * stride]);   \
+    }                                                     \
+    return 0;
+  case OML_LONG_VALUE:   GATHER(long, omlc_get_long);
+  case OML_INT32_VALUE:  GATHER(int32_t, omlc_get_int32);
+  case OML_UINT32_VALUE: GATHER(uint32_t, omlc_get_uint32);
+  case OML_INT64_VALUE:  GATHER(int64_t, omlc_get_int64);
+  case OML_UINT64_VALUE: GATHER(uint64_t, omlc_get_uint64);
+  case OML_DOUBLE_VALUE: GATHER(double, omlc_get_double);
+#undef GATHER
+  default:
+    return -1;
+  }
+}
+
+/**  Inject a batch of measurement samples into a Measurement Point.
+ *
+ * \param mp pointer to OmlMP into which the new samples are being injected
+ * \param values an array of n samples of mp->param_count OmlValueU each
+ * \param n number of samples in values
+ * \return 0 on success, <0 otherwise
+ *
+ * This has the same effect as calling omlc_inject() on each sample in turn,
+ * but the MP is only locked once, and filters supporting it receive the
+ * numeric fields as contiguous arrays of up to OMLF_BATCH_SIZE values
+ * through their oml_filter_input_batch() function, rather than one OmlValue
+ * at a time.  Batches are split at the boundaries of sample-based windows,
+ * so each output tuple summarises the same samples as with omlc_inject().
+ *
+ * \see omlc_inject, oml_filter_input_batch
+ */
+int
+omlc_inject_batch(OmlMP *mp, OmlValueU *values, int n)
+{
+  OmlMStream* ms;
+  OmlValue v;
+  union {
+    long l[OMLF_BATCH_SIZE];
+    int32_t i32[OMLF_BATCH_SIZE];
+    uint32_t u32[OMLF_BATCH_SIZE];
+    int64_t i64[OMLF_BATCH_SIZE];
+    uint64_t u64[OMLF_BATCH_SIZE];
+    double d[OMLF_BATCH_SIZE];
+  } column;
+  int row, i, k;
+
+  if (NULL == omlc_instance || omlc_instance->start_time <= 0) {
+    logerror("Cannot inject samples prior to calling omlc_init and omlc_start\n");
+    return -1;
+  }
+  if (mp == NULL || values == NULL || n < 0) {
+    return -1;
+  }
+
+  LOGDEBUG("Injecting %d samples into MP '%s'\n", n, mp->name);
+
+  oml_value_init(&v);
+  if (mp_lock(mp) == -1) {
+    logwarn("Cannot lock MP '%s' for injection\n", mp->name);
+    return -1;
+  }
+
+  uint64_t written = 0;
+  uint64_t dropped = 0;
+  for (ms = mp->streams; ms; ms = ms->next) {
+    for (row = 0; row < n; row += k) {
+      k = n - row < OMLF_BATCH_SIZE ? n - row : OMLF_BATCH_SIZE;
+      if (ms->sample_thres > 0 && ms->sample_thres - ms->sample_size < k) {
+        k = ms->sample_thres - ms->sample_size;
+      }
+
+      OmlFilter* f = ms->filters;
+      for (; f != NULL; f = f->next) {
+        OmlValueU *field = &values[row * mp->param_count + f->index];
+        OmlValueT type = mp->param_defs[f->index].param_types;
+
+        if (f->input_batch && f->input_type == type &&
+            !gather_column(&column, type, field, mp->param_count, k)) {
+          f->input_batch(f, &column, k);
+
+        } else {
+          for (i = 0; i < k; i++) {
+            oml_value_set(&v, &field[i * mp->param_count], type);
+            f->input(f, &v);
+          }
+        }
+      }
+      omlc_ms_deadband_sample(ms, &v, &values[(row + k - 1) * mp->param_count]);
+      omlc_ms_process(ms, k);
+    }
+    written += ms->written;
+    dropped += ms->dropped;
+  }
+  mp_unlock(mp);
+  oml_value_reset(&v);
+
+  omlc_instrument(mp, written, dropped);
+
+  return 0;
+}
+
+/** Send client instrumentation, if it is due.
+ *
+ * \param mp pointer to the OmlMP into which samples were just injected
+ * \param written number of tuples written by the MSs of mp
+ * \param dropped number of tuples dropped by the MSs of mp
+ */
+static void
+omlc_instrument(OmlMP *mp, uint64_t written, uint64_t dropped)
+{
   /* do we need to send client instrumentation? */
   if(mp != omlc_instance->client_instr && omlc_instance->instr_interval) {
     time_t now;
@@ -198,8 +334,6 @@ omlc_inject(OmlMP *mp, OmlValueU *values)
       omlc_instance->instr_time = now;
     }
   }
-
-  return 0;
 }
 
 /** Inject metadata (key/value) for a specific MP.
@@ -279,14 +413,15 @@ omlc_inject_metadata(OmlMP *mp, const char *key, const OmlValueU *value, OmlValu
  * A lock for the MP containing that MS must be held before calling this function.
  *
  * \param ms pointer to the OmlMStream to process
+ * \param n number of samples just input to the filters of ms
  * \see filter_process
  */
 static void
-omlc_ms_process(OmlMStream *ms)
+omlc_ms_process(OmlMStream *ms, int n)
 {
   if (ms == NULL) return;
 
-  if (ms->sample_thres > 0 && ++ms->sample_size >= ms->sample_thres) {
+  if (ms->sample_thres > 0 && (ms->sample_size += n) >= ms->sample_thres) {
     LOGDEBUG("Generating new sample for MS '%s'\n", ms->table_name);
     // sample based filters fire
     filter_process(ms);
@@ -294,6 +429,26 @@ omlc_ms_process(OmlMStream *ms)
 
 }
 
+/** Record the latest value of the field watched by the deadband of an MS, if any.
+ *
+ * A lock for the MP containing that MS must be held before calling this function.
+ *
+ * \param ms pointer to the OmlMStream
+ * \param v OmlValue to use as temporary storage
+ * \param values sample just injected into the MP of ms
+ * \see OmlDeadband, filter_process
+ */
+static void
+omlc_ms_deadband_sample(OmlMStream *ms, OmlValue *v, OmlValueU *values)
+{
+  OmlDeadband *db = ms->deadband;
+
+  if (db == NULL) return;
+
+  oml_value_set(v, &values[db->index], ms->mp->param_defs[db->index].param_types);
+  db->value = oml_value_to_double(v);
+}
+
 /*
  Local Variables:
  mode: C
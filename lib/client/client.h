@@ -87,6 +87,39 @@ typedef struct OmlClient {
 
 } OmlClient;
 
+/** Deadband (change detection) reporting for an MS.
+ *
+ * A tuple is only reported at the end of a window if the watched field has
+ * changed by more than the thresholds since it was last reported, or if
+ * nothing was reported for max_silence seconds; otherwise, the window is
+ * discarded.
+ *
+ * \see filter_process, liboml2.conf(5)
+ */
+typedef struct OmlDeadband {
+  /** Index of the watched field in the MP */
+  int         index;
+
+  /** Minimal absolute change of the field to report a tuple (if > 0) */
+  double      absolute;
+  /** Minimal change of the field, relative to its last reported value, to report a tuple (if > 0) */
+  double      relative;
+  /** Maximal time without reporting a tuple [s] (if > 0) */
+  double      max_silence;
+
+  /** Latest value of the field */
+  double      value;
+  /** Value of the field when a tuple was last reported */
+  double      last_value;
+  /** Time when a tuple was last reported [s] */
+  double      last_time;
+  /** Whether a tuple was reported yet */
+  int         reported;
+
+  /** Number of windows discarded */
+  long        suppressed;
+} OmlDeadband;
+
 /** Global OmlClient instance */
 extern OmlClient* omlc_instance;
 
@@ -25,6 +25,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include <pthread.h>
 #include <errno.h>
 #include <sys/time.h>
@@ -40,6 +41,8 @@
 #include "client.h"
 
 static void* thread_start(void* handle);
+static int deadband_report(OmlDeadband* db, double now);
+static void filter_newwindow(OmlMStream* ms);
 
 extern OmlClient* omlc_instance;
 
@@ -94,6 +97,9 @@ thread_start(void* handle)
  * (seqno and time). Then, instruct all the filters, in sequence, to write
  * their filtered sample to this writer before finalising the write.
  *
+ * If the MS has a deadband, and its watched field has not changed enough
+ * since the last output, the current window is discarded instead.
+ *
  * \param ms MS to generate output for
  * \return 0 if success, -1 otherwise
  *
@@ -117,6 +123,12 @@ filter_process(OmlMStream* ms)
   }
 
   now = tv.tv_sec - omlc_instance->start_time + 0.000001 * tv.tv_usec;
+
+  if (ms->deadband && !deadband_report(ms->deadband, now)) {
+    ms->deadband->suppressed++;
+    filter_newwindow(ms);
+    return 0;
+  }
   ms->seq_no++;
 
   for (i=0; i<ms->nwriters; i++) {
@@ -144,13 +156,57 @@ filter_process(OmlMStream* ms)
     }
   }
 
-  f = ms->firstFilter;
+  filter_newwindow(ms);
+
+  return 0;
+}
+
+/** Start a new window for all the filters of an MS.
+ * \param ms MS whose filters to reset
+ */
+static void
+filter_newwindow(OmlMStream* ms)
+{
+  OmlFilter *f = ms->firstFilter;
+
   for (; f != NULL; f = f->next) {
     f->newwindow(f);
   }
   ms->sample_size = 0;
+}
 
-  return 0;
+/** Decide whether to report the current window of an MS with a deadband.
+ *
+ * Without thresholds, any change of the watched field is reported.
+ *
+ * \param db OmlDeadband of the MS
+ * \param now current time, relative to the start of the client [s]
+ * \return 1 if a tuple should be reported (and record it as such), 0 otherwise
+ * \see OmlDeadband
+ */
+static int
+deadband_report(OmlDeadband* db, double now)
+{
+  double delta = fabs(db->value - db->last_value);
+  int report;
+
+  if (!db->reported) {
+    report = 1;
+  } else if (db->max_silence > 0 && now - db->last_time >= db->max_silence) {
+    report = 1;
+  } else if (db->absolute <= 0 && db->relative <= 0) {
+    report = delta > 0 || isnan(db->value) != isnan(db->last_value);
+  } else {
+    report = (db->absolute > 0 && delta > db->absolute) ||
+      (db->relative > 0 && delta > db->relative * fabs(db->last_value));
+  }
+
+  if (report) {
+    db->last_value = db->value;
+    db->last_time = now;
+    db->reported = 1;
+  }
+  return report;
 }
 
 /*
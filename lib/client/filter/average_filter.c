@@ -21,6 +21,7 @@
 #include "ocomm/o_log.h"
 #include "oml_value.h"
 #include "average_filter.h"
+#include "batch.h"
 
 #define FILTER_NAME  "avg"
 
@@ -32,6 +33,9 @@ process(OmlFilter* filter, OmlWriter* writer);
 static int
 sample(OmlFilter* f, OmlValue* value);
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n);
+
 static int
 newwindow(OmlFilter* f);
 
@@ -81,6 +85,7 @@ omlf_register_filter_average (void)
                         newwindow,
                         NULL,
                         def);
+  omlf_register_filter_batch (FILTER_NAME, sample_batch);
 }
 
 static int
@@ -106,6 +111,41 @@ sample(OmlFilter* f, OmlValue* value)
   return 0;
 }
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double buf[OMLF_BATCH_SIZE];
+  double sum = 0., min, max;
+  const double* v;
+  int i, k;
+
+  if (n <= 0)
+    return 0;
+
+  for (i = 0; i < n; i += k) {
+    double lo, hi;
+    k = BATCH_CHUNK(i, n);
+    if (!(v = omlf_batch_to_double (f->input_type, values, i, k, buf)))
+      return -1;
+    sum += batch_sum (v, k);
+    batch_min_max (v, k, &lo, &hi);
+    if (i == 0 || lo < min) min = lo;
+    if (i == 0 || hi > max) max = hi;
+  }
+
+  if (isnan(self->sample_sum)) {
+    self->sample_sum = sum;
+  } else {
+    self->sample_sum += sum;
+  }
+  if (min < self->sample_min || isnan(self->sample_min)) self->sample_min = min;
+  if (max > self->sample_max || isnan(self->sample_max)) self->sample_max = max;
+  self->sample_count += n;
+
+  return 0;
+}
+
 static int
 process(OmlFilter* f, OmlWriter* writer)
 {
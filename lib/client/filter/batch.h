@@ -0,0 +1,113 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file batch.h
+ * \brief Helpers for the oml_filter_input_batch() functions of the built-in filters.
+ *
+ * The loops below keep several independent accumulators, so that they are
+ * not serialised on the latency of floating-point additions, and can be
+ * vectorised by the compiler without reassociating a single sum.
+ *
+ * \see oml_filter_input_batch, omlf_batch_to_double
+ */
+#ifndef OML_FILTER_BATCH_H__
+#define OML_FILTER_BATCH_H__
+
+#include "oml2/omlc.h"
+#include "oml2/oml_filter.h"
+
+/** Get the number of samples to process next, at most OMLF_BATCH_SIZE, from i out of n */
+#define BATCH_CHUNK(i, n) ((n) - (i) < OMLF_BATCH_SIZE ? (n) - (i) : OMLF_BATCH_SIZE)
+
+/** Sum an array of doubles */
+static inline double
+batch_sum (const double* v, int n)
+{
+  double s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    s0 += v[i];
+    s1 += v[i + 1];
+    s2 += v[i + 2];
+    s3 += v[i + 3];
+  }
+  for (; i < n; i++) {
+    s0 += v[i];
+  }
+  return (s0 + s1) + (s2 + s3);
+}
+
+/** Sum the squared differences of an array of doubles to a value */
+static inline double
+batch_sum_squares (const double* v, int n, double m)
+{
+  double s0 = 0., s1 = 0., s2 = 0., s3 = 0.;
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    s0 += (v[i] - m) * (v[i] - m);
+    s1 += (v[i + 1] - m) * (v[i + 1] - m);
+    s2 += (v[i + 2] - m) * (v[i + 2] - m);
+    s3 += (v[i + 3] - m) * (v[i + 3] - m);
+  }
+  for (; i < n; i++) {
+    s0 += (v[i] - m) * (v[i] - m);
+  }
+  return (s0 + s1) + (s2 + s3);
+}
+
+/** Find the minimum and maximum of a non-empty array of doubles */
+static inline void
+batch_min_max (const double* v, int n, double* min, double* max)
+{
+  double lo = v[0], hi = v[0];
+  int i;
+
+  for (i = 1; i < n; i++) {
+    lo = v[i] < lo ? v[i] : lo;
+    hi = v[i] > hi ? v[i] : hi;
+  }
+  *min = lo;
+  *max = hi;
+}
+
+/** Get one sample of a batch as an OmlValueU
+ *
+ * \param type OmlValueT of the samples
+ * \param values array of samples of the native C type of type
+ * \param i index of the sample to get
+ * \param[out] u OmlValueU to set to the sample
+ * \return 0 on success, -1 if type is not numeric
+ */
+static inline int
+batch_get (OmlValueT type, const void* values, int i, OmlValueU* u)
+{
+  switch (type) {
+  case OML_LONG_VALUE:   omlc_set_long (*u, ((const long*)values)[i]); break;
+  case OML_INT32_VALUE:  omlc_set_int32 (*u, ((const int32_t*)values)[i]); break;
+  case OML_UINT32_VALUE: omlc_set_uint32 (*u, ((const uint32_t*)values)[i]); break;
+  case OML_INT64_VALUE:  omlc_set_int64 (*u, ((const int64_t*)values)[i]); break;
+  case OML_UINT64_VALUE: omlc_set_uint64 (*u, ((const uint64_t*)values)[i]); break;
+  case OML_DOUBLE_VALUE: omlc_set_double (*u, ((const double*)values)[i]); break;
+  default: return -1;
+  }
+  return 0;
+}
+
+#endif /* OML_FILTER_BATCH_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
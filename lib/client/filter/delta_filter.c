@@ -21,6 +21,7 @@
 #include "ocomm/o_log.h"
 #include "oml_value.h"
 #include "delta_filter.h"
+#include "batch.h"
 
 #define FILTER_NAME  "delta"
 
@@ -32,6 +33,9 @@ process(OmlFilter* filter, OmlWriter* writer);
 static int
 sample(OmlFilter* f, OmlValue* values);
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n);
+
 static int
 newwindow(OmlFilter* f);
 
@@ -82,6 +86,7 @@ omlf_register_filter_delta (void)
             newwindow,
             NULL,
             def);
+  omlf_register_filter_batch (FILTER_NAME, sample_batch);
 }
 
 static int
@@ -102,6 +107,25 @@ sample(
   return 0;
 }
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double buf[1];
+  const double* v;
+
+  if (n <= 0)
+    return 0;
+
+  /* Only the last sample matters */
+  if (!(v = omlf_batch_to_double (f->input_type, values, n - 1, 1, buf)))
+    return -1;
+  self->current = v[0];
+  self->sample_count += n;
+
+  return 0;
+}
+
 static int
 process(
   OmlFilter* f,
@@ -28,6 +28,7 @@ typedef struct FilterType {
   oml_filter_output output;
   oml_filter_newwindow newwindow;
   oml_filter_meta meta;
+  oml_filter_input_batch input_batch;
 
   OmlFilterDef* definition;
   int output_count;
@@ -116,6 +117,7 @@ create_filter(
   f->output = ft->output;
   f->newwindow = ft->newwindow;
   f->meta = ft->meta;
+  f->input_batch = ft->input_batch;
   f->definition = ft->definition;   /* FIXME:  Copy and substitute OML_INPUT_VALUE types */
   f->output_count = ft->output_count;
   f->result = create_filter_result_vector (f->definition, type, ft->output_count);
@@ -228,6 +230,7 @@ omlf_register_filter(const char* filter_name,
   ft->input = input;
   ft->output = output;
   ft->newwindow = newwindow;
+  ft->input_batch = NULL;
   ft->output_count = 0;
 
   OmlFilterDef* dp = filter_def;
@@ -250,6 +253,59 @@ omlf_register_filter(const char* filter_name,
   return 0;
 }
 
+/*! Register a batch input function for the filter type filter_name.
+ */
+int
+omlf_register_filter_batch(const char* filter_name,
+             oml_filter_input_batch input_batch)
+{
+  FilterType* ft = filter_types;
+  for (; ft != NULL; ft = ft->next) {
+    if (strcmp (filter_name, ft->name) == 0) break;
+  }
+  if (ft == NULL) {
+    logerror ("Cannot register batch input for unknown filter '%s'.\n", filter_name);
+    return -1;
+  }
+
+  ft->input_batch = input_batch;
+  return 0;
+}
+
+/** Convert a batch of numeric samples to doubles.
+ *
+ * \param type OmlValueT of the samples
+ * \param values array of samples of the native C type of type
+ * \param offset index of the first sample to convert in values
+ * \param n number of samples to convert, at most OMLF_BATCH_SIZE
+ * \param buf array of at least n doubles to convert the samples into
+ * \return the n samples from offset as doubles, in buf or directly in values, or NULL if type is not numeric
+ * \see oml_filter_input_batch
+ */
+const double*
+omlf_batch_to_double(OmlValueT type, const void* values, int offset, int n, double* buf)
+{
+  int i;
+
+  switch (type) {
+#define CONVERT(ctype)                                      \
+    for (i = 0; i < n; i++) {                               \
+      buf[i] = (double)((const ctype*)values)[offset + i];  \
+    }                                                       \
+    return buf;
+  case OML_LONG_VALUE:   CONVERT(long);
+  case OML_INT32_VALUE:  CONVERT(int32_t);
+  case OML_UINT32_VALUE: CONVERT(uint32_t);
+  case OML_INT64_VALUE:  CONVERT(int64_t);
+  case OML_UINT64_VALUE: CONVERT(uint64_t);
+#undef CONVERT
+  case OML_DOUBLE_VALUE:
+    return (const double*)values + offset;
+  default:
+    return NULL;
+  }
+}
+
 /* Builtin filter registration functions */
 void omlf_register_filter_average (void);
 void omlf_register_filter_first (void);
@@ -258,6 +314,9 @@ void omlf_register_filter_histogram (void);
 void omlf_register_filter_stddev (void);
 void omlf_register_filter_sum (void);
 void omlf_register_filter_delta (void);
+void omlf_register_filter_quantile (void);
+void omlf_register_filter_hdrhist (void);
+void omlf_register_filter_stats (void);
 
 /**
  *  Register all built-in filters.
@@ -271,6 +330,9 @@ void register_builtin_filters ()
   omlf_register_filter_stddev ();
   omlf_register_filter_sum ();
   omlf_register_filter_delta ();
+  omlf_register_filter_quantile ();
+  omlf_register_filter_hdrhist ();
+  omlf_register_filter_stats ();
 }
 
 /** Unregister all built-in filters.
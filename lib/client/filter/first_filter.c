@@ -19,6 +19,7 @@
 #include "ocomm/o_log.h"
 #include "oml_value.h"
 #include "first_filter.h"
+#include "batch.h"
 
 #define FILTER_NAME "first"
 
@@ -30,6 +31,9 @@ process(OmlFilter* filter, OmlWriter* writer);
 static int
 sample(OmlFilter* f, OmlValue* values);
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n);
+
 static int
 newwindow(OmlFilter* f);
 
@@ -77,6 +81,7 @@ omlf_register_filter_first (void)
             newwindow,
             meta,
             def);
+  omlf_register_filter_batch (FILTER_NAME, sample_batch);
 }
 
 static int
@@ -100,6 +105,27 @@ sample(OmlFilter* f, OmlValue * value)
   return 0;
 }
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+  OmlValueU v;
+
+  if (n <= 0)
+    return 0;
+
+  self->sample_count += n;
+  if (self->is_first) {
+    self->is_first = 0;
+    omlc_zero (v);
+    if (batch_get (f->input_type, values, 0, &v))
+      return -1;
+    return oml_value_set(&self->result[0], &v, f->input_type);
+  }
+
+  return 0;
+}
+
 static int
 process(OmlFilter* f, OmlWriter*  writer)
 {
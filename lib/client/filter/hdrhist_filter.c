@@ -0,0 +1,261 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file hdrhist_filter.c
+ * \brief Implements a filter which summarises its samples into a compact,
+ * mergeable histogram.
+ *
+ * \page hdrhist_filter HDR histogram
+ *
+ * The `hdrhist` filter counts its samples in a Sketch (see sketch.c), of
+ * bounded size and relative precision, and outputs the number of samples,
+ * their minimum and maximum, and the serialised Sketch as a blob.  Sketches
+ * from several sampling periods, or several clients, can later be
+ * decoded with sketch_decode() and merged with sketch_merge(), to estimate
+ * quantiles over any set of them.
+ *
+ * Its precision, in significant decimal digits, and its maximal number of
+ * buckets for each sign can be set with the `precision` and `buckets`
+ * properties; changing them discards the current samples.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "oml2/omlc.h"
+#include "oml2/oml_filter.h"
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "hdrhist_filter.h"
+
+#define FILTER_NAME "hdrhist"
+
+typedef struct OmlHdrhistFilterInstanceData InstanceData;
+
+static int
+set (OmlFilter* f, const char* name, OmlValue* value);
+
+static int
+input (OmlFilter* f, OmlValue* value);
+
+static int
+output (OmlFilter* f, OmlWriter* writer);
+
+static int
+newwindow(OmlFilter* f);
+
+void*
+omlf_hdrhist_new(
+  OmlValueT type,
+  OmlValue* result
+  ) {
+  (void)result;
+  if (! omlc_is_numeric_type (type)) {
+    logerror ("%s filter: Can only handle numeric parameters\n", FILTER_NAME);
+    return NULL;
+  }
+
+  InstanceData* self = (InstanceData*)oml_malloc(sizeof(InstanceData) +
+      SKETCH_STORAGE_SIZE (SKETCH_DEFAULT_BUCKETS));
+
+  if (self) {
+    sketch_init (&self->sketch, sketch_precision (SKETCH_DEFAULT_DIGITS),
+        SKETCH_DEFAULT_BUCKETS, (uint64_t*)(self + 1));
+    return self;
+  } else {
+    logerror ("%s filter: Could not allocate %zu bytes for instance data\n",
+        FILTER_NAME,
+        sizeof(InstanceData) + SKETCH_STORAGE_SIZE (SKETCH_DEFAULT_BUCKETS));
+    return NULL;
+  }
+}
+
+void
+omlf_register_filter_hdrhist (void)
+{
+  OmlFilterDef def [] =
+    {
+      { "count", OML_UINT64_VALUE },
+      { "min", OML_DOUBLE_VALUE },
+      { "max", OML_DOUBLE_VALUE },
+      { "sketch", OML_BLOB_VALUE },
+      { NULL, 0 }
+    };
+
+  omlf_register_filter (FILTER_NAME,
+                        omlf_hdrhist_new,
+                        set,
+                        input,
+                        output,
+                        newwindow,
+                        NULL,
+                        def);
+}
+
+/** Get an integer filter property, given either as a number or a string */
+static int
+property_to_int (OmlValue* value, int* i)
+{
+  if (omlc_is_numeric (*value)) {
+    *i = (int)oml_value_to_double (value);
+    return 0;
+
+  } else if (omlc_is_string (*value)) {
+    const char *s = omlc_get_string_ptr (*oml_value_get_value (value));
+    char *end;
+    long l = strtol (s, &end, 10);
+    if (end != s && *end == '\0') {
+      *i = (int)l;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/** Set the precision or number of buckets of the Sketch of a filter.
+ *
+ * The instance data of the filter must end with its Sketch, whose storage
+ * immediately follows.  It is reallocated to the new size, and the Sketch
+ * emptied.
+ *
+ * \param f OmlFilter whose instance data contains a Sketch
+ * \param offset offset of the Sketch in the instance data
+ * \param name name of the property, "precision" (in decimal digits) or "buckets"
+ * \param value new value of the property
+ * \return 0 on success, -1 on error, or 1 if name is not one of the Sketch properties
+ * \see sketch_precision, sketch_init
+ */
+int
+omlf_sketch_set (OmlFilter* f, size_t offset, const char* name, OmlValue* value)
+{
+  Sketch *sketch;
+  void *self;
+  int precision, max_buckets, v;
+
+  if (strcmp (name, "precision") && strcmp (name, "buckets")) {
+    return 1;
+  } else if (!f->instance_data) {
+    return -1;
+  }
+
+  sketch = (Sketch*)((char*)f->instance_data + offset);
+  precision = sketch->precision;
+  max_buckets = sketch->max_buckets;
+  if (property_to_int (value, &v)) {
+    logerror ("%s filter: Invalid value for property '%s'\n", f->name, name);
+    return -1;
+
+  } else if (!strcmp (name, "precision")) {
+    if ((precision = sketch_precision (v)) < 0) {
+      logerror ("%s filter: Precision must be between 1 and %d significant digits, not %d\n",
+          f->name, SKETCH_MAX_DIGITS, v);
+      return -1;
+    }
+
+  } else {
+    if (v < 1) {
+      logerror ("%s filter: Invalid number of buckets %d\n", f->name, v);
+      return -1;
+    }
+    max_buckets = v;
+  }
+
+  if (!(self = oml_malloc (offset + sizeof (Sketch) + SKETCH_STORAGE_SIZE (max_buckets)))) {
+    logerror ("%s filter: Could not allocate memory for %d buckets\n", f->name, max_buckets);
+    return -1;
+  }
+  memcpy (self, f->instance_data, offset);
+  sketch = (Sketch*)((char*)self + offset);
+  sketch_init (sketch, precision, max_buckets, (uint64_t*)(sketch + 1));
+
+  oml_free (f->instance_data);
+  f->instance_data = self;
+  return 0;
+}
+
+static int
+set (
+  OmlFilter* f,
+  const char* name,
+  OmlValue* value
+) {
+  int ret = omlf_sketch_set (f, offsetof (InstanceData, sketch), name, value);
+
+  if (ret > 0) {
+    logwarn ("%s filter: Unknown property '%s'\n", f->name, name);
+    return -1;
+  }
+  return ret;
+}
+
+static int
+input (
+  OmlFilter* f,
+  OmlValue* value
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+
+  if (! omlc_is_numeric (*value))
+    return -1;
+
+  sketch_add (&self->sketch, oml_value_to_double (value));
+  return 0;
+}
+
+static int
+output (
+  OmlFilter* f,
+  OmlWriter* writer
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+  OmlValueU *blob = oml_value_get_value(&f->result[3]);
+  uint8_t *buf = NULL;
+  ssize_t len;
+
+  omlc_set_uint64(*oml_value_get_value(&f->result[0]), self->sketch.count);
+  omlc_set_double(*oml_value_get_value(&f->result[1]), self->sketch.min);
+  omlc_set_double(*oml_value_get_value(&f->result[2]), self->sketch.max);
+
+  /* Serialise the Sketch directly into the storage of the blob */
+  if (omlc_get_blob_size(*blob) > 0) {
+    buf = omlc_get_blob_ptr(*blob);
+  }
+  if ((len = sketch_encode (&self->sketch, &buf)) < 0) {
+    logerror ("%s filter: Could not serialise histogram\n", f->name);
+    return -1;
+  }
+  omlc_set_blob_ptr(*blob, buf);
+  omlc_set_blob_size(*blob, oml_malloc_usable_size (buf));
+  omlc_set_blob_length(*blob, len);
+
+  writer->out (writer, f->result, f->output_count);
+  return 0;
+}
+
+static int
+newwindow(OmlFilter* f)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+
+  sketch_reset (&self->sketch);
+
+  return 0;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
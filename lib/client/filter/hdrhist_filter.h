@@ -0,0 +1,33 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+#ifndef HDRHIST_FILTER_H__
+#define HDRHIST_FILTER_H__
+
+#include "sketch.h"
+
+struct OmlHdrhistFilterInstanceData
+{
+  /** Histogram of the samples received during the current sampling period;
+   * its storage follows this structure */
+  Sketch        sketch;
+};
+
+int omlf_sketch_set (OmlFilter *f, size_t offset, const char *name, OmlValue *value);
+
+#endif // HDRHIST_FILTER_H__
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -19,6 +19,7 @@
 #include "ocomm/o_log.h"
 #include "oml_value.h"
 #include "last_filter.h"
+#include "batch.h"
 
 #define FILTER_NAME "last"
 
@@ -30,6 +31,9 @@ process(OmlFilter* filter, OmlWriter* writer);
 static int
 sample(OmlFilter* f, OmlValue* values);
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n);
+
 static int
 newwindow(OmlFilter* f);
 
@@ -72,6 +76,7 @@ omlf_register_filter_last (void)
             newwindow,
             NULL,
             def);
+  omlf_register_filter_batch (FILTER_NAME, sample_batch);
 }
 
 static int
@@ -93,6 +98,23 @@ sample(
   return oml_value_set(&self->result[0], v, type);
 }
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+  OmlValueU v;
+
+  if (n <= 0)
+    return 0;
+
+  self->sample_count += n;
+  /* Only the last sample matters */
+  omlc_zero (v);
+  if (batch_get (f->input_type, values, n - 1, &v))
+    return -1;
+  return oml_value_set(&self->result[0], &v, f->input_type);
+}
+
 static int
 process(
   OmlFilter* f,
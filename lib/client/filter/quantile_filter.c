@@ -0,0 +1,306 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file quantile_filter.c
+ * \brief Implements a filter which reports percentiles of its samples.
+ *
+ * \page quantile_filter Quantiles
+ *
+ * The `quantile` filter counts its samples in a Sketch (see sketch.c), and
+ * outputs estimates of some of their percentiles, by default p50, p90 and
+ * p99, each within the relative precision of the Sketch.
+ *
+ * The percentiles are selected with the `percentiles` property, as a
+ * comma-separated list such as "p50,p99,p999", where the first two digits
+ * after the 'p' are the percentage, and the following ones its decimals;
+ * p999 is therefore the 99.9th percentile.  Each percentile is output as a
+ * double, named after it.  The `precision` and `buckets` properties are the
+ * same as those of the `hdrhist` filter.
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "oml2/omlc.h"
+#include "oml2/oml_filter.h"
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "hdrhist_filter.h"
+#include "quantile_filter.h"
+
+#define FILTER_NAME "quantile"
+
+/** Percentiles output by default */
+#define DEFAULT_PERCENTILES "p50,p90,p99"
+
+typedef struct OmlQuantileFilterInstanceData InstanceData;
+
+static int
+set (OmlFilter* f, const char* name, OmlValue* value);
+
+static int
+input (OmlFilter* f, OmlValue* value);
+
+static int
+output (OmlFilter* f, OmlWriter* writer);
+
+static int
+newwindow(OmlFilter* f);
+
+static int
+meta (OmlFilter* f, int index_offset, char** name_ptr, OmlValueT* type_ptr);
+
+static int
+parse_percentiles (const char* s, double* quantiles, char (*names)[QUANTILE_NAME_SIZE]);
+
+void*
+omlf_quantile_new(
+  OmlValueT type,
+  OmlValue* result
+  ) {
+  (void)result;
+  if (! omlc_is_numeric_type (type)) {
+    logerror ("%s filter: Can only handle numeric parameters\n", FILTER_NAME);
+    return NULL;
+  }
+
+  InstanceData* self = (InstanceData*)oml_malloc(sizeof(InstanceData) +
+      SKETCH_STORAGE_SIZE (SKETCH_DEFAULT_BUCKETS));
+
+  if (self) {
+    self->count = parse_percentiles (DEFAULT_PERCENTILES, self->quantiles, self->names);
+    sketch_init (&self->sketch, sketch_precision (SKETCH_DEFAULT_DIGITS),
+        SKETCH_DEFAULT_BUCKETS, (uint64_t*)(self + 1));
+    return self;
+  } else {
+    logerror ("%s filter: Could not allocate %zu bytes for instance data\n",
+        FILTER_NAME,
+        sizeof(InstanceData) + SKETCH_STORAGE_SIZE (SKETCH_DEFAULT_BUCKETS));
+    return NULL;
+  }
+}
+
+void
+omlf_register_filter_quantile (void)
+{
+  /* Must match DEFAULT_PERCENTILES */
+  OmlFilterDef def [] =
+    {
+      { "p50", OML_DOUBLE_VALUE },
+      { "p90", OML_DOUBLE_VALUE },
+      { "p99", OML_DOUBLE_VALUE },
+      { NULL, 0 }
+    };
+
+  omlf_register_filter (FILTER_NAME,
+                        omlf_quantile_new,
+                        set,
+                        input,
+                        output,
+                        newwindow,
+                        meta,
+                        def);
+}
+
+/** Parse a comma-separated list of percentiles, such as "p50,p99,p999".
+ *
+ * \param s list of percentiles
+ * \param[out] quantiles array of QUANTILE_MAX_PERCENTILES quantiles, between 0 and 1
+ * \param[out] names array of QUANTILE_MAX_PERCENTILES names of the percentiles
+ * \return the number of percentiles, or -1 on error
+ */
+static int
+parse_percentiles (const char* s, double* quantiles, char (*names)[QUANTILE_NAME_SIZE])
+{
+  int count = 0;
+
+  while (*s) {
+    const char *p = s;
+    double percent = 0., scale = 10.;
+    size_t len;
+
+    while (isspace ((unsigned char)*p)) p++;
+    s = p + strcspn (p, ",");
+    len = s - p;
+    while (len > 0 && isspace ((unsigned char)p[len - 1])) len--;
+    if (*s) s++;
+
+    if (count >= QUANTILE_MAX_PERCENTILES) {
+      logerror ("%s filter: Too many percentiles, at most %d are supported\n",
+          FILTER_NAME, QUANTILE_MAX_PERCENTILES);
+      return -1;
+    } else if (len < 2 || len >= QUANTILE_NAME_SIZE ||
+        tolower ((unsigned char)p[0]) != 'p' || strspn (p + 1, "0123456789") != len - 1) {
+      logerror ("%s filter: Invalid percentile '%.*s', should be of the form p99 or p999\n",
+          FILTER_NAME, (int)len, p);
+      return -1;
+    }
+
+    /* The first two digits are the percentage, the others its decimals */
+    if (len > 2) {
+      percent = 10 * (p[1] - '0') + (p[2] - '0');
+    } else {
+      percent = p[1] - '0';
+    }
+    if (len == 4 && !strncmp (p + 1, "100", 3)) {
+      percent = 100.;
+    } else {
+      size_t i;
+      for (i = 3; i < len; i++, scale *= 10.) {
+        percent += (p[i] - '0') / scale;
+      }
+    }
+
+    quantiles[count] = percent / 100.;
+    names[count][0] = 'p';
+    memcpy (names[count] + 1, p + 1, len - 1);
+    names[count][len] = '\0';
+    count++;
+  }
+
+  if (count == 0) {
+    logerror ("%s filter: No percentiles given\n", FILTER_NAME);
+    return -1;
+  }
+  return count;
+}
+
+/** Set the percentiles output by a filter, and resize its output accordingly */
+static int
+set_percentiles (OmlFilter* f, const char* s)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double quantiles[QUANTILE_MAX_PERCENTILES];
+  char names[QUANTILE_MAX_PERCENTILES][QUANTILE_NAME_SIZE];
+  int i, count;
+
+  if ((count = parse_percentiles (s, quantiles, names)) < 0) {
+    return -1;
+  }
+
+  if (count != f->output_count) {
+    OmlValue *result = (OmlValue*)oml_malloc (count * sizeof (OmlValue));
+    if (!result) {
+      logerror ("%s filter: Could not allocate memory for %d outputs\n", f->name, count);
+      return -1;
+    }
+    oml_value_array_init (result, count);
+    for (i = 0; i < count; i++) {
+      oml_value_set_type (&result[i], OML_DOUBLE_VALUE);
+    }
+    oml_value_array_reset (f->result, f->output_count);
+    oml_free (f->result);
+    f->result = result;
+    f->output_count = count;
+  }
+
+  self->count = count;
+  memcpy (self->quantiles, quantiles, sizeof (quantiles));
+  memcpy (self->names, names, sizeof (names));
+  return 0;
+}
+
+static int
+set (
+  OmlFilter* f,
+  const char* name,
+  OmlValue* value
+) {
+  int ret;
+
+  if (!f->instance_data) {
+    return -1;
+
+  } else if (!strcmp (name, "percentiles")) {
+    if (!omlc_is_string (*value)) {
+      logerror ("%s filter: Property 'percentiles' should be a string\n", f->name);
+      return -1;
+    }
+    return set_percentiles (f, omlc_get_string_ptr (*oml_value_get_value (value)));
+  }
+
+  ret = omlf_sketch_set (f, offsetof (InstanceData, sketch), name, value);
+  if (ret > 0) {
+    logwarn ("%s filter: Unknown property '%s'\n", f->name, name);
+    return -1;
+  }
+  return ret;
+}
+
+static int
+input (
+  OmlFilter* f,
+  OmlValue* value
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+
+  if (! omlc_is_numeric (*value))
+    return -1;
+
+  sketch_add (&self->sketch, oml_value_to_double (value));
+  return 0;
+}
+
+static int
+output (
+  OmlFilter* f,
+  OmlWriter* writer
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+  int i;
+
+  for (i = 0; i < self->count; i++) {
+    omlc_set_double(*oml_value_get_value(&f->result[i]),
+        sketch_quantile (&self->sketch, self->quantiles[i]));
+  }
+
+  writer->out (writer, f->result, f->output_count);
+  return 0;
+}
+
+static int
+newwindow(OmlFilter* f)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+
+  sketch_reset (&self->sketch);
+
+  return 0;
+}
+
+static int
+meta (
+  OmlFilter* f,
+  int index_offset,
+  char** name_ptr,
+  OmlValueT* type_ptr
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+
+  if (!self || index_offset < 0 || index_offset >= self->count)
+    return -1;
+
+  if (name_ptr)
+    *name_ptr = self->names[index_offset];
+  if (type_ptr)
+    *type_ptr = OML_DOUBLE_VALUE;
+  return 0;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+#ifndef QUANTILE_FILTER_H__
+#define QUANTILE_FILTER_H__
+
+#include "sketch.h"
+
+/** Maximal number of percentiles output by a quantile filter */
+#define QUANTILE_MAX_PERCENTILES 16
+/** Size of the name of a percentile, e.g., "p999" */
+#define QUANTILE_NAME_SIZE 16
+
+struct OmlQuantileFilterInstanceData
+{
+  /** Number of percentiles to output */
+  int           count;
+
+  /** Quantile of each output, between 0 and 1 */
+  double        quantiles[QUANTILE_MAX_PERCENTILES];
+
+  /** Name of each output, e.g., "p99" for the 0.99 quantile */
+  char          names[QUANTILE_MAX_PERCENTILES][QUANTILE_NAME_SIZE];
+
+  /** Histogram of the samples received during the current sampling period;
+   * its storage follows this structure */
+  Sketch        sketch;
+};
+
+#endif // QUANTILE_FILTER_H__
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
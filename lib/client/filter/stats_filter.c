@@ -0,0 +1,394 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file stats_filter.c
+ * \brief Implements a filter which calculates several summary statistics of
+ * its samples in a single pass.
+ *
+ * \page stats_filter Summary statistics
+ *
+ * The `stats` filter replaces combinations of the `avg`, `sum` and `stddev`
+ * filters on the same field, which would otherwise each convert and process
+ * every sample separately.  It outputs any subset of the number of samples,
+ * their sum, average, minimum, maximum, variance and standard deviation, in
+ * the order given in its `stats` property, e.g., "avg,min,max,stddev".
+ *
+ * The outputs are named as those of the separate filters (`avg`, `min`,
+ * `max`, `sum`, `variance`, `stddev`), plus `count`, so the columns of the
+ * measurement stream do not change when switching to this filter; `mean`
+ * and `var` are accepted as synonyms of `avg` and `variance`.  By default,
+ * it outputs the same columns as the `avg` and `stddev` filters together.
+ *
+ * The variance is calculated with the same recurrence as the `stddev`
+ * filter, only when it or the standard deviation are output.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "oml2/omlc.h"
+#include "oml2/oml_filter.h"
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "stats_filter.h"
+#include "batch.h"
+
+#define FILTER_NAME "stats"
+
+/** Statistics output by default, same as the avg and stddev filters */
+#define DEFAULT_STATS "avg,min,max,stddev,variance"
+
+typedef struct OmlStatsFilterInstanceData InstanceData;
+
+/** Names and types of the outputs, indexed by enum StatsOutput */
+static OmlFilterDef stats_defs [] =
+  {
+    { "count", OML_UINT64_VALUE },
+    { "sum", OML_DOUBLE_VALUE },
+    { "avg", OML_DOUBLE_VALUE },
+    { "min", OML_DOUBLE_VALUE },
+    { "max", OML_DOUBLE_VALUE },
+    { "variance", OML_DOUBLE_VALUE },
+    { "stddev", OML_DOUBLE_VALUE },
+  };
+
+static int
+set (OmlFilter* f, const char* name, OmlValue* value);
+
+static int
+input (OmlFilter* f, OmlValue* value);
+
+static int
+input_batch (OmlFilter* f, const void* values, int n);
+
+static int
+output (OmlFilter* f, OmlWriter* writer);
+
+static int
+newwindow(OmlFilter* f);
+
+static int
+meta (OmlFilter* f, int index_offset, char** name_ptr, OmlValueT* type_ptr);
+
+static int
+parse_stats (const char* s, uint8_t* outputs);
+
+void*
+omlf_stats_new(
+  OmlValueT type,
+  OmlValue* result
+  ) {
+  (void)result;
+  if (! omlc_is_numeric_type (type)) {
+    logerror ("%s filter: Can only handle numeric parameters\n", FILTER_NAME);
+    return NULL;
+  }
+
+  InstanceData* self = (InstanceData*)oml_malloc(sizeof(InstanceData));
+
+  if (self) {
+    self->noutputs = parse_stats (DEFAULT_STATS, self->outputs);
+    self->moments = 1;
+    self->count = 0;
+    self->sum = 0.;
+    self->min = NAN;
+    self->max = NAN;
+    return self;
+  } else {
+    logerror ("%s filter: Could not allocate %zu bytes for instance data\n",
+        FILTER_NAME,
+        sizeof(InstanceData));
+    return NULL;
+  }
+}
+
+void
+omlf_register_filter_stats (void)
+{
+  /* Must match DEFAULT_STATS */
+  OmlFilterDef def [] =
+    {
+      { "avg", OML_DOUBLE_VALUE },
+      { "min", OML_DOUBLE_VALUE },
+      { "max", OML_DOUBLE_VALUE },
+      { "stddev", OML_DOUBLE_VALUE },
+      { "variance", OML_DOUBLE_VALUE },
+      { NULL, 0 }
+    };
+
+  omlf_register_filter (FILTER_NAME,
+                        omlf_stats_new,
+                        set,
+                        input,
+                        output,
+                        newwindow,
+                        meta,
+                        def);
+  omlf_register_filter_batch (FILTER_NAME, input_batch);
+}
+
+/** Parse a comma-separated list of statistics, such as "avg,min,max".
+ *
+ * \param s list of statistics
+ * \param[out] outputs array of STATS_OUTPUTS enum StatsOutput
+ * \return the number of statistics, or -1 on error
+ */
+static int
+parse_stats (const char* s, uint8_t* outputs)
+{
+  int count = 0, seen = 0;
+
+  while (*s) {
+    const char *p = s;
+    int i;
+    size_t len;
+
+    while (isspace ((unsigned char)*p)) p++;
+    s = p + strcspn (p, ",");
+    len = s - p;
+    while (len > 0 && isspace ((unsigned char)p[len - 1])) len--;
+    if (*s) s++;
+
+    if (len == 4 && !strncmp (p, "mean", len)) {
+      i = STATS_AVG;
+    } else if (len == 3 && !strncmp (p, "var", len)) {
+      i = STATS_VARIANCE;
+    } else {
+      for (i = 0; i < STATS_OUTPUTS; i++) {
+        if (strlen (stats_defs[i].name) == len && !strncmp (p, stats_defs[i].name, len)) {
+          break;
+        }
+      }
+    }
+
+    if (i == STATS_OUTPUTS) {
+      logerror ("%s filter: Unknown statistic '%.*s'\n", FILTER_NAME, (int)len, p);
+      return -1;
+    } else if (seen & (1 << i)) {
+      logerror ("%s filter: Statistic '%s' requested more than once\n",
+          FILTER_NAME, stats_defs[i].name);
+      return -1;
+    }
+    seen |= 1 << i;
+    outputs[count++] = i;
+  }
+
+  if (count == 0) {
+    logerror ("%s filter: No statistics given\n", FILTER_NAME);
+    return -1;
+  }
+  return count;
+}
+
+/** Set the statistics output by a filter, and resize its output accordingly */
+static int
+set_stats (OmlFilter* f, const char* s)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+  uint8_t outputs[STATS_OUTPUTS];
+  int i, count;
+
+  if ((count = parse_stats (s, outputs)) < 0) {
+    return -1;
+  }
+
+  if (count != f->output_count) {
+    OmlValue *result = (OmlValue*)oml_malloc (count * sizeof (OmlValue));
+    if (!result) {
+      logerror ("%s filter: Could not allocate memory for %d outputs\n", f->name, count);
+      return -1;
+    }
+    oml_value_array_init (result, count);
+    oml_value_array_reset (f->result, f->output_count);
+    oml_free (f->result);
+    f->result = result;
+    f->output_count = count;
+  }
+
+  self->noutputs = count;
+  self->moments = 0;
+  for (i = 0; i < count; i++) {
+    self->outputs[i] = outputs[i];
+    self->moments |= outputs[i] == STATS_VARIANCE || outputs[i] == STATS_STDDEV;
+    oml_value_set_type (&f->result[i], stats_defs[outputs[i]].type);
+  }
+  newwindow (f);
+  return 0;
+}
+
+static int
+set (
+  OmlFilter* f,
+  const char* name,
+  OmlValue* value
+) {
+  if (!f->instance_data) {
+    return -1;
+
+  } else if (strcmp (name, "stats")) {
+    logwarn ("%s filter: Unknown property '%s'\n", f->name, name);
+    return -1;
+
+  } else if (!omlc_is_string (*value)) {
+    logerror ("%s filter: Property 'stats' should be a string\n", f->name);
+    return -1;
+  }
+
+  return set_stats (f, omlc_get_string_ptr (*oml_value_get_value (value)));
+}
+
+static int
+input (
+  OmlFilter* f,
+  OmlValue* value
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double val, m;
+
+  if (! omlc_is_numeric (*value))
+    return -1;
+
+  val = oml_value_to_double (value);
+
+  if (self->count++ == 0) {
+    self->sum = self->min = self->max = self->m = val;
+    self->s = 0.;
+    return 0;
+  }
+
+  self->sum += val;
+  if (val < self->min) self->min = val;
+  if (val > self->max) self->max = val;
+  if (self->moments) {
+    m = self->m + (val - self->m) / self->count;
+    self->s += (val - self->m) * (val - m);
+    self->m = m;
+  }
+  return 0;
+}
+
+/* The moments are combined chunk by chunk as in the stddev filter */
+static int
+input_batch (
+  OmlFilter* f,
+  const void* values,
+  int n
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double buf[OMLF_BATCH_SIZE];
+  const double* v;
+  int i, k;
+
+  for (i = 0; i < n; i += k) {
+    double sum, min, max;
+    k = BATCH_CHUNK(i, n);
+    if (!(v = omlf_batch_to_double (f->input_type, values, i, k, buf)))
+      return -1;
+
+    sum = batch_sum (v, k);
+    batch_min_max (v, k, &min, &max);
+    if (self->count == 0) {
+      self->sum = sum;
+      self->min = min;
+      self->max = max;
+    } else {
+      self->sum += sum;
+      if (min < self->min) self->min = min;
+      if (max > self->max) self->max = max;
+    }
+
+    if (self->moments) {
+      double m = sum / k;
+      double s = batch_sum_squares (v, k, m);
+      if (self->count == 0) {
+        self->m = m;
+        self->s = s;
+      } else {
+        double total = (double)self->count + k;
+        double delta = m - self->m;
+        self->m += delta * k / total;
+        self->s += s + delta * delta * self->count * k / total;
+      }
+    }
+    self->count += k;
+  }
+  return 0;
+}
+
+static int
+output (
+  OmlFilter* f,
+  OmlWriter* writer
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double variance = self->count > 1 ? self->s / (self->count - 1) : NAN;
+  int i;
+
+  for (i = 0; i < self->noutputs; i++) {
+    OmlValueU* v = oml_value_get_value(&f->result[i]);
+    switch (self->outputs[i]) {
+    case STATS_COUNT:    omlc_set_uint64(*v, self->count); break;
+    case STATS_SUM:      omlc_set_double(*v, self->sum); break;
+    case STATS_AVG:      omlc_set_double(*v, self->sum / self->count); break;
+    case STATS_MIN:      omlc_set_double(*v, self->min); break;
+    case STATS_MAX:      omlc_set_double(*v, self->max); break;
+    case STATS_VARIANCE: omlc_set_double(*v, variance); break;
+    case STATS_STDDEV:   omlc_set_double(*v, sqrt (variance)); break;
+    }
+  }
+
+  writer->out (writer, f->result, f->output_count);
+  return 0;
+}
+
+static int
+newwindow(OmlFilter* f)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+
+  self->count = 0;
+  self->sum = 0.;
+  self->min = NAN;
+  self->max = NAN;
+  self->m = 0.;
+  self->s = 0.;
+
+  return 0;
+}
+
+static int
+meta (
+  OmlFilter* f,
+  int index_offset,
+  char** name_ptr,
+  OmlValueT* type_ptr
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+
+  if (!self || index_offset < 0 || index_offset >= self->noutputs)
+    return -1;
+
+  if (name_ptr)
+    *name_ptr = (char*)stats_defs[self->outputs[index_offset]].name;
+  if (type_ptr)
+    *type_ptr = stats_defs[self->outputs[index_offset]].type;
+  return 0;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
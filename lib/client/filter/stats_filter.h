@@ -0,0 +1,67 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+#ifndef STATS_FILTER_H__
+#define STATS_FILTER_H__
+
+#include <stdint.h>
+
+/** Statistics which a stats filter can output */
+enum StatsOutput {
+  STATS_COUNT,
+  STATS_SUM,
+  STATS_AVG,
+  STATS_MIN,
+  STATS_MAX,
+  STATS_VARIANCE,
+  STATS_STDDEV,
+
+  /** Number of statistics */
+  STATS_OUTPUTS
+};
+
+/* All the state fits in a single 64-byte cache line */
+struct OmlStatsFilterInstanceData
+{
+  /** Number of samples received during the current sampling period */
+  uint64_t      count;
+
+  /** Sum of the samples of the current sampling period */
+  double        sum;
+
+  /** Minimal sample value seen during the current sampling period */
+  double        min;
+  /** Maximal sample value seen during the current sampling period */
+  double        max;
+
+  /** Running mean and sum of squared differences, as in the stddev filter;
+   * only updated if the variance or standard deviation are output */
+  double        m;
+  double        s;
+
+  /** Number of outputs */
+  uint8_t       noutputs;
+
+  /** Whether m and s are needed */
+  uint8_t       moments;
+
+  /** Statistic of each output, as an enum StatsOutput */
+  uint8_t       outputs[STATS_OUTPUTS];
+};
+
+#endif // STATS_FILTER_H__
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -42,6 +42,7 @@
 #include "ocomm/o_log.h"
 #include "oml_value.h"
 #include "stddev_filter.h"
+#include "batch.h"
 
 #define FILTER_NAME "stddev"
 
@@ -50,6 +51,9 @@ typedef struct OmlStddevFilterInstanceData InstanceData;
 static int
 input (OmlFilter* f, OmlValue* value);
 
+static int
+input_batch (OmlFilter* f, const void* values, int n);
+
 static int
 output (OmlFilter* f, OmlWriter* writer);
 
@@ -103,6 +107,7 @@ omlf_register_filter_stddev (void)
                         newwindow,
                         NULL,
                         def);
+  omlf_register_filter_batch (FILTER_NAME, input_batch);
 }
 
 static int
@@ -135,6 +140,45 @@ input (
   return 0;
 }
 
+/* Each chunk of samples is reduced to its own mean and sum of squared
+ * differences, which are then combined with the running ones, as in:
+ *
+ *   Chan, T.F., Golub, G.H., LeVeque, R.J., "Updating Formulae and a Pairwise
+ *   Algorithm for Computing Sample Variances", Stanford report STAN-CS-79-773.
+ */
+static int
+input_batch (
+  OmlFilter* f,
+  const void* values,
+  int n
+) {
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double buf[OMLF_BATCH_SIZE];
+  const double* v;
+  int i, k;
+
+  for (i = 0; i < n; i += k) {
+    double m, s, delta, total;
+    k = BATCH_CHUNK(i, n);
+    if (!(v = omlf_batch_to_double (f->input_type, values, i, k, buf)))
+      return -1;
+
+    m = batch_sum (v, k) / k;
+    s = batch_sum_squares (v, k, m);
+    if (self->sample_count == 0) {
+      self->m = m;
+      self->s = s;
+    } else {
+      total = (double)self->sample_count + k;
+      delta = m - self->m;
+      self->m += delta * k / total;
+      self->s += s + delta * delta * self->sample_count * k / total;
+    }
+    self->sample_count += k;
+  }
+  return 0;
+}
+
 static int
 output (
   OmlFilter* f,
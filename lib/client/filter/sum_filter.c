@@ -20,6 +20,7 @@
 #include "ocomm/o_log.h"
 #include "oml_value.h"
 #include "sum_filter.h"
+#include "batch.h"
 
 #define FILTER_NAME "sum"
 
@@ -31,6 +32,9 @@ process(OmlFilter* filter, OmlWriter* writer);
 static int
 sample(OmlFilter* f, OmlValue* value);
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n);
+
 static int
 newwindow(OmlFilter* f);
 
@@ -77,6 +81,7 @@ omlf_register_filter_sum (void)
                         newwindow,
                         NULL,
                         def);
+  omlf_register_filter_batch (FILTER_NAME, sample_batch);
 }
 
 static int
@@ -96,6 +101,25 @@ sample(OmlFilter* f, OmlValue* value)
   return 0;
 }
 
+static int
+sample_batch(OmlFilter* f, const void* values, int n)
+{
+  InstanceData* self = (InstanceData*)f->instance_data;
+  double buf[OMLF_BATCH_SIZE];
+  const double* v;
+  int i, k;
+
+  for (i = 0; i < n; i += k) {
+    k = BATCH_CHUNK(i, n);
+    if (!(v = omlf_batch_to_double (f->input_type, values, i, k, buf)))
+      return -1;
+    self->sample_sum += batch_sum (v, k);
+  }
+  self->sample_count += n;
+
+  return 0;
+}
+
 static int
 process(OmlFilter* f, OmlWriter* writer)
 {
@@ -1060,6 +1060,10 @@ destroy_ms(OmlMStream *ms)
 
   while( (ft = destroy_filter(ft)) );
 
+  if (ms->deadband) {
+    loginfo("MS %s: Deadband suppressed %ld tuples\n", ms->table_name, ms->deadband->suppressed);
+    oml_free(ms->deadband);
+  }
   oml_free(ms->writers);
   oml_free(ms);
 
@@ -9,6 +9,16 @@
  */
 /**\file net_stream.c
  * \brief An OmlOutStream implementation that writer that sends measurement tuples over the network.
+ *
+ * The server is asked to acknowledge the samples it stored (see ack.h). The
+ * data written is kept until then and, after a reconnection, what the server
+ * did not acknowledge is sent again before anything else; the server skips
+ * the samples it receives more than once. Acknowledgements are read as they
+ * arrive, whenever data is written, without ever waiting for them.
+ *
+ * Nothing is sent again to servers which never sent any acknowledgements
+ * (e.g., older ones, or the proxy, which does not forward them), and at most
+ * NET_STREAM_UNACKED_MAX bytes are kept for the others.
  */
 
 #include <assert.h>
@@ -17,6 +27,7 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <signal.h>
+#include <errno.h>
 
 #include "oml2/omlc.h"
 #include "oml2/oml_out_stream.h"
@@ -24,8 +35,16 @@
 #include "ocomm/o_socket.h"
 #include "mem.h"
 #include "oml_util.h"
+#include "mbuf.h"
+#include "message.h"
+#include "binary.h"
+#include "text.h"
+#include "ack.h"
 #include "client.h"
 
+/** Maximal amount of data [B] kept until the server acknowledges it */
+#define NET_STREAM_UNACKED_MAX (1024 * 1024)
+
 /** OmlOutStream writing out to an OComm Socket */
 typedef struct OmlNetOutStream {
 
@@ -61,6 +80,29 @@ typedef struct OmlNetOutStream {
   /** True if header has been written to the stream \see open_socket*/
   int   header_written;
 
+  /** Number of connections opened so far \see open_socket */
+  int   connections;
+  /** True if the measurements are sent in binary \see net_stream_write */
+  int   binary;
+  /** True once the server has sent acknowledgements, showing it supports them */
+  int   ack_supported;
+  /** True if acknowledged or resent samples should be skipped from the next write */
+  int   skip_known;
+  /** True if the last write only sent part of its buffer, possibly ending mid-measurement */
+  int   partial;
+  /** Acknowledgements received from the server, not processed yet \see ack_read */
+  MBuffer* acks;
+  /** Sequence number up to which the server acknowledged each stream */
+  int*  acked;
+  /** Number of elements in acked */
+  int   nacked;
+  /** Data sent, but not acknowledged yet \see net_stream_retain */
+  MBuffer* unacked;
+  /** Highest sequence number sent again for each stream after reconnecting \see net_stream_replay */
+  int*  replayed;
+  /** Number of elements in replayed */
+  int   nreplayed;
+
 } OmlNetOutStream;
 
 static int open_socket(OmlNetOutStream* self);
@@ -124,6 +166,18 @@ net_stream_close(OmlOutStream* stream)
   oml_free(self->host);
   oml_free(self->protocol);
   oml_free(self->service);
+  if (self->acks) {
+    mbuf_destroy(self->acks);
+  }
+  if (self->acked) {
+    oml_free(self->acked);
+  }
+  if (self->unacked) {
+    mbuf_destroy(self->unacked);
+  }
+  if (self->replayed) {
+    oml_free(self->replayed);
+  }
   oml_free(self);
   return 0;
 }
@@ -167,6 +221,11 @@ open_socket(OmlNetOutStream* self)
 
     self->socket = sock;
     self->header_written = 0;
+    self->partial = 0;
+    self->connections++;
+    if (self->acks) {
+      mbuf_clear(self->acks);
+    }
   } else {
     logerror("%s: Unsupported transport protocol '%s'\n", self->dest, self->protocol);
     return 0;
@@ -187,12 +246,279 @@ open_socket(OmlNetOutStream* self)
   return 1;
 }
 
+/** Make sure an array of sequence numbers has an element for a stream.
+ *
+ * \param seqnos pointer to the array, reallocated as needed; new elements are zeroed
+ * \param n pointer to the number of elements in the array
+ * \param stream index of the stream
+ * \return 0 on success, -1 on error
+ */
+static int
+net_stream_seqnos_grow(int** seqnos, int* n, int stream)
+{
+  int *grown;
+
+  if (stream < *n) {
+    return 0;
+  } else if (!(grown = oml_realloc(*seqnos, (stream + 1) * sizeof(int)))) {
+    return -1;
+  }
+  memset(grown + *n, 0, (stream + 1 - *n) * sizeof(int));
+  *seqnos = grown;
+  *n = stream + 1;
+
+  return 0;
+}
+
+/** Process the acknowledgements received from the server, without waiting for more.
+ *
+ * \param self OmlNetOutStream to read acknowledgements for
+ * \return the number of acknowledgements which moved a stream forward
+ * \see ack_read
+ */
+static int
+net_stream_read_acks(OmlNetOutStream* self)
+{
+  int stream, seqno, n, progress = 0;
+  ssize_t len;
+
+  if (!self->acks && !(self->acks = mbuf_create())) {
+    return 0;
+  }
+
+  while (self->socket) {
+    if (mbuf_make_room(self->acks, 512) ||
+        (len = recv(socket_get_sockfd(self->socket), mbuf_wrptr(self->acks),
+                    mbuf_wr_remaining(self->acks), MSG_DONTWAIT)) <= 0) {
+      /* Nothing more for now; a closed connection is dealt with when writing */
+      break;
+    }
+    mbuf_write_advance(self->acks, len);
+
+    for (n = ack_read(self->acks, &stream, &seqno); n != ACK_MORE;
+        n = ack_read(self->acks, &stream, &seqno)) {
+      if (n == ACK_END) {
+        self->ack_supported = 1;
+      } else if (n == ACK_SEQNO && stream >= 0) {
+        self->ack_supported = 1;
+        if (!net_stream_seqnos_grow(&self->acked, &self->nacked, stream) &&
+            seqno > self->acked[stream]) {
+          self->acked[stream] = seqno;
+          progress++;
+        }
+      } else {
+        logdebug("%s: Ignoring malformed acknowledgement\n", self->dest);
+      }
+    }
+    mbuf_repack_message(self->acks);
+  }
+
+  return progress;
+}
+
+/** Check whether headers announce binary measurements.
+ *
+ * \param header headers, ending with an empty line, possibly followed by measurements
+ * \param length length of header
+ * \return 1 if a "content: binary" line is found in the headers, 0 otherwise
+ */
+static int
+net_stream_header_is_binary(const uint8_t* header, size_t length)
+{
+  static const char content[] = "content: binary\n";
+  const uint8_t *line = header, *end = header + length, *eol;
+
+  while (line < end && (eol = memchr(line, '\n', end - line)) && eol > line) {
+    if ((size_t)(eol + 1 - line) == sizeof(content) - 1 &&
+        !memcmp(line, content, sizeof(content) - 1)) {
+      return 1;
+    }
+    line = eol + 1;
+  }
+
+  return 0;
+}
+
+/** Find how much of a buffer the server already has, or was sent again.
+ *
+ * \param self OmlNetOutStream through which the buffer would be sent
+ * \param buffer complete measurements to send
+ * \param length length of buffer
+ * \return the length of the longest prefix of buffer made only of measurements
+ * which were acknowledged, or sent again since reconnecting
+ * \see bin_read_msg_start, text_read_msg_start, net_stream_replay
+ */
+static size_t
+net_stream_known_length(OmlNetOutStream* self, uint8_t* buffer, size_t length)
+{
+  MBuffer *mbuf;
+  struct oml_message msg;
+  size_t skip = 0;
+  int len;
+
+  if ((!self->nacked && !self->nreplayed) || !(mbuf = mbuf_create())) {
+    return 0;
+  }
+
+  /* The parsers may modify the data, so work on a copy */
+  if (mbuf_write(mbuf, buffer, length) == 0) {
+    while ((len = self->binary ? bin_read_msg_start(&msg, mbuf) : text_read_msg_start(&msg, mbuf)) > 0 &&
+        msg.stream >= 0 &&
+        ((msg.stream < self->nacked && (int)msg.seqno <= self->acked[msg.stream]) ||
+         (msg.stream < self->nreplayed && (int)msg.seqno <= self->replayed[msg.stream]))) {
+      mbuf_reset_read(mbuf);
+      mbuf_read_skip(mbuf, len);
+      mbuf_consume_message(mbuf);
+      skip = mbuf_message_offset(mbuf);
+    }
+  }
+  mbuf_destroy(mbuf);
+
+  return skip;
+}
+
+/** Keep data sent to the server until it acknowledges it.
+ *
+ * If more than NET_STREAM_UNACKED_MAX bytes are waiting for acknowledgement,
+ * they are forgotten, as soon as this can be done between two measurements.
+ *
+ * \param self OmlNetOutStream through which the data was sent
+ * \param buffer data sent
+ * \param length length of buffer
+ * \see net_stream_trim, net_stream_replay
+ */
+static void
+net_stream_retain(OmlNetOutStream* self, uint8_t* buffer, size_t length)
+{
+  if (!self->unacked && !(self->unacked = mbuf_create())) {
+    return;
+  }
+
+  if (mbuf_rd_remaining(self->unacked) + length > NET_STREAM_UNACKED_MAX && !self->partial) {
+    if (self->ack_supported) {
+      logwarn("%s: Server did not acknowledge the last %zuB of data, not keeping them any more\n",
+          self->dest, mbuf_rd_remaining(self->unacked));
+    }
+    mbuf_clear2(self->unacked, 0);
+  }
+  if (mbuf_write(self->unacked, buffer, length)) {
+    logwarn("%s: Could not keep %zuB of data until acknowledged\n", self->dest, length);
+    mbuf_clear2(self->unacked, 0);
+  }
+}
+
+/** Forget the data the server acknowledged.
+ *
+ * Only the acknowledged measurements at the start of the retained data are
+ * forgotten; any other is sent again, and skipped by the server, if the
+ * connection breaks.
+ *
+ * \param self OmlNetOutStream which received acknowledgements
+ * \see net_stream_retain
+ */
+static void
+net_stream_trim(OmlNetOutStream* self)
+{
+  size_t acked;
+
+  if (!self->unacked || !mbuf_rd_remaining(self->unacked)) {
+    return;
+  }
+
+  acked = net_stream_known_length(self, mbuf_rdptr(self->unacked), mbuf_rd_remaining(self->unacked));
+  if (acked > 0) {
+    mbuf_read_skip(self->unacked, acked);
+    mbuf_consume_message(self->unacked);
+    mbuf_repack_message(self->unacked);
+  }
+}
+
+/** Send again what the server did not acknowledge before the connection broke.
+ *
+ * Only complete measurements are sent. One cut short at the end of the
+ * retained data was being written when the connection broke, and the
+ * BufferedWriter writes it again in full, along with those before it in its
+ * chain; the highest sequence number sent again for each stream is recorded
+ * so the latter can be skipped.
+ *
+ * \param self OmlNetOutStream which just reconnected and wrote its headers
+ * \return 0 on success, -1 if the connection broke again
+ * \see net_stream_known_length
+ */
+static int
+net_stream_replay(OmlNetOutStream* self)
+{
+  MBuffer *mbuf, *unacked = self->unacked;
+  struct oml_message msg;
+  size_t complete = 0, sent;
+  ssize_t len;
+
+  self->nreplayed = 0;
+  if (!unacked || !mbuf_rd_remaining(unacked)) {
+    return 0;
+  } else if (!self->ack_supported || !(mbuf = mbuf_create())) {
+    /* Without acknowledgements, the server would not skip what it already has */
+    mbuf_clear2(unacked, 0);
+    return 0;
+  }
+
+  /* The parsers may modify the data, so work on a copy */
+  if (mbuf_write(mbuf, mbuf_rdptr(unacked), mbuf_rd_remaining(unacked)) == 0) {
+    while ((len = self->binary ? bin_read_msg_start(&msg, mbuf) : text_read_msg_start(&msg, mbuf)) > 0) {
+      if (msg.stream >= 0 &&
+          !net_stream_seqnos_grow(&self->replayed, &self->nreplayed, msg.stream) &&
+          (int)msg.seqno > self->replayed[msg.stream]) {
+        self->replayed[msg.stream] = msg.seqno;
+      }
+      mbuf_reset_read(mbuf);
+      mbuf_read_skip(mbuf, len);
+      mbuf_consume_message(mbuf);
+      complete = mbuf_message_offset(mbuf);
+    }
+  }
+  mbuf_destroy(mbuf);
+
+  if (complete < mbuf_rd_remaining(unacked)) {
+    /* Drop the incomplete measurement, which is about to be written again */
+    if ((mbuf = mbuf_create()) && mbuf_write(mbuf, mbuf_rdptr(unacked), complete) == 0) {
+      mbuf_destroy(unacked);
+      unacked = self->unacked = mbuf;
+    } else {
+      if (mbuf) {
+        mbuf_destroy(mbuf);
+      }
+      mbuf_clear2(unacked, 0);
+      self->nreplayed = 0;
+      return 0;
+    }
+  }
+  if (complete == 0) {
+    return 0;
+  }
+
+  logdebug("%s: Sending again %zuB of data the server did not acknowledge\n", self->dest, complete);
+  for (sent = 0; sent < complete; sent += len) {
+    if ((len = socket_write(self, mbuf_rdptr(unacked) + sent, complete - sent)) <= 0) {
+      if (self->socket) {
+        /* Part of a measurement may have been sent; start over on a new connection */
+        socket_free(self->socket);
+        self->socket = NULL;
+      }
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 /** Called to write into the socket
  * \see oml_outs_write_f
  *
- * If the connection needs to be re-established, header is sent first, then buffer,
+ * If the connection needs to be re-established, header is sent first, then
+ * the data the server did not acknowledge, then buffer, less the
+ * measurements the server already has or which were just sent again.
  *
- * \see \see open_socket, socket_write
+ * \see open_socket, socket_write, net_stream_replay
  */
 static size_t
 net_stream_write(OmlOutStream* hdl, uint8_t* buffer, size_t  length, uint8_t* header, size_t  header_length)
@@ -207,14 +533,19 @@ net_stream_write(OmlOutStream* hdl, uint8_t* buffer, size_t  length, uint8_t* he
     }
   }
 
-  size_t count;
+  size_t count, skip = 0;
   if (! self->header_written) {
+    char ack_header[32];
+    size_t ack_header_length = snprintf(ack_header, sizeof(ack_header), "%s: %d\n",
+        ACK_HEADER_KEY, ACK_PROTOCOL_VERSION);
+
     if(o_log_level_active(O_LOG_DEBUG4)) {
       char *out = to_octets(header, header_length);
       logdebug("%s: Sending header %s\n", self->dest, out);
       oml_free(out);
     }
-    if ((count = socket_write(self, header, header_length)) < header_length) {
+    if (socket_write(self, (uint8_t*)ack_header, ack_header_length) < (ssize_t)ack_header_length ||
+        (count = socket_write(self, header, header_length)) < header_length) {
       // TODO: This is not completely right as we end up rewriting the same header
       // if we can only partially write it. At this stage we think this is too hard
       // to deal with and we assume it doesn't happen.
@@ -225,14 +556,46 @@ net_stream_write(OmlOutStream* hdl, uint8_t* buffer, size_t  length, uint8_t* he
       return 0;
     }
     self->header_written = 1;
+    self->binary = net_stream_header_is_binary(header, header_length);
+
+    if (self->connections > 1) {
+      /* Whatever the previous connections were sending when they broke is
+       * about to be written again; send what the server did not acknowledge
+       * first, and skip it from what follows */
+      if (net_stream_replay(self) < 0) {
+        return 0;
+      }
+      self->skip_known = 1;
+    }
   }
+
+  if (self->skip_known) {
+    self->skip_known = 0;
+    skip = net_stream_known_length(self, buffer, length);
+    self->nreplayed = 0;
+    if (skip > 0) {
+      logdebug("%s: Server already has, or was just sent, the first %zuB of data, not sending them again\n",
+          self->dest, skip);
+      if (skip == length) {
+        return length;
+      }
+    }
+  }
+
   if(o_log_level_active(O_LOG_DEBUG4)) {
-    char *out = to_octets(buffer, length);
+    char *out = to_octets(buffer + skip, length - skip);
     logdebug("%s: Sending data %s\n", self->dest, out);
     oml_free(out);
   }
-  count = socket_write(self, buffer, length);
-  return count;
+  count = socket_write(self, buffer + skip, length - skip);
+  if ((ssize_t)count > 0) {
+    net_stream_retain(self, buffer + skip, count);
+    self->partial = count < length - skip;
+  }
+  if (net_stream_read_acks(self) > 0) {
+    net_stream_trim(self);
+  }
+  return (ssize_t)count > 0 ? count + skip : count;
 }
 
 /** Do the actual writing into the OComm Socket, with error handling
@@ -249,8 +612,11 @@ socket_write(OmlNetOutStream* self, uint8_t* buffer, size_t  length)
 {
   int result = socket_sendto(self->socket, (char*)buffer, length);
 
-  if (result == -1 && socket_is_disconnected (self->socket)) {
+  if (result <= 0 && socket_is_disconnected (self->socket)) {
+    /* The Socket would otherwise silently reconnect on the next write, without
+     * the headers being sent again */
     logwarn ("%s: Connection lost\n", self->dest);
+    socket_free(self->socket);
     self->socket = NULL;      // Server closed the connection
   }
   return result;
@@ -52,6 +52,23 @@ typedef int (*oml_filter_set)(struct OmlFilter* filter, const char* name, OmlVal
 typedef int (*oml_filter_input)(struct OmlFilter* filter, OmlValue* value);
 
 
+/** Optional function called with a batch of numeric samples at once.
+ *
+ * The samples are in a contiguous array of the native C type of
+ * filter->input_type (e.g., int32_t for OML_INT32_VALUE, or double for
+ * OML_DOUBLE_VALUE), so the filter can process them in tight loops, which the
+ * compiler can vectorise.  The result must be the same as calling
+ * oml_filter_input() on each of them in turn, but for floating-point
+ * rounding.  All samples belong to the current sampling period.
+ *
+ * \param filter pointer to OmlFilter instance
+ * \param values array of n samples
+ * \param n number of samples in values
+ * \return 0 on success, -1 otherwise
+ * \see omlf_register_filter_batch, omlf_batch_to_double, omlc_inject_batch
+ */
+typedef int (*oml_filter_input_batch)(struct OmlFilter* filter, const void* values, int n);
+
 /** Function called whenever aggregated output is requested from the filter.
  * some function over the samples received since the last call.
  *
@@ -141,6 +158,9 @@ typedef struct OmlFilter {
 
   /** Function to start a new sampling period \see oml_filter_newwindow */
   oml_filter_newwindow newwindow; /* XXX: To be pulled up after output on the next ABI version change */
+
+  /** Function to process a batch of numeric samples (optional) \see oml_filter_input_batch */
+  oml_filter_input_batch input_batch; /* XXX: To be pulled up after input on the next ABI version change */
 } OmlFilter;
 
 /** Register a new filter type.
@@ -174,6 +194,27 @@ int
 omlf_register_filter(const char* filter_name, oml_filter_create create, oml_filter_set set, oml_filter_input input,
     oml_filter_output output, oml_filter_newwindow newwindow, oml_filter_meta meta, OmlFilterDef* filter_def);
 
+/** Register a function processing batches of samples for an existing filter type.
+ *
+ *  Instances of the filter type created afterwards use input_batch when
+ *  several numeric samples are available at once, e.g., from
+ *  omlc_inject_batch().  Filters without one receive each sample through
+ *  their oml_filter_input() function.
+ *
+ *  \param filter_name name of the filter type, as given to omlf_register_filter()
+ *  \param input_batch oml_filter_input_batch() function
+ *  \return 0 on success, -1 if the filter type is unknown
+ *  \see omlf_register_filter, oml_filter_input_batch
+ */
+int
+omlf_register_filter_batch(const char* filter_name, oml_filter_input_batch input_batch);
+
+/** Number of samples converted at a time by omlf_batch_to_double() */
+#define OMLF_BATCH_SIZE 256
+
+const double*
+omlf_batch_to_double(OmlValueT type, const void* values, int offset, int n, double* buf);
+
 #ifdef __cplusplus
 }
 #endif
@@ -683,6 +683,7 @@ typedef struct OmlMP {
 /* Forward declaration from oml_filter.h */
 struct OmlFilter;   // can't include oml_filter.h yet
 struct OmlWriter;   // forward declaration
+struct OmlDeadband; // internal, see client.h
 
 /** Definition of a Measurement Stream.
  *
@@ -750,6 +751,9 @@ typedef struct OmlMStream {
   /** Number of tuples dropped */
   uint32_t dropped;
 
+  /** Deadband reporting, only reporting tuples when a field changes, or NULL */
+  struct OmlDeadband* deadband;
+
 } OmlMStream;
 
 /* Initialise the measurement library. */
@@ -764,6 +768,9 @@ int omlc_start(void);
 /*  Inject a measurement sample into a Measurement Point.  */
 int omlc_inject(OmlMP *mp, OmlValueU *values);
 
+/*  Inject a batch of measurement samples into a Measurement Point.  */
+int omlc_inject_batch(OmlMP *mp, OmlValueU *values, int n);
+
 /** Inject metadata (key/value) for a specific MP.  */
 int omlc_inject_metadata(OmlMP *mp, const char *key, const OmlValueU *value, OmlValueT type, const char *fname);
 
@@ -35,6 +35,11 @@ enum ConfToken {
   CT_STREAM_SOURCE,
   CT_STREAM_SAMPLES,
   CT_STREAM_INTERVAL,
+  CT_DEADBAND,
+  CT_DEADBAND_FIELD,
+  CT_DEADBAND_ABSOLUTE,
+  CT_DEADBAND_RELATIVE,
+  CT_DEADBAND_SILENCE,
   CT_FILTER,
   CT_FILTER_FIELD,
   CT_FILTER_OPER,
@@ -61,6 +66,7 @@ static int parse_mp(xmlNodePtr el, OmlWriter* writer);
 static int parse_stream(xmlNodePtr el, OmlWriter* writer);
 static int parse_stream_filters (xmlNodePtr el, OmlWriter* writer, char *source, char *name);
 static OmlFilter* parse_filter(xmlNodePtr el, OmlMStream* ms, OmlMP* mp);
+static int parse_deadband(xmlNodePtr el, OmlMStream* ms, OmlMP* mp);
 static OmlFilter* parse_filter_properties(xmlNodePtr el, OmlFilter* f);
 static int set_filter_property(OmlFilter* f, const char* pname, const char* ptype, const char* pvalue);
 
@@ -95,6 +101,11 @@ init_tokens (void)
   setcurtok (CT_STREAM_SOURCE),    mksyn ("source"), mksyn ("mp");
   setcurtok (CT_STREAM_SAMPLES),   mksyn ("samples");
   setcurtok (CT_STREAM_INTERVAL),  mksyn ("interval");
+  setcurtok (CT_DEADBAND),         mksyn ("deadband");
+  setcurtok (CT_DEADBAND_FIELD),   mksyn ("field");
+  setcurtok (CT_DEADBAND_ABSOLUTE),mksyn ("absolute");
+  setcurtok (CT_DEADBAND_RELATIVE),mksyn ("relative");
+  setcurtok (CT_DEADBAND_SILENCE), mksyn ("silence");
   setcurtok (CT_FILTER),           mksyn ("f"), mksyn ("filter");
   setcurtok (CT_FILTER_FIELD),     mksyn ("pname"), mksyn ("field");
   setcurtok (CT_FILTER_OPER),      mksyn ("fname"), mksyn ("operation");
@@ -494,6 +505,11 @@ parse_stream_filters (xmlNodePtr el, OmlWriter *writer,
       }
       f->next = ms->filters;
       ms->filters = f;
+
+    } else if (match_xml_elt (el2, CT_DEADBAND)) {
+      if (parse_deadband(el2, ms, mp)) {
+        return -7;
+      }
     }
   }
 
@@ -561,6 +577,94 @@ parse_filter (xmlNodePtr el, OmlMStream* ms, OmlMP* mp)
   return f;
 }
 
+/** Parse a non-negative number from an attribute of a <deadband/> element.
+ *
+ * \param el the XML element
+ * \param tok the token of the attribute
+ * \param[out] value the parsed number, left untouched if the attribute is absent
+ * \return 0 if successful or absent, -1 otherwise
+ */
+static int
+parse_deadband_number(xmlNodePtr el, enum ConfToken tok, double *value)
+{
+  char *str = get_xml_attr (el, tok);
+  char *end;
+  double d;
+
+  if (str == NULL) {
+    return 0;
+  }
+
+  d = strtod (str, &end);
+  if (end == str || *end != '\0' || d < 0) {
+    logerror("Config line %hu: Invalid value '%s' for '%s' in <%s ...>; it should be a non-negative number.\n",
+             el->line, str, canonical_name (tok), el->name);
+    oml_free (str);
+    return -1;
+  }
+  *value = d;
+  oml_free (str);
+  return 0;
+}
+
+/** Parse a <deadband/> element and attach it to its stream.
+ *
+ * The stream then only reports a tuple when the numeric field named in the
+ * 'field' attribute has changed by more than 'absolute', or by more than
+ * 'relative' times its last reported value, or at least every 'silence'
+ * seconds. Without 'absolute' or 'relative', any change is reported.
+ *
+ * \param el the XML element to analyze.
+ * \param ms the stream to which the deadband applies.
+ * \param mp the measurement point to which the stream is attached.
+ * \return 0 if successful, -1 otherwise
+ * \see OmlDeadband
+ */
+static int
+parse_deadband (xmlNodePtr el, OmlMStream* ms, OmlMP* mp)
+{
+  char* field = get_xml_attr (el, CT_DEADBAND_FIELD);
+  OmlDeadband *db = NULL;
+  int index, ret = -1;
+
+  if (field == NULL) {
+    logerror("Config line %hu: Deadband config element <%s ...> must include a '%s' attribute.\n",
+             el->line, el->name, canonical_name (CT_DEADBAND_FIELD));
+    return -1;
+
+  } else if ((index = find_mp_field (field, mp)) < 0) {
+    logerror("Config line %hu: Unknown field '%s' in measurement point '%s'.\n",
+             el->line, field, mp->name);
+
+  } else if (!omlc_is_numeric_type (mp->param_defs[index].param_types)) {
+    logerror("Config line %hu: Deadband field '%s' of measurement point '%s' is not numeric.\n",
+             el->line, field, mp->name);
+
+  } else if (ms->deadband) {
+    logwarn("Config line %hu: MS '%s' already has a deadband, ignoring this one.\n",
+            el->line, ms->table_name);
+    ret = 0;
+
+  } else if (!(db = oml_malloc (sizeof (OmlDeadband)))) {
+    logerror("Cannot allocate memory for the deadband of MS '%s'\n", ms->table_name);
+
+  } else if (parse_deadband_number (el, CT_DEADBAND_ABSOLUTE, &db->absolute) ||
+      parse_deadband_number (el, CT_DEADBAND_RELATIVE, &db->relative) ||
+      parse_deadband_number (el, CT_DEADBAND_SILENCE, &db->max_silence)) {
+    oml_free (db);
+
+  } else {
+    logdebug("MS '%s' reports changes of '%s' by more than %g or %g%%, or every %gs\n",
+             ms->table_name, field, db->absolute, 100 * db->relative, db->max_silence);
+    db->index = index;
+    ms->deadband = db;
+    ret = 0;
+  }
+
+  oml_free (field);
+  return ret;
+}
+
 /** Parse optional filter properties and call the filter's 'set' funtion with the properly cast values.
  *
  * A property has a name and a type, which are specified in attributes
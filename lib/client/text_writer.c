@@ -12,7 +12,6 @@
  */
 
 #include <assert.h>
-#include <float.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,6 +26,7 @@
 #include "buffered_writer.h"
 #include "string_utils.h"
 #include "base64.h"
+#include "json.h"
 
 typedef struct OmlTextWriter {
 
@@ -133,6 +133,26 @@ owt_header_done(OmlWriter* writer)
 }
 
 
+/** Make room for a vector in the output buffer, and write its number of elements
+ *
+ * \param mbuf MBuffer to write into
+ * \param nof_elts number of elements in the vector
+ * \param elt_maxlen maximal length of the text representation of an element
+ * \return a pointer where to write the elements, followed by mbuf_write_advance(), or NULL on error
+ * \see json_format_double, json_format_int64, json_format_uint64
+ */
+static char*
+owt_vector_start(MBuffer* mbuf, size_t nof_elts, size_t elt_maxlen)
+{
+  char *p;
+  if (mbuf_check_resize(mbuf, 1 + JSON_UINT64_MAXLEN + nof_elts * (1 + elt_maxlen)) < 0) {
+    return NULL;
+  }
+  p = (char*)mbuf_wrptr(mbuf);
+  *p++ = '\t';
+  return p + json_format_uint64(p, nof_elts);
+}
+
 /** Function called for every result value in a measurement tuple (sample)
  * \see oml_writer_out
  */
@@ -216,61 +236,84 @@ owt_row_cols(OmlWriter* writer, OmlValue* values, int value_count)
 
     case OML_VECTOR_DOUBLE_VALUE: {
       OmlValueU *u = oml_value_get_value(v);
-      size_t nof_elts = omlc_get_vector_nof_elts(*u);
+      size_t j, nof_elts = omlc_get_vector_nof_elts(*u);
       double *elts = omlc_get_vector_ptr(*u);
-      res = mbuf_print(mbuf, "\t%zu", nof_elts);
-      for(i = 0; 0 == res && i < nof_elts; i++)
-        res = mbuf_print(mbuf, " %.*g", DBL_DIG, elts[i]);
+      char *p = owt_vector_start(mbuf, nof_elts, JSON_DOUBLE_MAXLEN);
+      for(j = 0; p && j < nof_elts; j++) {
+        *p++ = ' ';
+        p += json_format_double(p, elts[j]);
+      }
+      res = p ? mbuf_write_advance(mbuf, p - (char*)mbuf_wrptr(mbuf)) : -1;
       break;
     }
 
     case OML_VECTOR_INT32_VALUE: {
       OmlValueU *u = oml_value_get_value(v);
-      size_t nof_elts = omlc_get_vector_nof_elts(*u);
+      size_t j, nof_elts = omlc_get_vector_nof_elts(*u);
       int32_t *elts = omlc_get_vector_ptr(*u);
-      res = mbuf_print(mbuf, "\t%zu", nof_elts);
-      for(i = 0; 0 == res && i < nof_elts; i++)
-        res = mbuf_print(mbuf, " %" PRId32, elts[i]);
+      char *p = owt_vector_start(mbuf, nof_elts, JSON_INT32_MAXLEN);
+      for(j = 0; p && j < nof_elts; j++) {
+        *p++ = ' ';
+        p += json_format_int64(p, elts[j]);
+      }
+      res = p ? mbuf_write_advance(mbuf, p - (char*)mbuf_wrptr(mbuf)) : -1;
       break;
     }
 
     case OML_VECTOR_UINT32_VALUE: {
       OmlValueU *u = oml_value_get_value(v);
-      size_t nof_elts = omlc_get_vector_nof_elts(*u);
+      size_t j, nof_elts = omlc_get_vector_nof_elts(*u);
       uint32_t *elts = omlc_get_vector_ptr(*u);
-      res = mbuf_print(mbuf, "\t%zu", nof_elts);
-      for(i = 0; 0 == res && i < nof_elts; i++)
-        res = mbuf_print(mbuf, " %" PRIu32, elts[i]);
+      char *p = owt_vector_start(mbuf, nof_elts, JSON_UINT32_MAXLEN);
+      for(j = 0; p && j < nof_elts; j++) {
+        *p++ = ' ';
+        p += json_format_uint64(p, elts[j]);
+      }
+      res = p ? mbuf_write_advance(mbuf, p - (char*)mbuf_wrptr(mbuf)) : -1;
       break;
     }
 
     case OML_VECTOR_INT64_VALUE: {
       OmlValueU *u = oml_value_get_value(v);
-      size_t nof_elts = omlc_get_vector_nof_elts(*u);
+      size_t j, nof_elts = omlc_get_vector_nof_elts(*u);
       int64_t *elts = omlc_get_vector_ptr(*u);
-      res = mbuf_print(mbuf, "\t%zu", nof_elts);
-      for(i = 0; 0 == res && i < nof_elts; i++)
-        res = mbuf_print(mbuf, " %" PRId64, elts[i]);
+      char *p = owt_vector_start(mbuf, nof_elts, JSON_INT64_MAXLEN);
+      for(j = 0; p && j < nof_elts; j++) {
+        *p++ = ' ';
+        p += json_format_int64(p, elts[j]);
+      }
+      res = p ? mbuf_write_advance(mbuf, p - (char*)mbuf_wrptr(mbuf)) : -1;
       break;
     }
 
     case OML_VECTOR_UINT64_VALUE: {
       OmlValueU *u = oml_value_get_value(v);
-      size_t nof_elts = omlc_get_vector_nof_elts(*u);
+      size_t j, nof_elts = omlc_get_vector_nof_elts(*u);
       uint64_t *elts = omlc_get_vector_ptr(*u);
-      res = mbuf_print(mbuf, "\t%zu", nof_elts);
-      for(i = 0; 0 == res && i < nof_elts; i++)
-        res = mbuf_print(mbuf, " %" PRIu64, elts[i]);
+      char *p = owt_vector_start(mbuf, nof_elts, JSON_UINT64_MAXLEN);
+      for(j = 0; p && j < nof_elts; j++) {
+        *p++ = ' ';
+        p += json_format_uint64(p, elts[j]);
+      }
+      res = p ? mbuf_write_advance(mbuf, p - (char*)mbuf_wrptr(mbuf)) : -1;
       break;
     }
 
     case OML_VECTOR_BOOL_VALUE: {
       OmlValueU *u = oml_value_get_value(v);
-      size_t nof_elts = omlc_get_vector_nof_elts(*u);
+      size_t j, nof_elts = omlc_get_vector_nof_elts(*u);
       bool *elts = omlc_get_vector_ptr(*u);
-      res = mbuf_print(mbuf, "\t%zu", nof_elts);
-      for(i = 0; 0 == res && i < nof_elts; i++)
-        res = mbuf_print(mbuf, " %s", elts[i] ? "True" : "False");
+      char *p = owt_vector_start(mbuf, nof_elts, JSON_BOOL_MAXLEN);
+      for(j = 0; p && j < nof_elts; j++) {
+        if (elts[j]) {
+          memcpy(p, " True", 5);
+          p += 5;
+        } else {
+          memcpy(p, " False", 6);
+          p += 6;
+        }
+      }
+      res = p ? mbuf_write_advance(mbuf, p - (char*)mbuf_wrptr(mbuf)) : -1;
       break;
     }
 
@@ -13,9 +13,13 @@
  * \see eventloop_init, eventloop_run, eventloop_stop
  * \eventloop_on_stdin, eventloop_on_monitor_in_channel, eventloop_on_read_in_channel, eventloop_on_out_channel
  * \see o_el_timer_callback, o_el_read_socket_callback, o_el_monitor_socket_callback, o_el_state_socket_callback, o_el_timer_callback
- * \see poll(3)
+ * \see poll(3), epoll(7)
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,6 +30,12 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <time.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include "mem.h"
 #include "ocomm/o_log.h"
@@ -35,7 +45,19 @@
 
 /** Initial expected number of socket event sources */
 #define DEF_FDS_LENGTH 10
-#define MAX_READ_BUFFER_SIZE 512
+/** Bounds and initial value of the adaptive amount of data read at once from
+ * a channel \see channel_read */
+#define MIN_READ_BUFFER_SIZE 512
+#define DEF_READ_BUFFER_SIZE 4096
+#define MAX_READ_BUFFER_SIZE 65536
+/** Maximum number of consecutive reads from a single ready socket, so others
+ * are not starved \see channel_read */
+#define MAX_DRAIN_READS 16
+/** Maximum number of events returned by a single call to epoll_wait() */
+#define DEF_EPOLL_EVENTS 64
+
+/** Initial size of the timer heap \see timer_heap_push */
+#define DEF_TIMERS_LENGTH 8
 
 /** Default time, in second, after which an idle socket is cleaned up */
 #define DEF_SOCKET_TIMEOUT 60
@@ -71,11 +93,15 @@ typedef struct _timerInt {
   /** Non zero if the timer is periodic */
   int is_periodic;
 
-  /** Period of the timer: in seconds */
-  int period;
+  /** Period of the timer: in milliseconds */
+  unsigned int period;
 
-  /** Next UNIX time when the timer will expire */
-  time_t due_time;
+  /** Next monotonic time [ms] when the timer will expire \see monotonic_ms */
+  uint64_t due_time;
+
+  /** Position of this timer in the EventLoop's heap, or -1 if not scheduled
+   * \see timer_heap_push */
+  int heap_index;
 
   /** Function pointer to the timeout callback \see o_el_timer_callback */
   o_el_timer_callback callback;
@@ -83,6 +109,9 @@ typedef struct _timerInt {
   /** Pointer to application-provided data */
   void *handle;
 
+  /** EventLoop this timer is registered with */
+  EventLoop *loop;
+
   /** Pointer to next TimerInt in the linked-list */
   struct _timerInt* next;
 
@@ -117,7 +146,17 @@ typedef struct _channel {
   /** Function pointer to the read callback for this channel */
   o_el_read_socket_callback read_cbk;
 
-  /** Function pointer to the monitoring callback for this channel */
+  /** Function pointer to the buffer-supply callback for this channel
+   * \see eventloop_socket_set_buffer */
+  o_el_buffer_socket_callback buffer_cbk;
+
+  /** Current amount of data to try and read at once, adapted to the
+   * incoming data rate \see channel_read */
+  size_t read_size;
+
+  /** Function pointer to the monitoring callback for this channel; if a
+   * read callback is also set, the monitoring callback takes over reading
+   * \see eventloop_socket_set_monitor */
   o_el_monitor_socket_callback monitor_cbk;
 
   /** Function pointer to the status-change callback for this channel
@@ -132,6 +171,9 @@ typedef struct _channel {
   /** Mask of events monitored for that FD \see poll(3) */
   int fds_events;
 
+  /** EventLoop this channel is registered with */
+  EventLoop *loop;
+
   /** Pointer to next Channel in the linked-list */
   struct _channel* next;
 
@@ -142,14 +184,52 @@ typedef struct _channel {
   time_t last_activity;
 } Channel;
 
+/** Deferred call queued with eventloop_post()
+ *
+ * \see eventloop_post, run_posted
+ */
+typedef struct _postedCall {
+  /** Function to call from the EventLoop's thread */
+  o_el_post_callback callback;
+  /** Pointer to application-provided data */
+  void *handle;
+  /** Pointer to next PostedCall in the queue */
+  struct _postedCall* next;
+} PostedCall;
+
 /** EventLoop object storing the internal internal state */
-typedef struct _eventLoop {
+struct _eventLoop {
   /** Linked list of registered channels */
   Channel* channels;
   /** Linked list registered timers */
   TimerInt* timers;
-
-  /** Array of descriptors to monitor
+  /** Binary min-heap of active timers, ordered by due_time
+   * \see timer_heap_push, timer_heap_remove */
+  TimerInt** timer_heap;
+  /** Number of timers in timer_heap */
+  int timer_count;
+  /** Allocated size of timer_heap */
+  int timer_length;
+
+  /** epoll(7) instance, or -1 if the poll(3) backend is used instead
+   * \see eventloop_setup, epoll_disable */
+  int epoll_fd;
+#ifdef HAVE_SYS_EPOLL_H
+  /** Array of events returned by the last epoll_wait() \see epoll_dispatch */
+  struct epoll_event* events;
+#endif
+  /** Number of events in the epoll array being currently dispatched; they
+   * may get cancelled if their Channel is removed in the meantime
+   * \see cancel_pending */
+  int nevents;
+  /** Number of descriptors in the fds array being currently dispatched
+   * \see cancel_pending */
+  int npolled;
+  /** Channel whose events are currently being processed, reset to NULL if it
+   * gets removed by a callback \see process_events */
+  Channel* current;
+
+  /** Array of descriptors to monitor (poll(3) backend only)
    * \see update_fds */
   struct pollfd* fds;
   /** Array of channels associated to the descriptors in fds */
@@ -157,7 +237,7 @@ typedef struct _eventLoop {
   /** If non zero, fds structure needs to get recomputed
    * \see eventloop_socket_activate */
   int fds_dirty;
-  /** Number of active descriptors in the fds array */
+  /** Number of active channels (descriptors in the fds array, for poll(3)) */
   int size;
   /** Allocated size of fds and fds_channels arrays */
   int length;
@@ -171,57 +251,328 @@ typedef struct _eventLoop {
   /** If set to 1, the eventloop will not wait for active FDs to be closed */
   int force_stop;
 
+  /** Pending stop reason, set atomically from any thread or signal handler,
+   * and moved to stopping by the loop's own thread
+   * \see eventloop_stop_loop, take_stop_request */
+  volatile int stop_request;
+  /** Non zero if the pending stop request is a forced termination */
+  volatile int force_request;
+
   /** UNIX Time when the EventLoop was started
    * \see time(3) */
   time_t start;
   /** Current UNIX time (updated whenever poll() returns)
    * \see time(3)*/
   time_t now;
+  /** Current monotonic time [ms] (updated whenever poll() returns)
+   * \see monotonic_ms */
+  uint64_t now_ms;
   /** Last UNIX time idle sockets were reaped
    * \see time(3) */
   time_t last_reaped;
 
-} EventLoop;
+  /** Non zero once terminate_fds() has been run for the current stop request */
+  int terminated;
+  /** Buffer used to read data from channels which don't supply their own
+   * \see channel_read, eventloop_socket_set_buffer */
+  char* read_buf;
+
+  /** Non zero if some channels have been released, and need to be removed
+   * \see eventloop_socket_release, remove_released */
+  int has_removable;
+
+  /** Self-pipe used to interrupt poll() from other threads or signal handlers;
+   * [0] is monitored by the EventLoop, [1] is written to
+   * \see eventloop_wakeup */
+  int wakeup_fds[2];
+
+  /** Queue of calls to run from this EventLoop's thread \see eventloop_post */
+  PostedCall* posted;
+  /** Tail of the posted queue, for FIFO ordering */
+  PostedCall* posted_tail;
+  /** Mutex protecting posted and posted_tail */
+  pthread_mutex_t posted_lock;
+
+};
 
 
 /* Local helpers, defined at the end of this file */
 static Channel* channel_new(char* name, int fd, int fd_events, o_el_state_socket_callback status_cbk, void* handle);
 static void channel_free(Channel *ch);
 
-/* XXX: These should probably be made non-static, but they use the Channel type */
+/* XXX: This should probably be made non-static, but it uses the Channel type */
 static Channel* eventloop_on_in_fd(char* name, int fd, o_el_read_socket_callback read_cbk, o_el_monitor_socket_callback monitor_cbk, o_el_state_socket_callback status_cbk, void* handle);
-static Channel* eventloop_on_out_fd( char* name, int fd, o_el_state_socket_callback status_cbk, void* handle);
 
-static int update_fds(void);
-static void terminate_fds(void);
+static int update_fds(EventLoop *self);
+static void terminate_fds(EventLoop *self);
+static void take_stop_request(EventLoop *self);
+static void eventloop_wakeup(EventLoop *self);
+static void drain_wakeup(EventLoop *self);
+static void run_posted(EventLoop *self);
+
+static uint64_t monotonic_ms(void);
+static int timer_heap_push(EventLoop *self, TimerInt *t);
+static void timer_heap_remove(EventLoop *self, TimerInt *t);
+static void timer_heap_sift_down(EventLoop *self, int i);
+static int timers_timeout(EventLoop *self);
+static void run_timers(EventLoop *self);
+
+static void poll_dispatch(EventLoop *self, int timeout);
+static void process_events(EventLoop *self, Channel *ch, int revents);
+static int channel_read(EventLoop *self, Channel *ch, int max_reads);
+static void reap_idle(EventLoop *self, Channel *ch);
+static void remove_released(EventLoop *self);
+static void cancel_pending(EventLoop *self, Channel *ch);
+
+#ifdef HAVE_SYS_EPOLL_H
+static void epoll_dispatch(EventLoop *self, int timeout);
+static void epoll_update(EventLoop *self, Channel *ch);
+static void epoll_disable(EventLoop *self);
+#endif
 
 static void do_read_callback (Channel *ch, void *buffer, int buf_size);
 static void do_monitor_callback (Channel *ch);
 static void do_status_callback (Channel *ch, SocketStatus status, int error);
 
 
-/** Global EventLoop object */
-static EventLoop self;
+/** Default EventLoop object, used by the main thread \see eventloop_init */
+static EventLoop default_loop;
 
+/** Thread-specific key storing each thread's current EventLoop \see eventloop_attach */
+static pthread_key_t current_key;
+/** Guard for the one-time creation of current_key */
+static pthread_once_t current_once = PTHREAD_ONCE_INIT;
 
-/** Initialise the global EventLoop
- * \see eventloop_run, eventloop_stop, eventloop_terminate
+/** Create the thread-specific key for the current EventLoop */
+static void current_key_create(void)
+{
+  pthread_key_create(&current_key, NULL);
+}
+
+/** Initialise the internal state of an EventLoop
+ *
+ * \param self EventLoop to initialise
+ * \return 0 on success, -1 otherwise
  */
-void eventloop_init()
+static int eventloop_setup(EventLoop *self)
 {
-  memset(&self, 0, sizeof(EventLoop));
+  int i;
+
+  memset(self, 0, sizeof(EventLoop));
 
-  self.fds = NULL;
-  self.channels = NULL;
-  self.timers = NULL;
+  self->fds = NULL;
+  self->channels = NULL;
+  self->timers = NULL;
 
-  self.size = 0;
-  self.length = 0;
+  self->size = 0;
+  self->length = 0;
 
-  eventloop_set_socket_timeout(DEF_SOCKET_TIMEOUT);
+  self->socket_timeout = DEF_SOCKET_TIMEOUT;
 
   /* Just to be sure we initialise everything */
-  self.start = self.now = self.last_reaped = -1;
+  self->start = self->now = self->last_reaped = -1;
+
+  self->epoll_fd = -1;
+
+  pthread_mutex_init(&self->posted_lock, NULL);
+  if (pipe(self->wakeup_fds)) {
+    o_log(O_LOG_ERROR, "EventLoop: Could not create wakeup pipe: %s\n", strerror(errno));
+    self->wakeup_fds[0] = self->wakeup_fds[1] = -1;
+    return -1;
+  }
+  for (i = 0; i < 2; i++) {
+    fcntl(self->wakeup_fds[i], F_SETFL, fcntl(self->wakeup_fds[i], F_GETFL) | O_NONBLOCK);
+    fcntl(self->wakeup_fds[i], F_SETFD, FD_CLOEXEC);
+  }
+
+#ifdef HAVE_SYS_EPOLL_H
+  /* Prefer epoll(7), where only ready descriptors are reported; fall back to
+   * poll(3) if anything goes wrong */
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = self; /* Identifies the wakeup pipe \see epoll_dispatch */
+  if (!(self->events = oml_malloc(DEF_EPOLL_EVENTS * sizeof(struct epoll_event)))) {
+    o_log(O_LOG_WARN, "EventLoop: Could not allocate epoll events, using poll()\n");
+  } else if ((self->epoll_fd = epoll_create(DEF_FDS_LENGTH)) < 0) {
+    o_log(O_LOG_WARN, "EventLoop: Could not create epoll instance, using poll(): %s\n", strerror(errno));
+  } else if (fcntl(self->epoll_fd, F_SETFD, FD_CLOEXEC),
+      epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, self->wakeup_fds[0], &ev)) {
+    o_log(O_LOG_WARN, "EventLoop: Could not register wakeup pipe with epoll, using poll(): %s\n", strerror(errno));
+    epoll_disable(self);
+  }
+#endif
+  o_log(O_LOG_DEBUG2, "EventLoop: Using %s() backend\n", self->epoll_fd >= 0 ? "epoll" : "poll");
+
+  return 0;
+}
+
+/** Release the resources held by an EventLoop, but not the EventLoop itself
+ *
+ * Channels and timers still registered are freed, but their sockets are left alone.
+ *
+ * \param self EventLoop to clean up
+ */
+static void eventloop_teardown(EventLoop *self)
+{
+  Channel *ch, *next_ch;
+  TimerInt *t, *next_t;
+  PostedCall *pc, *next_pc;
+
+  for (ch = self->channels; ch; ch = next_ch) {
+    next_ch = ch->next;
+    channel_free(ch);
+  }
+  for (t = self->timers; t; t = next_t) {
+    next_t = t->next;
+    oml_free(t);
+  }
+  oml_free(self->timer_heap);
+  for (pc = self->posted; pc; pc = next_pc) {
+    next_pc = pc->next;
+    oml_free(pc);
+  }
+  if (self->wakeup_fds[0] >= 0) {
+    close(self->wakeup_fds[0]);
+    close(self->wakeup_fds[1]);
+  }
+  if (self->epoll_fd >= 0) {
+    close(self->epoll_fd);
+  }
+#ifdef HAVE_SYS_EPOLL_H
+  oml_free(self->events);
+#endif
+  oml_free(self->read_buf);
+  free(self->fds);
+  free(self->fds_channels);
+  pthread_mutex_destroy(&self->posted_lock);
+}
+
+/** Create a new EventLoop, independent from the default one
+ *
+ * The new EventLoop is not attached to any thread. This should be done with
+ * eventloop_attach() from the thread which will run it.
+ *
+ * \return a newly allocated EventLoop, or NULL on error
+ * \see eventloop_attach, eventloop_free, eventloop_init
+ */
+EventLoop* eventloop_new(void)
+{
+  EventLoop *self = oml_malloc(sizeof(EventLoop));
+
+  if (!self) {
+    return NULL;
+  }
+  if (eventloop_setup(self)) {
+    oml_free(self);
+    return NULL;
+  }
+  return self;
+}
+
+/** Free an EventLoop created by eventloop_new()
+ *
+ * The EventLoop must not be running anymore.
+ *
+ * \param loop EventLoop to free
+ * \see eventloop_new
+ */
+void eventloop_free(EventLoop* loop)
+{
+  if (!loop || loop == &default_loop) {
+    return;
+  }
+  eventloop_teardown(loop);
+  oml_free(loop);
+}
+
+/** Make an EventLoop the current one for the calling thread.
+ *
+ * All eventloop_* functions not taking an explicit EventLoop argument then
+ * operate on this EventLoop, when called from this thread.
+ *
+ * \param loop EventLoop to attach to the calling thread
+ * \see eventloop_current, eventloop_new
+ */
+void eventloop_attach(EventLoop* loop)
+{
+  pthread_once(&current_once, current_key_create);
+  pthread_setspecific(current_key, loop);
+}
+
+/** Get the current EventLoop for the calling thread.
+ *
+ * \return the EventLoop attached to this thread, or the default one if none was
+ * \see eventloop_attach
+ */
+EventLoop* eventloop_current(void)
+{
+  EventLoop *self;
+
+  pthread_once(&current_once, current_key_create);
+  self = pthread_getspecific(current_key);
+  return self ? self : &default_loop;
+}
+
+/** Queue a function to be called from within an EventLoop's thread
+ *
+ * This function can be called from any thread, and is the only safe way to
+ * manipulate another thread's EventLoop (e.g., register new channels on it).
+ * Queued calls are run in order, at the next iteration of the target loop.
+ *
+ * \param loop EventLoop in which to run the callback
+ * \param callback function to call
+ * \param handle pointer to opaque data passed to the callback
+ * \return 0 on success, -1 otherwise
+ * \see o_el_post_callback
+ */
+int eventloop_post(EventLoop* loop, o_el_post_callback callback, void* handle)
+{
+  PostedCall *pc;
+
+  if (!loop || !callback) {
+    return -1;
+  }
+  if (!(pc = oml_malloc(sizeof(PostedCall)))) {
+    o_log(O_LOG_ERROR, "EventLoop: Could not allocate memory for deferred call\n");
+    return -1;
+  }
+  pc->callback = callback;
+  pc->handle = handle;
+  pc->next = NULL;
+
+  pthread_mutex_lock(&loop->posted_lock);
+  if (loop->posted_tail) {
+    loop->posted_tail->next = pc;
+  } else {
+    loop->posted = pc;
+  }
+  loop->posted_tail = pc;
+  pthread_mutex_unlock(&loop->posted_lock);
+
+  eventloop_wakeup(loop);
+  return 0;
+}
+
+/** Initialise the default EventLoop, and attach it to the calling thread
+ * \see eventloop_run, eventloop_stop, eventloop_terminate, eventloop_attach
+ */
+void eventloop_init()
+{
+  if (default_loop.wakeup_fds[1] > 0) {
+    /* Re-initialisation; don't leak the previous wakeup pipe */
+    close(default_loop.wakeup_fds[0]);
+    close(default_loop.wakeup_fds[1]);
+    if (default_loop.epoll_fd >= 0) {
+      close(default_loop.epoll_fd);
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    oml_free(default_loop.events);
+#endif
+    pthread_mutex_destroy(&default_loop.posted_lock);
+  }
+  eventloop_setup(&default_loop);
+  eventloop_attach(&default_loop);
 }
 
 /** Set the timeout, in seconds, after which idle sockets are reaped.
@@ -230,239 +581,151 @@ void eventloop_init()
  */
 void eventloop_set_socket_timeout(unsigned int to)
 {
+  EventLoop *self = eventloop_current();
   o_log(O_LOG_DEBUG2, "EventLoop: Setting socket idleness timeout to %ds\n", to);
-  self.socket_timeout = to;
+  self->socket_timeout = to;
 }
 
-/** Run the global EventLoop until eventloop_stop() or eventloop_terminate() is called.
+/** Run the current EventLoop until eventloop_stop() or eventloop_terminate() is called.
+ *
+ * The loop monitors event sources such as Channel or Timers, registered in the
+ * respective fields of the thread's current EventLoop object. It first
+ * considers the earliest timer to set the timeout for the wait. It then waits for events on the file descriptors
+ * (STDIN or sockets) related to active Channels, and runs the relevant
+ * callbacks for those with pending events.  It finally executes the callback
+ * functions of the expired timers.  The loop will not return until
+ * eventloop_stop() or eventloop_terminate() is called.  In the former case,
+ * it will try to wait until all active sockets are close, while not in the
+ * latter. Calls queued with eventloop_post() are run after socket events have
+ * been processed.
  *
- * The loop is based around the poll(3) system call. It monitor event sources
- * such as Channel or Timers, registered in the respective fields of the global
- * EventLoop object self. It first consider all timers to find whether some
- * have expired and to set the timeout for the poll(3) call. It then calls
- * poll(3) on the file descriptors (STDIN or sockets) related to active
- * Channels, and runs the relevant callbacks for those with pending events.  It
- * finally executes the callback functions of the expired timers.  The loop
- * will not return until eventloop_stop() or eventloop_terminate() is called.
- * In the former case, it will try to wait until all active sockets are close,
- * while not in the latter.
+ * Where available, epoll(7) is used to wait for events, so only the Channels
+ * which are ready are visited; otherwise, poll(3) is used on all active
+ * Channels.
  *
  * \return the (non-zero) value passed to eventloop_stop() or eventloop_terminate()
  *
- * \see eventloop_init, eventloop_stop, eventloop_terminate
+ * \see eventloop_init, eventloop_attach, eventloop_stop, eventloop_terminate, eventloop_post
  * \eventloop_on_stdin, eventloop_on_monitor_in_channel, eventloop_on_read_in_channel, eventloop_on_out_channel
  * \see o_el_timer_callback, o_el_read_socket_callback, o_el_monitor_socket_callback, o_el_state_socket_callback, o_el_timer_callback
- * \see poll(3)
+ * \see poll_dispatch, epoll_dispatch
  */
 int eventloop_run()
 {
-  int i;
-  self.stopping = 0;
-  self.force_stop = 0;
-  self.start = self.now = self.last_reaped = time(NULL);
-  while (!self.stopping || (self.size>0 && !self.force_stop)) {
-    // Check for active timers
-    int timeout = -1;
-    TimerInt* t = self.timers;
-    while (t != NULL) {
-      if (t->is_active) {
-        int delta = 1000 * (t->due_time - self.now);
-        if (delta < 0) delta = 0; // overdue
-        if (delta < timeout || timeout < 0) timeout = delta;
-      }
-      t = t->next;
+  EventLoop *self = eventloop_current();
+  self->stopping = 0;
+  self->force_stop = 0;
+  self->terminated = 0;
+  self->start = self->now = self->last_reaped = time(NULL);
+  self->now_ms = monotonic_ms();
+  take_stop_request(self);
+  while (!self->stopping || (self->size>0 && !self->force_stop)) {
+    if (self->stopping && !self->terminated) {
+      /* Stop requests may come from other threads, so channels are
+       * only cleaned up from here */
+      terminate_fds(self);
+      continue;
     }
+
+    // Check for active timers
+    int timeout = timers_timeout(self);
     if (timeout != -1)
       o_log(O_LOG_DEBUG3, "EventLoop: Timeout = %d\n", timeout);
 
-    if (self.fds_dirty)
-      if (update_fds()<1 && timeout < 0) /* No FD nor timeout */
-        continue;
-    o_log(O_LOG_DEBUG4, "EventLoop: About to poll() on %d FDs with a timeout of %ds\n", self.size, timeout);
-    /* for(i=0; i < self.size; i++) {
-      o_log(O_LOG_DEBUG4, "EventLoop: FD %d->%s\n", self.fds[i].fd, self.fds_channels[i]->name);
-    } */
+#ifdef HAVE_SYS_EPOLL_H
+    if (self->epoll_fd >= 0) {
+      epoll_dispatch(self, timeout);
+    } else
+#endif
+    {
+      poll_dispatch(self, timeout);
+    }
+
+    if (self->has_removable) {
+      remove_released(self);
+    }
 
-    int count = poll(self.fds, self.size, timeout);
-    self.now = time(NULL);
+    if (timeout >= 0) {
+      run_timers(self);
+    }
 
-    if (count < 1) {
-      o_log(O_LOG_DEBUG4, "EventLoop: Timeout\n");
-    } else {
-    // Check sockets
-      i = 0;
-      o_log(O_LOG_DEBUG4, "EventLoop: Got events\n");
-      for (; i < self.size; i++) {
-        Channel* ch = self.fds_channels[i];
-        if (self.fds[i].revents & POLLERR) {
-          char buf[32];
-          SocketStatus status;
-          int len;
-
-          if ((len = recv(self.fds[i].fd, buf, 32, 0)) <= 0) {
-            switch (errno) {
-            case ECONNREFUSED:
-              status = SOCKET_CONN_REFUSED;
-              break;
-            default:
-              status = SOCKET_UNKNOWN;
-              if (!ch->status_cbk) {
-                o_log(O_LOG_ERROR, "EventLoop: While reading from socket '%s': (%d) %s\n",
-                      ch->name, errno, strerror(errno));
-              }
-            }
-            eventloop_socket_activate((SockEvtSource*)ch, 0);
-            do_status_callback (ch, status, errno);
-          } else {
-            o_log(O_LOG_ERROR, "EventLoop: Expected error on socket '%s' but read '%s'\n", ch->name, buf);
-          }
-        } else if (self.fds[i].revents & POLLHUP) {
-          eventloop_socket_activate((SockEvtSource*)ch, 0);
-
-          /* Client closed the connection, but there might still be bytes
-             for us to read from our end of the connection. */
-          int len;
-          int fd = self.fds[i].fd;
-          char buf[MAX_READ_BUFFER_SIZE];
-          do {
-            if (fd == 0) {
-              len = read(fd, buf, MAX_READ_BUFFER_SIZE);
-            } else {
-              len = recv(fd, buf, 512, 0);
-            }
-            if (len > 0) {
-              o_log(O_LOG_DEBUG3, "EventLoop: Received last %i bytes\n", len);
-              do_read_callback (ch, buf, len);
-            }
-          } while (len > 0);
-          do_status_callback (ch, SOCKET_CONN_CLOSED, 0);
-        } else if (self.fds[i].revents & POLLIN) {
-          char buf[MAX_READ_BUFFER_SIZE];
-          if (ch->read_cbk) {
-            int len;
-            int fd = self.fds[i].fd;
-            if (fd == 0) {
-              // stdin
-              len = read(fd, buf, MAX_READ_BUFFER_SIZE);
-            } else {
-              // socket
-              len = recv(fd, buf, 512, 0);
-            }
-            ch->last_activity = self.now;
-            if (len > 0) {
-              o_log(O_LOG_DEBUG3, "EventLoop: Received %i bytes\n", len);
-              do_read_callback (ch, buf, len);
-            } else if (len == 0 && ch->socket != NULL) {  // skip stdin
-              // closed down
-              eventloop_socket_activate((SockEvtSource*)ch, 0);
-              do_status_callback (ch, SOCKET_CONN_CLOSED, 0);
-            } else if (len < 0) {
-              if (errno == ENOTSOCK) {
-                o_log(O_LOG_ERROR,
-                      "EventLoop: Monitored socket '%s' is now invalid; "
-                      "removing from monitored set\n",
-                      ch->name);
-                eventloop_socket_remove ((SockEvtSource*)ch);
-              } else {
-                o_log(O_LOG_ERROR, "EventLoop: Unrecognized read error not handled (errno=%d)\n",
-                      errno);
-              }
-            }
-          } else {
-            do_monitor_callback (ch);
-          }
-        } else if (ch->is_shutting_down) {
-          /* The socket was shutting down, and nothing new has appeared;
-           * We flushed the buffers, mark it as removable */
-          eventloop_socket_release((SockEvtSource*)ch);
-        }
+    run_posted(self);
 
-        if (self.fds[i].revents & POLLOUT) {
-          do_status_callback(ch, SOCKET_WRITEABLE, 0);
-          if (0 != ch->last_activity) {
-            /* If we track the activity of this socket */
-            ch->last_activity = self.now;
-          }
-        }
+    take_stop_request(self);
+  }
 
-        if (self.fds[i].revents & POLLNVAL) {
-          o_log(O_LOG_WARN, "EventLoop: socket '%s' invalid, deactivating...\n", ch->name);
-          eventloop_socket_activate((SockEvtSource*)ch, 0);
-          do_status_callback(ch, SOCKET_DROPPED, 0);
-        }
+  if (!self->terminated) {
+    /* Forced termination, make sure sockets get closed */
+    terminate_fds(self);
+  }
+  return self->stopping;
+}
 
-        /* We reap idle channels as we go through the list.  XXX: There might
-         * be a corner case where all FDs are already used, and some of them
-         * idle, however a new a new connection (on one listening socket early
-         * in the list) would be dropped before cleanup triggered by its
-         * arrival freed the resources it needs (from the idle sockets further
-         * towards the end of the list. See #959.*/
-        if (ch->last_activity != 0 &&
-            self.socket_timeout > 0 &&
-            self.now - ch->last_activity > self.socket_timeout) {
-            o_log(O_LOG_DEBUG2, "EventLoop: Socket '%s' idle for %ds, reaping...\n", ch->name, self.now - ch->last_activity);
-          do_status_callback(ch, SOCKET_IDLE, 0);
-        }
-      }
-      for (i = 0; i < self.size; i++) {
-        Channel* ch = self.fds_channels[i];
-        if (ch->is_removable)
-          eventloop_socket_remove ((SockEvtSource*)ch);
-      }
-    }
-    if (timeout >= 0) {
-      // check timers
-      TimerInt* t = self.timers;
-      while (t != NULL) {
-        if (t->is_active) {
-          if (t->due_time <= self.now) {
-            // fires
-            o_log(O_LOG_DEBUG2, "EventLoop: Timer '%s' fired\n", t->name);
-            if (t->callback) t->callback((TimerEvtSource*)t, t->handle);
-
-            if (t->is_periodic) {
-              while ((t->due_time += t->period) < self.now) {
-                // should really only happen during debugging
-                o_log(O_LOG_WARN, "EventLoop: Skipped timer period for '%s'\n",
-                      t->name);
-              }
-            } else {
-              t->is_active = 0;
-            }
-          }
-        }
-        t = t->next;
-      }
-    }
+/** Stop an EventLoop.
+ *
+ * The EventLoop will try to gracefully finish by waiting for all active FDs to
+ * be closed.  The request is only recorded atomically and the loop woken up,
+ * so this function can be called from any thread, as well as from signal
+ * handlers; the loop's own thread then acts upon it.
+ *
+ * \param loop EventLoop to stop
+ * \param reason a non-zero reason for stopping the loop; default to 1
+ * \see eventloop_terminate_loop, take_stop_request
+ */
+void eventloop_stop_loop(EventLoop* loop, int reason)
+{
+  if (!loop) {
+    return;
+  }
+  __sync_lock_test_and_set(&loop->stop_request, reason ? reason : 1);
+  eventloop_wakeup(loop);
+}
+
+/** Terminate an EventLoop, without waiting for active FDs to be closed.
+ *
+ * Like eventloop_stop_loop(), this can be called from any thread or signal
+ * handler.
+ *
+ * \param loop EventLoop to terminate
+ * \param reason a non-zero reason for stopping the loop; default to 1
+ * \see eventloop_stop_loop
+ */
+void eventloop_terminate_loop(EventLoop* loop, int reason)
+{
+  if (!loop) {
+    return;
   }
-  return self.stopping;
+  /* Set before the stop request, so both are seen together */
+  __sync_fetch_and_or(&loop->force_request, 1);
+  eventloop_stop_loop(loop, reason);
 }
 
-/** Stop the eventloop,
+/** Stop the current EventLoop,
  *
  * The eventloop will try to gracefully finish by waiting for all active FDs to be closed.
  *
  * \param reason a non-zero reason for stopping the loop; default to 1, with a warning
+ * \see eventloop_stop_loop
  */
 void eventloop_stop(int reason)
 {
-  if(reason) {
-    self.stopping = reason;
-  } else {
+  if(!reason) {
     o_log(O_LOG_WARN, "EventLoop: Tried to stop with no reason, defaulting to 1");
-    self.stopping = 1;
   }
-  terminate_fds();
+  eventloop_stop_loop(eventloop_current(), reason);
 }
 
-/** Terminate the eventloop,
+/** Terminate the current EventLoop,
  *
  * \param reason a non-zero reason for stopping the loop; default to 1, with a warning
+ * \see eventloop_terminate_loop
  */
 void eventloop_terminate(int reason)
 {
-    self.force_stop = 1;
-    eventloop_stop(reason);
+  if(!reason) {
+    o_log(O_LOG_WARN, "EventLoop: Tried to terminate with no reason, defaulting to 1");
+  }
+  eventloop_terminate_loop(eventloop_current(), reason);
 }
 
 /** Log a summary of resource usage.
@@ -472,7 +735,12 @@ void eventloop_terminate(int reason)
  */
 void eventloop_report (int loglevel)
 {
-  o_log(loglevel, "EventLoop: Open file descriptors: %d/%d\n", self.size, self.length);
+  EventLoop *self = eventloop_current();
+  if (self->epoll_fd >= 0) {
+    o_log(loglevel, "EventLoop: Open file descriptors (epoll): %d\n", self->size);
+  } else {
+    o_log(loglevel, "EventLoop: Open file descriptors (poll): %d/%d\n", self->size, self->length);
+  }
   o_log(loglevel, "EventLoop: Memory usage: %s\n", oml_memsummary());
 }
 
@@ -485,7 +753,7 @@ void eventloop_report (int loglevel)
  * \param handle pointer to opaque data passed to callback functions
  * \return a pointer to the newly-created TimerInt, cast as a TimerEvtSource
  *
- * \see o_el_timer_callback, eventloop_timer_stop
+ * \see o_el_timer_callback, eventloop_timer_stop, eventloop_every_ms
  */
 TimerEvtSource* eventloop_every(
   char* name,
@@ -493,21 +761,56 @@ TimerEvtSource* eventloop_every(
   o_el_timer_callback callback,
   void* handle
 ) {
+  return eventloop_every_ms(name, 1000 * period, callback, handle);
+}
+
+/** Register a new periodic timer with millisecond resolution to the event loop
+ *
+ * Timers are based on the monotonic clock, so they are not affected by
+ * changes to the system time.
+ *
+ * \param name name of this object, used for debugging
+ * \param period period [ms] of the timer; at least 1ms
+ * \param timer_cbk function called when the state of the timer expires
+ * \param handle pointer to opaque data passed to callback functions
+ * \return a pointer to the newly-created TimerInt, cast as a TimerEvtSource, or NULL on error
+ *
+ * \see o_el_timer_callback, eventloop_timer_stop, eventloop_every
+ * \see clock_gettime(3)
+ */
+TimerEvtSource* eventloop_every_ms(
+  char* name,
+  unsigned int period,
+  o_el_timer_callback callback,
+  void* handle
+) {
+  EventLoop *self = eventloop_current();
   TimerInt* t = (TimerInt*)oml_malloc(sizeof(TimerInt));
+  if (!t) {
+    o_log(O_LOG_ERROR, "EventLoop: Could not allocate memory for timer '%s'\n", name);
+    return NULL;
+  }
   memset(t, 0, sizeof(TimerInt));
 
   t->name = t->nameBuf;
-  strcpy(t->name, name);
+  strncpy(t->name, name, sizeof(t->nameBuf) - 1);
 
   t->is_active = 1;
   t->is_periodic = 1;
-  t->period = period;
-  t->due_time = time(NULL) + period;
+  t->period = period > 0 ? period : 1;
+  t->due_time = monotonic_ms() + t->period;
   t->callback = callback;
   t->handle = handle;
+  t->loop = self;
+  t->heap_index = -1;
+
+  if (timer_heap_push(self, t)) {
+    oml_free(t);
+    return NULL;
+  }
 
-  t->next = self.timers;
-  self.timers = t;
+  t->next = self->timers;
+  self->timers = t;
 
   return (TimerEvtSource*)t;
 }
@@ -533,13 +836,16 @@ static void eventloop_timer_free(TimerInt* timer) {
  */
 void eventloop_timer_stop(TimerEvtSource* timer) {
   TimerInt *t = (TimerInt *)timer;
+  EventLoop *self = t->loop;
+
+  timer_heap_remove(self, t);
 
   /* Update the linked list */
-  if (self.timers == t) {
-    self.timers = t->next;
+  if (self->timers == t) {
+    self->timers = t->next;
 
   } else {
-    TimerInt* prev = self.timers;
+    TimerInt* prev = self->timers;
     TimerInt* p = prev->next;
 
     while (p != NULL) {
@@ -603,7 +909,7 @@ SockEvtSource* eventloop_on_read_in_channel(
   ch = eventloop_on_in_fd(socket->name, socket->get_sockfd(socket),
               data_cbk, NULL, status_cbk, handle);
   ch->socket = socket;
-  ch->last_activity = self.now;
+  ch->last_activity = ch->loop->now;
   return (SockEvtSource*)ch;
 }
 
@@ -656,7 +962,7 @@ SockEvtSource* eventloop_on_out_channel(
     return NULL;
   }
   Channel* ch;
-  ch = eventloop_on_out_fd(socket->name, socket->get_sockfd(socket),
+  ch = (Channel*)eventloop_on_out_fd(socket->name, socket->get_sockfd(socket),
               status_cbk, handle);
   ch->socket = socket;
 
@@ -677,10 +983,50 @@ void eventloop_socket_activate(SockEvtSource* source, int flag)
   Channel* ch = (Channel*)source;
   if (ch->is_active != flag) {
     ch->is_active = flag;
-    self.fds_dirty = 1;
+    ch->loop->fds_dirty = 1;
+#ifdef HAVE_SYS_EPOLL_H
+    if (ch->loop->epoll_fd >= 0) {
+      epoll_update(ch->loop, ch);
+    }
+#endif
   }
 }
 
+/** Set a buffer-supply callback for a channel.
+ *
+ * Data read from the channel will then be received directly in the memory
+ * returned by this callback, before being passed to the read callback.
+ *
+ * \param source SockEvtSource to set the callback for
+ * \param buffer_cbk buffer-supply callback, or NULL to use the EventLoop's buffer
+ *
+ * \see o_el_buffer_socket_callback, o_el_read_socket_callback
+ */
+void eventloop_socket_set_buffer(SockEvtSource* source, o_el_buffer_socket_callback buffer_cbk)
+{
+  Channel* ch = (Channel*)source;
+  ch->buffer_cbk = buffer_cbk;
+}
+
+/** Let the application read from a channel by itself.
+ *
+ * While a monitoring callback is set on a channel which also has a read
+ * callback, the EventLoop does not read any data from it, nor detect the end
+ * of the stream; the monitoring callback is called instead whenever the
+ * channel is readable or has been hung up. Resetting the monitoring callback
+ * to NULL restores the normal behaviour.
+ *
+ * \param source SockEvtSource to set the callback for
+ * \param monitor_cbk monitoring callback, or NULL to let the EventLoop read
+ *
+ * \see o_el_monitor_socket_callback, o_el_read_socket_callback
+ */
+void eventloop_socket_set_monitor(SockEvtSource* source, o_el_monitor_socket_callback monitor_cbk)
+{
+  Channel* ch = (Channel*)source;
+  ch->monitor_cbk = monitor_cbk;
+}
+
 /** Tell the EventLoop to release a channel.
  *
  *  This marks the socket as "removable", but does not remove it
@@ -701,6 +1047,7 @@ void eventloop_socket_release(SockEvtSource* source)
   eventloop_socket_activate(source, 0);
   ch->is_removable = 1;
   ch->handle = NULL;
+  ch->loop->has_removable = 1;
 }
 
 /** Remove channels from monitoring of the EventLoop.
@@ -714,15 +1061,17 @@ void eventloop_socket_release(SockEvtSource* source)
 void eventloop_socket_remove(SockEvtSource* source)
 {
   Channel* ch = (Channel*)source;
+  EventLoop *self = ch->loop;
 
   eventloop_socket_activate(source, 0);
+  cancel_pending(self, ch);
 
   /* Update the linked list */
-  if (self.channels == ch) {
-    self.channels = ch->next;
+  if (self->channels == ch) {
+    self->channels = ch->next;
 
   } else {
-    Channel* prev = self.channels;
+    Channel* prev = self->channels;
     Channel* p = prev->next;
 
     while (p != NULL) {
@@ -743,11 +1092,11 @@ void eventloop_socket_remove(SockEvtSource* source)
 /** Create a new channel and register it to the EventLoop.
  *
  * The Channel is allocated and initialised. It is also registered to the
- * global EventLoop self, at the beginning of the channels linked list, and activated.
+ * thread's current EventLoop, at the beginning of the channels linked list, and activated.
  *
  * \param name name of this object, used for debugging
  * \param fd file descriptor linked to the channel
- * \param fd_events event flags for poll()
+ * \param fd_events event flags for poll(), also mapped for epoll()
  * \param status_cbk callback function called when the state of the file descriptor changes
  * \param handle pointer to opaque data passed to callback functions
  * \return a pointer to the newly-created Channel
@@ -763,6 +1112,7 @@ static Channel* channel_new(
   o_el_state_socket_callback status_cbk,
   void* handle
 ) {
+  EventLoop *self = eventloop_current();
   Channel* ch = (Channel *)oml_malloc(sizeof(Channel));
   memset(ch, 0, sizeof(Channel));
 
@@ -774,9 +1124,10 @@ static Channel* channel_new(
 
   ch->status_cbk = status_cbk;
   ch->handle = handle;
+  ch->loop = self;
 
-  ch->next = self.channels;
-  self.channels = ch;
+  ch->next = self->channels;
+  self->channels = ch;
 
   eventloop_socket_activate((SockEvtSource*)ch, 1); /* Updates ch->is_active */
 
@@ -832,17 +1183,25 @@ static Channel* eventloop_on_in_fd(
 }
 
 /** Create a new Channel with the specified callbacks to manage outgoing data.
+ *
+ * This allows to monitor file descriptors which are not wrapped in an OComm
+ * Socket, e.g., non-blocking sockets still connect(2)ing. The status callback
+ * is called with SOCKET_WRITEABLE whenever data can be written to fd; the
+ * Channel should be deactivated with eventloop_socket_activate() when there is
+ * nothing to write, so the EventLoop doesn't spin.
+ *
+ * The file descriptor is not closed when the Channel is removed.
  *
  * \param name name of this object, used for debugging
  * \param fd file descriptor to consider
  * \param status_cbk callback function called when the state of the socket changes, can be NULL
  * \param handle pointer to opaque data passed to callback functions
- * \return a pointer to the new Channel
+ * \return a pointer to the new SockEvtSource
  *
- * \see o_el_state_socket_callback
+ * \see o_el_state_socket_callback, eventloop_on_out_channel
  * \see channel_new
  */
-static Channel* eventloop_on_out_fd(
+SockEvtSource* eventloop_on_out_fd(
   char* name,
   int fd,
   o_el_state_socket_callback status_cbk,
@@ -850,37 +1209,50 @@ static Channel* eventloop_on_out_fd(
 ) {
   Channel* ch = channel_new(name, fd, POLLOUT, status_cbk, handle);
 
-  return ch;
+  return (SockEvtSource*)ch;
 }
 
 /** Update the number of currently active Channels
+ *
+ * The wakeup pipe is added after the active channels, at index self->size.
+ *
+ * \param self EventLoop to update
  * \return the number of active channels
  */
-static int update_fds(void)
+static int update_fds(EventLoop *self)
 {
-  Channel* ch = self.channels;
+  Channel* ch = self->channels;
   int i = 0;
 
   while (ch != NULL) {
     if (ch->is_active) {
-      if (self.length <= i) {
+      if (self->length <= i + 1) { /* Keep space for the wakeup pipe */
         // Need to increase size of fds array
-        int l = (self.length > 0 ? 2 * self.length : DEF_FDS_LENGTH);
-        self.fds = (struct pollfd *)realloc(self.fds, l * sizeof(struct pollfd));
-        self.fds_channels = (Channel **)realloc(self.fds_channels, l * sizeof(Channel*));
-        self.length = l;
+        int l = (self->length > 0 ? 2 * self->length : DEF_FDS_LENGTH);
+        self->fds = (struct pollfd *)realloc(self->fds, l * sizeof(struct pollfd));
+        self->fds_channels = (Channel **)realloc(self->fds_channels, l * sizeof(Channel*));
+        self->length = l;
       }
-      self.fds[i].fd = ch->fds_fd;
-      self.fds[i].events = ch->fds_events;
-      self.fds_channels[i] = ch;
+      self->fds[i].fd = ch->fds_fd;
+      self->fds[i].events = ch->fds_events;
+      self->fds_channels[i] = ch;
       i++;
     }
     ch = ch->next;
   }
   o_log(O_LOG_DEBUG, "EventLoop: %d active channel%s\n", i, i>1?"s":"");
 
-  self.size = i;
-  self.fds_dirty = 0;
+  if (self->length <= i) {
+    self->fds = (struct pollfd *)realloc(self->fds, DEF_FDS_LENGTH * sizeof(struct pollfd));
+    self->fds_channels = (Channel **)realloc(self->fds_channels, DEF_FDS_LENGTH * sizeof(Channel*));
+    self->length = DEF_FDS_LENGTH;
+  }
+  self->fds[i].fd = self->wakeup_fds[0];
+  self->fds[i].events = POLLIN;
+  self->fds[i].revents = 0;
+
+  self->size = i;
+  self->fds_dirty = 0;
 
   return i;
 }
@@ -893,11 +1265,12 @@ static int update_fds(void)
  * channels and repeatedly calling functions which do the same), but it's only
  * used for cleanup, so it should be fine.
  *
+ * \param self EventLoop to terminate the sources of
  * \see eventloop_stop
  */
-static void terminate_fds(void)
+static void terminate_fds(EventLoop *self)
 {
-  Channel *ch = self.channels, *next;
+  Channel *ch = self->channels, *next;
 
   while (ch != NULL) {
     next = ch->next;
@@ -907,7 +1280,7 @@ static void terminate_fds(void)
         socket_is_listening(ch->socket)) {
       o_log(O_LOG_DEBUG3, "EventLoop: Releasing listening channel %s\n", ch->name);
       eventloop_socket_release((SockEvtSource*)ch);
-    } else if (self.force_stop) {
+    } else if (self->force_stop) {
       o_log(O_LOG_DEBUG3, "EventLoop: Closing down %s\n", ch->name);
       eventloop_socket_release((SockEvtSource*)ch);
       socket_close(ch->socket);
@@ -919,7 +1292,708 @@ static void terminate_fds(void)
     ch = next;
   }
 
-  update_fds();
+  self->terminated = 1;
+  if (self->epoll_fd < 0) {
+    update_fds(self);
+  }
+}
+
+/** Apply a pending stop request, from within the EventLoop's thread.
+ *
+ * The channels are terminated from eventloop_run() once stopping is set.
+ *
+ * \param self EventLoop to check for stop requests
+ * \see eventloop_stop_loop, eventloop_terminate_loop
+ */
+static void take_stop_request(EventLoop *self)
+{
+  int reason = __sync_fetch_and_and(&self->stop_request, 0);
+
+  if (reason) {
+    if (__sync_fetch_and_and(&self->force_request, 0)) {
+      self->force_stop = 1;
+    }
+    self->stopping = reason;
+    self->terminated = 0;
+  }
+}
+
+/** Interrupt a blocking poll() in an EventLoop.
+ *
+ * This is safe to call from other threads and signal handlers.
+ *
+ * \param self EventLoop to wake up
+ * \see eventloop_post, eventloop_stop
+ */
+static void eventloop_wakeup(EventLoop *self)
+{
+  char c = 0;
+  int saved_errno = errno;
+
+  if (self->wakeup_fds[1] >= 0 && write(self->wakeup_fds[1], &c, 1) < 0 && errno != EAGAIN) {
+    o_log(O_LOG_DEBUG, "EventLoop: Could not write to wakeup pipe: %s\n", strerror(errno));
+  }
+  errno = saved_errno;
+}
+
+/** Get the current time from the monotonic clock.
+ *
+ * \return the current monotonic time [ms]
+ * \see clock_gettime(3)
+ */
+static uint64_t monotonic_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Move a timer up the heap until its parent is due earlier.
+ *
+ * \param self EventLoop owning the heap
+ * \param i index of the timer to move
+ * \see timer_heap_push
+ */
+static void timer_heap_sift_up(EventLoop *self, int i)
+{
+  TimerInt **heap = self->timer_heap;
+  TimerInt *t = heap[i];
+
+  while (i > 0 && heap[(i - 1) / 2]->due_time > t->due_time) {
+    heap[i] = heap[(i - 1) / 2];
+    heap[i]->heap_index = i;
+    i = (i - 1) / 2;
+  }
+  heap[i] = t;
+  t->heap_index = i;
+}
+
+/** Move a timer down the heap until its children are due later.
+ *
+ * \param self EventLoop owning the heap
+ * \param i index of the timer to move
+ * \see timer_heap_remove, run_timers
+ */
+static void timer_heap_sift_down(EventLoop *self, int i)
+{
+  TimerInt **heap = self->timer_heap;
+  TimerInt *t = heap[i];
+  int c;
+
+  while ((c = 2 * i + 1) < self->timer_count) {
+    if (c + 1 < self->timer_count && heap[c + 1]->due_time < heap[c]->due_time) {
+      c++;
+    }
+    if (heap[c]->due_time >= t->due_time) {
+      break;
+    }
+    heap[i] = heap[c];
+    heap[i]->heap_index = i;
+    i = c;
+  }
+  heap[i] = t;
+  t->heap_index = i;
+}
+
+/** Schedule a timer in the EventLoop's heap.
+ *
+ * The earliest timer is always at the top of the heap, so finding the next
+ * timeout is O(1), while scheduling and expiring timers is O(log n).
+ *
+ * \param self EventLoop to schedule the timer in
+ * \param t TimerInt to schedule, with its due_time set
+ * \return 0 on success, -1 otherwise
+ * \see timer_heap_remove
+ */
+static int timer_heap_push(EventLoop *self, TimerInt *t)
+{
+  if (self->timer_count >= self->timer_length) {
+    int l = self->timer_length > 0 ? 2 * self->timer_length : DEF_TIMERS_LENGTH;
+    TimerInt **heap = oml_realloc(self->timer_heap, l * sizeof(TimerInt*));
+    if (!heap) {
+      o_log(O_LOG_ERROR, "EventLoop: Could not allocate memory to schedule timer '%s'\n", t->name);
+      return -1;
+    }
+    self->timer_heap = heap;
+    self->timer_length = l;
+  }
+  self->timer_heap[self->timer_count] = t;
+  timer_heap_sift_up(self, self->timer_count++);
+  return 0;
+}
+
+/** Unschedule a timer from the EventLoop's heap, if it was scheduled.
+ *
+ * \param self EventLoop the timer is scheduled in
+ * \param t TimerInt to unschedule
+ * \see timer_heap_push
+ */
+static void timer_heap_remove(EventLoop *self, TimerInt *t)
+{
+  int i = t->heap_index;
+
+  if (i < 0) {
+    return;
+  }
+  t->heap_index = -1;
+  if (i == --self->timer_count) {
+    return;
+  }
+  self->timer_heap[i] = self->timer_heap[self->timer_count];
+  self->timer_heap[i]->heap_index = i;
+  timer_heap_sift_down(self, i);
+  timer_heap_sift_up(self, self->timer_heap[i]->heap_index);
+}
+
+/** Compute how long to wait for the next timer to expire.
+ *
+ * \param self EventLoop to consider the timers of
+ * \return the time until the next timer expires [ms], 0 if overdue, or -1 if there is no active timer
+ */
+static int timers_timeout(EventLoop *self)
+{
+  uint64_t due;
+
+  if (self->timer_count == 0) {
+    return -1;
+  }
+  self->now_ms = monotonic_ms();
+  due = self->timer_heap[0]->due_time;
+  if (due <= self->now_ms) {
+    return 0; // overdue
+  }
+  return due - self->now_ms > INT32_MAX ? INT32_MAX : (int)(due - self->now_ms);
+}
+
+/** Run the callbacks of all expired timers.
+ *
+ * Periodic timers are rescheduled before their callback is called, so the
+ * callback may safely stop the timer.
+ *
+ * \param self EventLoop to run the timers of
+ * \see eventloop_every_ms, eventloop_timer_stop
+ */
+static void run_timers(EventLoop *self)
+{
+  TimerInt *t;
+
+  self->now_ms = monotonic_ms();
+  while (self->timer_count > 0 && (t = self->timer_heap[0])->due_time <= self->now_ms) {
+    // fires
+    o_log(O_LOG_DEBUG2, "EventLoop: Timer '%s' fired\n", t->name);
+
+    if (t->is_periodic) {
+      while ((t->due_time += t->period) < self->now_ms) {
+        // should really only happen during debugging
+        o_log(O_LOG_WARN, "EventLoop: Skipped timer period for '%s'\n",
+              t->name);
+      }
+      timer_heap_sift_down(self, 0);
+    } else {
+      t->is_active = 0;
+      timer_heap_remove(self, t);
+    }
+
+    if (t->callback) t->callback((TimerEvtSource*)t, t->handle);
+  }
+}
+
+/** Empty the wakeup pipe, after it has been reported as readable.
+ *
+ * \param self EventLoop which has been woken up
+ * \see eventloop_wakeup
+ */
+static void drain_wakeup(EventLoop *self)
+{
+  char drain[64];
+  while (read(self->wakeup_fds[0], drain, sizeof(drain)) > 0);
+}
+
+/** Wait for, and process, events on all active Channels using poll(3).
+ *
+ * The array of monitored descriptors is rebuilt whenever a Channel has been
+ * (de)activated, and all active Channels are visited on every wakeup.
+ *
+ * \param self EventLoop to process events for
+ * \param timeout maximum time to wait [ms], or -1 to wait indefinitely
+ * \see update_fds, process_events
+ * \see poll(3)
+ */
+static void poll_dispatch(EventLoop *self, int timeout)
+{
+  Channel *ch;
+  int i, count;
+
+  if (self->fds_dirty || !self->fds)
+    update_fds(self);
+  o_log(O_LOG_DEBUG4, "EventLoop: About to poll() on %d FDs with a timeout of %dms\n", self->size, timeout);
+
+  /* The wakeup pipe is always polled, right after the active channels */
+  count = poll(self->fds, self->size + 1, timeout);
+  self->now = time(NULL);
+
+  if (count > 0 && self->fds[self->size].revents & POLLIN) {
+    drain_wakeup(self);
+    count--;
+  }
+
+  if (count < 1) {
+    o_log(O_LOG_DEBUG4, "EventLoop: Timeout\n");
+    return;
+  }
+
+  o_log(O_LOG_DEBUG4, "EventLoop: Got events\n");
+  self->npolled = self->size;
+  for (i = 0; i < self->size; i++) {
+    /* Channels may get removed by callbacks; see cancel_pending() */
+    if ((ch = self->fds_channels[i])) {
+      process_events(self, ch, self->fds[i].revents);
+    }
+    if ((ch = self->fds_channels[i])) {
+      reap_idle(self, ch);
+    }
+  }
+  self->npolled = 0;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+/** Wait for, and process, events on ready Channels using epoll(7).
+ *
+ * Descriptors are registered once with the kernel when their Channel is
+ * activated, so only those which are ready are visited. Idle Channels are
+ * reaped in a separate pass, at most once per second.
+ *
+ * \param self EventLoop to process events for
+ * \param timeout maximum time to wait [ms], or -1 to wait indefinitely
+ * \see epoll_update, process_events
+ * \see epoll(7)
+ */
+static void epoll_dispatch(EventLoop *self, int timeout)
+{
+  Channel *ch, *next;
+  uint32_t ev;
+  int i, count;
+
+  o_log(O_LOG_DEBUG4, "EventLoop: About to epoll_wait() on %d FDs with a timeout of %dms\n", self->size, timeout);
+  count = epoll_wait(self->epoll_fd, self->events, DEF_EPOLL_EVENTS, timeout);
+  self->now = time(NULL);
+
+  if (count < 0) {
+    if (errno != EINTR) {
+      o_log(O_LOG_ERROR, "EventLoop: Error waiting for events: %s\n", strerror(errno));
+    }
+    count = 0;
+  }
+
+  self->nevents = count;
+  for (i = 0; i < count; i++) {
+    if (self->events[i].data.ptr == self) {
+      drain_wakeup(self);
+      continue;
+    }
+    /* Channels may get removed by callbacks; see cancel_pending() */
+    if (!(ch = self->events[i].data.ptr)) {
+      continue;
+    }
+    ev = self->events[i].events;
+    process_events(self, ch,
+        (ev & EPOLLIN ? POLLIN : 0) | (ev & EPOLLOUT ? POLLOUT : 0) |
+        (ev & EPOLLERR ? POLLERR : 0) | (ev & EPOLLHUP ? POLLHUP : 0));
+  }
+  self->nevents = 0;
+
+  if (self->now > self->last_reaped) {
+    self->last_reaped = self->now;
+    for (ch = self->channels; ch; ch = next) {
+      next = ch->next;
+      if (!ch->is_active) {
+        continue;
+      }
+      if (ch->is_shutting_down) {
+        /* We have been waiting for at least a second for new data to
+         * appear, and are not polling idle channels, mark it as removable */
+        eventloop_socket_release((SockEvtSource*)ch);
+      } else {
+        reap_idle(self, ch);
+      }
+    }
+  }
+}
+
+/** Find another active Channel monitoring the same descriptor.
+ *
+ * \param self EventLoop to search
+ * \param ch Channel whose descriptor to look for
+ * \return the first other active Channel on ch's descriptor, or NULL
+ * \see epoll_update
+ */
+static Channel* epoll_fd_owner(EventLoop *self, Channel *ch)
+{
+  Channel *other;
+
+  for (other = self->channels; other; other = other->next) {
+    if (other != ch && other->is_active && other->fds_fd == ch->fds_fd) {
+      return other;
+    }
+  }
+  return NULL;
+}
+
+/** Register or unregister a Channel with the epoll instance of its EventLoop.
+ *
+ * This is called whenever the Channel is (de)activated. If the descriptor
+ * cannot be monitored with epoll(7) (e.g., a regular file on STDIN), the
+ * EventLoop falls back to poll(3).
+ *
+ * epoll(7) only keeps one registration, and one Channel pointer, per
+ * descriptor, so a Channel whose descriptor is already monitored by another
+ * active Channel of the same EventLoop is rejected, and left inactive.  An
+ * existing registration with no active owner is stale, and simply updated.
+ *
+ * \param self EventLoop the Channel belongs to
+ * \param ch Channel which has just been (de)activated
+ * \see eventloop_socket_activate, epoll_disable
+ */
+static void epoll_update(EventLoop *self, Channel *ch)
+{
+  struct epoll_event ev;
+  Channel *owner;
+  int ret;
+
+  if (ch->is_active) {
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (ch->fds_events & POLLIN ? EPOLLIN : 0) | (ch->fds_events & POLLOUT ? EPOLLOUT : 0);
+    ev.data.ptr = ch;
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, ch->fds_fd, &ev) == 0) {
+      ret = 0;
+    } else if (errno != EEXIST) {
+      ret = -1;
+    } else if ((owner = epoll_fd_owner(self, ch))) {
+      o_log(O_LOG_ERROR, "EventLoop: Cannot monitor '%s': descriptor %d is already monitored by '%s'\n",
+          ch->name, ch->fds_fd, owner->name);
+      ch->is_active = 0;
+      return;
+    } else {
+      ret = epoll_ctl(self->epoll_fd, EPOLL_CTL_MOD, ch->fds_fd, &ev);
+    }
+    if (ret) {
+      o_log(O_LOG_WARN, "EventLoop: Cannot monitor '%s' with epoll, falling back to poll(): %s\n",
+          ch->name, strerror(errno));
+      epoll_disable(self);
+      return;
+    }
+    self->size++;
+
+  } else {
+    /* The descriptor may already have been closed, which also unregisters it */
+    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, ch->fds_fd, NULL) &&
+        errno != EBADF && errno != ENOENT) {
+      o_log(O_LOG_DEBUG, "EventLoop: Could not unregister '%s' from epoll: %s\n",
+          ch->name, strerror(errno));
+    }
+    self->size--;
+  }
+}
+
+/** Stop using epoll(7), and revert to poll(3) for this EventLoop.
+ *
+ * \param self EventLoop to switch to the poll(3) backend
+ * \see epoll_update, update_fds
+ */
+static void epoll_disable(EventLoop *self)
+{
+  if (self->epoll_fd >= 0) {
+    close(self->epoll_fd);
+    self->epoll_fd = -1;
+  }
+  /* The events array is kept, as it might be in the process of being
+   * dispatched; it will be freed in eventloop_teardown() */
+  self->fds_dirty = 1;
+}
+#endif
+
+/** Process events reported on a Channel, and run the relevant callbacks.
+ *
+ * \param self EventLoop the Channel belongs to
+ * \param ch Channel with pending events
+ * \param revents mask of returned events, as poll(3) flags
+ *
+ * \see poll_dispatch, epoll_dispatch
+ * \see poll(3)
+ */
+static void process_events(EventLoop *self, Channel *ch, int revents)
+{
+  int fd = ch->fds_fd;
+
+  self->current = ch;
+  if (revents & POLLERR) {
+    char buf[32];
+    SocketStatus status;
+    int len;
+
+    if ((len = recv(fd, buf, 32, 0)) <= 0) {
+      switch (errno) {
+      case ECONNREFUSED:
+        status = SOCKET_CONN_REFUSED;
+        break;
+      default:
+        status = SOCKET_UNKNOWN;
+        if (!ch->status_cbk) {
+          o_log(O_LOG_ERROR, "EventLoop: While reading from socket '%s': (%d) %s\n",
+                ch->name, errno, strerror(errno));
+        }
+      }
+      eventloop_socket_activate((SockEvtSource*)ch, 0);
+      do_status_callback (ch, status, errno);
+    } else {
+      o_log(O_LOG_ERROR, "EventLoop: Expected error on socket '%s' but read '%s'\n", ch->name, buf);
+    }
+  } else if (ch->read_cbk && ch->monitor_cbk && revents & (POLLIN | POLLHUP)) {
+    /* The application reads by itself \see eventloop_socket_set_monitor */
+    ch->last_activity = self->now;
+    do_monitor_callback (ch);
+  } else if (revents & POLLHUP) {
+    eventloop_socket_activate((SockEvtSource*)ch, 0);
+
+    /* Client closed the connection, but there might still be bytes
+       for us to read from our end of the connection. */
+    while (channel_read(self, ch, MAX_DRAIN_READS) > 0 &&
+        self->current == ch && !ch->is_removable);
+    if (self->current == ch) {
+      do_status_callback (ch, SOCKET_CONN_CLOSED, 0);
+    }
+  } else if (revents & POLLIN) {
+    if (ch->read_cbk) {
+      int len;
+      ch->last_activity = self->now;
+      len = channel_read(self, ch, MAX_DRAIN_READS);
+      if (len > 0) {
+        /* Data was passed to the read callback */
+      } else if (len == 0 && ch->socket != NULL) {  // skip stdin
+        // closed down
+        eventloop_socket_activate((SockEvtSource*)ch, 0);
+        do_status_callback (ch, SOCKET_CONN_CLOSED, 0);
+      } else if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        if (errno == ENOTSOCK) {
+          o_log(O_LOG_ERROR,
+                "EventLoop: Monitored socket '%s' is now invalid; "
+                "removing from monitored set\n",
+                ch->name);
+          /* Only release it here, it will be removed once all events have
+           * been processed */
+          eventloop_socket_release ((SockEvtSource*)ch);
+        } else {
+          o_log(O_LOG_ERROR, "EventLoop: Unrecognized read error not handled (errno=%d)\n",
+                errno);
+        }
+      }
+    } else {
+      do_monitor_callback (ch);
+    }
+  } else if (ch->is_shutting_down) {
+    /* The socket was shutting down, and nothing new has appeared;
+     * We flushed the buffers, mark it as removable */
+    eventloop_socket_release((SockEvtSource*)ch);
+  }
+
+  /* The Channel may have been removed by one of the callbacks above */
+  if (self->current != ch) {
+    return;
+  }
+
+  if (revents & POLLOUT) {
+    do_status_callback(ch, SOCKET_WRITEABLE, 0);
+    if (self->current != ch) {
+      return;
+    }
+    if (0 != ch->last_activity) {
+      /* If we track the activity of this socket */
+      ch->last_activity = self->now;
+    }
+  }
+
+  if (revents & POLLNVAL) {
+    o_log(O_LOG_WARN, "EventLoop: socket '%s' invalid, deactivating...\n", ch->name);
+    eventloop_socket_activate((SockEvtSource*)ch, 0);
+    do_status_callback(ch, SOCKET_DROPPED, 0);
+  }
+  self->current = NULL;
+}
+
+/** Read available data from a Channel, and pass it to its read callback.
+ *
+ * Data is read directly into the memory provided by the Channel's
+ * buffer-supply callback, if any, or in the EventLoop's own buffer otherwise.
+ * The amount of data requested at once grows when reads fill the buffer, and
+ * shrinks when they don't, between MIN_READ_BUFFER_SIZE and
+ * MAX_READ_BUFFER_SIZE.
+ *
+ * Sockets are read from without blocking until no more data is available
+ * (short read or EAGAIN), but at most max_reads times, so other Channels are
+ * not starved. STDIN is only read once.
+ *
+ * \param self EventLoop the Channel belongs to
+ * \param ch Channel to read from
+ * \param max_reads maximum number of reads to perform
+ * \return the size of the last read, 0 on end of file or if the Channel has
+ * been released, or -1 on error, with errno set
+ *
+ * \see eventloop_socket_set_buffer, o_el_buffer_socket_callback, do_read_callback
+ */
+static int channel_read(EventLoop *self, Channel *ch, int max_reads)
+{
+  int fd = ch->fds_fd;
+  size_t size;
+  void *buf;
+  int len;
+
+  if (!ch->read_size) {
+    ch->read_size = DEF_READ_BUFFER_SIZE;
+  }
+
+  do {
+    /* A released Channel's socket may already have been closed, and its
+     * descriptor reused, e.g., by another thread; don't read from it */
+    if (ch->is_removable) {
+      return 0;
+    }
+
+    buf = NULL;
+    size = ch->read_size;
+    if (ch->buffer_cbk) {
+      buf = ch->buffer_cbk((SockEvtSource*)ch, ch->handle, &size);
+    }
+    if (!buf) {
+      if (!self->read_buf &&
+          !(self->read_buf = oml_malloc(MAX_READ_BUFFER_SIZE))) {
+        o_log(O_LOG_ERROR, "EventLoop: Could not allocate read buffer\n");
+        errno = ENOMEM;
+        return -1;
+      }
+      buf = self->read_buf;
+      size = ch->read_size;
+    }
+    if (size > MAX_READ_BUFFER_SIZE) {
+      size = MAX_READ_BUFFER_SIZE;
+    }
+
+    if (fd == 0) {
+      // stdin
+      len = read(fd, buf, size);
+      max_reads = 0;
+    } else {
+      // socket
+      len = recv(fd, buf, size, MSG_DONTWAIT);
+    }
+    if (len <= 0) {
+      return len;
+    }
+
+    o_log(O_LOG_DEBUG3, "EventLoop: Received %i bytes\n", len);
+    if ((size_t)len >= ch->read_size && ch->read_size < MAX_READ_BUFFER_SIZE) {
+      ch->read_size *= 2;
+    } else if ((size_t)len < ch->read_size / 4 && ch->read_size > MIN_READ_BUFFER_SIZE) {
+      ch->read_size /= 2;
+    }
+
+    do_read_callback (ch, buf, len);
+
+    /* Stop on short reads, as the socket is most likely empty; also stop if
+     * the Channel has been removed or released by the callback */
+  } while ((size_t)len == size && --max_reads > 0 &&
+      self->current == ch && !ch->is_removable);
+
+  return len;
+}
+
+/** Reap a Channel if it has been idle for longer than the socket timeout.
+ *
+ * XXX: There might be a corner case where all FDs are already used, and some
+ * of them idle, however a new a new connection (on one listening socket early
+ * in the list) would be dropped before cleanup triggered by its arrival freed
+ * the resources it needs (from the idle sockets further towards the end of
+ * the list. See #959.
+ *
+ * \param self EventLoop the Channel belongs to
+ * \param ch Channel to check
+ * \see eventloop_set_socket_timeout
+ */
+static void reap_idle(EventLoop *self, Channel *ch)
+{
+  if (ch->last_activity != 0 &&
+      self->socket_timeout > 0 &&
+      self->now - ch->last_activity > self->socket_timeout) {
+    o_log(O_LOG_DEBUG2, "EventLoop: Socket '%s' idle for %ds, reaping...\n", ch->name, self->now - ch->last_activity);
+    do_status_callback(ch, SOCKET_IDLE, 0);
+  }
+}
+
+/** Remove all Channels marked as removable.
+ *
+ * \param self EventLoop to clean up
+ * \see eventloop_socket_release, eventloop_socket_remove
+ */
+static void remove_released(EventLoop *self)
+{
+  Channel *ch, *next;
+
+  self->has_removable = 0;
+  for (ch = self->channels; ch; ch = next) {
+    next = ch->next;
+    if (ch->is_removable) {
+      eventloop_socket_remove((SockEvtSource*)ch);
+    }
+  }
+}
+
+/** Forget about any not-yet-processed events for a Channel about to be freed.
+ *
+ * \param self EventLoop the Channel belongs to
+ * \param ch Channel being removed
+ * \see eventloop_socket_remove, poll_dispatch, epoll_dispatch
+ */
+static void cancel_pending(EventLoop *self, Channel *ch)
+{
+  int i;
+
+  if (self->current == ch) {
+    self->current = NULL;
+  }
+#ifdef HAVE_SYS_EPOLL_H
+  for (i = 0; i < self->nevents; i++) {
+    if (self->events[i].data.ptr == ch) {
+      self->events[i].data.ptr = NULL;
+    }
+  }
+#endif
+  for (i = 0; i < self->npolled; i++) {
+    if (self->fds_channels[i] == ch) {
+      self->fds_channels[i] = NULL;
+    }
+  }
+}
+
+/** Run all calls queued with eventloop_post().
+ *
+ * \param self EventLoop for which to run queued calls
+ * \see eventloop_post
+ */
+static void run_posted(EventLoop *self)
+{
+  PostedCall *pc, *next;
+
+  pthread_mutex_lock(&self->posted_lock);
+  pc = self->posted;
+  self->posted = self->posted_tail = NULL;
+  pthread_mutex_unlock(&self->posted_lock);
+
+  while (pc) {
+    next = pc->next;
+    pc->callback(pc->handle);
+    oml_free(pc);
+    pc = next;
+  }
 }
 
 /** Execute the data-read callback of a channel, if defined.
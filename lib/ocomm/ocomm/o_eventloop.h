@@ -115,6 +115,24 @@ typedef void (*o_el_timer_callback)(TimerEvtSource* source, void* handle);
  */
 typedef void (*o_el_read_socket_callback)(SockEvtSource* source, void* handle, void* buffer, int buf_size);
 
+/** Buffer-supply callback prototype for sockets.
+ *
+ * If registered with eventloop_socket_set_buffer(), this callback is called
+ * before each read, to let the application provide the memory in which data
+ * should be received. The o_el_read_socket_callback is then called with a
+ * pointer into that memory, so the data doesn't need to be copied again.
+ *
+ * \param source SockEvtSource about to be read from
+ * \param handle pointer to application-supplied data
+ * \param size pointer to the amount of data the EventLoop would like to read;
+ * to be updated with the space actually available at the returned address
+ * \return a pointer to where the data should be read, or NULL to let the
+ * EventLoop use its own buffer
+ *
+ * \see eventloop_socket_set_buffer, o_el_read_socket_callback
+ */
+typedef void* (*o_el_buffer_socket_callback)(SockEvtSource* source, void* handle, size_t* size);
+
 /** Monitoring callback prototype for sockets.
  *
  * This callback is a fallback when no data-read callback. Listening sockets,
@@ -150,14 +168,45 @@ typedef void (*o_el_monitor_socket_callback)(SockEvtSource* source, void* handle
  */
 typedef void (*o_el_state_socket_callback)(SockEvtSource* source, SocketStatus status, int error, void* handle);
 
+/** Deferred-call callback prototype.
+ *
+ * Callbacks of this type are queued with eventloop_post() from any thread, and
+ * run from within the target EventLoop's own thread.
+ *
+ * \param handle pointer to application-supplied data
+ *
+ * \see eventloop_post
+ */
+typedef void (*o_el_post_callback)(void* handle);
+
+/** An opaque EventLoop instance.
+ *
+ * Each thread has a current EventLoop, on which the eventloop_* functions
+ * below operate. The main thread's EventLoop is set up by eventloop_init();
+ * additional ones can be created with eventloop_new() and bound to other
+ * threads with eventloop_attach().
+ *
+ * \see eventloop_init, eventloop_new, eventloop_attach
+ */
+typedef struct _eventLoop EventLoop;
+
+EventLoop* eventloop_new(void);
+void eventloop_free(EventLoop* loop);
+void eventloop_attach(EventLoop* loop);
+EventLoop* eventloop_current(void);
+int eventloop_post(EventLoop* loop, o_el_post_callback callback, void* handle);
+
 void eventloop_init(void);
 void eventloop_set_socket_timeout(unsigned int to);
 int eventloop_run(void);
 void eventloop_stop(int reason);
 void eventloop_terminate(int reason);
+void eventloop_stop_loop(EventLoop* loop, int reason);
+void eventloop_terminate_loop(EventLoop* loop, int reason);
 void eventloop_report (int loglevel);
 
 TimerEvtSource* eventloop_every(char* name, int period, o_el_timer_callback callback, void* handle);
+TimerEvtSource* eventloop_every_ms(char* name, unsigned int period, o_el_timer_callback callback, void* handle);
 void eventloop_timer_stop(TimerEvtSource* timer);
 
 /* These functions create new channels around either STDIN or an OComm socket,
@@ -166,9 +215,12 @@ SockEvtSource* eventloop_on_stdin( o_el_read_socket_callback callback, void* han
 SockEvtSource* eventloop_on_monitor_in_channel(Socket* socket, o_el_monitor_socket_callback monitor_cbk, o_el_state_socket_callback status_cbk, void* handle);
 SockEvtSource* eventloop_on_read_in_channel(Socket* socket,o_el_read_socket_callback data_cbk, o_el_state_socket_callback status_cbk, void* handle);
 SockEvtSource* eventloop_on_out_channel( Socket* socket, o_el_state_socket_callback status_cbk, void* handle);
+SockEvtSource* eventloop_on_out_fd(char* name, int fd, o_el_state_socket_callback status_cbk, void* handle);
 
 /* XXX: Is "socket" the right term here? */
 void eventloop_socket_activate(SockEvtSource* source, int flag);
+void eventloop_socket_set_buffer(SockEvtSource* source, o_el_buffer_socket_callback buffer_cbk);
+void eventloop_socket_set_monitor(SockEvtSource* source, o_el_monitor_socket_callback monitor_cbk);
 void eventloop_socket_release(SockEvtSource* source);
 void eventloop_socket_remove(SockEvtSource* source);
 
@@ -468,7 +468,7 @@ socket_server_new(const char* name, const char* node, const char* service, o_so_
   socketlist = socket_in_new(name, node, service, TRUE);
 
   for (it=(SocketInt*)socketlist; it; it=(SocketInt*)it->next) {
-    listen(it->sockfd, 5);
+    listen(it->sockfd, SOMAXCONN);
     it->connect_callback = callback;
     it->connect_handle = handle;
 
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file ack.c
+ * \brief Encode and decode acknowledgements of stored measurements.
+ * \see ack.h
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "mbuf.h"
+#include "ack.h"
+
+/** Append the acknowledgement of a stream's sequence number to an MBuffer.
+ *
+ * \param mbuf MBuffer to write into
+ * \param stream index of the acknowledged stream
+ * \param seqno sequence number up to which all samples of this stream were stored
+ * \return 0 on success, -1 otherwise
+ */
+int
+ack_write (MBuffer *mbuf, int stream, int seqno)
+{
+  return mbuf_print (mbuf, "%s: %d %d\n", ACK_HEADER_KEY, stream, seqno);
+}
+
+/** Append the end of the acknowledgements sent on connection to an MBuffer.
+ *
+ * \param mbuf MBuffer to write into
+ * \return 0 on success, -1 otherwise
+ */
+int
+ack_write_end (MBuffer *mbuf)
+{
+  return mbuf_write (mbuf, (const uint8_t*)"\n", 1);
+}
+
+/** Read one line of acknowledgements from an MBuffer.
+ *
+ * Complete lines are consumed from the MBuffer, even when malformed.
+ *
+ * \param mbuf MBuffer to read from
+ * \param[out] stream index of the acknowledged stream, set if ACK_SEQNO is returned
+ * \param[out] seqno acknowledged sequence number, set if ACK_SEQNO is returned
+ * \return ACK_SEQNO or ACK_END depending on the line read, ACK_MORE if no
+ * complete line is available yet, or ACK_INVALID if it is malformed
+ * \see ack_write, ack_write_end
+ */
+enum AckReadResult
+ack_read (MBuffer *mbuf, int *stream, int *seqno)
+{
+  char line[64];
+  int len = mbuf_find (mbuf, '\n');
+  enum AckReadResult res = ACK_INVALID;
+
+  if (len == -1) {
+    return ACK_MORE;
+
+  } else if (len == 0) {
+    res = ACK_END;
+
+  } else if (len < (int)sizeof (line)) {
+    memcpy (line, mbuf_rdptr (mbuf), len);
+    line[len] = '\0';
+    if (sscanf (line, ACK_HEADER_KEY ": %d %d", stream, seqno) == 2) {
+      res = ACK_SEQNO;
+    }
+  }
+
+  mbuf_read_skip (mbuf, len + 1);
+  mbuf_consume_message (mbuf);
+  return res;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
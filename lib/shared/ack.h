@@ -0,0 +1,56 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file ack.h
+ * \brief Acknowledgements of stored measurements, sent back to the clients.
+ *
+ * A client wanting acknowledgements sends an "ack: VERSION" header line.
+ * Once the headers are processed, the server replies, on the same
+ * connection, with one "ack: STREAM SEQNO" line for each stream of which it
+ * already stored samples from that client instance (e.g., before a
+ * reconnection), followed by an empty line. It then periodically sends
+ * further "ack: STREAM SEQNO" lines as these sequence numbers progress.
+ *
+ * SEQNO is the sequence number up to which all samples of STREAM were stored,
+ * not merely the highest one. Clients keep what they sent until it is
+ * acknowledged, and resend it after reconnecting; the server skips the
+ * samples it receives again.
+ */
+#ifndef ACK_H__
+#define ACK_H__
+
+#include "mbuf.h"
+
+/** Header key requesting acknowledgements */
+#define ACK_HEADER_KEY "ack"
+/** Version of the acknowledgement protocol */
+#define ACK_PROTOCOL_VERSION 1
+
+/** Results of ack_read */
+enum AckReadResult {
+  ACK_INVALID = -1, /**< malformed line, skipped */
+  ACK_MORE = 0,     /**< no complete line yet */
+  ACK_SEQNO = 1,    /**< acknowledgement of a stream's sequence number */
+  ACK_END = 2,      /**< end of the acknowledgements sent on connection */
+};
+
+int ack_write (MBuffer *mbuf, int stream, int seqno);
+int ack_write_end (MBuffer *mbuf);
+enum AckReadResult ack_read (MBuffer *mbuf, int *stream, int *seqno);
+
+#endif /* ACK_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -110,6 +110,9 @@ bin_read_msg_start (struct oml_message *msg, MBuffer *mbuf)
   if (msg == NULL || mbuf == NULL)
     return -1;
 
+  if (mbuf_rd_remaining (mbuf) < 2)
+    return 0; /* Not enough data to find the sync bytes */
+
   /* First, find the sync position */
   int sync_pos = bin_find_sync (mbuf);
 
@@ -132,14 +135,15 @@ bin_read_msg_start (struct oml_message *msg, MBuffer *mbuf)
 
   switch (packet_type) {
   case OMB_DATA_P:
-    // FIXME:  Return type (maybe not enough bytes)
-    mbuf_read (mbuf, (uint8_t*)&msglen16, 2);
+    if (mbuf_read (mbuf, (uint8_t*)&msglen16, 2) == -1)
+      return 0; /* Not enough data for the length */
     msglen16 = ntohs (msglen16);
     length = (uint32_t)msglen16;
     header_length = 5;
     break;
   case OMB_LDATA_P:
-    mbuf_read (mbuf, (uint8_t*)&length, 4);
+    if (mbuf_read (mbuf, (uint8_t*)&length, 4) == -1)
+      return 0; /* Not enough data for the length */
     length = ntohl (length);
     header_length = 7;
     break;
@@ -161,6 +161,10 @@ cbuf_write (CBuffer *cbuf, char *buf, size_t size)
 /**
  *  Get a cursor pointing to the current write position in the buffer
  *  chain.
+ *
+ *  If the current page is full, the cursor points to the start of the
+ *  page the next write will go to, rather than to the end of the full
+ *  one, which may be recycled before the cursor is used.
  */
 
 void
@@ -169,6 +173,13 @@ cbuf_write_cursor (CBuffer *cbuf, struct cbuffer_cursor *cursor)
   if (cbuf == NULL || cursor == NULL)
     return;
 
+  if (cbuf->tail->fill == cbuf->tail->size) {
+    if (cbuf->tail->next->empty)
+      cbuf->tail = cbuf->tail->next;
+    else
+      cbuf_add_page (cbuf, -1);
+  }
+
   cursor->page = cbuf->tail;
   cursor->index = cursor->page->fill;
 }
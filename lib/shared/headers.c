@@ -186,6 +186,7 @@ static const struct {
   { "sender-id",     9,  H_SENDER_ID },
   { "start-time",    10, H_START_TIME },
   { "start_time",    10, H_START_TIME }, /* This one will be deprecated at some point */
+  { "ack",           3,  H_ACK },
   { NULL, 0, H_NONE }
 };
 
@@ -35,6 +35,7 @@ enum HeaderTag {
   H_SENDER_ID,
   H_SCHEMA,
   H_START_TIME,
+  H_ACK,
   H_max /* For calculating the max value for use in tables */
 };
 
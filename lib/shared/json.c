@@ -10,12 +10,24 @@
 
 /** \file json.c
  * \brief Source code for converting internal data to JSON format (used for storing vectors on DB).
+ *
+ * Vectors are written in a single pass, into an output buffer which is
+ * resized at most once, to an upper bound of the length of their
+ * representation.  Integers are formatted two digits at a time from a table,
+ * and doubles with the Grisu2 algorithm [Loitsch, "Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", PLDI 2010], which gives a
+ * representation that reads back as the same double, and is the shortest
+ * such one in all but a tiny fraction of cases.
+ *
+ * The json_format_*() functions are also used to write vectors in the text
+ * protocol.
  */
 
 #include <assert.h>
 #include <errno.h>
 #include <float.h>
 #include <inttypes.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -23,12 +35,23 @@
 #include "json.h"
 #include "mem.h"
 
+/** Pairs of decimal digits, to format integers two digits at a time */
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
 
 /**
  * Resize the output buffer to at least new_sz octets. The buffer
  * pointed at by *str must be either NULL or have been allocated by
- * oml_malloc(). On return the output buffer pointed to by *str will have
- * been zeroed.
+ * oml_malloc(). Its content is not preserved.
  *
  * \param str A non-NULL pointer pointer to the buffer.
  * \param new_sz The news size for the output buffer.
@@ -44,15 +67,440 @@ resize_buffer(char **str, size_t new_sz)
     if(new) {
       *str = new;
       str_sz = new_sz;
-      memset(*str, 0, str_sz);
     }
   } else {
     str_sz = oml_malloc_usable_size(*str);
-    memset(*str, 0, str_sz);
   }
   return str_sz;
 }
 
+/**
+ * Write the separator preceding the i-th element of a JSON array.
+ *
+ * \param p Pointer to write the separator at.
+ * \param i Index of the next element.
+ * \return A pointer past the separator.
+ */
+static inline char*
+array_next(char *p, size_t i)
+{
+  *p++ = i ? ',' : '[';
+  *p++ = ' ';
+  return p;
+}
+
+/**
+ * Terminate a JSON array, or an empty string if it has no elements.
+ *
+ * \param str Start of the output buffer.
+ * \param p Pointer past the last element.
+ * \param v_sz Number of elements in the array.
+ * \return The length of the output, excluding the terminating '\0'.
+ */
+static inline ssize_t
+array_end(char *str, char *p, size_t v_sz)
+{
+  if(v_sz) {
+    *p++ = ' ';
+    *p++ = ']';
+  }
+  *p = '\0';
+  return p - str;
+}
+
+/**
+ * Format an unsigned integer in decimal.
+ *
+ * \param buf Output buffer, with room for at least JSON_UINT64_MAXLEN characters; no '\0' is written.
+ * \param u Value to format.
+ * \return The number of characters written.
+ */
+size_t
+json_format_uint64(char *buf, uint64_t u)
+{
+  char tmp[JSON_UINT64_MAXLEN];
+  char *p = tmp + sizeof(tmp);
+  size_t n;
+
+  while(u >= 100) {
+    unsigned int d = (unsigned int)(u % 100) * 2;
+    u /= 100;
+    *--p = digit_pairs[d + 1];
+    *--p = digit_pairs[d];
+  }
+  if(u >= 10) {
+    *--p = digit_pairs[u * 2 + 1];
+    *--p = digit_pairs[u * 2];
+  } else {
+    *--p = '0' + (char)u;
+  }
+  n = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, n);
+  return n;
+}
+
+/**
+ * Format a signed integer in decimal.
+ *
+ * \param buf Output buffer, with room for at least JSON_INT64_MAXLEN characters; no '\0' is written.
+ * \param i Value to format.
+ * \return The number of characters written.
+ */
+size_t
+json_format_int64(char *buf, int64_t i)
+{
+  if(i < 0) {
+    *buf = '-';
+    return 1 + json_format_uint64(buf + 1, -(uint64_t)i);
+  }
+  return json_format_uint64(buf, i);
+}
+
+/** A floating-point number with a 64-bit significand, f * 2^e */
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+#define DP_SIGNIFICAND_SIZE 52
+#define DP_EXPONENT_BIAS (0x3FF + DP_SIGNIFICAND_SIZE)
+#define DP_HIDDEN_BIT    (UINT64_C(1) << DP_SIGNIFICAND_SIZE)
+#define DP_FRACTION_MASK (DP_HIDDEN_BIT - 1)
+#define DP_EXPONENT_MASK UINT64_C(0x7FF0000000000000)
+
+/** Normalised approximations of 10^k, for k = -348 + 8i; see diyfp_cached_power() */
+static const struct {
+  uint64_t f;
+  int e;
+} cached_powers[] = {
+  { UINT64_C(0xfa8fd5a0081c0288), -1220 }, { UINT64_C(0xbaaee17fa23ebf76), -1193 },
+  { UINT64_C(0x8b16fb203055ac76), -1166 }, { UINT64_C(0xcf42894a5dce35ea), -1140 },
+  { UINT64_C(0x9a6bb0aa55653b2d), -1113 }, { UINT64_C(0xe61acf033d1a45df), -1087 },
+  { UINT64_C(0xab70fe17c79ac6ca), -1060 }, { UINT64_C(0xff77b1fcbebcdc4f), -1034 },
+  { UINT64_C(0xbe5691ef416bd60c), -1007 }, { UINT64_C(0x8dd01fad907ffc3c),  -980 },
+  { UINT64_C(0xd3515c2831559a83),  -954 }, { UINT64_C(0x9d71ac8fada6c9b5),  -927 },
+  { UINT64_C(0xea9c227723ee8bcb),  -901 }, { UINT64_C(0xaecc49914078536d),  -874 },
+  { UINT64_C(0x823c12795db6ce57),  -847 }, { UINT64_C(0xc21094364dfb5637),  -821 },
+  { UINT64_C(0x9096ea6f3848984f),  -794 }, { UINT64_C(0xd77485cb25823ac7),  -768 },
+  { UINT64_C(0xa086cfcd97bf97f4),  -741 }, { UINT64_C(0xef340a98172aace5),  -715 },
+  { UINT64_C(0xb23867fb2a35b28e),  -688 }, { UINT64_C(0x84c8d4dfd2c63f3b),  -661 },
+  { UINT64_C(0xc5dd44271ad3cdba),  -635 }, { UINT64_C(0x936b9fcebb25c996),  -608 },
+  { UINT64_C(0xdbac6c247d62a584),  -582 }, { UINT64_C(0xa3ab66580d5fdaf6),  -555 },
+  { UINT64_C(0xf3e2f893dec3f126),  -529 }, { UINT64_C(0xb5b5ada8aaff80b8),  -502 },
+  { UINT64_C(0x87625f056c7c4a8b),  -475 }, { UINT64_C(0xc9bcff6034c13053),  -449 },
+  { UINT64_C(0x964e858c91ba2655),  -422 }, { UINT64_C(0xdff9772470297ebd),  -396 },
+  { UINT64_C(0xa6dfbd9fb8e5b88f),  -369 }, { UINT64_C(0xf8a95fcf88747d94),  -343 },
+  { UINT64_C(0xb94470938fa89bcf),  -316 }, { UINT64_C(0x8a08f0f8bf0f156b),  -289 },
+  { UINT64_C(0xcdb02555653131b6),  -263 }, { UINT64_C(0x993fe2c6d07b7fac),  -236 },
+  { UINT64_C(0xe45c10c42a2b3b06),  -210 }, { UINT64_C(0xaa242499697392d3),  -183 },
+  { UINT64_C(0xfd87b5f28300ca0e),  -157 }, { UINT64_C(0xbce5086492111aeb),  -130 },
+  { UINT64_C(0x8cbccc096f5088cc),  -103 }, { UINT64_C(0xd1b71758e219652c),   -77 },
+  { UINT64_C(0x9c40000000000000),   -50 }, { UINT64_C(0xe8d4a51000000000),   -24 },
+  { UINT64_C(0xad78ebc5ac620000),     3 }, { UINT64_C(0x813f3978f8940984),    30 },
+  { UINT64_C(0xc097ce7bc90715b3),    56 }, { UINT64_C(0x8f7e32ce7bea5c70),    83 },
+  { UINT64_C(0xd5d238a4abe98068),   109 }, { UINT64_C(0x9f4f2726179a2245),   136 },
+  { UINT64_C(0xed63a231d4c4fb27),   162 }, { UINT64_C(0xb0de65388cc8ada8),   189 },
+  { UINT64_C(0x83c7088e1aab65db),   216 }, { UINT64_C(0xc45d1df942711d9a),   242 },
+  { UINT64_C(0x924d692ca61be758),   269 }, { UINT64_C(0xda01ee641a708dea),   295 },
+  { UINT64_C(0xa26da3999aef774a),   322 }, { UINT64_C(0xf209787bb47d6b85),   348 },
+  { UINT64_C(0xb454e4a179dd1877),   375 }, { UINT64_C(0x865b86925b9bc5c2),   402 },
+  { UINT64_C(0xc83553c5c8965d3d),   428 }, { UINT64_C(0x952ab45cfa97a0b3),   455 },
+  { UINT64_C(0xde469fbd99a05fe3),   481 }, { UINT64_C(0xa59bc234db398c25),   508 },
+  { UINT64_C(0xf6c69a72a3989f5c),   534 }, { UINT64_C(0xb7dcbf5354e9bece),   561 },
+  { UINT64_C(0x88fcf317f22241e2),   588 }, { UINT64_C(0xcc20ce9bd35c78a5),   614 },
+  { UINT64_C(0x98165af37b2153df),   641 }, { UINT64_C(0xe2a0b5dc971f303a),   667 },
+  { UINT64_C(0xa8d9d1535ce3b396),   694 }, { UINT64_C(0xfb9b7cd9a4a7443c),   720 },
+  { UINT64_C(0xbb764c4ca7a44410),   747 }, { UINT64_C(0x8bab8eefb6409c1a),   774 },
+  { UINT64_C(0xd01fef10a657842c),   800 }, { UINT64_C(0x9b10a4e5e9913129),   827 },
+  { UINT64_C(0xe7109bfba19c0c9d),   853 }, { UINT64_C(0xac2820d9623bf429),   880 },
+  { UINT64_C(0x80444b5e7aa7cf85),   907 }, { UINT64_C(0xbf21e44003acdd2d),   933 },
+  { UINT64_C(0x8e679c2f5e44ff8f),   960 }, { UINT64_C(0xd433179d9c8cb841),   986 },
+  { UINT64_C(0x9e19db92b4e31ba9),  1013 }, { UINT64_C(0xeb96bf6ebadf77d9),  1039 },
+  { UINT64_C(0xaf87023b9bf0ee6b),  1066 }
+};
+
+/** Powers of ten which fit in 32 bits */
+static const uint32_t pow10_32[] = {
+  1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+/**
+ * Multiply two DiyFps, rounding the result to 64 bits.
+ *
+ * \param x, y DiyFps to multiply.
+ * \return x * y.
+ */
+static inline DiyFp
+diyfp_mul(DiyFp x, DiyFp y)
+{
+  const uint64_t M32 = 0xFFFFFFFF;
+  uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+  DiyFp r;
+
+  tmp += UINT64_C(1) << 31; /* Round */
+  r.f = ac + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+  r.e = x.e + y.e + 64;
+  return r;
+}
+
+/**
+ * Shift a non-zero DiyFp so that the top bit of its significand is set.
+ *
+ * \param x DiyFp to normalise.
+ * \return The normalised DiyFp.
+ */
+static inline DiyFp
+diyfp_normalize(DiyFp x)
+{
+#ifdef __GNUC__
+  int s = __builtin_clzll(x.f);
+  x.f <<= s;
+  x.e -= s;
+#else
+  while(!(x.f & (UINT64_C(1) << 63))) {
+    x.f <<= 1;
+    x.e--;
+  }
+#endif
+  return x;
+}
+
+/**
+ * Find the cached power of ten which brings a normalised DiyFp with binary
+ * exponent e close to [2^-60, 2^-32).
+ *
+ * \param e Binary exponent of the DiyFp.
+ * \param[out] K Opposite of the decimal exponent of the cached power.
+ * \return The cached power of ten, c such that c ~= 10^-K.
+ */
+static inline DiyFp
+diyfp_cached_power(int e, int *K)
+{
+  double dk = (-61 - e) * 0.30102999566398114 + 347; /* log10(2) */
+  int k = (int)dk;
+  unsigned int i;
+  DiyFp c;
+
+  if(dk - k > 0.0)
+    k++;
+  i = (unsigned int)((k >> 3) + 1);
+  *K = -(-348 + (int)(i << 3));
+  c.f = cached_powers[i].f;
+  c.e = cached_powers[i].e;
+  return c;
+}
+
+/**
+ * Move the last digit generated by Grisu2 down, as long as this brings the
+ * output closer to the actual value while remaining in the rounding interval.
+ */
+static inline void
+grisu_round(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w)
+{
+  while(rest < wp_w && delta - rest >= ten_kappa &&
+      (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buffer[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/**
+ * Generate the shortest digits of a number in the interval (Mp - delta, Mp].
+ *
+ * \param W Scaled value to format.
+ * \param Mp Scaled upper bound of the rounding interval of W.
+ * \param delta Width of the rounding interval.
+ * \param buffer Output buffer for the digits, of at least 17 characters.
+ * \param[out] len Number of digits generated.
+ * \param[in,out] K Decimal exponent of the digits.
+ */
+static void
+grisu_digit_gen(DiyFp W, DiyFp Mp, uint64_t delta, char *buffer, int *len, int *K)
+{
+  DiyFp one;
+  uint64_t wp_w = Mp.f - W.f;
+  uint32_t p1;
+  uint64_t p2;
+  int kappa;
+
+  one.f = UINT64_C(1) << -Mp.e;
+  one.e = Mp.e;
+  p1 = (uint32_t)(Mp.f >> -one.e);
+  p2 = Mp.f & (one.f - 1);
+  for(kappa = 1; kappa < 10 && p1 >= pow10_32[kappa]; kappa++);
+  *len = 0;
+
+  while(kappa > 0) {
+    uint32_t d = p1 / pow10_32[kappa - 1];
+    uint64_t tmp;
+
+    p1 %= pow10_32[kappa - 1];
+    if(d || *len)
+      buffer[(*len)++] = (char)('0' + d);
+    kappa--;
+    tmp = ((uint64_t)p1 << -one.e) + p2;
+    if(tmp <= delta) {
+      *K += kappa;
+      grisu_round(buffer, *len, delta, tmp, (uint64_t)pow10_32[kappa] << -one.e, wp_w);
+      return;
+    }
+  }
+
+  for(;;) {
+    char d;
+
+    p2 *= 10;
+    delta *= 10;
+    d = (char)(p2 >> -one.e);
+    if(d || *len)
+      buffer[(*len)++] = (char)('0' + d);
+    p2 &= one.f - 1;
+    kappa--;
+    if(p2 < delta) {
+      *K += kappa;
+      grisu_round(buffer, *len, delta, p2, one.f, wp_w * (-kappa < 10 ? pow10_32[-kappa] : 0));
+      return;
+    }
+  }
+}
+
+/**
+ * Compute the shortest digits reading back as a positive, finite double.
+ *
+ * \param value Double to format.
+ * \param buffer Output buffer for the digits, of at least 17 characters.
+ * \param[out] len Number of digits generated.
+ * \param[out] K Decimal exponent, so that value ~= buffer * 10^K.
+ */
+static void
+grisu2(double value, char *buffer, int *len, int *K)
+{
+  uint64_t bits;
+  DiyFp v, m_plus, m_minus, c_mk, W, Wp, Wm;
+  int biased_e;
+
+  memcpy(&bits, &value, sizeof(bits));
+  biased_e = (int)((bits & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+  if(biased_e) {
+    v.f = (bits & DP_FRACTION_MASK) + DP_HIDDEN_BIT;
+    v.e = biased_e - DP_EXPONENT_BIAS;
+  } else {
+    v.f = bits & DP_FRACTION_MASK;
+    v.e = 1 - DP_EXPONENT_BIAS;
+  }
+
+  /* Boundaries of the rounding interval of v, with the same exponent */
+  m_plus.f = (v.f << 1) + 1;
+  m_plus.e = v.e - 1;
+  m_plus = diyfp_normalize(m_plus);
+  if(v.f == DP_HIDDEN_BIT) {
+    m_minus.f = (v.f << 2) - 1;
+    m_minus.e = v.e - 2;
+  } else {
+    m_minus.f = (v.f << 1) - 1;
+    m_minus.e = v.e - 1;
+  }
+  m_minus.f <<= m_minus.e - m_plus.e;
+  m_minus.e = m_plus.e;
+
+  c_mk = diyfp_cached_power(m_plus.e, K);
+  W = diyfp_mul(diyfp_normalize(v), c_mk);
+  Wp = diyfp_mul(m_plus, c_mk);
+  Wm = diyfp_mul(m_minus, c_mk);
+  Wm.f++;
+  Wp.f--;
+  grisu_digit_gen(W, Wp, Wp.f - Wm.f, buffer, len, K);
+}
+
+/**
+ * Format a double with as few digits as needed to read it back exactly.
+ *
+ * The notation is that of printf(3)'s %g with a precision of DBL_DIG, i.e.,
+ * exponential notation is only used for numbers smaller than 1e-4 or larger
+ * than 1e15, and the output is the same for numbers with up to DBL_DIG
+ * significant digits.  NaN and infinities are written as nan, inf and -inf.
+ *
+ * \param buf Output buffer, with room for at least JSON_DOUBLE_MAXLEN characters; no '\0' is written.
+ * \param d Value to format.
+ * \return The number of characters written.
+ */
+size_t
+json_format_double(char *buf, double d)
+{
+  char digits[18];
+  char *p = buf;
+  int n, K, x;
+
+  if(isnan(d)) {
+    memcpy(buf, "nan", 3);
+    return 3;
+  }
+  if(signbit(d)) {
+    *p++ = '-';
+    d = -d;
+  }
+  if(isinf(d)) {
+    memcpy(p, "inf", 3);
+    return p + 3 - buf;
+  } else if(0. == d) {
+    *p++ = '0';
+    return p - buf;
+  }
+
+  grisu2(d, digits, &n, &K);
+  while(n > 1 && '0' == digits[n - 1]) {
+    n--;
+    K++;
+  }
+  x = n + K - 1; /* Decimal exponent of the first digit */
+
+  if(x < -4 || x >= DBL_DIG) {
+    *p++ = digits[0];
+    if(n > 1) {
+      *p++ = '.';
+      memcpy(p, digits + 1, n - 1);
+      p += n - 1;
+    }
+    *p++ = 'e';
+    if(x < 0) {
+      *p++ = '-';
+      x = -x;
+    } else {
+      *p++ = '+';
+    }
+    if(x >= 100) {
+      *p++ = (char)('0' + x / 100);
+      x %= 100;
+    }
+    *p++ = digit_pairs[x * 2];
+    *p++ = digit_pairs[x * 2 + 1];
+
+  } else if(x < 0) {
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -x - 1);
+    p += -x - 1;
+    memcpy(p, digits, n);
+    p += n;
+
+  } else if(n <= x + 1) {
+    memcpy(p, digits, n);
+    p += n;
+    memset(p, '0', x + 1 - n);
+    p += x + 1 - n;
+
+  } else {
+    memcpy(p, digits, x + 1);
+    p += x + 1;
+    *p++ = '.';
+    memcpy(p, digits + x + 1, n - x - 1);
+    p += n - x - 1;
+  }
+
+  return p - buf;
+}
 
 /**
  * Convert a vector of double values to a JSON string. The output
@@ -62,36 +510,26 @@ resize_buffer(char **str, size_t new_sz)
  * \param v Pointer to an array of double values.
  * \param v_sz Number of elements in v.
  * \param str Non-NULL pointer pointer to the output buffer.
- * \return If the call succeeds then the buffer; otherwise NULL.
+ * \return The length of the output string, or -1 on error.
+ * \see json_format_double
  */
 ssize_t
 vector_double_to_json(const double *v, size_t v_sz, char **str)
 {
   assert(v || 0 == v_sz);
   assert(str);
-  ssize_t str_sz = resize_buffer(str, 4 + (v_sz * (DBL_DIG + 3)) + 1);
-  if(-1 == str_sz) {
+  if(-1 == resize_buffer(str, JSON_VECTOR_MAXLEN(v_sz, JSON_DOUBLE_MAXLEN) + 1)) {
     o_log(O_LOG_ERROR, "%s(): failed to resize buffer for [double] (v_sz=%zu)\n", __func__, v_sz);
     return -1;
   }
 
   size_t i;
-  ssize_t m = 0, n = 0;
-  memset(*str, 0, str_sz);
+  char *p = *str;
   for(i = 0; i < v_sz; i++) {
-    if(i)
-      n = snprintf(*str + m, str_sz - m, ", %.*g ]", DBL_DIG, v[i]);
-    else
-      n = snprintf(*str + m, str_sz - m, "[ %.*g ]", DBL_DIG, v[i]);
-    
-    if(0 <= n && n < str_sz - m)
-      m += n - 2;
-    else {
-      o_log(O_LOG_ERROR, "%s(): failed to convert [double] (v_sz=%zu, n=%zd, str_sz=%zu, m=%zu)\n", __func__, v_sz, n, str_sz, m);
-      return -1;
-    }
+    p = array_next(p, i);
+    p += json_format_double(p, v[i]);
   }
-  return strlen(*str);
+  return array_end(*str, p, v_sz);
 }
 
 
@@ -103,36 +541,25 @@ vector_double_to_json(const double *v, size_t v_sz, char **str)
  * \param v Pointer to an array of int32_t values.
  * \param v_sz Number of elements in v.
  * \param str Non-NULL pointer pointer to the output buffer.
- * \return If the call succeeds then the buffer; otherwise NULL.
+ * \return The length of the output string, or -1 on error.
  */
 ssize_t
 vector_int32_to_json(const int32_t *v, size_t v_sz, char **str)
 {
   assert(v || 0 == v_sz);
   assert(str);
-  ssize_t str_sz = resize_buffer(str, 4 + (v_sz * 13) + 1);
-  if(-1 == str_sz) {
+  if(-1 == resize_buffer(str, JSON_VECTOR_MAXLEN(v_sz, JSON_INT32_MAXLEN) + 1)) {
     o_log(O_LOG_ERROR, "%s(): failed to resize buffer for [int32] (v_sz=%zu)\n", __func__, v_sz);
     return -1;
   }
 
   size_t i;
-  ssize_t m = 0, n = 0;
-  memset(*str, 0, str_sz);
+  char *p = *str;
   for(i = 0; i < v_sz; i++) {
-    if(i)
-      n = snprintf(*str + m, str_sz - m, ", %" PRId32 " ]", v[i]);
-    else
-      n = snprintf(*str + m, str_sz - m, "[ %" PRId32 " ]", v[i]);
-
-    if(0 <= n && n < str_sz - m)
-      m += n - 2;
-    else {
-      o_log(O_LOG_ERROR, "%s(): failed to convert [int32] (v_sz=%zu, n=%zd, str_sz=%zu, m=%zu)\n", __func__, v_sz, n, str_sz, m);
-      return -1;
-    }
+    p = array_next(p, i);
+    p += json_format_int64(p, v[i]);
   }
-  return strlen(*str);
+  return array_end(*str, p, v_sz);
 }
 
 
@@ -144,36 +571,25 @@ vector_int32_to_json(const int32_t *v, size_t v_sz, char **str)
  * \param v Pointer to an array of uint32_t values.
  * \param v_sz Number of elements in v.
  * \param str Non-NULL pointer pointer to the output buffer.
- * \return If the call succeeds then the buffer; otherwise NULL.
+ * \return The length of the output string, or -1 on error.
  */
 ssize_t
 vector_uint32_to_json(const uint32_t *v, size_t v_sz, char **str)
 {
   assert(v || 0 == v_sz);
   assert(str);
-  ssize_t str_sz = resize_buffer(str, 4 + (v_sz * 13) + 1);
-  if(-1 == str_sz) {
+  if(-1 == resize_buffer(str, JSON_VECTOR_MAXLEN(v_sz, JSON_UINT32_MAXLEN) + 1)) {
     o_log(O_LOG_ERROR, "%s(): failed to resize buffer for [uint32] (v_sz=%zu)\n", __func__, v_sz);
     return -1;
   }
 
   size_t i;
-  ssize_t m = 0, n = 0;
-  memset(*str, 0, str_sz);
+  char *p = *str;
   for(i = 0; i < v_sz; i++) {
-    if(i)
-      n = snprintf(*str + m, str_sz - m, ", %" PRIu32 " ]", v[i]);
-    else
-      n = snprintf(*str + m, str_sz - m, "[ %" PRIu32 " ]", v[i]);
-
-    if(0 <= n && n < str_sz - m)
-      m += n - 2;
-    else {
-      o_log(O_LOG_ERROR, "%s(): failed to convert [uint32] (v_sz=%zu, n=%zd, str_sz=%zu, m=%zu)\n", __func__, v_sz, n, str_sz, m);
-      return -1;
-    }
+    p = array_next(p, i);
+    p += json_format_uint64(p, v[i]);
   }
-  return strlen(*str);
+  return array_end(*str, p, v_sz);
 }
 
 
@@ -186,36 +602,25 @@ vector_uint32_to_json(const uint32_t *v, size_t v_sz, char **str)
  * \param v Pointer to an array of int64_t values.
  * \param v_sz Number of elements in v.
  * \param str Non-NULL pointer pointer to the output buffer.
- * \return If the call succeeds then the buffer; otherwise NULL.
+ * \return The length of the output string, or -1 on error.
  */
 ssize_t
 vector_int64_to_json(const int64_t *v, size_t v_sz, char **str)
 {
   assert(v || 0 == v_sz);
   assert(str);
-  ssize_t str_sz = resize_buffer(str, 4 + (v_sz * 22) + 1);
-  if(-1 == str_sz) {
+  if(-1 == resize_buffer(str, JSON_VECTOR_MAXLEN(v_sz, JSON_INT64_MAXLEN) + 1)) {
     o_log(O_LOG_ERROR, "%s(): failed to resize buffer for [int64] (v_sz=%zu)\n", __func__, v_sz);
     return -1;
   }
 
   size_t i;
-  ssize_t m = 0, n = 0;
-  memset(*str, 0, str_sz);
+  char *p = *str;
   for(i = 0; i < v_sz; i++) {
-    if(i)
-      n = snprintf(*str + m, str_sz - m, ", %" PRId64 " ]", v[i]);
-    else
-      n = snprintf(*str + m, str_sz - m, "[ %" PRId64 " ]", v[i]);
-
-    if(0 <= n && n < str_sz - m)
-      m += n - 2;
-    else {
-      o_log(O_LOG_ERROR, "%s(): failed to convert [int64] (v_sz=%zu, n=%zd, str_sz=%zu, m=%zu)\n", __func__, v_sz, n, str_sz, m);
-      return -1;
-    }
+    p = array_next(p, i);
+    p += json_format_int64(p, v[i]);
   }
-  return strlen(*str);
+  return array_end(*str, p, v_sz);
 }
 
 
@@ -228,77 +633,61 @@ vector_int64_to_json(const int64_t *v, size_t v_sz, char **str)
  * \param v Pointer to an array of uint64_t values.
  * \param v_sz Number of elements in v.
  * \param str Non-NULL pointer pointer to the output buffer.
- * \return If the call succeeds then the buffer; otherwise NULL.
+ * \return The length of the output string, or -1 on error.
  */
 ssize_t
 vector_uint64_to_json(const uint64_t *v, size_t v_sz, char **str)
 {
   assert(v || 0 == v_sz);
   assert(str);
-  ssize_t str_sz = resize_buffer(str, 4 + (v_sz * 22) + 1);
-  if(-1 == str_sz) {
+  if(-1 == resize_buffer(str, JSON_VECTOR_MAXLEN(v_sz, JSON_UINT64_MAXLEN) + 1)) {
     o_log(O_LOG_ERROR, "%s(): failed to resize buffer for [uint64] (v_sz=%zu)\n", __func__, v_sz);
     return -1;
   }
 
   size_t i;
-  ssize_t m = 0, n = 0;
-  memset(*str, 0, str_sz);
+  char *p = *str;
   for(i = 0; i < v_sz; i++) {
-    if(i)
-      n = snprintf(*str + m, str_sz - m, ", %" PRIu64 " ]", v[i]);
-    else
-      n = snprintf(*str + m, str_sz - m, "[ %" PRIu64 " ]", v[i]);
-
-    if(0 <= n && n < str_sz - m)
-      m += n - 2;
-    else {
-      o_log(O_LOG_ERROR, "%s(): failed to convert [uint64] (v_sz=%zu, n=%zd, str_sz=%zu, m=%zu)\n", __func__, v_sz, n, str_sz, m);
-      return -1;
-    }
+    p = array_next(p, i);
+    p += json_format_uint64(p, v[i]);
   }
-  return strlen(*str);
+  return array_end(*str, p, v_sz);
 }
 
 
 /**
- * Convert a vector of uint64_t values to a JSON string. The output
+ * Convert a vector of bool values to a JSON string. The output
  * string is written to an output buffer which is oml_realloc()ed if too
  * small to accommodate the output.
  *
- * \param v Pointer to an array of uint64_t values.
+ * \param v Pointer to an array of bool values.
  * \param v_sz Number of elements in v.
  * \param str Non-NULL pointer pointer to the output buffer.
- * \return If the call succeeds then the buffer; otherwise NULL.
+ * \return The length of the output string, or -1 on error.
  */
 ssize_t
 vector_bool_to_json(const bool *v, size_t v_sz, char **str)
 {
   assert(v || 0 == v_sz);
   assert(str);
-  ssize_t str_sz = resize_buffer(str, 4 + (v_sz * 22) + 1);
-  if(-1 == str_sz) {
+  if(-1 == resize_buffer(str, JSON_VECTOR_MAXLEN(v_sz, JSON_BOOL_MAXLEN) + 1)) {
     o_log(O_LOG_ERROR, "%s(): failed to resize buffer for [bool] (v_sz=%zu)\n", __func__, v_sz);
     return -1;
   }
 
   size_t i;
-  ssize_t m = 0, n = 0;
-  memset(*str, 0, str_sz);
+  char *p = *str;
   for(i = 0; i < v_sz; i++) {
-    if(i)
-      n = snprintf(*str + m, str_sz - m, ", %s ]", (v[i] ? "true" : "false"));
-    else
-      n = snprintf(*str + m, str_sz - m, "[ %s ]", (v[i] ? "true" : "false"));
-
-    if(0 <= n && n < str_sz - m)
-      m += n - 2;
-    else {
-      o_log(O_LOG_ERROR, "%s(): failed to convert [bool] (v_sz=%zu, n=%zd, str_sz=%zu, m=%zu)\n", __func__, v_sz, n, str_sz, m);
-      return -1;
+    p = array_next(p, i);
+    if(v[i]) {
+      memcpy(p, "true", 4);
+      p += 4;
+    } else {
+      memcpy(p, "false", 5);
+      p += 5;
     }
   }
-  return strlen(*str);
+  return array_end(*str, p, v_sz);
 }
 
 
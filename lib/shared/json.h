@@ -15,6 +15,31 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+/** Maximal length of a double formatted by json_format_double() */
+#define JSON_DOUBLE_MAXLEN 24
+/** Maximal length of an int32_t formatted by json_format_int64() */
+#define JSON_INT32_MAXLEN 11
+/** Maximal length of a uint32_t formatted by json_format_uint64() */
+#define JSON_UINT32_MAXLEN 10
+/** Maximal length of an int64_t formatted by json_format_int64() */
+#define JSON_INT64_MAXLEN 20
+/** Maximal length of a uint64_t formatted by json_format_uint64() */
+#define JSON_UINT64_MAXLEN 20
+/** Maximal length of a bool in JSON */
+#define JSON_BOOL_MAXLEN 5
+
+/** Upper bound on the length of a JSON array of n elements of at most elt_maxlen characters, excluding the '\0' */
+#define JSON_VECTOR_MAXLEN(n, elt_maxlen) (4 + (n) * ((elt_maxlen) + 2))
+
+extern size_t
+json_format_double(char *buf, double d);
+
+extern size_t
+json_format_int64(char *buf, int64_t i);
+
+extern size_t
+json_format_uint64(char *buf, uint64_t u);
+
 extern ssize_t
 vector_double_to_json(const double *v, size_t v_sz, char **str);
 
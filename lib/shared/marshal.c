@@ -177,6 +177,7 @@
 #include "oml_util.h"
 #include "oml_value.h"
 #include "marshal.h"
+#include "scan.h"
 
 #define BIG_S 15
 #define BIG_L 30
@@ -362,18 +363,16 @@ static const OmlValueT vector_type_map[] = {
  * \param buf buffer to search for SYNC_BYTEs
  * \param len length of buf
  * \return a pointer to the first of two subsequent SYNC_BYTEs, or NULL if not found
+ * \see scan_pair
  * */
 uint8_t* find_sync (const uint8_t *buf, int len)
 {
-  int i;
+  if (len < 2)
+    return NULL;
 
   /* We cannot use find_matching from oml_util here as buf is not a
    * nil-terminated string, and some bytes within might be nil */
-  for (i = 1; i < len; i++)
-      if (buf[i] == SYNC_BYTE && buf[i-1] == SYNC_BYTE)
-        return (uint8_t*)&buf[i-1];
-
-  return NULL;
+  return (uint8_t*)scan_pair (buf, len, SYNC_BYTE);
 }
 
 /** Prepare a short marshalling header into an MBuffer.
@@ -1052,7 +1051,33 @@ unmarshal_values(
   return value_count;
 }
 
+/** Make sure the vector storage of an OmlValueU can hold a number of bytes.
+ *
+ * The current storage is reused if it is large enough.
+ *
+ * \param v pointer to the OmlValueU to manipulate
+ * \param bytes size needed
+ * \return a pointer to the storage, or NULL on error
+ * \see unmarshal_value
+ */
+static void*
+unmarshal_vector_storage(OmlValueU *v, size_t bytes)
+{
+  if (!omlc_get_vector_ptr(*v) || omlc_get_vector_size(*v) < bytes) {
+    omlc_reset_vector(*v);
+    omlc_set_vector_ptr(*v, oml_malloc(bytes ? bytes : 1));
+    if (!omlc_get_vector_ptr(*v)) {
+      return NULL;
+    }
+    omlc_set_vector_size(*v, oml_malloc_usable_size(omlc_get_vector_ptr(*v)));
+  }
+  return omlc_get_vector_ptr(*v);
+}
+
 /** Unmarshals the next content of an MBuffer into a OmlValue
+ *
+ * Any storage already allocated in value for a string, blob or vector is
+ * reused if large enough.
  *
  * \param mbuf MBuffer to read from
  * \param value pointer to OmlValue to unmarshall the read data into
@@ -1216,17 +1241,16 @@ unmarshal_value(MBuffer *mbuf, OmlValue *value)
     case INT32_T:
     case UINT32_T: {
       size_t bytes = nof_elts * sizeof(uint32_t);
-      uint32_t *elts = oml_calloc(nof_elts, sizeof(uint32_t));
-      if(mbuf_read(mbuf, (uint8_t*)(elts), nof_elts * sizeof(uint32_t)) == -1) {
+      uint32_t *elts;
+      oml_value_set_type(value, oml_type);
+      if(!(elts = unmarshal_vector_storage(v, bytes)) ||
+         mbuf_read(mbuf, (uint8_t*)(elts), nof_elts * sizeof(uint32_t)) == -1) {
         logerror("%s(): failed to unmarshall OML_VECTOR_(U)INT32_VALUE\n", __func__);
         return 0;
       }
       for(i = 0; i < nof_elts; i++)
         elts[i] = ntohl(elts[i]);
-      oml_value_set_type(value, oml_type);
-      omlc_set_vector_ptr(*v, elts);
       omlc_set_vector_length(*v, bytes);
-      omlc_set_vector_size(*v, bytes);
       omlc_set_vector_nof_elts(*v, nof_elts);
       omlc_set_vector_elt_size(*v, sizeof(uint32_t));
       break;
@@ -1235,17 +1259,16 @@ unmarshal_value(MBuffer *mbuf, OmlValue *value)
     case UINT64_T:
     case DOUBLE64_T: {
       size_t bytes = nof_elts * sizeof(uint64_t);
-      uint64_t *elts = oml_calloc(nof_elts, sizeof(uint64_t));
-      if(mbuf_read(mbuf, (uint8_t*)(elts), nof_elts * sizeof(uint64_t)) == -1) {
+      uint64_t *elts;
+      oml_value_set_type(value, oml_type);
+      if(!(elts = unmarshal_vector_storage(v, bytes)) ||
+         mbuf_read(mbuf, (uint8_t*)(elts), nof_elts * sizeof(uint64_t)) == -1) {
         logerror("%s(): failed to unmarshall OML_VECTOR_(U)INT64_VALUE\n", __func__);
         return 0;
       }
       for(i = 0; i < nof_elts; i++)
         elts[i] = ntohll(elts[i]);
-      oml_value_set_type(value, oml_type);
-      omlc_set_vector_ptr(*v, elts);
       omlc_set_vector_length(*v, bytes);
-      omlc_set_vector_size(*v, bytes);
       omlc_set_vector_nof_elts(*v, nof_elts);
       omlc_set_vector_elt_size(*v, sizeof(uint64_t));
       break;
@@ -1253,17 +1276,16 @@ unmarshal_value(MBuffer *mbuf, OmlValue *value)
     case BOOL_T: {
       uint8_t y[nof_elts];
       size_t bytes = nof_elts * sizeof(bool);
-      bool *elts = oml_calloc(nof_elts, sizeof(bool));
-      if(mbuf_read(mbuf, y, nof_elts) == -1) {
+      bool *elts;
+      oml_value_set_type(value, oml_type);
+      if(!(elts = unmarshal_vector_storage(v, bytes)) ||
+         mbuf_read(mbuf, y, nof_elts) == -1) {
         logerror("%s(): failed to unmarshall OML_VECTOR_BOOL_VALUE\n", __func__);
         return 0;
       }
       for(i = 0; i < nof_elts; i++)
         elts[i] = ((BOOL_TRUE_T == y[i]) ? true : false);
-      oml_value_set_type(value, oml_type);
-      omlc_set_vector_ptr(*v, elts);
       omlc_set_vector_length(*v, bytes);
-      omlc_set_vector_size(*v, bytes);
       omlc_set_vector_nof_elts(*v, nof_elts);
       omlc_set_vector_elt_size(*v, sizeof(bool));
       break;
@@ -17,6 +17,7 @@
 
 #include "mem.h"
 #include "mbuf.h"
+#include "scan.h"
 
 #define DEF_BUF_SIZE 512
 #define DEF_MIN_BUF_RESIZE (size_t)(0.1 * DEF_BUF_SIZE)
@@ -145,16 +146,14 @@ mbuf_rd_remaining (MBuffer* mbuf)
 }
 
 /** Get the remaining amount of data to write in MBuffer
- *
- * XXX: Shall we use wr_remaining directly?
  *
  * \param mbuf MBuffer to manipulate
- * \return the number of unread bytes in the buffer
+ * \return the number of bytes which can be written without resizing the buffer
  */
 size_t
 mbuf_wr_remaining (MBuffer* mbuf)
 {
-  return mbuf->wrptr - mbuf->rdptr;
+  return mbuf->wr_remaining;
 }
 
 
@@ -363,6 +362,48 @@ mbuf_check_resize (MBuffer* mbuf, size_t bytes)
   }
 }
 
+/** Make room for more data at the end of an MBuffer being parsed.
+ *
+ * Unlike mbuf_check_resize, this also reclaims the space taken by messages
+ * which have already been consumed, by moving the current message to the
+ * start of the buffer (see mbuf_repack_message). This is only done when the
+ * data to move is no larger than the space reclaimed; otherwise, the storage
+ * is doubled instead. Either way, each byte received is only copied a bounded
+ * number of times on average, however small the pieces it arrives in.
+ *
+ * This is meant to be used instead of repacking the buffer after each read,
+ * and only works for MBuffers where nothing refers to data before the message
+ * pointer.
+ *
+ * \param mbuf MBuffer to manipulate
+ * \param bytes amount of data which need to be written into the MBuffer
+ * \return 0 on success, or -1 on error
+ * \see mbuf_check_resize, mbuf_repack_message
+ */
+int
+mbuf_make_room (MBuffer* mbuf, size_t bytes)
+{
+  size_t consumed, pending, new_length;
+
+  if (mbuf == NULL) return -1;
+
+  if (mbuf->wr_remaining >= bytes)
+    return 0;
+
+  consumed = mbuf->msgptr - mbuf->base;
+  pending = mbuf->wrptr - mbuf->msgptr;
+  if (consumed > 0 && consumed >= pending) {
+    mbuf_repack_message (mbuf);
+    if (mbuf->wr_remaining >= bytes)
+      return 0;
+  }
+
+  new_length = 2 * mbuf->length;
+  if (new_length < mbuf->fill + bytes)
+    new_length = mbuf->fill + bytes;
+  return mbuf_resize (mbuf, new_length);
+}
+
 /** Write data into an MBuffer.
  *
  * Write len bytes from the raw buffer pointed to by buf into the MBuffer.  If the
@@ -399,6 +440,37 @@ mbuf_write (MBuffer* mbuf, const uint8_t* buf, size_t len)
   return 0;
 }
 
+/** Account for data written directly into an MBuffer.
+ *
+ * This allows to, e.g., recv(2) data straight at mbuf_wrptr(), after having
+ * made enough space with mbuf_check_resize(), rather than copying it from
+ * another buffer with mbuf_write(). The write pointer is advanced by len
+ * bytes, which must not exceed mbuf_wr_remaining().
+ *
+ * \param mbuf MBuffer which has been written into
+ * \param len amount of data written at the write pointer
+ * \return 0 on success, -1 on failure.
+ * \see mbuf_write, mbuf_wrptr, mbuf_check_resize
+ */
+int
+mbuf_write_advance (MBuffer* mbuf, size_t len)
+{
+  if (mbuf == NULL) return -1;
+
+  mbuf_check_invariant (mbuf);
+
+  if (mbuf->wr_remaining < len) return -1;
+
+  mbuf->wrptr += len;
+  mbuf->fill += len;
+  mbuf->wr_remaining -= len;
+  mbuf->rd_remaining += len;
+
+  mbuf_check_invariant (mbuf);
+
+  return 0;
+}
+
 /**  Append the printed string described by format to the MBuffer.
  *
  * Write the string described by a format string and arguments to the MBuffer,
@@ -431,8 +503,9 @@ mbuf_print(MBuffer* mbuf, const char* format, ...)
     va_start(arglist, format);
     len = vsnprintf((char*)mbuf->wrptr, mbuf->wr_remaining, format, arglist);
     va_end(arglist);
-    if (! (success = (len <= (int)mbuf->wr_remaining))) {
-      if (mbuf_check_resize(mbuf, len) == -1)
+    /* vsnprintf(3) needs room for the terminating '\0' too */
+    if (! (success = (len < (int)mbuf->wr_remaining))) {
+      if (mbuf_check_resize(mbuf, len + 1) == -1)
     return -1;
     }
   } while (! success);
@@ -535,6 +608,7 @@ mbuf_read_byte (MBuffer* mbuf)
  * \param mbuf MBuffer to search
  * \param c byte to search for
  * \return offset from the read pointer to the first matching byte, or -1 if not found
+ * \see scan_byte
  */
 size_t
 mbuf_find (MBuffer* mbuf, uint8_t c)
@@ -543,12 +617,10 @@ mbuf_find (MBuffer* mbuf, uint8_t c)
 
   mbuf_check_invariant (mbuf);
 
-  uint8_t* p = mbuf->rdptr;
-
-  while (p < mbuf->wrptr && *p != c) p++;
+  const uint8_t* p = scan_byte (mbuf->rdptr, mbuf->rd_remaining, c);
 
   int result = -1;
-  if (p < mbuf->wrptr && *p == c)
+  if (p != NULL)
     result = p - mbuf->rdptr;
 
   mbuf_check_invariant (mbuf);
@@ -81,10 +81,12 @@ size_t mbuf_message_index (MBuffer* mbuf);
 
 int mbuf_resize (MBuffer* mbuf, size_t new_length);
 int mbuf_check_resize (MBuffer* mbuf, size_t bytes);
+int mbuf_make_room (MBuffer* mbuf, size_t bytes);
 
 int mbuf_begin_write (MBuffer* mbuf);
 int mbuf_reset_write (MBuffer* mbuf);
 int mbuf_write (MBuffer* mbuf, const uint8_t* buf, size_t len);
+int mbuf_write_advance (MBuffer* mbuf, size_t len);
 int mbuf_print(MBuffer* mbuf, const char* format, ...);
 
 int mbuf_begin_read (MBuffer* mbuf);
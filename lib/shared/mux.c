@@ -0,0 +1,103 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file mux.c
+ * \brief Encode and decode frames of multiplexed connections.
+ * \see mux.h
+ */
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "mbuf.h"
+#include "mux.h"
+
+/** Write a frame header.
+ *
+ * \param buf buffer to write into, with room for at least MUX_HEADER_SIZE bytes
+ * \param type type of the frame
+ * \param channel channel the frame belongs to
+ * \param length length of the payload which will follow
+ * \return the number of bytes written, MUX_HEADER_SIZE
+ */
+size_t
+mux_frame_header_write (uint8_t *buf, enum MuxFrameType type, uint32_t channel, uint32_t length)
+{
+  uint32_t nchannel = htonl (channel);
+  uint32_t nlength = htonl (length);
+
+  buf[0] = (uint8_t)type;
+  memcpy (buf + 1, &nchannel, sizeof (nchannel));
+  memcpy (buf + 5, &nlength, sizeof (nlength));
+
+  return MUX_HEADER_SIZE;
+}
+
+/** Read a frame header.
+ *
+ * \param buf buffer to read from
+ * \param len amount of data available in buf
+ * \param[out] frame frame description to fill
+ * \return MUX_HEADER_SIZE on success, 0 if more data is needed, or -1 if the header is invalid
+ */
+int
+mux_frame_header_read (const uint8_t *buf, size_t len, struct mux_frame *frame)
+{
+  uint32_t nchannel, nlength;
+
+  if (len < MUX_HEADER_SIZE) {
+    return 0;
+  }
+
+  memcpy (&nchannel, buf + 1, sizeof (nchannel));
+  memcpy (&nlength, buf + 5, sizeof (nlength));
+  frame->type = (enum MuxFrameType)buf[0];
+  frame->channel = ntohl (nchannel);
+  frame->length = ntohl (nlength);
+
+  if (frame->type < MUX_OPEN || frame->type > MUX_CLOSE ||
+      frame->length > MUX_MAX_PAYLOAD) {
+    return -1;
+  }
+
+  return MUX_HEADER_SIZE;
+}
+
+/** Append a complete frame to an MBuffer.
+ *
+ * \param mbuf MBuffer to write into
+ * \param type type of the frame
+ * \param channel channel the frame belongs to
+ * \param payload data to send in the frame, can be NULL if length is 0
+ * \param length length of the payload
+ * \return 0 on success, -1 otherwise
+ */
+int
+mux_frame_write (MBuffer *mbuf, enum MuxFrameType type, uint32_t channel, const void *payload, uint32_t length)
+{
+  uint8_t header[MUX_HEADER_SIZE];
+
+  mux_frame_header_write (header, type, channel, length);
+  if (mbuf_write (mbuf, header, MUX_HEADER_SIZE) == -1) {
+    return -1;
+  }
+  if (length > 0 && mbuf_write (mbuf, payload, length) == -1) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file mux.h
+ * \brief Framing for connections multiplexing several clients.
+ *
+ * A multiplexed connection starts with a single "mux: VERSION" header line.
+ * It is then only made of frames, each with a MUX_HEADER_SIZE-byte header
+ * (type, channel and payload length, in network byte order) followed by
+ * the payload.
+ *
+ * A MUX_OPEN frame starts a new logical client on a channel, its payload
+ * identifying the original sender; MUX_DATA frames then carry that client's
+ * data stream, as it would have been sent on its own connection (headers,
+ * then measurements); a MUX_CLOSE frame ends it.
+ */
+#ifndef MUX_H__
+#define MUX_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "mbuf.h"
+
+/** Header key starting a multiplexed connection */
+#define MUX_HEADER_KEY "mux"
+/** Version of the multiplexing protocol */
+#define MUX_PROTOCOL_VERSION 1
+
+/** Size of a frame header on the wire */
+#define MUX_HEADER_SIZE 9
+/** Maximal payload length of a frame */
+#define MUX_MAX_PAYLOAD (16 * 1024 * 1024)
+
+enum MuxFrameType {
+  MUX_OPEN = 1,
+  MUX_DATA = 2,
+  MUX_CLOSE = 3,
+};
+
+struct mux_frame {
+  enum MuxFrameType type;
+  uint32_t channel;
+  uint32_t length;
+};
+
+size_t mux_frame_header_write (uint8_t *buf, enum MuxFrameType type, uint32_t channel, uint32_t length);
+int mux_frame_header_read (const uint8_t *buf, size_t len, struct mux_frame *frame);
+int mux_frame_write (MBuffer *mbuf, enum MuxFrameType type, uint32_t channel, const void *payload, uint32_t length);
+
+#endif /* MUX_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
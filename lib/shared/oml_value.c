@@ -191,10 +191,11 @@ oml_value_copy(OmlValueU *value, OmlValueT type, OmlValue *to)
 /** Reset one OmlValue, cleaning any allocated memory.
  *
  * The type of the value is also reset (to 0, i.e., OML_DOUBLE_VALUE).
+ * To reuse the storage for a subsequent value, use oml_value_clear instead.
  *
  * \param v pointer to OmlValue to reset
  * \return 0 if successful, -1 otherwise
- * \see oml_value_init, oml_value_array_reset, memset(3)
+ * \see oml_value_init, oml_value_array_reset, oml_value_clear, memset(3)
  */
 int
 oml_value_reset(OmlValue* v)
@@ -236,6 +237,72 @@ oml_value_reset(OmlValue* v)
   return 0;
 }
 
+/** Clear one OmlValue, keeping its type and any allocated storage.
+ *
+ * Unlike oml_value_reset, which releases the storage, this only empties
+ * strings, blobs and vectors, so the next value of the same type can be
+ * copied into the same buffer if it fits. This is meant for OmlValues
+ * which are filled over and over, e.g., for each row received from a
+ * client; they still need to be oml_value_reset() when no longer used.
+ *
+ * Strings not owned by the OmlValue (e.g., constant) are dropped.
+ *
+ * \param v pointer to OmlValue to clear
+ * \return 0 if successful, -1 otherwise
+ * \see oml_value_reset, oml_value_array_clear
+ */
+int
+oml_value_clear(OmlValue* v)
+{
+  OmlValueU *u = oml_value_get_value(v);
+
+  switch(v->type) {
+  case OML_STRING_VALUE:
+    if (omlc_get_string_is_const(*u) || omlc_get_string_size(*u) == 0) {
+      omlc_reset_string(*u);
+    } else {
+      omlc_get_string_ptr(*u)[0] = '\0';
+      omlc_set_string_length(*u, 0);
+    }
+    break;
+
+  case OML_BLOB_VALUE:
+    omlc_set_blob_length(*u, 0);
+    break;
+
+  case OML_VECTOR_DOUBLE_VALUE:
+  case OML_VECTOR_INT32_VALUE:
+  case OML_VECTOR_UINT32_VALUE:
+  case OML_VECTOR_INT64_VALUE:
+  case OML_VECTOR_UINT64_VALUE:
+  case OML_VECTOR_BOOL_VALUE:
+    omlc_set_vector_length(*u, 0);
+    omlc_set_vector_nof_elts(*u, 0);
+    break;
+
+  default:
+    /* No storage to keep */
+    memset(u, 0, sizeof(OmlValueU));
+    break;
+  }
+  return 0;
+}
+
+/** Clear array of OmlValue, keeping their types and allocated memory.
+ *
+ * \param v pointer to the first OmlValue of the array to manipulate
+ * \param n length of the array
+ * \see oml_value_clear, oml_value_array_reset
+ */
+void
+oml_value_array_clear(OmlValue* v, unsigned int n)
+{
+ int i;
+ for (i=0; i<n; i++) {
+   oml_value_clear(&v[i]);
+ }
+}
+
 /** Reset array of OmlValue, cleaning any allocated memory.
  *
  * \param v pointer to the first OmlValue of the array to manipulate
@@ -69,6 +69,8 @@ void oml_value_set_type(OmlValue* v, OmlValueT type);
 
 int oml_value_reset(OmlValue* v);
 void oml_value_array_reset(OmlValue* v, unsigned int n);
+int oml_value_clear(OmlValue* v);
+void oml_value_array_clear(OmlValue* v, unsigned int n);
 
 int oml_value_duplicate(OmlValue* dst, OmlValue* src);
 
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file scan.c
+ * \brief Find delimiters in received data, a vector of bytes at a time.
+ *
+ * The parsers spend most of their time looking for the next newline or tab
+ * (text protocol) or pair of SYNC_BYTEs (binary protocol). On x86, these
+ * searches are done 16 (SSE2) or 32 (AVX2) bytes at a time; the best variant
+ * supported by the CPU is chosen the first time one is needed. A plain C
+ * variant is used everywhere else, and for the last few bytes of a buffer.
+ */
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SCAN_X86 1
+# include <immintrin.h>
+#endif
+
+/** A set of scanning functions */
+struct scan_kernels {
+  const char *name;
+  const uint8_t* (*byte) (const uint8_t *buf, size_t len, uint8_t c);
+  const uint8_t* (*pair) (const uint8_t *buf, size_t len, uint8_t c);
+  int (*supported) (void);
+};
+
+static const uint8_t*
+scan_byte_scalar (const uint8_t *buf, size_t len, uint8_t c)
+{
+  const uint8_t *end = buf + len;
+
+  for (; buf < end; buf++)
+    if (*buf == c)
+      return buf;
+
+  return NULL;
+}
+
+static const uint8_t*
+scan_pair_scalar (const uint8_t *buf, size_t len, uint8_t c)
+{
+  size_t i;
+
+  for (i = 1; i < len; i++)
+    if (buf[i] == c && buf[i-1] == c)
+      return &buf[i-1];
+
+  return NULL;
+}
+
+static int
+scan_supported_scalar (void)
+{
+  return 1;
+}
+
+#ifdef SCAN_X86
+/* Each vector loop below stops where a full load would overrun the buffer,
+ * and leaves the rest to the scalar variant */
+
+__attribute__((target("sse2"))) static const uint8_t*
+scan_byte_sse2 (const uint8_t *buf, size_t len, uint8_t c)
+{
+  __m128i needle = _mm_set1_epi8 ((char)c);
+  size_t i;
+  int mask;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i*)(buf + i)), needle));
+    if (mask)
+      return buf + i + __builtin_ctz (mask);
+  }
+
+  return scan_byte_scalar (buf + i, len - i, c);
+}
+
+__attribute__((target("sse2"))) static const uint8_t*
+scan_pair_sse2 (const uint8_t *buf, size_t len, uint8_t c)
+{
+  __m128i needle = _mm_set1_epi8 ((char)c);
+  __m128i first, second;
+  size_t i;
+  int mask;
+
+  /* Compare each byte, and the one following it */
+  for (i = 0; i + 17 <= len; i += 16) {
+    first = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i*)(buf + i)), needle);
+    second = _mm_cmpeq_epi8 (_mm_loadu_si128 ((const __m128i*)(buf + i + 1)), needle);
+    mask = _mm_movemask_epi8 (_mm_and_si128 (first, second));
+    if (mask)
+      return buf + i + __builtin_ctz (mask);
+  }
+
+  return scan_pair_scalar (buf + i, len - i, c);
+}
+
+static int
+scan_supported_sse2 (void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("sse2");
+}
+
+__attribute__((target("avx2"))) static const uint8_t*
+scan_byte_avx2 (const uint8_t *buf, size_t len, uint8_t c)
+{
+  __m256i needle = _mm256_set1_epi8 ((char)c);
+  size_t i;
+  unsigned int mask;
+
+  for (i = 0; i + 32 <= len; i += 32) {
+    mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i*)(buf + i)), needle));
+    if (mask)
+      return buf + i + __builtin_ctz (mask);
+  }
+
+  return scan_byte_scalar (buf + i, len - i, c);
+}
+
+__attribute__((target("avx2"))) static const uint8_t*
+scan_pair_avx2 (const uint8_t *buf, size_t len, uint8_t c)
+{
+  __m256i needle = _mm256_set1_epi8 ((char)c);
+  __m256i first, second;
+  size_t i;
+  unsigned int mask;
+
+  for (i = 0; i + 33 <= len; i += 32) {
+    first = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i*)(buf + i)), needle);
+    second = _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i*)(buf + i + 1)), needle);
+    mask = _mm256_movemask_epi8 (_mm256_and_si256 (first, second));
+    if (mask)
+      return buf + i + __builtin_ctz (mask);
+  }
+
+  return scan_pair_scalar (buf + i, len - i, c);
+}
+
+static int
+scan_supported_avx2 (void)
+{
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("avx2");
+}
+#endif /* SCAN_X86 */
+
+/** Available kernels, from least to most preferred */
+static const struct scan_kernels kernels[] = {
+  { "scalar", scan_byte_scalar, scan_pair_scalar, scan_supported_scalar },
+#ifdef SCAN_X86
+  { "sse2", scan_byte_sse2, scan_pair_sse2, scan_supported_sse2 },
+  { "avx2", scan_byte_avx2, scan_pair_avx2, scan_supported_avx2 },
+#endif
+};
+
+/** Kernels in use; NULL until scan_select() is first called */
+static const struct scan_kernels *active;
+
+/** Select the scanning kernels to use.
+ *
+ * This is done automatically, with a NULL name, the first time a scan is
+ * needed. Naming a specific variant is mostly useful to compare them.
+ *
+ * \param name name of the variant to use ("scalar", "sse2", "avx2"), or NULL
+ * for the fastest one the CPU supports
+ * \return 0 on success, or -1 if the named variant is unknown or unsupported
+ * \see scan_name
+ */
+int
+scan_select (const char *name)
+{
+  int i;
+
+  for (i = sizeof (kernels) / sizeof (kernels[0]) - 1; i >= 0; i--) {
+    if (name && strcmp (name, kernels[i].name))
+      continue;
+    if (kernels[i].supported ()) {
+      active = &kernels[i];
+      return 0;
+    }
+    if (name)
+      break;
+  }
+
+  return -1;
+}
+
+/** Get the name of the scanning kernels in use.
+ *
+ * \return the name of the variant, as accepted by scan_select
+ */
+const char*
+scan_name (void)
+{
+  if (!active)
+    scan_select (NULL);
+  return active->name;
+}
+
+/** Find the first occurrence of a byte in a buffer.
+ *
+ * Like memchr(3), but the search is done with the selected kernels.
+ *
+ * \param buf buffer to search
+ * \param len length of buf
+ * \param c byte to search for
+ * \return a pointer to the first c in buf, or NULL if not found
+ * \see scan_select
+ */
+const uint8_t*
+scan_byte (const uint8_t *buf, size_t len, uint8_t c)
+{
+  if (!active)
+    scan_select (NULL);
+  return active->byte (buf, len, c);
+}
+
+/** Find the first occurrence of two identical bytes back to back in a buffer.
+ *
+ * \param buf buffer to search
+ * \param len length of buf
+ * \param c byte to search for
+ * \return a pointer to the first of two subsequent c in buf, or NULL if not found
+ * \see scan_select, find_sync
+ */
+const uint8_t*
+scan_pair (const uint8_t *buf, size_t len, uint8_t c)
+{
+  if (!active)
+    scan_select (NULL);
+  return active->pair (buf, len, c);
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,35 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file scan.h
+ * \brief Interface for the byte-scanning kernels used by the parsers.
+ * \see scan.c
+ */
+#ifndef SCAN_H__
+#define SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+const uint8_t* scan_byte (const uint8_t *buf, size_t len, uint8_t c);
+const uint8_t* scan_pair (const uint8_t *buf, size_t len, uint8_t c);
+
+int scan_select (const char *name);
+const char* scan_name (void);
+
+#endif /* SCAN_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
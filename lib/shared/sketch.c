@@ -0,0 +1,545 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file sketch.c
+ * \brief Mergeable, bounded-memory histograms for estimating quantiles.
+ *
+ * A Sketch counts values in log-linear buckets, as HDR histograms do: each
+ * power of two is split into 2^precision buckets of equal width.  As the
+ * bits of a positive IEEE 754 double sort in the same order as its value,
+ * the index of the bucket of a value is simply the top 11+precision bits of
+ * its absolute value.  Any value in a bucket is then within a relative
+ * 2^-(precision+1) of the middle of the bucket, which is what
+ * sketch_quantile() returns; sketch_precision() gives the precision needed
+ * for a number of significant decimal digits.
+ *
+ * Positive and negative values are counted in separate SketchStores, each a
+ * contiguous window of at most max_buckets buckets.  When a new value would
+ * extend a window further, the buckets of the smallest absolute values are
+ * folded into the lowest remaining one, so that the memory used is bounded,
+ * and large quantiles (e.g., of latencies) stay accurate.  Sketches of the
+ * same precision are merged by adding up their buckets.
+ *
+ * A Sketch does not allocate memory: its storage, of
+ * SKETCH_STORAGE_SIZE(max_buckets) bytes, is given to sketch_init(), and can
+ * be allocated along with the Sketch itself.
+ *
+ * The serialised form produced by sketch_encode(), e.g., to transport a
+ * Sketch in a blob, is, with all integers as unsigned LEB128 varints, and
+ * doubles as 8 little-endian bytes:
+ *
+ *   version (1 byte, 1) | precision (1 byte) | count | zero_count | min | max |
+ *   positive store | negative store
+ *
+ * where each store is its number of buckets, followed, if non-zero, by the
+ * index of its first bucket and the count of each of its buckets.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "sketch.h"
+
+/** Version of the serialised format \see sketch_encode */
+#define SKETCH_FORMAT_VERSION 1
+/** Maximal precision of a Sketch, for bucket indices to fit in an int */
+#define SKETCH_MAX_PRECISION 16
+
+/** Get the precision needed for a number of significant decimal digits.
+ *
+ * \param digits number of significant decimal digits, between 1 and SKETCH_MAX_DIGITS
+ * \return the precision, for sketch_init, or -1 if digits is out of range
+ * \see sketch_init
+ */
+int
+sketch_precision (int digits)
+{
+  /* Smallest p such that 2^-(p+1) <= 10^-digits */
+  static const int precision[SKETCH_MAX_DIGITS + 1] = { 0, 3, 6, 9, 13 };
+
+  if (digits < 1 || digits > SKETCH_MAX_DIGITS) {
+    return -1;
+  }
+  return precision[digits];
+}
+
+/** Initialise an empty Sketch.
+ *
+ * \param s Sketch to initialise
+ * \param precision number of bits of the mantissa indexing the buckets, e.g., from sketch_precision()
+ * \param max_buckets maximal number of buckets for each sign
+ * \param storage memory for the buckets, of SKETCH_STORAGE_SIZE(max_buckets) bytes, to be kept until s is not used anymore
+ * \return 0 on success, -1 on invalid parameters
+ * \see sketch_precision, sketch_reset
+ */
+int
+sketch_init (Sketch *s, int precision, int max_buckets, uint64_t *storage)
+{
+  if (precision < 0 || precision > SKETCH_MAX_PRECISION || max_buckets < 1 || !storage) {
+    logerror ("%s(): Invalid precision %d or number of buckets %d\n",
+        __FUNCTION__, precision, max_buckets);
+    return -1;
+  }
+  memset (s, 0, sizeof (*s));
+  s->precision = precision;
+  s->max_buckets = max_buckets;
+  s->positive.counts = storage;
+  s->negative.counts = storage + max_buckets;
+  sketch_reset (s);
+  return 0;
+}
+
+/** Remove all values from a Sketch, keeping its parameters and storage.
+ *
+ * \param s Sketch to reset
+ */
+void
+sketch_reset (Sketch *s)
+{
+  s->count = 0;
+  s->zero_count = 0;
+  s->min = NAN;
+  s->max = NAN;
+  s->positive.len = 0;
+  s->negative.len = 0;
+}
+
+/** Get the index of the bucket of a positive value */
+static inline int
+bucket_index (const Sketch *s, double v)
+{
+  uint64_t bits;
+  memcpy (&bits, &v, sizeof (bits));
+  return (int)(bits >> (52 - s->precision));
+}
+
+/** Get the value in the middle of a bucket of positive values */
+static double
+bucket_value (const Sketch *s, int index)
+{
+  uint64_t bits;
+  double lo, hi;
+
+  bits = (uint64_t)index << (52 - s->precision);
+  memcpy (&lo, &bits, sizeof (lo));
+  bits = (uint64_t)(index + 1) << (52 - s->precision);
+  memcpy (&hi, &bits, sizeof (hi));
+  return lo + (hi - lo) / 2;
+}
+
+/** Move the window of a SketchStore to [lo, hi], with hi not below its
+ * current upper end; the counts of the buckets below lo are added to lo
+ */
+static void
+store_window (SketchStore *st, int lo, int hi)
+{
+  int old_hi = st->offset + st->len - 1;
+  int n = hi - lo + 1;
+
+  if (lo > st->offset) {
+    uint64_t folded = 0;
+    int drop = lo - st->offset;
+    int i, keep;
+
+    if (drop > st->len) {
+      drop = st->len;
+    }
+    for (i = 0; i < drop; i++) {
+      folded += st->counts[i];
+    }
+    keep = st->len - drop;
+    memmove (st->counts, st->counts + drop, keep * sizeof (uint64_t));
+    memset (st->counts + keep, 0, (n - keep) * sizeof (uint64_t));
+    st->counts[0] += folded;
+
+  } else {
+    int shift = st->offset - lo;
+    if (shift > 0) {
+      memmove (st->counts + shift, st->counts, st->len * sizeof (uint64_t));
+      memset (st->counts, 0, shift * sizeof (uint64_t));
+    }
+    memset (st->counts + shift + st->len, 0, (hi - old_hi) * sizeof (uint64_t));
+  }
+
+  st->offset = lo;
+  st->len = n;
+}
+
+/** Add n values to a bucket of a SketchStore, moving its window if needed */
+static void
+store_add (SketchStore *st, int max_buckets, int index, uint64_t n)
+{
+  int lo, hi;
+
+  if (st->len == 0) {
+    st->offset = index;
+    st->len = 1;
+    st->counts[0] = n;
+    return;
+  }
+
+  lo = st->offset;
+  hi = st->offset + st->len - 1;
+  if (index >= lo && index <= hi) {
+    st->counts[index - lo] += n;
+    return;
+  } else if (index < lo) {
+    lo = index;
+  } else {
+    hi = index;
+  }
+
+  if (hi - lo + 1 > max_buckets) {
+    lo = hi - max_buckets + 1;
+  }
+  store_window (st, lo, hi);
+  st->counts[(index < lo ? lo : index) - lo] += n;
+}
+
+/** Add a value to a Sketch.
+ *
+ * NaNs are ignored.
+ *
+ * \param s Sketch to add the value to
+ * \param v value to add
+ */
+void
+sketch_add (Sketch *s, double v)
+{
+  if (isnan (v)) {
+    return;
+  }
+
+  if (s->count == 0) {
+    s->min = s->max = v;
+  } else if (v < s->min) {
+    s->min = v;
+  } else if (v > s->max) {
+    s->max = v;
+  }
+  s->count++;
+
+  if (v > 0) {
+    store_add (&s->positive, s->max_buckets, bucket_index (s, v), 1);
+  } else if (v < 0) {
+    store_add (&s->negative, s->max_buckets, bucket_index (s, -v), 1);
+  } else {
+    s->zero_count++;
+  }
+}
+
+/** Add the values of a Sketch to another.
+ *
+ * \param dst Sketch to add values to
+ * \param src Sketch to add the values of, of the same precision as dst
+ * \return 0 on success, -1 if the Sketches have different precisions
+ */
+int
+sketch_merge (Sketch *dst, const Sketch *src)
+{
+  int i;
+
+  if (dst->precision != src->precision) {
+    logerror ("%s(): Cannot merge sketches of different precisions (%d and %d)\n",
+        __FUNCTION__, dst->precision, src->precision);
+    return -1;
+  } else if (src->count == 0) {
+    return 0;
+  }
+
+  if (dst->count == 0 || src->min < dst->min) {
+    dst->min = src->min;
+  }
+  if (dst->count == 0 || src->max > dst->max) {
+    dst->max = src->max;
+  }
+  dst->count += src->count;
+  dst->zero_count += src->zero_count;
+
+  for (i = 0; i < src->positive.len; i++) {
+    if (src->positive.counts[i]) {
+      store_add (&dst->positive, dst->max_buckets, src->positive.offset + i, src->positive.counts[i]);
+    }
+  }
+  for (i = 0; i < src->negative.len; i++) {
+    if (src->negative.counts[i]) {
+      store_add (&dst->negative, dst->max_buckets, src->negative.offset + i, src->negative.counts[i]);
+    }
+  }
+  return 0;
+}
+
+/** Estimate a quantile of the values of a Sketch.
+ *
+ * \param s Sketch to query
+ * \param q quantile, between 0 (the minimum) and 1 (the maximum), e.g., 0.99 for the 99th percentile
+ * \return an estimate of the quantile, or NaN if s is empty
+ */
+double
+sketch_quantile (const Sketch *s, double q)
+{
+  double rank, v;
+  uint64_t seen = 0;
+  int i;
+
+  if (s->count == 0 || isnan (q)) {
+    return NAN;
+  } else if (q <= 0) {
+    return s->min;
+  } else if (q >= 1) {
+    return s->max;
+  }
+
+  /* Find the bucket of the value of this rank, from the smallest */
+  rank = q * (s->count - 1);
+  for (i = s->negative.len - 1; i >= 0; i--) {
+    seen += s->negative.counts[i];
+    if (seen > rank) {
+      v = -bucket_value (s, s->negative.offset + i);
+      goto found;
+    }
+  }
+  seen += s->zero_count;
+  if (seen > rank) {
+    v = 0.;
+    goto found;
+  }
+  for (i = 0; i < s->positive.len; i++) {
+    seen += s->positive.counts[i];
+    if (seen > rank) {
+      v = bucket_value (s, s->positive.offset + i);
+      goto found;
+    }
+  }
+  return s->max;
+
+found:
+  if (v < s->min) {
+    return s->min;
+  } else if (v > s->max) {
+    return s->max;
+  }
+  return v;
+}
+
+/** Append an unsigned LEB128 varint to a buffer */
+static inline uint8_t*
+put_varint (uint8_t *p, uint64_t v)
+{
+  while (v >= 0x80) {
+    *p++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+/** Read an unsigned LEB128 varint from a buffer, NULL on error */
+static inline const uint8_t*
+get_varint (const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+  int shift;
+
+  *v = 0;
+  for (shift = 0; p < end && shift < 64; shift += 7) {
+    *v |= (uint64_t)(*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/** Append a double to a buffer, in little-endian byte order */
+static inline uint8_t*
+put_double (uint8_t *p, double d)
+{
+  uint64_t bits;
+  int i;
+
+  memcpy (&bits, &d, sizeof (bits));
+  for (i = 0; i < 8; i++, bits >>= 8) {
+    *p++ = (uint8_t)bits;
+  }
+  return p;
+}
+
+/** Read a little-endian double from a buffer, NULL on error */
+static inline const uint8_t*
+get_double (const uint8_t *p, const uint8_t *end, double *d)
+{
+  uint64_t bits = 0;
+  int i;
+
+  if (end - p < 8) {
+    return NULL;
+  }
+  for (i = 7; i >= 0; i--) {
+    bits = (bits << 8) | p[i];
+  }
+  memcpy (d, &bits, sizeof (*d));
+  return p + 8;
+}
+
+/** Serialise a Sketch, e.g., to send it as a blob.
+ *
+ * \param s Sketch to serialise
+ * \param[in,out] buf pointer to an oml_malloc()ed buffer (or NULL), oml_realloc()ed if too small
+ * \return the length of the serialised Sketch [B], or -1 on error
+ * \see sketch_decode
+ */
+ssize_t
+sketch_encode (const Sketch *s, uint8_t **buf)
+{
+  const SketchStore *stores[] = { &s->positive, &s->negative };
+  size_t bound = 2 + 2 * 10 + 2 * 8 + 2 * (2 * 10);
+  uint8_t *p;
+  int i, j;
+
+  bound += 10 * (s->positive.len + s->negative.len);
+  if (!*buf || oml_malloc_usable_size (*buf) < bound) {
+    if (!(p = oml_realloc (*buf, bound))) {
+      return -1;
+    }
+    *buf = p;
+  }
+
+  p = *buf;
+  *p++ = SKETCH_FORMAT_VERSION;
+  *p++ = (uint8_t)s->precision;
+  p = put_varint (p, s->count);
+  p = put_varint (p, s->zero_count);
+  p = put_double (p, s->min);
+  p = put_double (p, s->max);
+  for (i = 0; i < 2; i++) {
+    p = put_varint (p, stores[i]->len);
+    if (stores[i]->len) {
+      p = put_varint (p, stores[i]->offset);
+      for (j = 0; j < stores[i]->len; j++) {
+        p = put_varint (p, stores[i]->counts[j]);
+      }
+    }
+  }
+  return p - *buf;
+}
+
+/** Read one SketchStore of a serialised Sketch, NULL on error */
+static const uint8_t*
+decode_store (const uint8_t *p, const uint8_t *end, int precision, int *offset, int *len, const uint8_t **counts)
+{
+  uint64_t v;
+  int i;
+
+  *offset = 0;
+  if (!(p = get_varint (p, end, &v)) || v > (uint64_t)(end - p)) {
+    return NULL;
+  }
+  *len = (int)v;
+  if (*len) {
+    if (!(p = get_varint (p, end, &v)) || v + *len > (UINT64_C(1) << (11 + precision))) {
+      return NULL;
+    }
+    *offset = (int)v;
+  }
+  *counts = p;
+  for (i = 0; i < *len; i++) {
+    if (!(p = get_varint (p, end, &v))) {
+      return NULL;
+    }
+  }
+  return p;
+}
+
+/** Deserialise a Sketch, e.g., to merge it with others.
+ *
+ * The returned Sketch is allocated together with its storage, which has
+ * room for at least SKETCH_DEFAULT_BUCKETS buckets of each sign.
+ *
+ * \param data serialised Sketch, from sketch_encode()
+ * \param len length of data [B]
+ * \return a new Sketch, to be oml_free()d, or NULL on error
+ * \see sketch_encode, sketch_merge
+ */
+Sketch*
+sketch_decode (const void *data, size_t len)
+{
+  const uint8_t *p = data, *end = p + len;
+  const uint8_t *counts[2];
+  int offsets[2], lens[2];
+  int precision, max_buckets, i, j;
+  uint64_t count, zero_count, total;
+  double min, max;
+  Sketch *s;
+
+  if (len < 2 || p[0] != SKETCH_FORMAT_VERSION || p[1] > SKETCH_MAX_PRECISION) {
+    logerror ("%s(): Unsupported sketch format\n", __FUNCTION__);
+    return NULL;
+  }
+  precision = p[1];
+  p += 2;
+  if (!(p = get_varint (p, end, &count)) ||
+      !(p = get_varint (p, end, &zero_count)) ||
+      !(p = get_double (p, end, &min)) ||
+      !(p = get_double (p, end, &max)) ||
+      !(p = decode_store (p, end, precision, &offsets[0], &lens[0], &counts[0])) ||
+      !(p = decode_store (p, end, precision, &offsets[1], &lens[1], &counts[1])) ||
+      p != end) {
+    logerror ("%s(): Invalid sketch of %zuB\n", __FUNCTION__, len);
+    return NULL;
+  }
+
+  max_buckets = SKETCH_DEFAULT_BUCKETS;
+  for (i = 0; i < 2; i++) {
+    if (lens[i] > max_buckets) {
+      max_buckets = lens[i];
+    }
+  }
+  s = oml_malloc (sizeof (Sketch) + SKETCH_STORAGE_SIZE (max_buckets));
+  if (!s) {
+    return NULL;
+  }
+  sketch_init (s, precision, max_buckets, (uint64_t*)(s + 1));
+  s->count = count;
+  s->zero_count = zero_count;
+  s->min = min;
+  s->max = max;
+
+  total = zero_count;
+  for (i = 0; i < 2; i++) {
+    SketchStore *st = i ? &s->negative : &s->positive;
+    st->offset = offsets[i];
+    st->len = lens[i];
+    for (j = 0, p = counts[i]; j < lens[i]; j++) {
+      p = get_varint (p, end, &st->counts[j]);
+      total += st->counts[j];
+    }
+  }
+  if (total != count) {
+    logerror ("%s(): Inconsistent sketch, with %" PRIu64 " values in its buckets out of %" PRIu64 "\n",
+        __FUNCTION__, total, count);
+    oml_free (s);
+    return NULL;
+  }
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
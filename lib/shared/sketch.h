@@ -0,0 +1,79 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file sketch.h
+ * \brief Mergeable, bounded-memory histograms for estimating quantiles.
+ * \see sketch.c
+ */
+#ifndef OML_SKETCH_H
+#define OML_SKETCH_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Default number of significant decimal digits of the values \see sketch_precision */
+#define SKETCH_DEFAULT_DIGITS 2
+/** Maximal number of significant decimal digits of the values \see sketch_precision */
+#define SKETCH_MAX_DIGITS 4
+/** Default maximal number of buckets for each sign */
+#define SKETCH_DEFAULT_BUCKETS 2048
+/** Size of the storage needed by a Sketch with max_buckets buckets for each sign \see sketch_init */
+#define SKETCH_STORAGE_SIZE(max_buckets) (2 * (size_t)(max_buckets) * sizeof (uint64_t))
+
+/** Contiguous range of buckets of a Sketch, for values of one sign */
+typedef struct SketchStore {
+  /** Number of values in each bucket, counts[0] being that of bucket offset */
+  uint64_t *counts;
+  /** Index of the first bucket */
+  int offset;
+  /** Number of buckets in use */
+  int len;
+} SketchStore;
+
+/** Log-linear histogram of doubles \see sketch.c */
+typedef struct Sketch {
+  /** Number of bits of the mantissa indexing the buckets */
+  int precision;
+  /** Maximal number of buckets of each SketchStore */
+  int max_buckets;
+
+  /** Number of values added */
+  uint64_t count;
+  /** Number of zeroes added */
+  uint64_t zero_count;
+  /** Smallest value added */
+  double min;
+  /** Largest value added */
+  double max;
+
+  /** Buckets of the positive values */
+  SketchStore positive;
+  /** Buckets of the absolute negative values */
+  SketchStore negative;
+} Sketch;
+
+int sketch_precision (int digits);
+int sketch_init (Sketch *s, int precision, int max_buckets, uint64_t *storage);
+void sketch_reset (Sketch *s);
+void sketch_add (Sketch *s, double v);
+int sketch_merge (Sketch *dst, const Sketch *src);
+double sketch_quantile (const Sketch *s, double q);
+ssize_t sketch_encode (const Sketch *s, uint8_t **buf);
+Sketch *sketch_decode (const void *data, size_t len);
+
+#endif /* OML_SKETCH_H */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
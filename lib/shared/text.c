@@ -74,7 +74,10 @@
 #include "marshal.h"
 #include "oml_value.h"
 #include "schema.h"
+#include "mem.h"
 #include "message.h"
+#include "scan.h"
+#include "text.h"
 
 /**
  *  @brief Read an OmlValue value from +mbuf+.
@@ -109,16 +112,16 @@ static int
 text_read_value (MBuffer *mbuf, OmlValue *value, size_t line_length)
 {
   uint8_t *line = mbuf_rdptr (mbuf);
-  size_t field_length = mbuf_find (mbuf, '\t');
+  const uint8_t *tab = scan_byte (line, line_length, '\t');
   int len;
   int ret = 0;
   uint8_t save;
 
   /* No tab '\t' found on this line --> final field */
-  if (field_length == (size_t)-1 || field_length > line_length)
+  if (tab == NULL)
     len = line_length;
   else
-    len = field_length;
+    len = tab - line;
 
   save = line[len];
   line[len] = '\0';
@@ -218,6 +221,282 @@ text_read_msg_values (struct oml_message *msg, MBuffer *mbuf, struct schema *sch
   return 0;
 }
 
+/** Parse a plain decimal integer.
+ *
+ * This only handles what clients normally send: an optional sign followed by
+ * at most max_digits digits, and nothing else. Anything else (leading zeros,
+ * which strtol(3) would take as octal, hexadecimal, blanks, too many digits,
+ * or trailing characters) is left for the caller to convert with strtol(3)
+ * and siblings, which give the same result for what is handled here.
+ *
+ * \param s nil-terminated string to parse
+ * \param max_digits maximum number of digits to accept (at most 18)
+ * \param[out] value parsed value
+ * \return 0 on success, or -1 if the string should be parsed otherwise
+ */
+int
+text_parse_integer (const char *s, int max_digits, int64_t *value)
+{
+  const char *p = s;
+  uint64_t v = 0;
+  int neg = 0;
+
+  if (*p == '-' || *p == '+')
+    neg = (*p++ == '-');
+
+  if (p[0] == '0' && p[1] == '\0') {
+    *value = 0;
+    return 0;
+  } else if (*p < '1' || *p > '9') {
+    return -1;
+  }
+
+  for (; *p >= '0' && *p <= '9'; p++) {
+    if (max_digits-- == 0)
+      return -1;
+    v = v * 10 + (*p - '0');
+  }
+  if (*p != '\0')
+    return -1;
+
+  *value = neg ? -(int64_t)v : (int64_t)v;
+  return 0;
+}
+
+/** Parse a plain decimal number.
+ *
+ * This only handles an optional sign followed by digits, possibly with a
+ * decimal point, with at most 15 digits overall. Such a number is exactly an
+ * integer (< 2^53) divided by an exact power of 10, so a single division
+ * gives the same correctly rounded result as strtod(3). Anything else
+ * (exponents, infinities, NaNs, more digits, trailing characters) is left for
+ * the caller to convert with strtod(3).
+ *
+ * \param s nil-terminated string to parse
+ * \param[out] value parsed value
+ * \return 0 on success, or -1 if the string should be parsed otherwise
+ */
+int
+text_parse_double (const char *s, double *value)
+{
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+  };
+  const char *p = s;
+  uint64_t m = 0;
+  int neg = 0, digits = 0, decimals = -1;
+  double v;
+
+  if (*p == '-' || *p == '+')
+    neg = (*p++ == '-');
+
+  for (;; p++) {
+    if (*p >= '0' && *p <= '9') {
+      if (++digits > 15)
+        return -1;
+      m = m * 10 + (*p - '0');
+      if (decimals >= 0)
+        decimals++;
+    } else if (*p == '.' && decimals < 0) {
+      decimals = 0;
+    } else {
+      break;
+    }
+  }
+  if (*p != '\0' || digits == 0)
+    return -1;
+
+  v = decimals > 0 ? (double)m / powers[decimals] : (double)m;
+  *value = neg ? -v : v;
+  return 0;
+}
+
+/** Undo the backslash encoding of a string, in place.
+ *
+ * \param s nil-terminated string to decode
+ * \return the length of the decoded string
+ * \see backslash_decode
+ */
+static size_t
+text_unescape (char *s)
+{
+  char *in, *out;
+
+  for (in = out = s; *in; in++) {
+    if (*in == '\\' && in[1] != '\0') {
+      switch (*++in) {
+      case 't': *out++ = '\t'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      default: *out++ = *in;
+      }
+    } else {
+      *out++ = *in;
+    }
+  }
+  *out = '\0';
+
+  return out - s;
+}
+
+/** Convert a field with the generic, slower, oml_value_from_s */
+static int
+text_field_generic (OmlValue *value, char *s)
+{
+  OmlValueT type = oml_value_get_type (value);
+
+  /* oml_value_from_s expects cleared storage */
+  oml_value_reset (value);
+  oml_value_set_type (value, type);
+  return oml_value_from_s (value, s);
+}
+
+static int
+text_field_int32 (OmlValue *value, char *s)
+{
+  int64_t v;
+  if (text_parse_integer (s, 9, &v) == -1)
+    return text_field_generic (value, s);
+  omlc_set_int32 (*oml_value_get_value (value), (int32_t)v);
+  return 0;
+}
+
+static int
+text_field_uint32 (OmlValue *value, char *s)
+{
+  int64_t v;
+  if (text_parse_integer (s, 9, &v) == -1)
+    return text_field_generic (value, s);
+  omlc_set_uint32 (*oml_value_get_value (value), (uint32_t)v);
+  return 0;
+}
+
+static int
+text_field_int64 (OmlValue *value, char *s)
+{
+  int64_t v;
+  if (text_parse_integer (s, 18, &v) == -1)
+    return text_field_generic (value, s);
+  omlc_set_int64 (*oml_value_get_value (value), v);
+  return 0;
+}
+
+static int
+text_field_uint64 (OmlValue *value, char *s)
+{
+  int64_t v;
+  if (text_parse_integer (s, 18, &v) == -1)
+    return text_field_generic (value, s);
+  omlc_set_uint64 (*oml_value_get_value (value), (uint64_t)v);
+  return 0;
+}
+
+static int
+text_field_double (OmlValue *value, char *s)
+{
+  double v;
+  if (text_parse_double (s, &v) == -1)
+    return text_field_generic (value, s);
+  omlc_set_double (*oml_value_get_value (value), v);
+  return 0;
+}
+
+/** Decode a string in place, and copy it into the storage the OmlValue
+ * already has, if large enough */
+static int
+text_field_string (OmlValue *value, char *s)
+{
+  size_t len = text_unescape (s);
+  omlc_set_string_copy (*oml_value_get_value (value), s, len);
+  return 0;
+}
+
+/** Create a decoder for text samples of the given schema.
+ *
+ * The conversion function for each field is chosen once here, rather than
+ * for each value received.
+ *
+ * \param schema schema of the samples to decode
+ * \return a new text_decoder, to be freed with text_decoder_free, or NULL on error
+ * \see text_decoder_decode
+ */
+struct text_decoder*
+text_decoder_new (const struct schema *schema)
+{
+  struct text_decoder *decoder;
+  int i;
+
+  if (schema == NULL)
+    return NULL;
+
+  decoder = oml_malloc (sizeof (struct text_decoder));
+  if (decoder == NULL)
+    return NULL;
+  decoder->nfields = schema->nfields;
+  decoder->fields = oml_calloc (schema->nfields > 0 ? schema->nfields : 1, sizeof (*decoder->fields));
+  if (decoder->fields == NULL) {
+    oml_free (decoder);
+    return NULL;
+  }
+
+  for (i = 0; i < schema->nfields; i++) {
+    OmlValueT type = schema->fields[i].type;
+
+    decoder->fields[i].type = type;
+    switch (type) {
+    case OML_INT32_VALUE:  decoder->fields[i].parse = text_field_int32; break;
+    case OML_UINT32_VALUE: decoder->fields[i].parse = text_field_uint32; break;
+    case OML_INT64_VALUE:  decoder->fields[i].parse = text_field_int64; break;
+    case OML_UINT64_VALUE: decoder->fields[i].parse = text_field_uint64; break;
+    case OML_DOUBLE_VALUE: decoder->fields[i].parse = text_field_double; break;
+    case OML_STRING_VALUE: decoder->fields[i].parse = text_field_string; break;
+    default:               decoder->fields[i].parse = text_field_generic; break;
+    }
+  }
+
+  return decoder;
+}
+
+/** Free a text_decoder.
+ *
+ * \param decoder text_decoder to free
+ */
+void
+text_decoder_free (struct text_decoder *decoder)
+{
+  if (decoder == NULL)
+    return;
+  oml_free (decoder->fields);
+  oml_free (decoder);
+}
+
+/** Convert the fields of a text sample into OmlValues.
+ *
+ * The fields are modified in place (e.g., strings are unescaped there). The
+ * OmlValues are not reset between samples, so the storage they already have
+ * for strings can be reused; they only are when the type changes.
+ *
+ * \param decoder text_decoder for the schema of the sample
+ * \param fields nil-terminated values, one per field of the schema
+ * \param values array of at least as many OmlValues as there are fields
+ * \return 0 on success, or the (negative) index of the first field which
+ * could not be converted, minus 1
+ * \see text_decoder_new, oml_value_from_s
+ */
+int
+text_decoder_decode (const struct text_decoder *decoder, char **fields, OmlValue *values)
+{
+  int i;
+
+  for (i = 0; i < decoder->nfields; i++) {
+    oml_value_set_type (&values[i], decoder->fields[i].type);
+    if (decoder->fields[i].parse (&values[i], fields[i]) == -1)
+      return -i - 1;
+  }
+
+  return 0;
+}
+
 /*
  Local Variables:
  mode: C
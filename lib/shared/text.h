@@ -32,6 +32,26 @@ int text_read_msg_start  (struct oml_message *msg, MBuffer *mbuf);
 int text_read_msg_values (struct oml_message *msg, MBuffer *mbuf,
                           struct schema *schema, OmlValue *values);
 
+/** Conversion function for one field of a text sample */
+typedef int (*text_field_fn) (OmlValue *value, char *s);
+
+/** Precomputed conversions for the text samples of one schema
+ * \see text_decoder_new */
+struct text_decoder {
+  int nfields;
+  struct {
+    OmlValueT type;
+    text_field_fn parse;
+  } *fields;
+};
+
+int text_parse_integer (const char *s, int max_digits, int64_t *value);
+int text_parse_double (const char *s, double *value);
+
+struct text_decoder* text_decoder_new (const struct schema *schema);
+void text_decoder_free (struct text_decoder *decoder);
+int text_decoder_decode (const struct text_decoder *decoder, char **fields, OmlValue *values);
+
 #endif /* TEXT_H__ */
 
 /*
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file vector.c
+ * \brief Packed little-endian binary representation of vectors (used for storing vectors on DB).
+ *
+ * A vector is stored as its elements one after the other, with no header
+ * nor padding, each in little-endian byte order: IEEE 754 doubles, 32- or
+ * 64-bit integers, and single bytes (0 or 1) for booleans. Its number of
+ * elements is therefore the length of the data divided by the size of one
+ * element, as returned by vector_le_elt_size(). This is the native layout on
+ * most hosts, which makes encoding free there, and decoding trivial in most
+ * languages (e.g., numpy.frombuffer(data, '<f8') in Python).
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+
+#include "ocomm/o_log.h"
+#include "oml_value.h"
+#include "mem.h"
+#include "htonll.h"
+#include "vector.h"
+
+/** Get the size of one element of a vector in its packed binary form.
+ *
+ * \param type OmlValueT of the vector
+ * \return the size of an element [B], or 0 if type is not a vector type
+ */
+size_t
+vector_le_elt_size (OmlValueT type)
+{
+  switch (type) {
+  case OML_VECTOR_DOUBLE_VALUE:
+  case OML_VECTOR_INT64_VALUE:
+  case OML_VECTOR_UINT64_VALUE:
+    return 8;
+  case OML_VECTOR_INT32_VALUE:
+  case OML_VECTOR_UINT32_VALUE:
+    return 4;
+  case OML_VECTOR_BOOL_VALUE:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+#ifdef WORDS_BIGENDIAN
+/** Copy packed elements, reversing their byte order.
+ *
+ * \param dst destination buffer
+ * \param src source buffer
+ * \param n number of elements
+ * \param size size of each element [B]
+ */
+static void
+vector_swap (void *dst, const void *src, size_t n, size_t size)
+{
+  size_t i;
+  for (i = 0; i < n; i++) {
+    switch (size) {
+    case 8: ((uint64_t*)dst)[i] = bswap_64 (((const uint64_t*)src)[i]); break;
+    case 4: ((uint32_t*)dst)[i] = bswap_32 (((const uint32_t*)src)[i]); break;
+    default: ((uint8_t*)dst)[i] = ((const uint8_t*)src)[i]; break;
+    }
+  }
+}
+#endif
+
+/** Get the packed little-endian binary representation of a vector.
+ *
+ * On little-endian hosts, this is the storage of the vector itself, and
+ * nothing is copied. Otherwise, the elements are converted into *scratch,
+ * which is oml_realloc()ed as needed; the caller should oml_free() it when
+ * no longer needed. Either way, the returned data is only valid until
+ * value or *scratch are next modified.
+ *
+ * \param value OmlValueU containing the vector
+ * \param type OmlValueT of the vector
+ * \param[out] len length of the binary representation [B]
+ * \param[in,out] scratch pointer to a buffer to use if a conversion is needed, initially NULL
+ * \return a pointer to the binary representation (never NULL for an empty
+ * vector), or NULL on error
+ * \see vector_from_le, vector_le_elt_size
+ */
+const void*
+vector_to_le (const OmlValueU *value, OmlValueT type, size_t *len, void **scratch)
+{
+  static const uint64_t empty = 0;
+  size_t size = vector_le_elt_size (type);
+  size_t n = omlc_get_vector_nof_elts (*value);
+
+  if (!size) {
+    logerror ("%s(): Not a vector type: %d\n", __FUNCTION__, type);
+    return NULL;
+  } else if (omlc_get_vector_elt_size (*value) != size && n > 0) {
+    logerror ("%s(): Unexpected element size %zu for a vector of %s\n", __FUNCTION__,
+        omlc_get_vector_elt_size (*value), oml_type_to_s (type));
+    return NULL;
+  }
+
+  *len = n * size;
+  if (n == 0 || !omlc_get_vector_ptr (*value)) {
+    *len = 0;
+    return &empty;
+  }
+
+#ifdef WORDS_BIGENDIAN
+  void *buf = *scratch;
+  if (!buf || oml_malloc_usable_size (buf) < *len) {
+    if (!(buf = oml_realloc (buf, *len))) {
+      return NULL;
+    }
+    *scratch = buf;
+  }
+  vector_swap (buf, omlc_get_vector_ptr (*value), n, size);
+  return buf;
+#else
+  (void)scratch;
+  return omlc_get_vector_ptr (*value);
+#endif
+}
+
+/** Decode a vector from its packed little-endian binary representation.
+ *
+ * This is the helper for readers of vectors stored in binary form.
+ *
+ * \param value OmlValue to store the vector in; it is given type, and its storage is reused if possible
+ * \param type OmlValueT of the vector
+ * \param data binary representation of the vector
+ * \param len length of data [B]
+ * \return 0 on success, -1 otherwise (e.g., len is not a multiple of the size of an element)
+ * \see vector_to_le, vector_le_elt_size
+ */
+int
+vector_from_le (OmlValue *value, OmlValueT type, const void *data, size_t len)
+{
+  size_t size = vector_le_elt_size (type);
+  size_t n;
+
+  if (!size) {
+    logerror ("%s(): Not a vector type: %d\n", __FUNCTION__, type);
+    return -1;
+  } else if (len % size) {
+    logerror ("%s(): %zuB is not a whole number of %s elements\n", __FUNCTION__,
+        len, oml_type_to_s (type));
+    return -1;
+  }
+  n = len / size;
+
+  oml_value_set_type (value, type);
+  /* Empty data may come as a NULL pointer, e.g., from sqlite3_column_blob() */
+  _omlc_set_vector_copy (*oml_value_get_value (value), n ? data : "", n, size);
+#ifdef WORDS_BIGENDIAN
+  vector_swap (omlc_get_vector_ptr (*oml_value_get_value (value)), data, n, size);
+#endif
+  return 0;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,34 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file vector.h
+ * \brief Packed little-endian binary representation of vectors (used for storing vectors on DB).
+ * \see vector.c, json.h
+ */
+#ifndef OML_VECTOR_H
+#define OML_VECTOR_H
+
+#include <stddef.h>
+
+#include "oml2/omlc.h"
+
+size_t vector_le_elt_size (OmlValueT type);
+const void *vector_to_le (const OmlValueU *value, OmlValueT type, size_t *len, void **scratch);
+int vector_from_le (OmlValue *value, OmlValueT type, const void *data, size_t len);
+
+#endif /* OML_VECTOR_H */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
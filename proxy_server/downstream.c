@@ -0,0 +1,395 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file downstream.c
+ * \brief Multiplexes the data of several clients over shared connections to the OML server.
+ *
+ * Rather than opening one connection to the OML server per client, a small
+ * number of Downstream connections can be shared by all clients. After a
+ * "mux" preamble, each client's headers and measurements are sent as frames
+ * on its own channel (see mux.h), which the server demultiplexes into
+ * independent logical clients.
+ *
+ * Frames are built in an MBuffer from the clients' queues, taking at most
+ * DOWNSTREAM_BATCH bytes from each client in turn. Messages are only removed
+ * from the queues once the whole MBuffer has been written to the socket; if
+ * the connection is lost before then, they are sent again, after the
+ * headers, on the next connection.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "mux.h"
+#include "session.h"
+#include "proxy_client.h"
+#include "downstream.h"
+
+/** Amount of queued data to take from a client at a time */
+#define DOWNSTREAM_BATCH (64 * 1024)
+
+static void downstream_status (SockEvtSource *source, SocketStatus status, int error, void *handle);
+
+/** Create the Downstream connections of a Session.
+ *
+ * \param session Session the connections will serve; its downstreams and
+ * ndownstreams fields are set
+ * \param count number of connections to create
+ * \return a pointer to the array of Downstreams, or NULL on error
+ */
+Downstream*
+downstreams_new (Session *session, int count)
+{
+  int i;
+  Downstream *downstreams = oml_malloc (count * sizeof (Downstream));
+
+  if (downstreams == NULL)
+    return NULL;
+
+  for (i = 0; i < count; i++) {
+    Downstream *self = &downstreams[i];
+    snprintf (self->name, sizeof (self->name), "downstream-%d", i);
+    self->session = session;
+    self->socket = -1;
+    self->state = S_DISCONNECTED;
+    self->next_channel = 1;
+    self->out = mbuf_create ();
+    if (self->out == NULL) {
+      while (i-- > 0)
+        mbuf_destroy (downstreams[i].out);
+      oml_free (downstreams);
+      return NULL;
+    }
+  }
+
+  session->downstreams = downstreams;
+  session->ndownstreams = count;
+
+  return downstreams;
+}
+
+/** Assign a Client to a Downstream connection.
+ *
+ * \param self Downstream to use
+ * \param client Client to assign a new channel to
+ */
+void
+downstream_add_client (Downstream *self, Client *client)
+{
+  client->downstream = self;
+  client->mux_channel = self->next_channel++;
+  client->mux_open = 0;
+  client->mux_inflight = 0;
+  logdebug ("%s: Client %s assigned channel %u\n", self->name, client->name, client->mux_channel);
+}
+
+/** Close the connection to the downstream server, if any.
+ *
+ * Any data not yet written is discarded; the messages it contained are still
+ * queued, and will be sent again after the client's headers on the next
+ * connection.
+ *
+ * \param self Downstream to disconnect
+ */
+void
+downstream_disconnect (Downstream *self)
+{
+  Client *client;
+
+  if (self->event) {
+    eventloop_socket_remove (self->event);
+    self->event = NULL;
+  }
+  if (self->socket >= 0) {
+    shutdown (self->socket, SHUT_RDWR);
+    close (self->socket);
+    self->socket = -1;
+  }
+  self->state = S_DISCONNECTED;
+  mbuf_clear (self->out);
+
+  for (client = self->session->clients; client; client = client->next) {
+    if (client->downstream == self) {
+      client->mux_open = 0;
+      client->mux_inflight = 0;
+    }
+  }
+}
+
+/** Start a non-blocking connection to the downstream server.
+ *
+ * \param self Downstream to connect
+ * \return 0 if the connection is in progress, -1 otherwise
+ * \see downstream_status
+ */
+static int
+downstream_connect (Downstream *self)
+{
+  int s = sender_connect (self->session->downstream_address, self->session->downstream_port);
+
+  if (s == -1)
+    return -1;
+
+  self->socket = s;
+  self->state = S_CONNECTING;
+  self->event = eventloop_on_out_fd (self->name, s, downstream_status, self);
+
+  return 0;
+}
+
+/** Queue frames for the pending data of one client.
+ *
+ * A channel is opened and the headers sent if needed, then a single frame
+ * carries as many whole messages as fit in DOWNSTREAM_BATCH (but at least
+ * one). A disconnected client whose data has all been sent is closed and
+ * freed.
+ *
+ * \param self Downstream the client is assigned to
+ * \param client Client to consider
+ * \return 1 if frames were added, 0 if there was nothing to send, -1 on error
+ */
+static int
+downstream_fill_client (Downstream *self, Client *client)
+{
+  struct msg_queue_node *node;
+  size_t count = 0, length = 0, i;
+  uint8_t header[MUX_HEADER_SIZE];
+  int filled = 0;
+
+  if (client->state == C_HEADER || client->state == C_CONFIGURE)
+    return 0; // Haven't finished receiving the headers
+
+  if (!client->mux_open) {
+    if (client_send_headers (client) == -1 ||
+        mux_frame_write (self->out, MUX_OPEN, client->mux_channel,
+                         client->name, strlen (client->name)) == -1 ||
+        mux_frame_write (self->out, MUX_DATA, client->mux_channel,
+                         mbuf_rdptr (client->send_headers),
+                         mbuf_rd_remaining (client->send_headers)) == -1) {
+      logwarn ("%s: Could not prepare headers of %s\n", self->name, client->name);
+      return -1;
+    }
+    mbuf_clear (client->send_headers);
+    client->mux_open = 1;
+    filled = 1;
+  }
+
+  for (node = msg_queue_head (client->messages); count < client->messages->length; node = node->next) {
+    if (count > 0 && length + node->msg->length > DOWNSTREAM_BATCH)
+      break;
+    length += node->msg->length;
+    count++;
+  }
+
+  if (count > 0) {
+    mux_frame_header_write (header, MUX_DATA, client->mux_channel, length);
+    if (mbuf_write (self->out, header, sizeof (header)) == -1)
+      return -1;
+
+    for (i = 0, node = msg_queue_head (client->messages); i < count; i++, node = node->next) {
+      struct cbuffer_cursor cursor = node->cursor;
+      size_t remaining = node->msg->length;
+
+      while (remaining > 0) {
+        size_t page_remaining = cbuf_cursor_page_remaining (&cursor);
+        size_t n = remaining < page_remaining ? remaining : page_remaining;
+        if (mbuf_write (self->out, (uint8_t*)cbuf_cursor_pointer (&cursor), n) == -1)
+          return -1;
+        cbuf_advance_cursor (&cursor, n);
+        remaining -= n;
+      }
+    }
+    client->mux_inflight = count;
+    logdebug ("%s: Queued %zu messages (%zu bytes) from %s\n", self->name, count, length, client->name);
+    return 1;
+  }
+
+  if (client->state == C_DISCONNECTED) {
+    loginfo ("%s: Client %s disconnected and all pending measurements have been sent; shutting down this client\n",
+             self->name, client->name);
+    if (mux_frame_write (self->out, MUX_CLOSE, client->mux_channel, NULL, 0) == -1)
+      return -1;
+    session_remove_client (client->session, client);
+    client_free (client);
+    return 1;
+  }
+
+  return filled;
+}
+
+/** Queue frames for the pending data of all clients of a Downstream.
+ *
+ * \param self Downstream to fill
+ * \return 1 if frames were added, 0 if there was nothing to send, -1 on error
+ */
+static int
+downstream_fill (Downstream *self)
+{
+  Client *client = self->session->clients, *next;
+  int filled = 0;
+
+  while (client) {
+    next = client->next; // client may be freed
+    if (client->downstream == self) {
+      switch (downstream_fill_client (self, client)) {
+      case 1:
+        filled = 1;
+        break;
+      case -1:
+        return -1;
+      }
+    }
+    client = next;
+  }
+
+  return filled;
+}
+
+/** Remove the messages which have been completely written from the clients' queues.
+ *
+ * \param self Downstream whose output has been flushed
+ */
+static void
+downstream_commit (Downstream *self)
+{
+  Client *client;
+
+  for (client = self->session->clients; client; client = client->next) {
+    if (client->downstream == self) {
+      while (client->mux_inflight > 0) {
+        client_message_consume (client);
+        client->mux_inflight--;
+      }
+    }
+  }
+  mbuf_clear (self->out);
+}
+
+/** Write as much pending data as the downstream socket accepts.
+ *
+ * \param self Downstream for which to send data
+ * \return 1 if all data was sent, 0 if the socket is full, -1 on error
+ */
+static int
+downstream_drain (Downstream *self)
+{
+  ssize_t result;
+
+  do {
+    while (mbuf_rd_remaining (self->out) > 0) {
+      result = send (self->socket, mbuf_rdptr (self->out), mbuf_rd_remaining (self->out), MSG_NOSIGNAL);
+      if (result == -1) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+      }
+      mbuf_read_skip (self->out, result);
+    }
+    downstream_commit (self);
+  } while ((result = downstream_fill (self)) == 1);
+
+  return result == 0 ? 1 : -1;
+}
+
+/** EventLoop status callback for a Downstream connection.
+ *
+ * \copydetails o_el_state_socket_callback
+ */
+static void
+downstream_status (SockEvtSource *source, SocketStatus status, int error, void *handle)
+{
+  Downstream *self = (Downstream*)handle;
+  int err = 0;
+  socklen_t errlen = sizeof (err);
+  (void)source;
+
+  switch (status) {
+  case SOCKET_WRITEABLE:
+    if (self->state == S_CONNECTING) {
+      if (getsockopt (self->socket, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1) {
+        err = errno;
+      }
+      if (err) {
+        logdebug ("%s: Failed to connect: %s\n", self->name, strerror (err));
+        downstream_disconnect (self);
+        return;
+      }
+      loginfo ("%s: Connected to %s:%d\n", self->name,
+               self->session->downstream_address, self->session->downstream_port);
+      self->state = S_CONNECTED;
+      mbuf_clear (self->out);
+      if (mbuf_print (self->out, "%s: %d\n", MUX_HEADER_KEY, MUX_PROTOCOL_VERSION) == -1) {
+        logwarn ("%s: Could not prepare preamble\n", self->name);
+        downstream_disconnect (self);
+        return;
+      }
+    }
+
+    if (self->session->state != ProxyState_SENDING) {
+      eventloop_socket_activate (self->event, 0);
+      return;
+    }
+
+    switch (downstream_drain (self)) {
+    case 1:
+      /* Nothing more to send for now */
+      eventloop_socket_activate (self->event, 0);
+      break;
+    case 0:
+      break;
+    default:
+      logdebug ("%s: send(2) failed (%s)\n", self->name, strerror (errno));
+      downstream_disconnect (self);
+      break;
+    }
+    break;
+
+  default:
+    logdebug ("%s: Lost connection (%s): %s\n", self->name,
+              socket_status_string (status), strerror (error));
+    downstream_disconnect (self);
+    break;
+  }
+}
+
+/** Get the clients' pending data sent downstream, if the session allows it.
+ *
+ * \param self Downstream to consider
+ * \see client_sender_kick
+ */
+void
+downstream_kick (Downstream *self)
+{
+  if (self->session->state != ProxyState_SENDING)
+    return;
+
+  switch (self->state) {
+  case S_DISCONNECTED:
+    if (downstream_connect (self) == -1) {
+      logdebug ("%s: Failed to connect: %s\n", self->name, strerror (errno));
+    }
+    break;
+  case S_CONNECTING:
+    break;
+  case S_CONNECTED:
+    eventloop_socket_activate (self->event, 1);
+    break;
+  }
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
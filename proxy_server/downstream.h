@@ -0,0 +1,53 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file downstream.h
+ * \brief Interface for connections multiplexing several clients to the OML server.
+ * \see downstream.c, mux.h
+ */
+#ifndef DOWNSTREAM_H__
+#define DOWNSTREAM_H__
+
+#include <stdint.h>
+#include <mbuf.h>
+#include <ocomm/o_eventloop.h>
+
+#include "proxy_client.h"
+
+struct _session;
+
+/** A connection to the downstream server, shared by several Clients */
+typedef struct _downstream {
+  //! Name used for debugging
+  char        name[64];
+  struct _session *session;
+
+  SockEvtSource *event;       // Only active when there is data to send
+  int         socket;         // -1 when not connected
+  enum SenderState state;
+
+  MBuffer    *out;            // Frames being written
+  uint32_t    next_channel;   // Channel to assign to the next Client
+} Downstream;
+
+Downstream* downstreams_new (struct _session *session, int count);
+void downstream_add_client (Downstream *self, Client *client);
+void downstream_kick (Downstream *self);
+void downstream_disconnect (Downstream *self);
+
+#endif /* DOWNSTREAM_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,201 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file message_spool.c
+ * \brief Implement a FIFO of messages stored in an append-only file.
+ *
+ * Messages are appended to the segment file as a struct oml_message
+ * followed by the message itself, and are read back in large chunks in the
+ * same order. Once all messages have been shifted out, the file is truncated
+ * so it doesn't grow forever.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "message_spool.h"
+
+/** Amount of data to read back from the file at once */
+#define SPOOL_READAHEAD (64 * 1024)
+
+/** Create a new, empty, spool.
+ *
+ * The segment file is only created when the first message is appended.
+ *
+ * \param path name of the segment file
+ * \return a new msg_spool, or NULL on error
+ */
+struct msg_spool*
+msg_spool_create (const char *path)
+{
+  struct msg_spool *spool = oml_malloc (sizeof (struct msg_spool));
+
+  if (spool == NULL)
+    return NULL;
+
+  spool->path = oml_strndup (path, strlen (path));
+  spool->readahead = mbuf_create ();
+  if (spool->path == NULL || spool->readahead == NULL) {
+    msg_spool_destroy (spool);
+    return NULL;
+  }
+  spool->fd = -1;
+
+  return spool;
+}
+
+/** Destroy a spool, and remove its segment file.
+ *
+ * \param spool msg_spool to destroy
+ */
+void
+msg_spool_destroy (struct msg_spool *spool)
+{
+  if (spool == NULL)
+    return;
+
+  if (spool->fd >= 0) {
+    close (spool->fd);
+    unlink (spool->path);
+  }
+  if (spool->readahead)
+    mbuf_destroy (spool->readahead);
+  if (spool->path)
+    oml_free (spool->path);
+  oml_free (spool);
+}
+
+/** Append a message to the end of the spool.
+ *
+ * \param spool msg_spool to append to
+ * \param msg description of the message
+ * \param buf the message itself
+ * \param length length of the message
+ * \return 0 on success, -1 on error
+ */
+int
+msg_spool_append (struct msg_spool *spool, struct oml_message *msg, const char *buf, size_t length)
+{
+  struct oml_message header = *msg;
+  ssize_t result;
+
+  if (spool->fd < 0) {
+    spool->fd = open (spool->path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (spool->fd < 0) {
+      logerror ("Could not open spool file '%s': %s\n", spool->path, strerror (errno));
+      return -1;
+    }
+  }
+
+  header.length = length;
+  result = pwrite (spool->fd, &header, sizeof (header), spool->write_offset);
+  if (result == -1 || (size_t)result != sizeof (header)) {
+    logerror ("Could not write message header to spool file '%s': %s\n", spool->path,
+              result == -1 ? strerror (errno) : "short write");
+    return -1;
+  }
+  result = pwrite (spool->fd, buf, length, spool->write_offset + sizeof (header));
+  if (result == -1 || (size_t)result != length) {
+    logerror ("Could not write to spool file '%s': %s\n", spool->path,
+              result == -1 ? strerror (errno) : "short write");
+    return -1;
+  }
+
+  spool->write_offset += sizeof (header) + length;
+  spool->count++;
+  spool->bytes += length;
+
+  return 0;
+}
+
+/** Make sure at least n bytes have been read back from the file.
+ *
+ * \param spool msg_spool to read from
+ * \param n amount of data needed in the readahead buffer
+ * \return 0 on success, -1 on error
+ */
+static int
+msg_spool_fill (struct msg_spool *spool, size_t n)
+{
+  MBuffer *readahead = spool->readahead;
+  size_t missing;
+  ssize_t result;
+
+  if (mbuf_rd_remaining (readahead) >= n)
+    return 0;
+
+  mbuf_repack (readahead);
+  missing = n - mbuf_rd_remaining (readahead);
+  if (mbuf_check_resize (readahead, missing < SPOOL_READAHEAD ? SPOOL_READAHEAD : missing) == -1)
+    return -1;
+
+  while (mbuf_rd_remaining (readahead) < n) {
+    result = pread (spool->fd, mbuf_wrptr (readahead), mbuf_wr_remaining (readahead), spool->read_offset);
+    if (result <= 0) {
+      logerror ("Could not read from spool file '%s': %s\n", spool->path,
+                result == -1 ? strerror (errno) : "unexpected end of file");
+      return -1;
+    }
+    mbuf_write_advance (readahead, result);
+    spool->read_offset += result;
+  }
+
+  return 0;
+}
+
+/** Remove the message at the head of the spool.
+ *
+ * \param spool msg_spool to read from
+ * \param[out] msg description of the message
+ * \param[out] buf set to point to the message, valid until the next call
+ * \return the length of the message, 0 if the spool is empty, or -1 on error
+ */
+int
+msg_spool_shift (struct msg_spool *spool, struct oml_message *msg, char **buf)
+{
+  MBuffer *readahead = spool->readahead;
+
+  if (spool->count == 0)
+    return 0;
+
+  if (msg_spool_fill (spool, sizeof (*msg)) == -1)
+    return -1;
+  memcpy (msg, mbuf_rdptr (readahead), sizeof (*msg));
+  if (msg_spool_fill (spool, sizeof (*msg) + msg->length) == -1)
+    return -1;
+
+  *buf = (char*)mbuf_rdptr (readahead) + sizeof (*msg);
+  mbuf_read_skip (readahead, sizeof (*msg) + msg->length);
+
+  spool->count--;
+  spool->bytes -= msg->length;
+  if (spool->count == 0) {
+    /* Everything has been read back; start the file afresh. The data
+     * pointed to by *buf is still in the readahead buffer */
+    if (ftruncate (spool->fd, 0) == -1) {
+      logwarn ("Could not truncate spool file '%s': %s\n", spool->path, strerror (errno));
+    }
+    spool->read_offset = spool->write_offset = 0;
+  }
+
+  return msg->length;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
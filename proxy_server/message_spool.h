@@ -0,0 +1,45 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file message_spool.h
+ * \brief Interface for the on-disk overflow of a message queue.
+ * \see message_spool.c
+ */
+#ifndef MESSAGE_SPOOL_H__
+#define MESSAGE_SPOOL_H__
+
+#include <sys/types.h>
+#include <message.h>
+#include <mbuf.h>
+
+struct msg_spool {
+  char *path;         /* Name of the segment file */
+  int fd;             /* -1 until the first message is appended */
+  off_t read_offset;  /* Start of the data not yet read back */
+  off_t write_offset; /* End of the data appended so far */
+  size_t count;       /* Number of messages not yet shifted out */
+  size_t bytes;       /* Total length of those messages */
+  MBuffer *readahead; /* Data read back from the file, but not shifted out yet */
+};
+
+struct msg_spool* msg_spool_create (const char *path);
+void msg_spool_destroy (struct msg_spool *spool);
+int msg_spool_append (struct msg_spool *spool, struct oml_message *msg, const char *buf, size_t length);
+int msg_spool_shift (struct msg_spool *spool, struct oml_message *msg, char **buf);
+
+#endif /* MESSAGE_SPOOL_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
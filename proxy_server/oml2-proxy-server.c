@@ -18,6 +18,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <signal.h>
+#include <pthread.h>
 #include <popt.h>
 
 #include "ocomm/o_log.h"
@@ -26,6 +27,7 @@
 #include "mstring.h"
 #include "session.h"
 #include "proxy_client.h"
+#include "downstream.h"
 
 #define V_STRING  "OML2 Proxy Server V%s\n"
 #define COPYRIGHT "Copyright 2007-2013 NICTA\n"
@@ -48,10 +50,12 @@ static char resultfile_name[128] = DEFAULT_RESULT_FILE;
 static int page_size = DEF_PAGE_SIZE;
 static int downstream_port = DEF_PORT;
 static char* downstream_address = DEFAULT_SERVER_ADDRESS;
+static int multiplex = 0;
+static int max_memory = 0;
+static int zero_copy = 0;
 int sigpipe_flag = 0; // Set to 'true' by signal handler.
 
 Session* session = NULL;
-extern void *client_send_thread (void* handle);
 
 
 struct poptOption options[] = {
@@ -65,12 +69,12 @@ struct poptOption options[] = {
   { "size",        's',  POPT_ARG_INT,    &page_size,       0,   "Page size for buffering measurements", NULL},
   { "dstport",     'p',  POPT_ARG_INT,    &downstream_port, 0,   "Downstream OML server port",       NULL},
   { "dstaddress",  'a',  POPT_ARG_STRING, &downstream_address,  0,   "Downstream OML server address",    DEFAULT_SERVER_ADDRESS },
+  { "multiplex",   'm',  POPT_ARG_INT,    &multiplex,       0,   "Number of connections to share between all clients (0: one per client)", NULL},
+  { "max-memory",  'M',  POPT_ARG_INT,    &max_memory,      0,   "Memory for queued measurements, in MiB, before spooling them to disk (0: no limit)", NULL},
+  { "zero-copy",   'z',  POPT_ARG_NONE,   &zero_copy,       0,   "Splice binary streams straight through while sending", NULL},
   { NULL,          0,    0,               NULL,             0,   NULL,                                   NULL }
 };
 
-void
-proxy_message_loop (const char *client_id, Client *client, void *buf, size_t size);
-
 /** Callback function called when the socket receive some data
  * \param source the socket event
  * \param handle the client handler
@@ -99,9 +103,7 @@ client_callback(SockEvtSource *source, void *handle, void *buf, int buf_size)
 
   fwrite (buf, sizeof (char), buf_size, self->file);
 
-  pthread_mutex_lock (&self->mutex);
-  pthread_cond_signal (&self->condvar);
-  pthread_mutex_unlock (&self->mutex);
+  client_sender_kick (self);
 }
 
 /** Callback function when the status of the socket change
@@ -121,13 +123,12 @@ status_callback(SockEvtSource *source, SocketStatus status, int error, void *han
         socket_close (source->socket);
         logdebug("socket '%s' closed\n", source->name);
         eventloop_socket_remove (source); // Note:  this free()'s source!
+        self->recv_event = NULL;
       }
 
-      /* Signal the sender thread for this client that the client disconnected */
-      pthread_mutex_lock (&self->mutex);
+      /* Let the sender flush the remaining messages, and clean up */
       self->state = C_DISCONNECTED;
-      pthread_cond_signal (&self->condvar);
-      pthread_mutex_unlock (&self->mutex);
+      client_sender_kick (self);
       break;
     default:
       break;
@@ -143,6 +144,7 @@ void
 on_connect (Socket* client_sock, void* handle)
 {
   (void)handle;  // This parameter is unused
+  static unsigned int nclients = 0;
   MString *mstr = mstring_create ();
 
   mstring_sprintf (mstr,"%s.%d", resultfile_name, session->client_count);
@@ -156,11 +158,35 @@ on_connect (Socket* client_sock, void* handle)
 
   session_add_client (session, client);
   client->session = session;
+  if (session->ndownstreams > 0) {
+    downstream_add_client (&session->downstreams[nclients++ % session->ndownstreams], client);
+  }
 
   client->recv_event = eventloop_on_read_in_channel(client_sock, client_callback,
                                                     status_callback, (void*)client);
+}
 
-  pthread_create (&client->thread, NULL, client_send_thread, (void*)client);
+/** Retry connecting clients to the downstream server.
+ *
+ * Called every second by the EventLoop.
+ *
+ * \param source TimerEvtSource which expired
+ * \param handle pointer to the Session
+ * \see client_sender_kick
+ */
+void
+retry_callback (TimerEvtSource *source, void *handle)
+{
+  Session *proxy = (Session*)handle;
+  Client *current = proxy->clients;
+  (void)source;
+
+  while (current) {
+    if (current->sender_state == S_DISCONNECTED) {
+      client_sender_kick (current);
+    }
+    current = current->next;
+  }
 }
 
 /*
@@ -240,20 +266,20 @@ stdin_handler(SockEvtSource* source, void* handle, void* buf, int buf_size)
   }
 
   /*
-   * If we're in sending state, wake up the client sender threads
-   * so that they will start sending to the downstream server.  We do
-   * this even if the state was already ProxyState_SENDING because
-   * some of the clients might have dropped back to idle due to
-   * disconnection from the upstream server.
+   * If we're in sending state, wake up the client senders so that they
+   * will start sending to the downstream server.  We do this even if the
+   * state was already ProxyState_SENDING because some of the clients
+   * might have dropped back to idle due to disconnection from the
+   * upstream server.  When paused, downstream connections are closed.
    */
-  if (session->state == ProxyState_SENDING) {
-    Client *current = session->clients;
-    while (current) {
-      pthread_mutex_lock (&current->mutex);
-      pthread_cond_signal (&current->condvar);
-      pthread_mutex_unlock (&current->mutex);
-      current = current->next;
+  Client *current = session->clients;
+  while (current) {
+    if (session->state == ProxyState_SENDING) {
+      client_sender_kick (current);
+    } else if (session->state == ProxyState_PAUSED) {
+      client_sender_disconnect (current);
     }
+    current = current->next;
   }
 }
 
@@ -349,6 +375,18 @@ main(int argc, const char *argv[])
   memset(session, 0, sizeof(Session));
 
   session->state = ProxyState_PAUSED;
+  session->downstream_address = downstream_address;
+  session->downstream_port = downstream_port;
+  /* Resolved once and for all, not to block the EventLoop */
+  if (sender_resolve (downstream_address, downstream_port) == -1) {
+    logwarn("Could not resolve downstream server %s, will retry when connecting\n", downstream_address);
+  }
+  session->memory_limit = (size_t)max_memory * 1024 * 1024;
+  session->zero_copy = zero_copy;
+  if (multiplex > 0 && downstreams_new (session, multiplex) == NULL) {
+    logerror("Unable to allocate %d multiplexed downstream connections\n", multiplex);
+    return -1;
+  }
 
   serverSock = socket_server_new("proxy_server", NULL, listen_service, on_connect, NULL);
   controlSock = socket_server_new("proxy_server_control", NULL, control_service, on_control_connect, NULL);
@@ -359,6 +397,7 @@ main(int argc, const char *argv[])
 
   } else {
     eventloop_on_stdin(stdin_handler, session);
+    eventloop_every("downstream_retry", 1, retry_callback, session);
     eventloop_run();
     ret = 0;
   }
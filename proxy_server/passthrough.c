@@ -0,0 +1,423 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file passthrough.c
+ * \brief Forwards binary streams without copying them through the proxy's memory.
+ *
+ * Once a Client's queue has been completely sent, and as long as the session
+ * is in the SENDING state, the data of a binary stream doesn't need to be
+ * parsed: only message boundaries matter, so that the queue can take over
+ * again if the downstream connection is lost or the session paused.
+ *
+ * In passthrough mode, the EventLoop doesn't read from the client's socket.
+ * Instead, the incoming data is looked at with MSG_PEEK, and only whole
+ * messages are moved into pass_pipe with splice(2). When the downstream
+ * socket is writeable, the content of pass_pipe is duplicated into pass_tx
+ * with tee(2), and pass_tx is spliced to the socket. Once that copy has been
+ * completely sent, the original data is spliced from pass_pipe to the result
+ * file. The data is therefore never copied to user space.
+ *
+ * When passthrough stops, any data still in pass_pipe is written to the file
+ * and queued as usual, minus what had already been sent.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#define _GNU_SOURCE /* splice(2), tee(2), pipe2(2), F_SETPIPE_SZ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "ocomm/o_log.h"
+#include "session.h"
+#include "proxy_client.h"
+
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+
+/** Requested size of the pipes */
+#define PASSTHROUGH_PIPE_SIZE (1024 * 1024)
+/** Maximal amount of data to look at at once */
+#define PASSTHROUGH_PEEK (64 * 1024)
+/** Size of the buffer used to read the pipes back */
+#define PASSTHROUGH_COPY (16 * 1024)
+
+/** Stop receiving from a client until some data has been committed.
+ *
+ * \param client Client to throttle
+ */
+static void
+client_passthrough_throttle (Client *client)
+{
+  if (!client->pass_throttled) {
+    eventloop_socket_activate (client->recv_event, 0);
+    client->pass_throttled = 1;
+  }
+}
+
+/** Move data from the client's socket into its pipe.
+ *
+ * This is the monitoring callback of the client's Channel while in
+ * passthrough mode. The data is peeked at, after the start of any partial
+ * message already in pass_pipe, to keep track of the end of the last complete
+ * message; it is then spliced into pass_pipe. The partial message at the end,
+ * if any, is kept in the client's MBuffer. If the data could not be parsed,
+ * or the stream has ended, passthrough is stopped, so the EventLoop reads
+ * from the socket, and handles the situation, as usual.
+ *
+ * \copydetails o_el_monitor_socket_callback
+ */
+static void
+client_passthrough_receive (SockEvtSource *source, void *handle)
+{
+  Client *client = (Client*)handle;
+  int fd = socket_get_sockfd (client->recv_socket);
+  MBuffer *mbuf = client->mbuf;
+  struct oml_message msg;
+  size_t room;
+  ssize_t result;
+  int length;
+  (void)source;
+
+  if (client->pass_owed == 0) {
+    room = client->pass_capacity - client->pass_queued;
+    if (room > PASSTHROUGH_PEEK) {
+      room = PASSTHROUGH_PEEK;
+    }
+    if (room == 0 && client->pass_ready > 0) {
+      client_passthrough_throttle (client);
+      return;
+    } else if (room == 0) {
+      logdebug ("'%s': Message larger than %zu bytes, stopping passthrough\n",
+                client->name, client->pass_capacity);
+      goto stop;
+    }
+
+    if (mbuf_check_resize (mbuf, room) == -1)
+      goto stop;
+    result = recv (fd, mbuf_wrptr (mbuf), room, MSG_PEEK);
+    if (result == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return;
+    } else if (result <= 0) {
+      goto stop;
+    }
+    mbuf_write_advance (mbuf, result);
+
+    while ((length = client->msg_start (&msg, mbuf)) > 0) {
+      mbuf_reset_read (mbuf);
+      mbuf_read_skip (mbuf, length);
+      mbuf_consume_message (mbuf);
+    }
+    if (length == -1)
+      goto stop; // Let the receiver report the error
+    mbuf_repack_message2 (mbuf);
+
+    client->pass_owed = result;
+  }
+
+  result = splice (fd, NULL, client->pass_pipe[1], NULL, client->pass_owed,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (result == -1 && errno == EAGAIN && client->pass_ready > 0) {
+    client_passthrough_throttle (client); // Pipe full
+    return;
+  } else if (result <= 0) {
+    logwarn ("'%s': Could not splice received data: %s\n", client->name,
+             result == 0 ? "unexpected end of stream" : strerror (errno));
+    goto stop;
+  }
+  client->pass_owed -= result;
+  client->pass_queued += result;
+  if (client->pass_owed == 0 && client->pass_queued - mbuf_fill (mbuf) > client->pass_ready) {
+    client->pass_ready = client->pass_queued - mbuf_fill (mbuf);
+    client_sender_kick (client);
+  }
+  return;
+
+ stop:
+  client_passthrough_stop (client);
+  client_sender_kick (client);
+}
+
+/** Start forwarding a client's data without queueing it, if possible.
+ *
+ * This is only done for binary streams of clients which have their own
+ * downstream connection, when the session is sending and all queued data has
+ * been sent. The start of a partial message already received is moved to the
+ * pipe.
+ *
+ * \param client Client to consider
+ * \return 0 if passthrough has started, -1 otherwise
+ */
+int
+client_passthrough_start (Client *client)
+{
+  size_t length = mbuf_message_length (client->mbuf);
+
+  if (client->passthrough)
+    return 0;
+  if (!client->session || !client->session->zero_copy ||
+      client->session->state != ProxyState_SENDING ||
+      client->content != CONTENT_BINARY || client->state != C_DATA ||
+      client->downstream || client->sender_state != S_CONNECTED ||
+      client->recv_event == NULL || client->file == NULL ||
+      client->messages->length > 0 || (client->spool && client->spool->count > 0) ||
+      mbuf_rd_remaining (client->send_headers) > 0 || client->send_remaining > 0)
+    return -1;
+
+  if (pipe2 (client->pass_pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+    logwarn ("'%s': Could not create pipe for passthrough: %s\n", client->name, strerror (errno));
+    return -1;
+  }
+  if (pipe2 (client->pass_tx, O_NONBLOCK | O_CLOEXEC) == -1) {
+    logwarn ("'%s': Could not create pipe for passthrough: %s\n", client->name, strerror (errno));
+    close (client->pass_pipe[0]);
+    close (client->pass_pipe[1]);
+    return -1;
+  }
+
+  /* pass_tx must be able to take all of pass_pipe at once */
+  fcntl (client->pass_pipe[1], F_SETPIPE_SZ, PASSTHROUGH_PIPE_SIZE);
+  fcntl (client->pass_tx[1], F_SETPIPE_SZ, fcntl (client->pass_pipe[1], F_GETPIPE_SZ));
+  client->pass_capacity = fcntl (client->pass_tx[1], F_GETPIPE_SZ);
+  if (fcntl (client->pass_pipe[1], F_GETPIPE_SZ) < (int)client->pass_capacity) {
+    client->pass_capacity = fcntl (client->pass_pipe[1], F_GETPIPE_SZ);
+  }
+
+  mbuf_repack_message2 (client->mbuf);
+  if (length > 0 && write (client->pass_pipe[1], mbuf_message (client->mbuf), length) != (ssize_t)length) {
+    logwarn ("'%s': Could not move %zu bytes to pipe for passthrough\n", client->name, length);
+    close (client->pass_pipe[0]);
+    close (client->pass_pipe[1]);
+    close (client->pass_tx[0]);
+    close (client->pass_tx[1]);
+    return -1;
+  }
+
+  fflush (client->file);
+  client->fd_file = fileno (client->file);
+
+  client->pass_queued = client->pass_written = length;
+  client->pass_ready = client->pass_inflight = client->pass_unsent = client->pass_owed = 0;
+  client->pass_throttled = 0;
+  client->passthrough = 1;
+  eventloop_socket_set_monitor (client->recv_event, client_passthrough_receive);
+
+  loginfo ("'%s': Forwarding data with splice(2), using %zu bytes pipes\n",
+           client->name, client->pass_capacity);
+
+  return 0;
+}
+
+/** Write sent data from a client's pipe to its result file.
+ *
+ * \param client Client to consider
+ * \return 0 on success, -1 otherwise
+ */
+static int
+client_passthrough_commit (Client *client)
+{
+  char buf[PASSTHROUGH_COPY];
+  size_t length;
+  ssize_t result;
+
+  while (client->pass_inflight > 0) {
+    /* Never take more than was sent from the pipe */
+    length = client->pass_inflight < sizeof (buf) ? client->pass_inflight : sizeof (buf);
+    if (client->pass_written > 0) {
+      /* Written when it was received, before passthrough started */
+      result = read (client->pass_pipe[0], buf,
+                     client->pass_written < length ? client->pass_written : length);
+      if (result > 0) {
+        client->pass_written -= result;
+      }
+    } else {
+      result = splice (client->pass_pipe[0], NULL, client->fd_file, NULL, client->pass_inflight,
+                       SPLICE_F_MOVE);
+    }
+    if (result == -1 && errno == EINVAL) {
+      /* The file system doesn't support splice(2) */
+      result = read (client->pass_pipe[0], buf, length);
+      if (result > 0 && (fwrite (buf, 1, result, client->file) != (size_t)result ||
+                         fflush (client->file) != 0)) {
+        result = -1;
+      }
+    }
+    if (result <= 0) {
+      logwarn ("'%s': Could not write to result file: %s\n", client->name,
+               result == 0 ? "unexpected end of pipe" : strerror (errno));
+      return -1;
+    }
+    if ((size_t)result > client->pass_inflight) {
+      logwarn ("'%s': Committed %zd bytes, but only %zu were sent\n", client->name,
+               result, client->pass_inflight);
+      result = client->pass_inflight;
+    }
+    client->pass_inflight -= result;
+    client->pass_ready -= result;
+    client->pass_queued -= result;
+  }
+
+  if (client->pass_throttled) {
+    eventloop_socket_activate (client->recv_event, 1);
+    client->pass_throttled = 0;
+  }
+
+  return 0;
+}
+
+/** Send as much of a client's pipe as the downstream socket accepts.
+ *
+ * \param client Client for which to send data
+ * \return 1 if all data was sent, 0 if the socket is full, -1 on error
+ * \see client_sender_drain
+ */
+int
+client_passthrough_send (Client *client)
+{
+  ssize_t result;
+
+  if (!client->passthrough)
+    return 1;
+
+  for (;;) {
+    if (client->pass_inflight == 0) {
+      if (client->pass_ready == 0)
+        return 1;
+
+      result = tee (client->pass_pipe[0], client->pass_tx[1], client->pass_ready, SPLICE_F_NONBLOCK);
+      if (result <= 0) {
+        logwarn ("'%s': Could not duplicate received data: %s\n", client->name,
+                 result == 0 ? "unexpected end of pipe" : strerror (errno));
+        return -1;
+      }
+      client->pass_inflight = client->pass_unsent = result;
+    }
+
+    while (client->pass_unsent > 0) {
+      result = splice (client->pass_tx[0], NULL, client->send_socket, NULL, client->pass_unsent,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (result == -1) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+      }
+      logdebug ("'%s': Spliced %zd/%zu bytes\n", client->name, result, client->pass_unsent);
+      client->pass_unsent -= result;
+    }
+
+    if (client_passthrough_commit (client) == -1)
+      return -1;
+  }
+}
+
+/** Queue data read back from a client's pipe or socket, and write it to the result file.
+ *
+ * \param client Client to consider
+ * \param buf data to queue
+ * \param length length of the data
+ */
+static void
+client_passthrough_requeue (Client *client, char *buf, size_t length)
+{
+  size_t written = client->pass_written < length ? client->pass_written : length;
+
+  fwrite (buf + written, 1, length - written, client->file);
+  client->pass_written -= written;
+  proxy_message_loop (client->name, client, buf, length);
+  mbuf_repack_message (client->mbuf);
+}
+
+/** Return a client to queueing the data it receives.
+ *
+ * The data which was received but not written to the result file yet is
+ * queued. The part of it which has already been sent downstream is then
+ * skipped, as in client_sender_advance.
+ *
+ * \param client Client to consider
+ */
+void
+client_passthrough_stop (Client *client)
+{
+  char buf[PASSTHROUGH_COPY];
+  size_t sent, length;
+  ssize_t result;
+
+  if (!client->passthrough)
+    return;
+
+  client->passthrough = 0;
+  sent = client->pass_inflight - client->pass_unsent;
+
+  if (client->recv_event) {
+    eventloop_socket_set_monitor (client->recv_event, NULL);
+    if (client->pass_throttled) {
+      eventloop_socket_activate (client->recv_event, 1);
+    }
+  }
+  client->pass_throttled = 0;
+  mbuf_clear2 (client->mbuf, 0);
+
+  while ((result = read (client->pass_pipe[0], buf, sizeof (buf))) > 0) {
+    client_passthrough_requeue (client, buf, result);
+  }
+  /* The rest of the last messages, already looked at, are in the socket */
+  while (client->pass_owed > 0) {
+    length = client->pass_owed < sizeof (buf) ? client->pass_owed : sizeof (buf);
+    result = recv (socket_get_sockfd (client->recv_socket), buf, length, 0);
+    if (result <= 0)
+      break;
+    client_passthrough_requeue (client, buf, result);
+    client->pass_owed -= result;
+  }
+
+  close (client->pass_pipe[0]);
+  close (client->pass_pipe[1]);
+  close (client->pass_tx[0]);
+  close (client->pass_tx[1]);
+  client->pass_queued = client->pass_ready = client->pass_written = 0;
+  client->pass_inflight = client->pass_unsent = 0;
+  client->pass_owed = 0;
+
+  loginfo ("'%s': Stopped forwarding data with splice(2); %zu messages queued\n",
+           client->name, client->messages->length);
+
+  client_sender_advance (client, sent);
+}
+
+#else /* HAVE_SPLICE && HAVE_TEE */
+
+int
+client_passthrough_start (Client *client)
+{
+  (void)client;
+  return -1;
+}
+
+int
+client_passthrough_send (Client *client)
+{
+  (void)client;
+  return 1;
+}
+
+void
+client_passthrough_stop (Client *client)
+{
+  (void)client;
+}
+
+#endif /* HAVE_SPLICE && HAVE_TEE */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -12,11 +12,13 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "ocomm/o_log.h"
 #include "mem.h"
 #include "mbuf.h"
 #include "cbuf.h"
+#include "session.h"
 #include "proxy_client.h"
 #include "message_queue.h"
 
@@ -62,10 +64,13 @@ client_new (Socket* client_sock, int page_size, char* file_name,
   self->file_name =  oml_strndup (file_name, strlen (file_name));
 
   self->recv_socket = client_sock;
+  if (client_sock) {
+    snprintf (self->name, sizeof (self->name), "%s", client_sock->name);
+  }
 
-  /* FIXME:  Return value checking */
-  pthread_mutex_init (&self->mutex, NULL);
-  pthread_cond_init (&self->condvar, NULL);
+  self->send_socket = -1;
+  self->sender_state = S_DISCONNECTED;
+  self->send_headers = mbuf_create ();
 
   return self;
 }
@@ -92,13 +97,35 @@ client_free (Client *client)
     header = next;
   }
 
+  if (client->session) {
+    struct msg_queue_node *node = msg_queue_head (client->messages);
+    size_t i;
+    for (i = 0; i < client->messages->length; i++, node = node->next) {
+      client->session->memory_used -= node->msg->length;
+    }
+  }
   msg_queue_destroy (client->messages);
   cbuf_destroy (client->cbuf);
+  msg_spool_destroy (client->spool);
 
-  pthread_cond_destroy (&client->condvar);
-  pthread_mutex_destroy (&client->mutex);
+  if (client->passthrough) {
+    close (client->pass_pipe[0]);
+    close (client->pass_pipe[1]);
+    close (client->pass_tx[0]);
+    close (client->pass_tx[1]);
+  }
 
-  socket_free (client->recv_socket);
+  if (client->send_event) {
+    eventloop_socket_remove (client->send_event);
+  }
+  if (client->send_socket >= 0) {
+    close (client->send_socket);
+  }
+  mbuf_destroy (client->send_headers);
+
+  if (client->recv_socket) {
+    socket_free (client->recv_socket);
+  }
 
   oml_free (client);
 }
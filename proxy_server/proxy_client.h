@@ -25,7 +25,6 @@
 #define CLIENT_H__
 
 #include <stdio.h>
-#include <pthread.h>
 #include <mbuf.h>
 #include <cbuf.h>
 #include <headers.h>
@@ -34,6 +33,7 @@
 #include <ocomm/o_socket.h>
 #include <ocomm/o_eventloop.h>
 #include "message_queue.h"
+#include "message_spool.h"
 
 enum ContentType {
   CONTENT_NONE,
@@ -49,6 +49,16 @@ enum ClientState {
   C_DISCONNECTED
 };
 
+/** State of the connection to the downstream OML server \see sender.c */
+enum SenderState {
+  /** No connection, nor attempt in progress */
+  S_DISCONNECTED,
+  /** Non-blocking connect(2) in progress */
+  S_CONNECTING,
+  /** Connected; headers and messages can be sent */
+  S_CONNECTED
+};
+
 struct _client;
 struct _session;
 
@@ -62,12 +72,8 @@ typedef struct _client {
   struct _session *session;
 
   /*
-   * The following data members are manipulated without locking in the
-   * main thread; they should not be modified from the sender thread.
-   *
-   * state, content, mbuf, and msg_start should only be manipulated in
-   * the main thread.  headers and header_table can safely be read
-   * from the other threads without locking if state == C_DATA.
+   * All data members are manipulated from the EventLoop's thread, both when
+   * receiving from the upstream client, and sending to the downstream server.
    */
   enum ClientState state;
   enum ContentType content;
@@ -78,30 +84,60 @@ typedef struct _client {
 
   SockEvtSource *recv_event;
   Socket*     recv_socket;
-  int         send_socket;
-  int         sender_connected;
 
-  /*
-   * All the data members below must be locked and signalled properly
-   * using the mutex and condvar
-   */
+  SockEvtSource *send_event;  // Only active when there is data to send
+  int         send_socket;    // -1 when not connected
+  enum SenderState sender_state;
+  MBuffer    *send_headers;   // Headers not yet sent downstream
+  struct cbuffer_cursor send_cursor; // Position in the message being sent
+  size_t      send_remaining; // Unsent bytes of that message, 0 if none started
+
+  struct _downstream *downstream; // Multiplexed connection, if any (see downstream.c)
+  uint32_t    mux_channel;    // Channel of this client on the downstream connection
+  int         mux_open;       // Whether the channel is open on the current connection
+  size_t      mux_inflight;   // Queued messages being written, consumed once sent
+
   struct msg_queue *messages;
   CBuffer    *cbuf;
+  struct msg_spool *spool;    // Messages received after those in cbuf, if any
+
+  int         passthrough;    // Whether data is spliced straight through (see passthrough.c)
+  int         pass_pipe[2];   // Whole messages received, not yet written to the file
+  int         pass_tx[2];     // Copy of the head of pass_pipe, being sent downstream
+  size_t      pass_capacity;  // Size of the pipes
+  size_t      pass_queued;    // Bytes in pass_pipe, ending with the partial message in mbuf
+  size_t      pass_ready;     // Bytes of whole messages at the head of pass_pipe
+  size_t      pass_written;   // Bytes at the head of pass_pipe already in the file
+  size_t      pass_inflight;  // Bytes of pass_pipe copied to pass_tx
+  size_t      pass_unsent;    // Bytes still in pass_tx
+  size_t      pass_owed;      // Bytes of whole messages still to move from the socket
+  int         pass_throttled; // Whether reception is suspended until the pipe drains
 
   FILE *      file;
   int         fd_file;
   char*       file_name;
 
-  pthread_t       thread; // The sender thread, see sender.c
-  pthread_mutex_t mutex;
-  pthread_cond_t  condvar;
-
   struct _client* next;
 } Client;
 
 Client* client_new (Socket* client_sock, int page_size, char* file_name,
                     int server_port, char* server_address);
 void client_free (Client *client);
+void store_received_message (Client *client, struct oml_message *msg, char *buf, size_t length);
+void client_spool_reload (Client *client);
+void proxy_message_loop (const char *client_id, Client *client, void *buf, size_t size);
+
+int sender_resolve (const char *address, int port);
+int sender_connect (const char *address, int port);
+int client_send_headers (Client *client);
+void client_message_consume (Client *client);
+void client_sender_advance (Client *client, size_t sent);
+void client_sender_kick (Client *client);
+void client_sender_disconnect (Client *client);
+
+int client_passthrough_start (Client *client);
+int client_passthrough_send (Client *client);
+void client_passthrough_stop (Client *client);
 
 
 #endif /* CLIENT_H__ */
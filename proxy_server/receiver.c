@@ -20,6 +20,8 @@
 #include "text.h"
 #include "binary.h"
 #include "message_queue.h"
+#include "message_spool.h"
+#include "session.h"
 #include "proxy_client.h"
 
 /** Read a line from mbuf.
@@ -119,18 +121,19 @@ content_from_string (const char *str)
   return CONTENT_NONE;
 }
 
-/**
- *  Store a received OML message into the client's message queue.
+/** Store a message into the in-memory part of the client's message queue.
  *
+ * \param client Client which received the message
+ * \param msg description of the message
+ * \param buf the message itself
+ * \param length length of the message
  */
-void
-store_received_message (Client *client, struct oml_message *msg, char *buf, size_t length)
+static void
+store_in_memory (Client *client, struct oml_message *msg, char *buf, size_t length)
 {
   struct msg_queue *queue = client->messages;
   struct msg_queue_node *node;
 
-  pthread_mutex_lock (&client->mutex);
-
   node = msg_queue_add (queue);
   cbuf_write_cursor (client->cbuf, &node->cursor);
   cbuf_write (client->cbuf, buf, length);
@@ -138,7 +141,99 @@ store_received_message (Client *client, struct oml_message *msg, char *buf, size
   node->msg = oml_malloc (sizeof (struct oml_message));
   *node->msg = *msg;
 
-  pthread_mutex_unlock (&client->mutex);
+  if (client->session) {
+    client->session->memory_used += length;
+  }
+}
+
+/** Store a message into the spool of the client, creating it if needed.
+ *
+ * \param client Client which received the message
+ * \param msg description of the message
+ * \param buf the message itself
+ * \param length length of the message
+ * \return 0 on success, -1 otherwise
+ */
+static int
+store_in_spool (Client *client, struct oml_message *msg, char *buf, size_t length)
+{
+  if (client->spool == NULL) {
+    char path[FILENAME_MAX];
+    snprintf (path, sizeof (path), "%s.spool", client->file_name);
+    client->spool = msg_spool_create (path);
+    if (client->spool == NULL)
+      return -1;
+  }
+
+  if (client->spool->count == 0) {
+    loginfo ("'%s': Memory limit reached, spooling messages to '%s'\n",
+             client->name, client->spool->path);
+  }
+
+  return msg_spool_append (client->spool, msg, buf, length);
+}
+
+/**
+ *  Store a received OML message into the client's message queue.
+ *
+ *  Messages are kept in memory until the session's memory limit is reached;
+ *  they are then appended to the client's spool, and so are all subsequent
+ *  messages until the spool has been read back. A message is always kept in
+ *  memory if the client has none queued there.
+ *
+ *  \see client_spool_reload
+ */
+void
+store_received_message (Client *client, struct oml_message *msg, char *buf, size_t length)
+{
+  Session *session = client->session;
+
+  /* The spool is only used behind in-memory messages, whose consumption
+   * triggers reloading it */
+  if (client->messages->length > 0 &&
+      ((client->spool && client->spool->count > 0) ||
+       (session && session->memory_limit > 0 &&
+        session->memory_used + length > session->memory_limit))) {
+    if (store_in_spool (client, msg, buf, length) == 0)
+      return;
+    logwarn ("'%s': Could not spool message, keeping it in memory\n", client->name);
+  }
+
+  store_in_memory (client, msg, buf, length);
+}
+
+/** Move spooled messages back to the in-memory queue, within the session's memory limit.
+ *
+ * At least one message is moved if the in-memory queue is empty, so the
+ * client can always progress.
+ *
+ * \param client Client to consider
+ * \see store_received_message
+ */
+void
+client_spool_reload (Client *client)
+{
+  Session *session = client->session;
+  struct oml_message msg;
+  char *buf;
+  int length;
+
+  if (client->spool == NULL)
+    return;
+
+  while (client->spool->count > 0 &&
+         (client->messages->length == 0 || session == NULL || session->memory_limit == 0 ||
+          session->memory_used + client->spool->bytes / client->spool->count <= session->memory_limit)) {
+    length = msg_spool_shift (client->spool, &msg, &buf);
+    if (length <= 0) {
+      logerror ("'%s': Could not read back spooled messages; %zu messages lost\n",
+                client->name, client->spool->count);
+      msg_spool_destroy (client->spool);
+      client->spool = NULL;
+      return;
+    }
+    store_in_memory (client, &msg, buf, length);
+  }
 }
 
 void
@@ -205,8 +300,10 @@ proxy_message_loop (const char *client_id, Client *client, void *buf, size_t siz
       break;
     }
     mbuf_consume_message (mbuf); // Next message starts after the headers.
-    client->state = C_DATA;
-    break;
+    if (client->state != C_PROTOCOL_ERROR) {
+      client->state = C_DATA;
+    }
+    goto loop;
   case C_DATA:
     result = client->msg_start (&msg, mbuf);
     if (result == -1) {
@@ -229,9 +326,9 @@ proxy_message_loop (const char *client_id, Client *client, void *buf, size_t siz
     store_received_message (client, &msg, (char*)mbuf_rdptr (mbuf), message_length);
     mbuf_read_skip (mbuf, message_length);
     mbuf_consume_message (mbuf);
-    break;
+    goto loop; // Process any other complete message already received
   case C_PROTOCOL_ERROR:
-    logdebug ("'%s': protocol error!\n");
+    logdebug ("'%s': protocol error!\n", client_id);
     break;
   default:
     logerror ("'%s': unknown client state '%d'\n", client_id, client->state);
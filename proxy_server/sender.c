@@ -8,104 +8,164 @@
  * in the License.
  */
 /** \file sender.c
- * \brief Implements half-async sender which uses a background thread to send messages to the OML server.
+ * \brief Implements the asynchronous sender forwarding messages to the OML server.
+ *
+ * Downstream connections are non-blocking sockets monitored by the EventLoop,
+ * so all clients are served from the main thread. A Client's output Channel
+ * is only activated when there are pending headers or messages; they are then
+ * sent as the socket becomes writeable, and the Channel is deactivated again
+ * once the queue is empty. From then on, binary streams may bypass the queue
+ * altogether (see passthrough.c).
  */
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
-#include <pthread.h>
-#include <assert.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
-//#include "ocomm/o_socket.h"
 #include "ocomm/o_log.h"
 #include "mem.h"
 #include "session.h"
 #include "proxy_client.h"
+#include "downstream.h"
+
+/** Maximum number of chunks of data to send at once */
+#define SENDER_MAX_IOV 64
+/** Amount of data above which no more messages are added to a send */
+#define SENDER_MAX_BATCH (64 * 1024)
 
-extern int sigpipe_flag;
+static void client_sender_status (SockEvtSource *source, SocketStatus status, int error, void *handle);
 
+/** Address of the downstream server, resolved once \see sender_resolve */
+static struct {
+  char *address;
+  int port;
+  int family, socktype, protocol;
+  struct sockaddr_storage addr;
+  socklen_t addrlen;
+} downstream;
+
+/** Resolve the address of the downstream server, and remember it.
+ *
+ * getaddrinfo(3) blocks, and all clients are forwarded from the main thread,
+ * so this is done once, at startup, rather than for each connection.
+ *
+ * \param address address of the downstream server
+ * \param port port of the downstream server
+ * \return 0 on success, -1 otherwise
+ * \see sender_connect
+ */
 int
-client_sender_connect (Client *client)
+sender_resolve (const char *address, int port)
 {
   int result = 0;
   struct addrinfo hints;
   struct addrinfo *servinfo;
-  char port[6];
+  char service[6];
 
-  if (client->downstream_port > 65535)
+  if (port < 0 || port > 65535)
     return -1;
 
-  snprintf (port, 5, "%d", client->downstream_port);
+  snprintf (service, sizeof (service), "%d", port);
 
   bzero (&hints, sizeof (hints));
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
 
-  result = getaddrinfo (client->downstream_addr, port, &hints, &servinfo);
+  result = getaddrinfo (address, service, &hints, &servinfo);
   if (result != 0) {
-    logerror ("Could not resolve downstream host %s:%s -- %s\n", client->downstream_addr, port,
-              strerror (errno));
+    logerror ("Could not resolve downstream host %s:%s -- %s\n", address, service,
+              gai_strerror (result));
     return -1;
   }
 
   /* Take the first address returned */
-  int s = socket (servinfo->ai_family, servinfo->ai_socktype, servinfo->ai_protocol);
+  if (downstream.address)
+    oml_free (downstream.address);
+  downstream.address = oml_strndup (address, strlen (address));
+  downstream.port = port;
+  downstream.family = servinfo->ai_family;
+  downstream.socktype = servinfo->ai_socktype;
+  downstream.protocol = servinfo->ai_protocol;
+  downstream.addrlen = servinfo->ai_addrlen;
+  memcpy (&downstream.addr, servinfo->ai_addr, servinfo->ai_addrlen);
+  freeaddrinfo (servinfo);
+
+  return downstream.address ? 0 : -1;
+}
+
+/** Start a non-blocking connection to the downstream server.
+ *
+ * The address is only resolved if it differs from that passed to
+ * sender_resolve, or if that failed.
+ *
+ * \param address address of the downstream server
+ * \param port port of the downstream server
+ * \return a non-blocking socket, connected or connecting, or -1 on error
+ */
+int
+sender_connect (const char *address, int port)
+{
+  int s, result;
+
+  if ((!downstream.address || downstream.port != port || strcmp (downstream.address, address)) &&
+      sender_resolve (address, port) == -1)
+    return -1;
+
+  s = socket (downstream.family, downstream.socktype, downstream.protocol);
   if (s == -1) {
-    logerror ("Could not create socket for downstream host %s:%s -- %s\n", client->downstream_addr, port,
+    logerror ("Could not create socket for downstream host %s:%d -- %s\n", address, port,
               strerror (errno));
-    freeaddrinfo (servinfo);
     return -1;
   }
+  fcntl (s, F_SETFL, fcntl (s, F_GETFL, 0) | O_NONBLOCK);
 
-  client->send_socket = s;
-  result = connect (client->send_socket, servinfo->ai_addr, servinfo->ai_addrlen);
-  if (result == -1) {
-    logerror ("Could not connect to downstream server: %s:%s -- %s\n", client->downstream_addr, port,
+  result = connect (s, (struct sockaddr*)&downstream.addr, downstream.addrlen);
+  if (result == -1 && errno != EINPROGRESS) {
+    logdebug ("Could not connect to downstream server: %s:%d -- %s\n", address, port,
               strerror (errno));
-    freeaddrinfo (servinfo);
+    close (s);
     return -1;
   }
 
-  freeaddrinfo (servinfo);
-  return 0;
+  return s;
 }
 
+/** Start a non-blocking connection of a client to the downstream server.
+ *
+ * The Client's output Channel is created, so the EventLoop reports when the
+ * connection is established (or has failed).
+ *
+ * \param client Client to connect
+ * \return 0 if the connection is established or in progress, -1 otherwise
+ * \see client_sender_status
+ */
 int
-client_send_header (Client *client, struct header *header)
+client_sender_connect (Client *client)
 {
-  const char *tagstr = tag_to_string (header->tag);
-  char *value = header->value;
-  char *buf = oml_malloc (strlen (tagstr) + strlen (value) + 4);
-  if (!buf)
-    return -1;
+  int s = sender_connect (client->downstream_addr, client->downstream_port);
 
-  strcpy (buf, tagstr);
-  strcat (buf, ": ");
-  strcat (buf, value);
-  strcat (buf, "\n");
-
-  int count = strlen (buf);
+  if (s == -1)
+    return -1;
 
-  do {
-    logdebug ("Sending %d bytes of header\n", count);
-    int result = send (client->send_socket, buf, count, 0);
-    if (result == -1) {
-      oml_free (buf);
-      return -1;
-    }
-    count -= result;
-  } while (count > 0);
-  oml_free (buf);
+  client->send_socket = s;
+  client->sender_state = S_CONNECTING;
+  client->send_event = eventloop_on_out_fd (client->name, s, client_sender_status, client);
 
   return 0;
 }
 
+/** Queue the connection headers of a client for sending downstream.
+ *
+ * \param client Client for which to prepare the headers
+ * \return 0 on success, -1 otherwise
+ */
 int
 client_send_headers (Client *client)
 {
@@ -117,126 +177,343 @@ client_send_headers (Client *client)
     H_APP_NAME,
   };
   unsigned int i = 0;
+  struct header *header;
+
+  mbuf_clear (client->send_headers);
 
   for (i = 0; i < sizeof (header_tags) / sizeof (header_tags[0]); i++) {
-    if (client_send_header (client, client->header_table[header_tags[i]]) == -1)
+    header = client->header_table[header_tags[i]];
+    if (mbuf_print (client->send_headers, "%s: %s\n", tag_to_string (header->tag), header->value) == -1)
       return -1;
   }
 
-  struct header *header = client->headers;
-  while (header) {
+  for (header = client->headers; header; header = header->next) {
     if (header->tag == H_SCHEMA) {
-      if (client_send_header (client, header) == -1)
+      if (mbuf_print (client->send_headers, "%s: %s\n", tag_to_string (header->tag), header->value) == -1)
         return -1;
     }
-    header = header->next;
   }
 
-  if (client_send_header (client, client->header_table[H_CONTENT]) == -1)
-    return -1;
-
-  if (send (client->send_socket, "\n", 1, 0) == -1)
+  header = client->header_table[H_CONTENT];
+  if (mbuf_print (client->send_headers, "%s: %s\n\n", tag_to_string (header->tag), header->value) == -1)
     return -1;
 
+  logdebug ("Queued %zu bytes of headers\n", mbuf_fill (client->send_headers));
   return 0;
 }
 
-/** Try to send data to the real OML server
- * \param handle the client data structure i.e. a pointer to a Client*.
+/** Close the connection to the downstream server, if any.
+ *
+ * Any partially-sent message will be sent again in full, after the headers, on
+ * the next connection. Passthrough, if active, is stopped, so that data
+ * received meanwhile gets queued.
+ *
+ * \param client Client to disconnect
  */
-void *client_send_thread (void* handle)
+void
+client_sender_disconnect (Client *client)
 {
-  Client *client = (Client*)handle;
-  Session *session = client->session;
-
-  loginfo ("'%s': client sender thread started\n", client->recv_socket->name);
-  pthread_mutex_lock (&client->mutex);
-
-  logdebug ("Mutex locked...\n");
-
-  while(1) {
-    logdebug ("Sender waiting...\n");
-    pthread_cond_wait (&client->condvar, &client->mutex);
-
-    if (session->state == ProxyState_SENDING) {
-      if (!client->sender_connected) {
-        // try to connect
-        if (client->state == C_HEADER || client->state == C_CONFIGURE)
-          continue; // Haven't finished receiving the headers
-
-
-        pthread_mutex_unlock (&client->mutex);
-        while (!client->sender_connected && session->state == ProxyState_SENDING) {
-          if (client_sender_connect (client) == 0) {
-            logdebug ("Connected to downstream OK\n");
-            client->sender_connected = 1;
-          } else {
-            logdebug ("Failed to connect to downstream:  %s\n", strerror (errno));
-            sleep (1); // Retry every second.
-            continue;
-          }
-        }
-        pthread_mutex_lock (&client->mutex);
-        if (client->sender_connected && client_send_headers (client) == -1) {
-          logdebug ("Something failed while sending headers:  %s\n", strerror (errno));
-          client->sender_connected = 0;
-          continue;
-        }
+  if (client->downstream) {
+    downstream_disconnect (client->downstream);
+    return;
+  }
+  client_passthrough_stop (client);
+  if (client->send_event) {
+    eventloop_socket_remove (client->send_event);
+    client->send_event = NULL;
+  }
+  if (client->send_socket >= 0) {
+    shutdown (client->send_socket, SHUT_RDWR);
+    close (client->send_socket);
+    client->send_socket = -1;
+  }
+  client->sender_state = S_DISCONNECTED;
+  client->send_remaining = 0;
+  mbuf_clear (client->send_headers);
+}
+
+/** Shut a client down after all its messages have been forwarded.
+ *
+ * \param client Client to clean up; it is freed
+ */
+static void
+client_sender_done (Client *client)
+{
+  loginfo ("Client disconnected and all pending measurements have been sent; shutting down this client\n");
+  client_sender_disconnect (client);
+  session_remove_client (client->session, client);
+  client_free (client);
+}
+
+/** Remove the message at the head of a client's queue, once it has been sent.
+ *
+ * \param client Client to consider
+ */
+void
+client_message_consume (Client *client)
+{
+  struct msg_queue_node *head = msg_queue_head (client->messages);
+
+  if (head == NULL)
+    return;
+
+  if (client->session) {
+    client->session->memory_used -= head->msg->length;
+  }
+  cbuf_consume_cursor (&head->cursor, head->msg->length);
+  oml_free (head->msg);
+  msg_queue_remove (client->messages);
+
+  if (client->messages->length == 0) {
+    client_spool_reload (client);
+  }
+}
+
+/** Describe the pending data of a client in an I/O vector.
+ *
+ * The unsent headers come first, followed by the queued messages, starting
+ * from the unsent part of the one at the head of the queue. Contiguous data
+ * from the same CBuffer page is described by a single iovec.
+ *
+ * \param client Client for which to send data
+ * \param[out] iov array of at least SENDER_MAX_IOV iovecs to fill
+ * \param[out] iovcnt number of iovecs used
+ * \return the number of bytes described by iov
+ */
+static size_t
+client_sender_gather (Client *client, struct iovec *iov, int *iovcnt)
+{
+  struct msg_queue_node *node = msg_queue_head (client->messages);
+  struct cbuffer_cursor cursor;
+  size_t i, remaining, total = 0;
+  int n = 0;
+
+  if (mbuf_rd_remaining (client->send_headers) > 0) {
+    iov[n].iov_base = mbuf_rdptr (client->send_headers);
+    iov[n].iov_len = mbuf_rd_remaining (client->send_headers);
+    total += iov[n++].iov_len;
+  }
+
+  if (node && client->send_remaining == 0) {
+    client->send_cursor = node->cursor;
+    client->send_remaining = node->msg->length;
+  }
+
+  for (i = 0; i < client->messages->length && total < SENDER_MAX_BATCH; i++, node = node->next) {
+    if (i == 0) {
+      cursor = client->send_cursor;
+      remaining = client->send_remaining;
+    } else {
+      cursor = node->cursor;
+      remaining = node->msg->length;
+    }
+
+    while (remaining > 0) {
+      char *buf = cbuf_cursor_pointer (&cursor);
+      size_t page_remaining = cbuf_cursor_page_remaining (&cursor);
+      size_t len = remaining < page_remaining ? remaining : page_remaining;
+
+      if (n > 0 && (char*)iov[n-1].iov_base + iov[n-1].iov_len == buf) {
+        iov[n-1].iov_len += len;
+      } else if (n < SENDER_MAX_IOV) {
+        iov[n].iov_base = buf;
+        iov[n++].iov_len = len;
+      } else {
+        *iovcnt = n;
+        return total;
       }
+      total += len;
+      remaining -= len;
+      if (remaining > 0) {
+        cbuf_advance_cursor (&cursor, len);
+      }
+    }
+  }
+
+  *iovcnt = n;
+  return total;
+}
+
+/** Account for data sent from the I/O vector built by client_sender_gather.
+ *
+ * Sent headers are skipped, and completely sent messages are removed from
+ * the queue.
+ *
+ * \param client Client for which data was sent
+ * \param sent number of bytes sent
+ */
+void
+client_sender_advance (Client *client, size_t sent)
+{
+  size_t headers = mbuf_rd_remaining (client->send_headers);
+  struct msg_queue_node *head;
+
+  if (headers > 0) {
+    headers = sent < headers ? sent : headers;
+    mbuf_read_skip (client->send_headers, headers);
+    sent -= headers;
+  }
+
+  while (sent > 0) {
+    head = msg_queue_head (client->messages);
+    if (client->send_remaining == 0) {
+      client->send_cursor = head->cursor;
+      client->send_remaining = head->msg->length;
+    }
+
+    if (sent < client->send_remaining) {
+      cbuf_advance_cursor (&client->send_cursor, sent);
+      client->send_remaining -= sent;
+      return;
+    }
+
+    logdebug ("Seqno: %d sent\n", head->msg->seqno);
+    sent -= client->send_remaining;
+    client->send_remaining = 0;
+    client_message_consume (client);
+  }
+}
+
+/** Send as much pending data as the downstream socket accepts.
+ *
+ * Headers and messages are gathered over the CBuffer pages, so up to
+ * SENDER_MAX_BATCH bytes are sent with a single sendmsg(2).
+ *
+ * \param client Client for which to send data
+ * \return 1 if all data was sent, 0 if the socket is full, -1 on error
+ */
+static int
+client_sender_drain (Client *client)
+{
+  struct iovec iov[SENDER_MAX_IOV];
+  struct msghdr msg;
+  size_t total;
+  ssize_t result;
+  int iovcnt;
+
+  bzero (&msg, sizeof (msg));
+  msg.msg_iov = iov;
+
+  while ((total = client_sender_gather (client, iov, &iovcnt)) > 0) {
+    msg.msg_iovlen = iovcnt;
+    result = sendmsg (client->send_socket, &msg, MSG_NOSIGNAL);
+    if (result == -1) {
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    }
+    logdebug ("Sent %zd/%zu bytes in %d chunks\n", result, total, iovcnt);
+    client_sender_advance (client, result);
+    if ((size_t)result < total) {
+      return 0; // Socket full
+    }
+  }
+
+  return 1;
+}
 
-      while (client->messages->length > 0 && client->sender_connected) {
-        struct msg_queue_node *head = msg_queue_head (client->messages);
-        struct cbuffer_cursor cursor = head->cursor;
-        size_t length = head->msg->length;
-        size_t count = 0;
-        int result = 0;
-
-        while (length > 0) {
-          char *buf = cbuf_cursor_pointer (&cursor);
-          size_t page_remaining = cbuf_cursor_page_remaining (&cursor);
-          size_t to_write = length < page_remaining ? length : page_remaining;
-
-          logdebug ("Seqno: %d Sending %d bytes (fill=%d, remain=%d)\n", head->msg->seqno, to_write, cursor.page->fill, page_remaining);
-          pthread_mutex_unlock (&client->mutex);
-          result = send (client->send_socket, buf, to_write, 0);
-          pthread_mutex_lock (&client->mutex);
-
-          if (result == -1) {
-            logdebug ("send(2) returned -1 (%s)\n", strerror (errno));
-            if (sigpipe_flag == 1) {
-              logdebug ("sigpipe_flag is 1\n");
-              sigpipe_flag = 0;
-            }
-            client->sender_connected = 0;
-            break;
-          } else if (result < (int)to_write) {
-            logdebug ("Wrote less than expected \n");
-          }
-          cbuf_advance_cursor (&cursor, result);
-          length -= result;
-          count += result;
-        }
-        if (result != -1) {
-          cbuf_consume_cursor (&head->cursor, head->msg->length);
-          msg_queue_remove (client->messages);
-        }
+/** EventLoop status callback for the downstream connection of a client.
+ *
+ * \copydetails o_el_state_socket_callback
+ */
+static void
+client_sender_status (SockEvtSource *source, SocketStatus status, int error, void *handle)
+{
+  Client *client = (Client*)handle;
+  int err = 0, result;
+  socklen_t errlen = sizeof (err);
+  (void)source;
+
+  switch (status) {
+  case SOCKET_WRITEABLE:
+    if (client->sender_state == S_CONNECTING) {
+      if (getsockopt (client->send_socket, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1) {
+        err = errno;
+      }
+      if (err) {
+        logdebug ("Failed to connect to downstream: %s\n", strerror (err));
+        client_sender_disconnect (client);
+        return;
       }
+      logdebug ("Connected to downstream OK\n");
+      client->sender_state = S_CONNECTED;
+      if (client_send_headers (client) == -1) {
+        logwarn ("Could not prepare headers for downstream\n");
+        client_sender_disconnect (client);
+        return;
+      }
+    }
 
-      if (client->state == C_DISCONNECTED && client->messages->length == 0) {
-        loginfo ("Client disconnected and all pending measurements have been sent; shutting down this client\n");
-        shutdown (client->send_socket, SHUT_RDWR);
-        sleep (1);
-        close (client->send_socket);
-        session_remove_client (session, client);
-        client_free (client);
-        pthread_exit (NULL);
+    if (client->session->state != ProxyState_SENDING) {
+      eventloop_socket_activate (client->send_event, 0);
+      return;
+    }
+
+    result = client_sender_drain (client);
+    if (result == 1 && (client->passthrough || client_passthrough_start (client) == 0)) {
+      result = client_passthrough_send (client);
+    }
+    switch (result) {
+    case 1:
+      if (client->state == C_DISCONNECTED) {
+        client_sender_done (client);
+      } else {
+        /* Nothing more to send for now */
+        eventloop_socket_activate (client->send_event, 0);
       }
-    } else if (session->state == ProxyState_PAUSED && client->sender_connected) {
-      shutdown (client->send_socket, SHUT_RDWR);
-      sleep (1);
-      close (client->send_socket);
-      client->sender_connected = 0;
+      break;
+    case 0:
+      break;
+    default:
+      logdebug ("send(2) failed (%s)\n", strerror (errno));
+      client_sender_disconnect (client);
+      break;
+    }
+    break;
+
+  default:
+    logdebug ("Lost connection to downstream (%s): %s\n",
+              socket_status_string (status), strerror (error));
+    client_sender_disconnect (client);
+    break;
+  }
+}
+
+/** Get a client's pending data sent downstream, if the session allows it.
+ *
+ * This connects to the downstream server if needed, or activates the output
+ * Channel so that pending data is sent when the socket is writeable. It is
+ * safe to call it whenever new data was queued, or the state of the session
+ * or client changed.
+ *
+ * The actual sending happens from the EventLoop, so the client is never freed
+ * from within this function.
+ *
+ * \param client Client to consider
+ * \see client_sender_status, client_sender_connect
+ */
+void
+client_sender_kick (Client *client)
+{
+  if (client->session->state != ProxyState_SENDING)
+    return;
+  if (client->state == C_HEADER || client->state == C_CONFIGURE)
+    return; // Haven't finished receiving the headers
+
+  if (client->downstream) {
+    downstream_kick (client->downstream);
+    return;
+  }
+
+  switch (client->sender_state) {
+  case S_DISCONNECTED:
+    if (client_sender_connect (client) == -1) {
+      logdebug ("Failed to connect to downstream: %s\n", strerror (errno));
     }
+    break;
+  case S_CONNECTING:
+    break;
+  case S_CONNECTED:
+    eventloop_socket_activate (client->send_event, 1);
+    break;
   }
 }
 
@@ -23,7 +23,10 @@
 #ifndef SESSION_H__
 #define SESSION_H__
 
+#include <stddef.h>
+
 struct _client;
+struct _downstream;
 
 enum ProxyState {
   ProxyState_PAUSED,
@@ -40,6 +43,19 @@ typedef struct _session {
   // All client connections in this session are forwarded to this address:port
   char* downstream_address;
   int   downstream_port;
+
+  // Connections multiplexing all clients, if any (see downstream.c)
+  struct _downstream* downstreams;
+  int   ndownstreams;
+
+  // Bytes of messages queued in memory by all clients, and the limit above
+  // which new messages are spilled to disk (0: no limit, see message_spool.c)
+  size_t memory_used;
+  size_t memory_limit;
+
+  // Whether binary streams can be spliced through when nothing is queued
+  // (see passthrough.c)
+  int zero_copy;
 } Session;
 
 void session_add_client (Session *session, struct _client *client);
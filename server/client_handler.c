@@ -18,6 +18,9 @@
 #include <ctype.h>
 #include <assert.h>
 
+#include <errno.h>
+#include <sys/socket.h>
+
 #include "oml2/oml_writer.h"
 #include "ocomm/o_log.h"
 #include "ocomm/o_socket.h"
@@ -30,18 +33,34 @@
 #include "validate.h"
 #include "marshal.h"
 #include "binary.h"
+#include "text.h"
 #include "schema.h"
+#include "mux.h"
+#include "ack.h"
+#include "scan.h"
 #include "client_handler.h"
 
 #define DEF_TABLE_COUNT 10
+/** Period [s] at which acknowledgements are sent */
+#define ACK_PERIOD 1
+/** Amount of unsent acknowledgements [B] after which the client is assumed not to read them */
+#define ACK_MAX_PENDING 4096
 
 /* XXX: This cannot be static anymore if we want to test it... */
 void
 client_callback(SockEvtSource* source, void* handle, void* buf, int buf_size);
+void
+client_ack_timer(TimerEvtSource* source, void* handle);
 
 static void
 status_callback(SockEvtSource* source, SocketStatus status, int errcode, void* handle);
 
+static void*
+buffer_callback(SockEvtSource* source, void* handle, size_t* size);
+
+static int
+client_process(ClientHandler* self, const char *name);
+
   const char *
 client_state_to_s (CState state)
 {
@@ -49,7 +68,9 @@ client_state_to_s (CState state)
     "C_HEADER",
     "C_BINARY_DATA",
     "C_TEXT_DATA",
-    "C_PROTOCOL_ERROR"
+    "C_PROTOCOL_ERROR",
+    "C_BINARY_SKIP",
+    "C_MUX",
   };
   return states[state];
 }
@@ -68,10 +89,12 @@ client_event_report(ClientHandler *self, const char *event, const char *message)
 #ifndef NOOML /* For unit tests */
   assert(self);
   assert(event);
-  const size_t ADDR_SZ = socket_get_addr_sz(self->socket);
+  /* Logical clients of multiplexed connections report their carrier's peer */
+  Socket *socket = self->mux_parent ? self->mux_parent->socket : self->socket;
+  const size_t ADDR_SZ = socket_get_addr_sz(socket);
   char addr[ADDR_SZ];
-  socket_get_peer_addr(self->socket, addr, ADDR_SZ);
-  uint16_t port = socket_get_port(self->socket);
+  socket_get_peer_addr(socket, addr, ADDR_SZ);
+  uint16_t port = socket_get_port(socket);
   const char *oml_id = self->sender_name ? self->sender_name : "";
   const char *domain = self->database && self->database->name ? self->database->name : "";
   const char *app_name = self->app_name ? self->app_name : "";
@@ -159,6 +182,10 @@ client_realloc_tables (ClientHandler *self, int ntables)
 /** (Re)allocate the values vector for the table with the given index,
  *  so that it is expanded (never reduced) to hold nvalues elements.
  *
+ *  The OmlValues are only oml_value_clear()ed between rows, so the storage
+ *  of their strings, blobs and vectors also only grows, and is reused for
+ *  the following rows of the same table.
+ *
  *  \param self ClientHandler holding the vectors
  *  \param idx index of the vector to reallocate
  *  \param nvalues number of values to allow in that vector
@@ -212,9 +239,11 @@ client_handler_new(Socket* new_sock)
   self->state = C_HEADER;
   self->content = C_TEXT_DATA;
   self->mbuf = mbuf_create ();
+  self->stats = stats_new (STATS_CLIENT);
   self->socket = new_sock;
   self->event = eventloop_on_read_in_channel(new_sock, client_callback,
       status_callback, (void*)self);
+  eventloop_socket_set_buffer(self->event, buffer_callback);
   strncpy (self->name, self->event->name, MAX_STRING_SIZE);
 
   const char *event = "Connect";
@@ -224,8 +253,91 @@ client_handler_new(Socket* new_sock)
   return self;
 }
 
+/** Create a ClientHandler for a logical client of a multiplexed connection.
+ *
+ * The new ClientHandler has no Socket of its own; it is fed with the data of
+ * the MUX_DATA frames for its channel.
+ *
+ * \param parent ClientHandler of the multiplexed connection
+ * \param channel channel of the new client in the connection
+ * \param identity identity of the original sender, from the MUX_OPEN frame (not nul-terminated)
+ * \param len length of identity
+ * \return a pointer to the newly created ClientHandler, or NULL on error
+ *
+ * \see process_mux_frame
+ */
+static ClientHandler*
+client_handler_new_mux(ClientHandler* parent, uint32_t channel, const char* identity, size_t len)
+{
+  ClientHandler* self = oml_malloc(sizeof(ClientHandler));
+  if (!self) return NULL;
+
+  memset(self, 0, sizeof(*self));
+  self->state = C_HEADER;
+  self->content = C_TEXT_DATA;
+  self->mbuf = mbuf_create ();
+  self->stats = stats_new (STATS_CLIENT);
+  self->mux_parent = parent;
+  self->mux_channel = channel;
+  self->mux_next = parent->mux_children;
+  parent->mux_children = self;
+
+  self->mux_name = oml_malloc(MAX_STRING_SIZE);
+  if (self->mux_name) {
+    snprintf (self->mux_name, MAX_STRING_SIZE, "%s#%u(%.*s)",
+        parent->event ? parent->event->name : parent->name, channel, (int)len, identity);
+    strncpy (self->name, self->mux_name, MAX_STRING_SIZE);
+  }
+
+  client_event_report(self, "Connect", "");
+
+  return self;
+}
+
+/** Get the name of the source of a ClientHandler's data, for logging.
+ *
+ * \param self ClientHandler to consider
+ * \return the name of its Channel, or of its logical channel if multiplexed
+ */
+static const char*
+client_source_name(ClientHandler* self)
+{
+  if (self->event) {
+    return self->event->name;
+  } else if (self->mux_name) {
+    return self->mux_name;
+  }
+  return self->name;
+}
+
 void client_handler_free (ClientHandler* self)
 {
+  /* Logical clients go away with their multiplexed connection */
+  while (self->mux_children) {
+    client_event_report(self->mux_children, "Disconnect", "Multiplexed connection closed");
+    client_handler_free (self->mux_children);
+  }
+  if (self->mux_parent) {
+    ClientHandler **it = &self->mux_parent->mux_children;
+    while (*it && *it != self) {
+      it = &(*it)->mux_next;
+    }
+    if (*it) {
+      *it = self->mux_next;
+    }
+  }
+  if (self->mux_name)
+    oml_free (self->mux_name);
+
+  if (self->ack_timer)
+    eventloop_timer_stop (self->ack_timer);
+  if (self->ack_out)
+    mbuf_destroy (self->ack_out);
+  if (self->ack_sent)
+    oml_free (self->ack_sent);
+  if (self->resume)
+    resume_state_release (self->resume);
+  stats_free (self->stats);
   if (self->event)
     eventloop_socket_release (self->event);
   if (self->database)
@@ -260,13 +372,199 @@ void client_handler_update_name(ClientHandler *self)
   if (self->database && self->sender_name && self->app_name) {
     snprintf(self->name, MAX_STRING_SIZE, "%s:%s:%s", self->database->name, self->sender_name, self->app_name);
     self->name[MAX_STRING_SIZE-1] = 0;
-  } else if (self->event) {
-    logwarn("%s: Some identification fields (domain, sender-id or app-name) were missing in the headers\n", self->event->name);
+  } else if (self->event || self->mux_parent) {
+    logwarn("%s: Some identification fields (domain, sender-id or app-name) were missing in the headers\n", client_source_name(self));
   } else {
     logerror("Unitialised fields in ClientHandler after end of headers; this is probably a bug\n");
   }
 }
 
+/** Send as many pending acknowledgements as possible, without blocking.
+ *
+ * Clients which asked for acknowledgements should read them as they come. If
+ * they pile up (e.g., behind a proxy which does not forward them), they are
+ * dropped, and no more are sent on this connection.
+ *
+ * \param self ClientHandler to send acknowledgements for
+ * \see ACK_MAX_PENDING
+ */
+static void
+client_ack_flush(ClientHandler *self)
+{
+  ssize_t n;
+
+  if (!self->socket || !mbuf_rd_remaining(self->ack_out)) {
+    return;
+  }
+
+  n = send(socket_get_sockfd(self->socket), mbuf_rdptr(self->ack_out),
+      mbuf_rd_remaining(self->ack_out), MSG_DONTWAIT | MSG_NOSIGNAL);
+  if (n > 0) {
+    mbuf_read_skip(self->ack_out, n);
+    mbuf_consume_message(self->ack_out);
+    mbuf_repack_message(self->ack_out);
+
+  } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    logdebug("%s: Could not send acknowledgements: %s\n", self->name, strerror(errno));
+  }
+
+  if (mbuf_rd_remaining(self->ack_out) > ACK_MAX_PENDING) {
+    logwarn("%s: Client does not read acknowledgements, not sending any more\n", self->name);
+    if (self->ack_timer) {
+      eventloop_timer_stop(self->ack_timer);
+      self->ack_timer = NULL;
+    }
+    mbuf_clear(self->ack_out);
+  }
+}
+
+/** Queue acknowledgements for the streams which progressed since the last ones.
+ *
+ * \param self ClientHandler to send acknowledgements for
+ * \see ack_write
+ */
+static void
+client_ack_queue(ClientHandler *self)
+{
+  int i, seqno, *sent;
+
+  if (self->ack_count < self->table_count) {
+    if (!(sent = oml_realloc(self->ack_sent, self->table_count * sizeof(int)))) {
+      return;
+    }
+    memset(sent + self->ack_count, 0, (self->table_count - self->ack_count) * sizeof(int));
+    self->ack_sent = sent;
+    self->ack_count = self->table_count;
+  }
+
+  for (i = 0; i < self->ack_count; i++) {
+    seqno = resume_state_seqno(self->resume, i);
+    if (seqno > self->ack_sent[i] && ack_write(self->ack_out, i, seqno) == 0) {
+      self->ack_sent[i] = seqno;
+    }
+  }
+}
+
+/** Periodically send acknowledgements to a client.
+ *
+ * \param source TimerEvtSource which expired
+ * \param handle ClientHandler to send acknowledgements for
+ * \see client_ack_start, eventloop_every
+ */
+void
+client_ack_timer(TimerEvtSource* source, void* handle)
+{
+  ClientHandler *self = (ClientHandler*)handle;
+  (void)source;
+
+  client_ack_queue(self);
+  client_ack_flush(self);
+}
+
+/** Start acknowledging stored samples, if the client asked for it.
+ *
+ * Called at the end of the headers. Whatever was already stored from this
+ * client instance (e.g., before it reconnected) is acknowledged straight away,
+ * and the end of these first acknowledgements is marked with an empty line.
+ *
+ * Only clients which sent the ack header get either acknowledgements or the
+ * skipping of samples received again.  This excludes the logical clients of a
+ * multiplexed connection, as the proxy does not forward that header; were
+ * one to send it, its samples would be deduplicated, but not acknowledged, as
+ * acknowledgements cannot be sent back through the multiplexed connection.
+ * Neither is done if the Database only queues samples for another thread
+ * (see Database::queued_inserts), as they could still be lost once queued.
+ *
+ * \param self ClientHandler which finished processing headers
+ * \see ack.h, resume_state_find
+ */
+static void
+client_ack_start(ClientHandler *self)
+{
+  if (!self->ack) {
+    return;
+  } else if (!self->database || !self->sender_name) {
+    logwarn("%s: Cannot acknowledge samples without domain and sender-id\n", self->name);
+    return;
+  } else if (self->database->queued_inserts) {
+    logdebug("%s: Samples are only queued for storage, not acknowledging them\n", self->name);
+    return;
+  } else if (!(self->resume = resume_state_find(self->database->name,
+          self->sender_name, self->start_time))) {
+    return;
+  } else if (self->mux_parent) {
+    return;
+  }
+
+  self->ack_out = mbuf_create();
+  client_ack_queue(self);
+  ack_write_end(self->ack_out);
+  client_ack_flush(self);
+  if (self->socket) {
+    self->ack_timer = eventloop_every(self->name, ACK_PERIOD, client_ack_timer, self);
+  }
+}
+
+/** Record that a sample was dealt with, though not stored.
+ *
+ * Acknowledgements cover all samples up to a sequence number, so the samples
+ * which are deliberately not stored (e.g., metadata which is only processed)
+ * must not be left out, lest the client keep them, and those after them.
+ *
+ * \param self ClientHandler which received the sample
+ * \param table_index index of the stream in the client
+ * \param seqno sequence number of the sample
+ * \see resume_state_update
+ */
+static void
+client_processed(ClientHandler *self, int table_index, int seqno)
+{
+  if (self->resume) {
+    resume_state_update(self->resume, table_index, seqno);
+  }
+}
+
+/** Store a sample, unless it has already been stored from this client instance.
+ *
+ * \param self ClientHandler which received the sample
+ * \param table DbTable to insert the sample into
+ * \param table_index index of the stream in the client
+ * \param seqno sequence number of the sample
+ * \param ts server timestamp of the sample
+ * \param values OmlValue array of the sample
+ * \param count number of elements in values
+ * \see db_adapter_insert, resume_state_update
+ */
+static void
+client_insert(ClientHandler *self, DbTable *table, int table_index, int seqno,
+    double ts, OmlValue *values, int count)
+{
+  /* Several connections from the same client instance (e.g., an old one not
+   * yet noticed as broken, and a new one) use the same Database; its lock
+   * makes sure only one of them stores each sample */
+  uint64_t start, ns;
+  int ok;
+
+  database_lock(self->database);
+  if (self->resume && resume_state_stored(self->resume, table_index, seqno)) {
+    logdebug("%s: Sample %d of table index %d '%s' already stored, skipping\n",
+        self->name, seqno, table_index, table->schema->name);
+
+  } else {
+    start = stats_now();
+    ok = self->database->insert(self->database, table, self->sender_id, seqno,
+        ts, values, count) == 0;
+    ns = stats_now() - start;
+    /* The Database lock also protects the counters of its tables */
+    stats_add_insert(table->stats, ns, ok);
+    stats_add_insert(self->stats, ns, ok);
+    if (ok && self->resume) {
+      resume_state_update(self->resume, table_index, seqno);
+    }
+  }
+  database_unlock(self->database);
+}
+
 
   static int
 validate_schema_names (struct schema *schema, char **invalid)
@@ -316,7 +614,9 @@ process_schema(ClientHandler* self, char* value)
   int idx = schema->index;
   logdebug("%s: New MS schema %s\n", self->name, value); /* Value contains the index */
 
+  database_lock(self->database);
   DbTable* table = database_find_or_create_table(self->database, schema);
+  database_unlock(self->database);
   if (table == NULL) {
     logerror("%s: Can't find table '%s' or client schema '%s' doesn't match any of the existing tables.\n",
         self->name, schema->name, value);
@@ -473,6 +773,7 @@ process_meta(ClientHandler* self, char* key, char* value)
        */
 
       start_time = atoi(value);
+      database_lock(self->database);
       if (self->database->start_time == 0) {
         // seed it with a time in the past
         self->database->start_time = start_time;// - 100;
@@ -481,6 +782,8 @@ process_meta(ClientHandler* self, char* key, char* value)
         self->database->set_metadata (self->database, "start_time", s);
       }
       self->time_offset = start_time - self->database->start_time;
+      database_unlock(self->database);
+      self->start_time = start_time;
       return 0;
     }
 
@@ -497,7 +800,9 @@ process_meta(ClientHandler* self, char* key, char* value)
       return -2;
 
     } else {
+      database_lock(self->database);
       self->sender_id = self->database->add_sender_id(self->database, value);
+      database_unlock(self->database);
       self->sender_name = oml_strndup (value, strlen (value));
       return 0;
     }
@@ -517,6 +822,41 @@ process_meta(ClientHandler* self, char* key, char* value)
     process_schema(self, value);
     return 0;
 
+  } else if (strcmp(key, MUX_HEADER_KEY) == 0) {
+    if (self->state != C_HEADER || self->database || self->mux_parent) {
+      logerror("%s: Meta '%s' is only valid at the start of a connection\n",
+          self->name, key);
+      self->state = C_PROTOCOL_ERROR;
+      return -2;
+
+    } else if (atoi(value) != MUX_PROTOCOL_VERSION) {
+      logerror("%s: Unsupported multiplexing version %s (expected %d)\n",
+          self->name, value, MUX_PROTOCOL_VERSION);
+      self->state = C_PROTOCOL_ERROR;
+      return -2;
+
+    } else {
+      loginfo("%s: Multiplexed connection\n", self->name);
+      self->state = C_MUX;
+      return 0;
+    }
+
+  } else if (strcmp(key, ACK_HEADER_KEY) == 0) {
+    if (self->state != C_HEADER) {
+      logwarn("%s: Meta '%s' is only valid in the headers, ignoring\n",
+          self->name, key);
+      return -1;
+
+    } else if (atoi(value) != ACK_PROTOCOL_VERSION) {
+      logwarn("%s: Unsupported acknowledgement version %s (expected %d), not acknowledging\n",
+          self->name, value, ACK_PROTOCOL_VERSION);
+      return -1;
+
+    } else {
+      self->ack = 1;
+      return 0;
+    }
+
   } else if (strcmp(key, "content") == 0) {
     if (self->state != C_HEADER) {
       logwarn("%s: Meta '%s' is only valid in the headers, ignoring\n",
@@ -598,8 +938,12 @@ process_header(ClientHandler* self, MBuffer* mbuf)
     mbuf_consume_message (mbuf);
     self->state = self->content;
     client_handler_update_name(self);
+    if (self->database) {
+      stats_register(self->stats, self->database->name, self->sender_name, self->app_name);
+    }
+    client_ack_start(self);
     client_event_report(self, "Ready", "");
-    loginfo("%s: Client %s ready to send data\n", self->name, self->event->name);
+    loginfo("%s: Client %s ready to send data\n", self->name, client_source_name(self));
     return 0;
   }
 
@@ -624,13 +968,85 @@ process_header(ClientHandler* self, MBuffer* mbuf)
     self->state = C_PROTOCOL_ERROR;
   }
 
-  // process_meta() might have signalled protocol error, so we have to check here.
-  if (self->state == C_PROTOCOL_ERROR)
+  // process_meta() might have signalled protocol error, or switched to
+  // multiplexing, so we have to check here.
+  if (self->state != C_HEADER)
     return 0;
   else
     return 1; // still in header
 }
 
+/** Process one frame of a multiplexed connection.
+ *
+ * MUX_OPEN frames create a new logical ClientHandler, which is then fed the
+ * payload of the MUX_DATA frames of its channel, and freed on MUX_CLOSE.
+ *
+ * \param self ClientHandler of the multiplexed connection
+ * \param mbuf MBuffer containing the frames
+ * \return 1 if a frame was processed, 0 otherwise (more data needed, or protocol error)
+ * \see mux.h, client_handler_new_mux
+ */
+static int
+process_mux_frame(ClientHandler* self, MBuffer* mbuf)
+{
+  struct mux_frame frame;
+  ClientHandler *child;
+  uint8_t *payload;
+  int ret;
+
+  ret = mux_frame_header_read (mbuf_rdptr (mbuf), mbuf_rd_remaining (mbuf), &frame);
+  if (ret < 0) {
+    logerror("%s: Invalid multiplexing frame\n", self->name);
+    self->state = C_PROTOCOL_ERROR;
+    return 0;
+  } else if (ret == 0 || mbuf_rd_remaining (mbuf) < MUX_HEADER_SIZE + frame.length) {
+    return 0;
+  }
+  payload = mbuf_rdptr (mbuf) + MUX_HEADER_SIZE;
+
+  for (child = self->mux_children; child && child->mux_channel != frame.channel;
+      child = child->mux_next);
+
+  switch (frame.type) {
+  case MUX_OPEN:
+    if (child) {
+      logwarn("%s: Channel %u reopened, dropping previous client\n", self->name, frame.channel);
+      client_event_report(child, "Disconnect", "MUX_OPEN");
+      client_handler_free (child);
+    }
+    child = client_handler_new_mux (self, frame.channel, (char*)payload, frame.length);
+    if (child) {
+      logdebug("%s: New client %s\n", self->name, child->name);
+    }
+    break;
+
+  case MUX_DATA:
+    if (!child) {
+      logwarn("%s: Dropping %u bytes for unknown channel %u\n", self->name, frame.length, frame.channel);
+    } else if (mbuf_make_room (child->mbuf, frame.length) == -1 ||
+        mbuf_write (child->mbuf, payload, frame.length) == -1) {
+      logerror("%s: Failed to write data for channel %u into message buffer\n", self->name, frame.channel);
+    } else {
+      stats_add_bytes (child->stats, frame.length);
+      /* The child is freed on protocol error */
+      client_process (child, client_source_name(child));
+    }
+    break;
+
+  case MUX_CLOSE:
+    if (child) {
+      client_event_report(child, "Disconnect", "MUX_CLOSE");
+      loginfo("%s: Client %s closed connection\n", child->name, client_source_name(child));
+      client_handler_free (child);
+    }
+    break;
+  }
+
+  mbuf_read_skip (mbuf, MUX_HEADER_SIZE + frame.length);
+  mbuf_consume_message (mbuf);
+  return 1;
+}
+
 /** Process contents of a message for which the header has already been
  * extracted by the marshalling code.
  *
@@ -654,6 +1070,7 @@ process_bin_data_message(ClientHandler* self, OmlBinaryHeader* header)
   MBuffer* mbuf = self->mbuf;
   OmlValue *v;
   int count;
+  uint64_t start;
 
   ts = header->timestamp;
   table_index = header->stream;
@@ -671,8 +1088,10 @@ process_bin_data_message(ClientHandler* self, OmlBinaryHeader* header)
     if (0 == table_index) {
       /* If this is schema 0, there is a chance the ClientHandler
        * doesn't know about it yet; find it */
+      database_lock(self->database);
       table = database_find_table(self->database,
           "_experiment_metadata");
+      database_unlock(self->database);
       client_realloc_tables(self, 1); /* Make sure we have space for 1 */
       client_realloc_values(self, 0, table->schema->nfields);
       self->tables[table_index] = table;
@@ -683,11 +1102,14 @@ process_bin_data_message(ClientHandler* self, OmlBinaryHeader* header)
   }
 
   v = self->values_vectors[table_index];
-  /* These OmlValue are properly initialised by client_realloc_values,
-   * however, the schema might have been redefined sinc last time */
+  /* These OmlValue are properly initialised by client_realloc_values, and
+   * keep their storage from the previous row; unmarshal_value changes their
+   * types if the schema has been redefined since last time */
   count = self->values_vector_counts[table_index];
-  oml_value_array_reset(v, count);
+  oml_value_array_clear(v, count);
+  start = stats_now();
   count = unmarshal_measurements(mbuf, header, v, count);
+  stats_add_decode(self->stats, start);
 
   schema = table->schema;
   if (count<-100) {
@@ -742,14 +1164,15 @@ process_bin_data_message(ClientHandler* self, OmlBinaryHeader* header)
           omlc_get_string_ptr(*oml_value_get_value(&v[ki])),
           omlc_get_string_ptr(*oml_value_get_value(&v[vi]))) <= 0) {
       logdebug("%s(bin): No need to store metadata separately\n", self->name);
+      client_processed(self, table_index, seqno);
       return;
     }
   }
 
   logdebug("%s(bin): Inserting data into table index %d '%s' (seqno=%d, ts=%f)\n",
       self->name, table_index, table->schema->name, seqno, ts);
-  self->database->insert(self->database, table, self->sender_id, header->seqno,
-      ts, self->values_vectors[table_index], count);
+  client_insert(self, table, table_index, seqno, ts,
+      self->values_vectors[table_index], count);
 }
 
 /** Read binary data from an MBuffer
@@ -823,20 +1246,23 @@ static void
 process_text_data_message(ClientHandler* self, char** msg, int count)
 {
   double ts;
+  int64_t n;
   int table_index;
   int seqno;
   struct schema *schema;
   int i, ki = -1, vi = -1, si = -1;
   DbTable *table;
   OmlValue *v;
+  uint64_t start;
 
   if (count < 3) {
     return;
   }
 
-  ts = atof(msg[0]);
-  table_index = atol(msg[1]);
-  seqno = atol(msg[2]);
+  if (text_parse_double(msg[0], &ts) == -1)
+    ts = atof(msg[0]);
+  table_index = text_parse_integer(msg[1], 9, &n) == 0 ? n : atol(msg[1]);
+  seqno = text_parse_integer(msg[2], 9, &n) == 0 ? n : atol(msg[2]);
 
   if (table_index < 0 || table_index >= self->table_count) {
     logwarn("%s(txt): Table index %d out of bounds, discarding sample %d\n",
@@ -850,8 +1276,10 @@ process_text_data_message(ClientHandler* self, char** msg, int count)
     if (0 == table_index) {
       /* If this is schema 0, there is a chance the ClientHandler
        * doesn't know about it yet; find it */
+      database_lock(self->database);
       table = database_find_table(self->database,
           "_experiment_metadata");
+      database_unlock(self->database);
       client_realloc_tables(self, 1); /* Make sure we have space for 1 */
       client_realloc_values(self, 0, table->schema->nfields);
       self->tables[table_index] = table;
@@ -898,6 +1326,7 @@ process_text_data_message(ClientHandler* self, char** msg, int count)
 
     } else if(process_meta(self, msg[ki], msg[vi]) <=0 ) {
       logdebug("%s(txt): No need to store metadata separately\n", self->name);
+      client_processed(self, table_index, seqno);
       return;
     }
   }
@@ -909,22 +1338,22 @@ process_text_data_message(ClientHandler* self, char** msg, int count)
   }
 
   v = self->values_vectors[table_index];
-  /* These OmlValue are properly initialised by client_realloc_values,
-   * however, the schema might have been redefined sinc last time */
-  oml_value_array_reset(v, count);
-
-  for (i=0; i < schema->nfields; i++) {
-    oml_value_set_type(&v[i], schema->fields[i].type);
-    if (oml_value_from_s (&v[i], msg[i+3]) == -1) {
-      logerror("%s(txt): Error converting value of type %d from string '%s'\n", self->name, oml_value_get_type(v), msg[i+3]);
-      return;
-    }
+  /* These OmlValue are properly initialised by client_realloc_values; the
+   * decoder changes their type if the schema has been redefined since last
+   * time, but otherwise reuses their storage */
+  start = stats_now();
+  i = text_decoder_decode(table->text_decoder, &msg[3], v);
+  stats_add_decode(self->stats, start);
+  if (i < 0) {
+    i = -i - 1;
+    logerror("%s(txt): Error converting value of type %d from string '%s'\n", self->name, schema->fields[i].type, msg[i+3]);
+    return;
   }
 
   logdebug("%s(txt): Inserting data into table index %d '%s' (seqno=%d, ts=%f)\n",
       self->name, table_index, table->schema->name, seqno, ts);
-  self->database->insert(self->database, table, self->sender_id, seqno,
-      ts, self->values_vectors[table_index], count - 3); /* Ignore first 3 elements */
+  client_insert(self, table, table_index, seqno, ts,
+      self->values_vectors[table_index], count - 3); /* Ignore first 3 elements */
 }
 
 /** Process as many lines of data as possible from an MBuffer.
@@ -955,15 +1384,17 @@ process_text_message(ClientHandler* self, MBuffer* mbuf)
 
     while (rem > 0 || lastempty) {
       char* param = p;
+      char* tab = (char*)scan_byte ((uint8_t*)p, rem, '\t');
       lastempty = 0;
-      for (; rem > 0; rem--, p++) {
-        if (*p == '\t') {
-          *(p++) = '\0';
-          rem--;
-          // Set if there was an empty string at the end of the line
-          lastempty = (0 == rem && '\0' == *(p-1) && !lastempty);
-          break;
-        }
+      if (tab) {
+        *tab = '\0';
+        rem -= tab + 1 - p;
+        p = tab + 1;
+        // Set if there was an empty string at the end of the line
+        lastempty = (0 == rem);
+      } else {
+        p += rem;
+        rem = 0;
       }
       a[a_size++] = param;
       if (a_size >= DEF_NUM_VALUES) {
@@ -983,7 +1414,39 @@ process_text_message(ClientHandler* self, MBuffer* mbuf)
   return 0;
 }
 
+/** Callback function called when the socket is about to be read from.
+ *
+ * Make sure the ClientHandler's MBuffer has enough room for the data, and let
+ * the EventLoop read it directly there. This is where any partial message
+ * left at the end of the buffer gets moved back to its start, if needed.
+ *
+ * \param source the socket event
+ * \param handle the client handler
+ * \param size amount of data the EventLoop wants to read, updated to the room
+ * available in the MBuffer
+ * \return a pointer to the MBuffer's write pointer, or NULL on error
+ *
+ * \see client_callback, mbuf_wrptr
+ */
+static void*
+buffer_callback(SockEvtSource* source, void* handle, size_t* size)
+{
+  ClientHandler* self = (ClientHandler*)handle;
+
+  if (mbuf_make_room (self->mbuf, *size) == -1) {
+    logwarn("%s: Could not make room for %zu bytes in message buffer\n",
+        source->name, *size);
+    return NULL;
+  }
+  *size = mbuf_wr_remaining (self->mbuf);
+  return mbuf_wrptr (self->mbuf);
+}
+
 /** * Callback function called when the socket receive some data
+ *
+ * If the data was received directly into the MBuffer (see buffer_callback),
+ * it is only accounted for; otherwise it is copied there first.
+ *
  * \param source the socket event
  * \param handle the client handler
  * \param buf data received from the socket
@@ -1008,13 +1471,34 @@ client_callback(SockEvtSource* source, void* handle, void* buf, int buf_size)
     oml_free(in);
   }
 
-  int result = mbuf_write (mbuf, buf, buf_size);
+  int result;
+  if (buf == mbuf_wrptr (mbuf)) {
+    result = mbuf_write_advance (mbuf, buf_size);
+  } else if ((result = mbuf_make_room (mbuf, buf_size)) == 0) {
+    result = mbuf_write (mbuf, buf, buf_size);
+  }
 
   if (result == -1) {
     logerror("%s: Failed to write message from client into message buffer\n",
         source->name);
     return;
   }
+  stats_add_bytes(self->stats, buf_size);
+
+  client_process(self, source->name);
+}
+
+/** Process the data accumulated in the MBuffer of a ClientHandler.
+ *
+ * \param self the client handler
+ * \param name name of the source of the data, for logging
+ * \return 0 on success, or -1 if the ClientHandler was freed following an error
+ * \see client_callback, process_mux_frame
+ */
+static int
+client_process(ClientHandler* self, const char *name)
+{
+  MBuffer* mbuf = self->mbuf;
 
 process:
   switch (self->state)
@@ -1035,29 +1519,40 @@ process:
     while (process_text_message(self, mbuf));
     break;
 
+  case C_MUX:
+    while (process_mux_frame(self, mbuf));
+    break;
+
   case C_PROTOCOL_ERROR:
     // Protocol error:  close the client connection
     logerror("%s: Fatal error, disconnecting client\n",
-        source->name);
+        name);
     client_event_report(self, "Disconnect", "C_PROTOCOL_ERROR");
     client_handler_free (self);
     /*
      * Protocol error --> no need to repack buffer, so just return;
      */
-    return;
+    return -1;
   default:
-    logerror("%s: Unknown client state %d\n", source->name, self->state);
+    logerror("%s: Unknown client state %d\n", name, self->state);
     mbuf_clear (mbuf);
-    return;
+    return 0;
   }
 
   if (self->state == C_PROTOCOL_ERROR)
     goto process;
 
-  // move remaining buffer content to beginning
-  mbuf_repack_message (mbuf);
-  logdebug("%s: Buffer repacked to %d bytes\n",
-      source->name, mbuf_fill(mbuf));
+  /* Rewind the buffer if everything has been consumed; a partial message is
+   * left where it is until its room is needed (see mbuf_make_room), so large
+   * messages arriving in small pieces aren't moved after every read */
+  if (mbuf_message_length (mbuf) == 0) {
+    mbuf_repack_message (mbuf);
+  } else {
+    logdebug("%s: %zu bytes of partial message left in buffer\n",
+        name, mbuf_message_length (mbuf));
+  }
+  stats_set_pending (self->stats, mbuf_rd_remaining (mbuf));
+  return 0;
 }
 /** Callback function called when the status of the socket change
  * \param source the socket event
@@ -30,6 +30,8 @@
 #include <mbuf.h>
 
 #include "database.h"
+#include "resume.h"
+#include "stats.h"
 
 #define MAX_PROTOCOL_VERSION OML_PROTOCOL_VERSION
 #define MIN_PROTOCOL_VERSION 1
@@ -40,6 +42,7 @@ typedef enum _cstate {
   C_TEXT_DATA,    // data in binary format
   C_PROTOCOL_ERROR,// a protocol error occurred --> kick the client
   C_BINARY_SKIP,  // somehow invalid binary message, we need to resync
+  C_MUX,          // multiplexed connection, data is made of frames for other ClientHandlers
 } CState;
 
 #define DEF_NUM_VALUES  30
@@ -67,6 +70,24 @@ typedef struct _clientHandler {
 
   time_t      time_offset;  // value to add to remote ts to
                             // sync time across all connections
+
+  /* Multiplexed connections, see mux.h */
+  struct _clientHandler *mux_parent;   // connection carrying this logical client, if any
+  struct _clientHandler *mux_children; // logical clients carried by this connection
+  struct _clientHandler *mux_next;     // next sibling in mux_parent->mux_children
+  uint32_t    mux_channel;  // channel of this logical client in mux_parent
+  char*       mux_name;     // name of this logical client, for debugging
+
+  /* Acknowledgements of stored samples, see ack.h */
+  int         ack;          // client asked for acknowledgements
+  int         start_time;   // start time of the client, telling its instances apart
+  ResumeState* resume;      // highest sequence numbers stored from this client instance
+  int*        ack_sent;     // last sequence number acknowledged for each stream
+  int         ack_count;    // size of ack_sent
+  MBuffer*    ack_out;      // acknowledgements not sent yet
+  TimerEvtSource *ack_timer; // periodic sending of acknowledgements
+
+  IngestStats* stats;       // ingest counters, see stats.h
 } ClientHandler;
 
 ClientHandler* client_handler_new (Socket* new_sock);
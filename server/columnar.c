@@ -0,0 +1,1048 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file columnar.c
+ * \brief Read and write the files of the columnar storage backend.
+ *
+ * A columnar database is a directory, DOMAIN.col, containing two key/value
+ * files (the server's metadata, including the schema of each table, and the
+ * mapping of sender names to IDs), and one directory per table.
+ *
+ * Each table is made of segments, numbered directories which are only ever
+ * appended to, and sealed (i.e., never written again) when they reach a given
+ * size or when the database is closed. A segment holds one file per column,
+ * named after it, starting with the four metadata columns (oml_sender_id,
+ * oml_seq, oml_ts_client and oml_ts_server):
+ * - fixed-size types are stored as arrays of elements in host byte order
+ *   (OML_LONG_VALUE as 64-bit integers, OML_BOOL_VALUE as bytes);
+ * - strings, blobs and vectors are stored as the concatenation of their
+ *   content, and a NAME.off file with the end offset of each element, as
+ *   64-bit integers; vectors are stored as arrays of their elements.
+ *
+ * The number of rows of a segment is the smallest number of elements of its
+ * columns, so a row partially written when the server stopped is ignored.
+ * Each segment also has a sparse index of the server timestamps (one entry
+ * every COL_INDEX_STRIDE rows), and a summary once sealed, to quickly find
+ * the rows of a given time range.
+ *
+ * \see columnar_adapter.c, oml2-columnar-export.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "columnar.h"
+
+/** Names of the metadata columns, in order */
+static const char *col_meta_names[COL_META_COLUMNS] = {
+  "oml_sender_id", "oml_seq", "oml_ts_client", "oml_ts_server",
+};
+/** Types of the metadata columns, in order */
+static const OmlValueT col_meta_types[COL_META_COLUMNS] = {
+  OML_INT32_VALUE, OML_INT32_VALUE, OML_DOUBLE_VALUE, OML_DOUBLE_VALUE,
+};
+
+/** Get the size of the stored elements of a type.
+ *
+ * \param type OmlValueT of the column
+ * \return the size of an element [B], 0 for variable-length types, or -1 if unsupported
+ */
+static int
+col_width (OmlValueT type)
+{
+  switch (type) {
+  case OML_DOUBLE_VALUE:
+  case OML_LONG_VALUE:
+  case OML_INT64_VALUE:
+  case OML_UINT64_VALUE:
+  case OML_GUID_VALUE:
+    return 8;
+  case OML_INT32_VALUE:
+  case OML_UINT32_VALUE:
+    return 4;
+  case OML_BOOL_VALUE:
+    return 1;
+  case OML_STRING_VALUE:
+  case OML_BLOB_VALUE:
+  case OML_VECTOR_DOUBLE_VALUE:
+  case OML_VECTOR_INT32_VALUE:
+  case OML_VECTOR_UINT32_VALUE:
+  case OML_VECTOR_INT64_VALUE:
+  case OML_VECTOR_UINT64_VALUE:
+  case OML_VECTOR_BOOL_VALUE:
+    return 0;
+  default:
+    return -1;
+  }
+}
+
+/** Get the size of the elements of a vector type.
+ *
+ * \param type OmlValueT of the column
+ * \return the size of an element of the vector [B]
+ */
+static int
+col_vector_width (OmlValueT type)
+{
+  switch (type) {
+  case OML_VECTOR_INT32_VALUE:
+  case OML_VECTOR_UINT32_VALUE:
+    return 4;
+  case OML_VECTOR_BOOL_VALUE:
+    return sizeof (bool);
+  default:
+    return 8;
+  }
+}
+
+/** Build the path of a file in a directory.
+ *
+ * \param dir directory
+ * \param name name of the file
+ * \return an oml_malloc'd string, or NULL on error
+ */
+char*
+col_path (const char *dir, const char *name)
+{
+  size_t len = strlen (dir) + strlen (name) + 2;
+  char *path = oml_malloc (len);
+
+  if (path) {
+    snprintf (path, len, "%s/%s", dir, name);
+  }
+  return path;
+}
+
+/** Create a directory if it does not exist yet.
+ *
+ * \param path path of the directory
+ * \return 0 on success, -1 otherwise
+ */
+int
+col_mkdir (const char *path)
+{
+  if (mkdir (path, 0755) && errno != EEXIST) {
+    logerror ("columnar: Could not create directory %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  return 0;
+}
+
+/** Compare two segment IDs, for qsort(3) */
+static int
+col_id_cmp (const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int*)a, y = *(const unsigned int*)b;
+  return x < y ? -1 : x > y;
+}
+
+/** List the segments of a table.
+ *
+ * \param tabledir directory of the table
+ * \param[out] ids oml_malloc'd array of segment IDs, in increasing order, to be oml_free'd by the caller
+ * \return the number of segments, or -1 on error
+ */
+int
+col_segments (const char *tabledir, unsigned int **ids)
+{
+  DIR *d = opendir (tabledir);
+  struct dirent *e;
+  unsigned int *a = NULL, *tmp;
+  int n = 0, size = 0;
+  char *end;
+  unsigned long id;
+
+  *ids = NULL;
+  if (!d) {
+    return errno == ENOENT ? 0 : -1;
+  }
+  while ((e = readdir (d))) {
+    if (e->d_name[0] < '0' || e->d_name[0] > '9') {
+      continue;
+    }
+    id = strtoul (e->d_name, &end, 10);
+    if (*end) {
+      continue;
+    }
+    if (n == size) {
+      size = size ? 2 * size : 16;
+      if (!(tmp = oml_realloc (a, size * sizeof (unsigned int)))) {
+        oml_free (a);
+        closedir (d);
+        return -1;
+      }
+      a = tmp;
+    }
+    a[n++] = id;
+  }
+  closedir (d);
+
+  if (n) {
+    qsort (a, n, sizeof (unsigned int), col_id_cmp);
+  } else if (a) {
+    oml_free (a);
+    a = NULL;
+  }
+  *ids = a;
+  return n;
+}
+
+/** Build the directory name of a segment.
+ *
+ * \param tabledir directory of the table
+ * \param id ID of the segment
+ * \return an oml_malloc'd string, or NULL on error
+ */
+char*
+col_segment_dir (const char *tabledir, unsigned int id)
+{
+  char name[16];
+  snprintf (name, sizeof (name), "%06u", id);
+  return col_path (tabledir, name);
+}
+
+/** Open the file(s) of a column.
+ *
+ * \param col ColColumn to set up
+ * \param dir directory of the segment
+ * \param name name of the column
+ * \param type type of the column
+ * \param mode fopen(3) mode
+ * \return 0 on success, -1 otherwise
+ */
+static int
+col_column_open (ColColumn *col, const char *dir, const char *name, OmlValueT type, const char *mode)
+{
+  char *path, *offname;
+  size_t len;
+
+  col->type = type;
+  if ((col->width = col_width (type)) < 0) {
+    logerror ("columnar: Unsupported type %s for column %s\n", oml_type_to_s (type), name);
+    return -1;
+  }
+  if (!(path = col_path (dir, name))) {
+    return -1;
+  }
+  col->data = fopen (path, mode);
+  if (!col->data) {
+    logerror ("columnar: Could not open %s: %s\n", path, strerror (errno));
+    oml_free (path);
+    return -1;
+  }
+  setvbuf (col->data, NULL, _IOFBF, COL_BUFFER_SIZE);
+  oml_free (path);
+
+  if (col->width == 0) {
+    len = strlen (name) + sizeof (COL_OFFSETS_SUFFIX);
+    if (!(offname = oml_malloc (len))) {
+      return -1;
+    }
+    snprintf (offname, len, "%s%s", name, COL_OFFSETS_SUFFIX);
+    path = col_path (dir, offname);
+    oml_free (offname);
+    if (!path) {
+      return -1;
+    }
+    col->offsets = fopen (path, mode);
+    if (!col->offsets) {
+      logerror ("columnar: Could not open %s: %s\n", path, strerror (errno));
+      oml_free (path);
+      return -1;
+    }
+    setvbuf (col->offsets, NULL, _IOFBF, COL_BUFFER_SIZE);
+    oml_free (path);
+  }
+  return 0;
+}
+
+/** Close the files of some columns, and free them.
+ *
+ * \param columns array of ColColumn
+ * \param n number of elements in columns
+ * \return 0 on success, -1 if some data could not be written
+ */
+static int
+col_columns_close (ColColumn *columns, int n)
+{
+  int i, ret = 0;
+
+  for (i = 0; i < n; i++) {
+    if (columns[i].data && fclose (columns[i].data)) {
+      ret = -1;
+    }
+    if (columns[i].offsets && fclose (columns[i].offsets)) {
+      ret = -1;
+    }
+  }
+  oml_free (columns);
+  return ret;
+}
+
+/** Open the files of all the columns of a segment.
+ *
+ * \param dir directory of the segment
+ * \param schema schema of the table
+ * \param mode fopen(3) mode
+ * \return an oml_malloc'd array of COL_META_COLUMNS + schema->nfields ColColumn, or NULL on error
+ */
+static ColColumn*
+col_columns_open (const char *dir, const struct schema *schema, const char *mode)
+{
+  int i, n = COL_META_COLUMNS + schema->nfields;
+  ColColumn *columns = oml_malloc (n * sizeof (ColColumn));
+
+  if (!columns) {
+    return NULL;
+  }
+  memset (columns, 0, n * sizeof (ColColumn));
+  for (i = 0; i < n; i++) {
+    if ((i < COL_META_COLUMNS &&
+          col_column_open (&columns[i], dir, col_meta_names[i], col_meta_types[i], mode)) ||
+        (i >= COL_META_COLUMNS &&
+         col_column_open (&columns[i], dir, schema->fields[i - COL_META_COLUMNS].name,
+           schema->fields[i - COL_META_COLUMNS].type, mode))) {
+      col_columns_close (columns, n);
+      return NULL;
+    }
+  }
+  return columns;
+}
+
+/** Open a new segment for writing.
+ *
+ * \param dir directory of the segment, created if needed
+ * \param schema schema of the table
+ * \return a new ColWriter, to be sealed with col_writer_seal, or NULL on error
+ * \see col_writer_seal, col_writer_close
+ */
+ColWriter*
+col_writer_open (const char *dir, const struct schema *schema)
+{
+  ColWriter *self;
+  char *path;
+
+  if (col_mkdir (dir) || !(self = oml_malloc (sizeof (ColWriter)))) {
+    return NULL;
+  }
+  memset (self, 0, sizeof (ColWriter));
+  self->dir = oml_strndup (dir, strlen (dir));
+  self->ncolumns = COL_META_COLUMNS + schema->nfields;
+  self->columns = col_columns_open (dir, schema, "ab");
+  path = col_path (dir, COL_INDEX_FILE);
+  if (path) {
+    self->index = fopen (path, "ab");
+    oml_free (path);
+  }
+  if (!self->dir || !self->columns || !self->index) {
+    logerror ("columnar: Could not open segment %s for writing\n", dir);
+    col_writer_close (self);
+    return NULL;
+  }
+  return self;
+}
+
+/** Write one fixed-size value.
+ *
+ * \param col ColColumn to write into
+ * \param v OmlValueU to write, of type col->type
+ * \return 1 on success, 0 otherwise
+ */
+static int
+col_write_fixed (ColColumn *col, OmlValueU *v)
+{
+  union {
+    double d;
+    int32_t i32;
+    uint32_t u32;
+    int64_t i64;
+    uint64_t u64;
+    uint8_t b;
+  } x;
+
+  switch (col->type) {
+  case OML_DOUBLE_VALUE: x.d = omlc_get_double (*v); break;
+  case OML_LONG_VALUE:   x.i64 = omlc_get_long (*v); break;
+  case OML_INT32_VALUE:  x.i32 = omlc_get_int32 (*v); break;
+  case OML_UINT32_VALUE: x.u32 = omlc_get_uint32 (*v); break;
+  case OML_INT64_VALUE:  x.i64 = omlc_get_int64 (*v); break;
+  case OML_UINT64_VALUE: x.u64 = omlc_get_uint64 (*v); break;
+  case OML_GUID_VALUE:   x.u64 = omlc_get_guid (*v); break;
+  case OML_BOOL_VALUE:   x.b = omlc_get_bool (*v) ? 1 : 0; break;
+  default: return 0;
+  }
+  return fwrite (&x, col->width, 1, col->data);
+}
+
+/** Write one variable-length value.
+ *
+ * \param col ColColumn to write into
+ * \param v OmlValueU to write, of type col->type
+ * \return 1 on success, 0 otherwise
+ */
+static int
+col_write_variable (ColColumn *col, OmlValueU *v)
+{
+  const void *ptr;
+  size_t len;
+
+  switch (col->type) {
+  case OML_STRING_VALUE:
+    ptr = omlc_get_string_ptr (*v);
+    len = ptr ? strlen (ptr) : 0;
+    break;
+  case OML_BLOB_VALUE:
+    ptr = omlc_get_blob_ptr (*v);
+    len = omlc_get_blob_length (*v);
+    break;
+  default:
+    ptr = omlc_get_vector_ptr (*v);
+    len = omlc_get_vector_nof_elts (*v) * col_vector_width (col->type);
+    break;
+  }
+  if (len && fwrite (ptr, len, 1, col->data) != 1) {
+    return 0;
+  }
+  /* Never let stdio write offsets out before the content they point to */
+  if (col->pending + sizeof (uint64_t) > COL_BUFFER_SIZE) {
+    if (fflush (col->data) || fflush (col->offsets)) {
+      return 0;
+    }
+    col->pending = 0;
+  }
+  col->offset += len;
+  col->pending += sizeof (uint64_t);
+  return fwrite (&col->offset, sizeof (uint64_t), 1, col->offsets);
+}
+
+/** Append a row to a segment.
+ *
+ * If an error occurs while writing, the columns might not be aligned
+ * anymore, and the ColWriter should be closed.
+ *
+ * \param self ColWriter to write into
+ * \param sender_id ID of the sender of the sample
+ * \param seq sequence number of the sample
+ * \param ts_client timestamp of the sample from the client
+ * \param ts_server timestamp of the sample from the server
+ * \param values OmlValue array of the sample, matching the schema
+ * \param nvalues number of elements in values
+ * \return 0 on success, -1 otherwise
+ */
+int
+col_writer_append (ColWriter *self, int32_t sender_id, int32_t seq,
+    double ts_client, double ts_server, OmlValue *values, int nvalues)
+{
+  ColColumn *col = &self->columns[COL_META_COLUMNS];
+  struct col_index_entry entry;
+  int i, ok;
+
+  if (nvalues != self->ncolumns - COL_META_COLUMNS) {
+    logerror ("columnar: Trying to write %d values into segment %s with %d columns\n",
+        nvalues, self->dir, self->ncolumns - COL_META_COLUMNS);
+    return -1;
+  }
+  for (i = 0; i < nvalues; i++) {
+    if (oml_value_get_type (&values[i]) != col[i].type) {
+      logerror ("columnar: Value %d type mismatch for segment %s: expected %s, got %s\n",
+          i, self->dir, oml_type_to_s (col[i].type), oml_type_to_s (oml_value_get_type (&values[i])));
+      return -1;
+    }
+  }
+
+  ok = fwrite (&sender_id, sizeof (int32_t), 1, self->columns[0].data) &&
+    fwrite (&seq, sizeof (int32_t), 1, self->columns[1].data) &&
+    fwrite (&ts_client, sizeof (double), 1, self->columns[2].data) &&
+    fwrite (&ts_server, sizeof (double), 1, self->columns[3].data);
+  for (i = 0; ok && i < nvalues; i++) {
+    ok = col[i].width ?
+      col_write_fixed (&col[i], oml_value_get_value (&values[i])) :
+      col_write_variable (&col[i], oml_value_get_value (&values[i]));
+  }
+  if (ok && self->summary.rows % COL_INDEX_STRIDE == 0) {
+    entry.row = self->summary.rows;
+    entry.ts_server = ts_server;
+    entry.sender_id = sender_id;
+    entry.seq = seq;
+    ok = fwrite (&entry, sizeof (entry), 1, self->index);
+  }
+  if (!ok) {
+    logerror ("columnar: Could not write row %" PRIu64 " of segment %s: %s\n",
+        self->summary.rows, self->dir, strerror (errno));
+    return -1;
+  }
+
+  if (!self->summary.rows || ts_server < self->summary.ts_min) {
+    self->summary.ts_min = ts_server;
+  }
+  if (!self->summary.rows || ts_server > self->summary.ts_max) {
+    self->summary.ts_max = ts_server;
+  }
+  self->summary.rows++;
+  return 0;
+}
+
+/** Write the buffered rows of a segment to disk.
+ *
+ * \param self ColWriter to flush
+ * \return 0 on success, -1 otherwise
+ */
+int
+col_writer_flush (ColWriter *self)
+{
+  int i, ret = 0;
+
+  /* Content is flushed before the offsets pointing to it */
+  for (i = 0; i < self->ncolumns; i++) {
+    if (fflush (self->columns[i].data) ||
+        (self->columns[i].offsets && fflush (self->columns[i].offsets))) {
+      ret = -1;
+    }
+    self->columns[i].pending = 0;
+  }
+  if (fflush (self->index)) {
+    ret = -1;
+  }
+  if (ret) {
+    logerror ("columnar: Could not flush segment %s: %s\n", self->dir, strerror (errno));
+  }
+  return ret;
+}
+
+/** Seal a segment: write its summary, and close it.
+ *
+ * \param self ColWriter to seal; it is freed in any case
+ * \return 0 on success, -1 otherwise
+ * \see col_summary_read
+ */
+int
+col_writer_seal (ColWriter *self)
+{
+  FILE *f;
+  char *path;
+  int ret = col_writer_flush (self);
+
+  if (!ret && (path = col_path (self->dir, COL_SUMMARY_FILE))) {
+    if ((f = fopen (path, "w"))) {
+      fprintf (f, "rows %" PRIu64 "\nts_min %.17g\nts_max %.17g\n",
+          self->summary.rows, self->summary.ts_min, self->summary.ts_max);
+      ret = fclose (f) ? -1 : 0;
+    } else {
+      ret = -1;
+    }
+    if (ret) {
+      logerror ("columnar: Could not write %s: %s\n", path, strerror (errno));
+    }
+    oml_free (path);
+  }
+  logdebug ("columnar: Sealed segment %s with %" PRIu64 " rows\n", self->dir, self->summary.rows);
+  col_writer_close (self);
+  return ret;
+}
+
+/** Close a segment without sealing it.
+ *
+ * \param self ColWriter to close and free
+ */
+void
+col_writer_close (ColWriter *self)
+{
+  if (self->columns) {
+    col_columns_close (self->columns, self->ncolumns);
+  }
+  if (self->index) {
+    fclose (self->index);
+  }
+  if (self->dir) {
+    oml_free (self->dir);
+  }
+  oml_free (self);
+}
+
+/** Read the summary of a sealed segment.
+ *
+ * \param dir directory of the segment
+ * \param[out] summary summary of the segment
+ * \return 0 on success, -1 if the segment is not sealed
+ */
+int
+col_summary_read (const char *dir, struct col_summary *summary)
+{
+  char *path = col_path (dir, COL_SUMMARY_FILE);
+  FILE *f;
+  int n = 0;
+
+  if (path && (f = fopen (path, "r"))) {
+    n = fscanf (f, "rows %" SCNu64 " ts_min %lf ts_max %lf",
+        &summary->rows, &summary->ts_min, &summary->ts_max);
+    fclose (f);
+  }
+  if (path) {
+    oml_free (path);
+  }
+  return n == 3 ? 0 : -1;
+}
+
+/** Find the row from which to scan a segment for a server timestamp.
+ *
+ * Server timestamps increase along a segment, so all rows before the
+ * returned one have a timestamp smaller than ts.
+ *
+ * \param dir directory of the segment
+ * \param ts oml_ts_server to look for
+ * \return the row of the last index entry with a smaller timestamp than ts, or 0
+ */
+uint64_t
+col_index_find (const char *dir, double ts)
+{
+  char *path = col_path (dir, COL_INDEX_FILE);
+  struct col_index_entry entry;
+  uint64_t row = 0;
+  FILE *f;
+
+  if (path && (f = fopen (path, "rb"))) {
+    while (fread (&entry, sizeof (entry), 1, f) == 1 && entry.ts_server < ts) {
+      row = entry.row;
+    }
+    fclose (f);
+  }
+  if (path) {
+    oml_free (path);
+  }
+  return row;
+}
+
+/** Get the number of elements in a column file.
+ *
+ * Elements of variable-length columns whose end offset lies past the end of
+ * the content file (if the server stopped while writing them) are ignored.
+ * The offsets file is left positioned on its first element.
+ *
+ * \param col ColColumn to consider
+ * \return the number of complete elements in the column
+ */
+static uint64_t
+col_column_rows (ColColumn *col)
+{
+  struct stat st;
+  uint64_t rows, end;
+  off_t size;
+
+  if (fstat (fileno (col->data), &st)) {
+    return 0;
+  }
+  if (col->width) {
+    return st.st_size / col->width;
+  }
+  size = st.st_size;
+  if (fstat (fileno (col->offsets), &st)) {
+    return 0;
+  }
+  /* Offsets increase, so only the last few can be past the content */
+  for (rows = st.st_size / sizeof (uint64_t); rows > 0; rows--) {
+    if (fseeko (col->offsets, (off_t)((rows - 1) * sizeof (uint64_t)), SEEK_SET) ||
+        fread (&end, sizeof (uint64_t), 1, col->offsets) != 1) {
+      rows = 0;
+      break;
+    }
+    if (end <= (uint64_t)size) {
+      break;
+    }
+  }
+  if (fseeko (col->offsets, 0, SEEK_SET)) {
+    return 0;
+  }
+  return rows;
+}
+
+/** Open a segment for reading.
+ *
+ * \param dir directory of the segment
+ * \param schema schema of the table
+ * \return a new ColReader, positioned on the first row, or NULL on error
+ * \see col_reader_next, col_reader_seek, col_reader_close
+ */
+ColReader*
+col_reader_open (const char *dir, const struct schema *schema)
+{
+  ColReader *self = oml_malloc (sizeof (ColReader));
+  uint64_t rows;
+  int i;
+
+  if (!self) {
+    return NULL;
+  }
+  memset (self, 0, sizeof (ColReader));
+  self->dir = oml_strndup (dir, strlen (dir));
+  self->ncolumns = COL_META_COLUMNS + schema->nfields;
+  self->nvalues = schema->nfields;
+  self->columns = col_columns_open (dir, schema, "rb");
+  self->values = oml_malloc ((self->nvalues + 1) * sizeof (OmlValue));
+  if (!self->dir || !self->columns || !self->values) {
+    col_reader_close (self);
+    return NULL;
+  }
+
+  oml_value_array_init (self->values, self->nvalues);
+  for (i = 0; i < self->nvalues; i++) {
+    oml_value_set_type (&self->values[i], schema->fields[i].type);
+  }
+  self->rows = col_column_rows (&self->columns[0]);
+  for (i = 1; i < self->ncolumns; i++) {
+    rows = col_column_rows (&self->columns[i]);
+    if (rows < self->rows) {
+      self->rows = rows;
+    }
+  }
+  return self;
+}
+
+/** Position a ColReader on a given row.
+ *
+ * \param self ColReader to move
+ * \param row row to read next
+ * \return 0 on success, -1 otherwise
+ */
+int
+col_reader_seek (ColReader *self, uint64_t row)
+{
+  ColColumn *col;
+  int i;
+
+  if (row > self->rows) {
+    row = self->rows;
+  }
+  for (i = 0; i < self->ncolumns; i++) {
+    col = &self->columns[i];
+    if (col->width) {
+      if (fseeko (col->data, (off_t)(row * col->width), SEEK_SET)) {
+        return -1;
+      }
+    } else {
+      col->offset = 0;
+      if (row > 0 && (fseeko (col->offsets, (off_t)((row - 1) * sizeof (uint64_t)), SEEK_SET) ||
+            fread (&col->offset, sizeof (uint64_t), 1, col->offsets) != 1)) {
+        return -1;
+      }
+      if ((row == 0 && fseeko (col->offsets, 0, SEEK_SET)) ||
+          fseeko (col->data, (off_t)col->offset, SEEK_SET)) {
+        return -1;
+      }
+    }
+  }
+  self->row = row;
+  return 0;
+}
+
+/** Read one fixed-size value.
+ *
+ * \param col ColColumn to read from
+ * \param v OmlValue to store the value into, of type col->type
+ * \return 1 on success, 0 otherwise
+ */
+static int
+col_read_fixed (ColColumn *col, OmlValue *v)
+{
+  OmlValueU *u = oml_value_get_value (v);
+  union {
+    double d;
+    int32_t i32;
+    uint32_t u32;
+    int64_t i64;
+    uint64_t u64;
+    uint8_t b;
+  } x;
+
+  if (fread (&x, col->width, 1, col->data) != 1) {
+    return 0;
+  }
+  switch (col->type) {
+  case OML_DOUBLE_VALUE: omlc_set_double (*u, x.d); break;
+  case OML_LONG_VALUE:   omlc_set_long (*u, (long)x.i64); break;
+  case OML_INT32_VALUE:  omlc_set_int32 (*u, x.i32); break;
+  case OML_UINT32_VALUE: omlc_set_uint32 (*u, x.u32); break;
+  case OML_INT64_VALUE:  omlc_set_int64 (*u, x.i64); break;
+  case OML_UINT64_VALUE: omlc_set_uint64 (*u, x.u64); break;
+  case OML_GUID_VALUE:   omlc_set_guid (*u, x.u64); break;
+  case OML_BOOL_VALUE:   omlc_set_bool (*u, x.b); break;
+  default: return 0;
+  }
+  return 1;
+}
+
+/** Read one variable-length value.
+ *
+ * \param self ColReader, whose buffer is used
+ * \param col ColColumn to read from
+ * \param v OmlValue to store the value into, of type col->type
+ * \return 1 on success, 0 otherwise
+ */
+static int
+col_read_variable (ColReader *self, ColColumn *col, OmlValue *v)
+{
+  OmlValueU *u = oml_value_get_value (v);
+  uint64_t end;
+  size_t len, n;
+  uint8_t *buf;
+
+  if (fread (&end, sizeof (uint64_t), 1, col->offsets) != 1 || end < col->offset) {
+    return 0;
+  }
+  len = end - col->offset;
+  if (len + 1 > self->bufsize) {
+    if (!(buf = oml_realloc (self->buf, len + 1))) {
+      return 0;
+    }
+    self->buf = buf;
+    self->bufsize = len + 1;
+  }
+  if (len && fread (self->buf, len, 1, col->data) != 1) {
+    return 0;
+  }
+  col->offset = end;
+
+  n = len / col_vector_width (col->type);
+  switch (col->type) {
+  case OML_STRING_VALUE:
+    omlc_set_string_copy (*u, (char*)self->buf, len);
+    break;
+  case OML_BLOB_VALUE:
+    omlc_set_blob (*u, self->buf, len);
+    break;
+  case OML_VECTOR_DOUBLE_VALUE:
+    omlc_set_vector_double (*u, self->buf, n);
+    break;
+  case OML_VECTOR_INT32_VALUE:
+    omlc_set_vector_int32 (*u, self->buf, n);
+    break;
+  case OML_VECTOR_UINT32_VALUE:
+    omlc_set_vector_uint32 (*u, self->buf, n);
+    break;
+  case OML_VECTOR_INT64_VALUE:
+    omlc_set_vector_int64 (*u, self->buf, n);
+    break;
+  case OML_VECTOR_UINT64_VALUE:
+    omlc_set_vector_uint64 (*u, self->buf, n);
+    break;
+  case OML_VECTOR_BOOL_VALUE:
+    omlc_set_vector_bool (*u, self->buf, n);
+    break;
+  default:
+    return 0;
+  }
+  return 1;
+}
+
+/** Read the next row of a segment.
+ *
+ * The metadata and values of the row are then available in the ColReader.
+ *
+ * \param self ColReader to read from
+ * \return 1 if a row was read, 0 at the end of the segment, or -1 on error
+ */
+int
+col_reader_next (ColReader *self)
+{
+  ColColumn *col = &self->columns[COL_META_COLUMNS];
+  int i, ok;
+
+  if (self->row >= self->rows) {
+    return 0;
+  }
+  ok = fread (&self->sender_id, sizeof (int32_t), 1, self->columns[0].data) &&
+    fread (&self->seq, sizeof (int32_t), 1, self->columns[1].data) &&
+    fread (&self->ts_client, sizeof (double), 1, self->columns[2].data) &&
+    fread (&self->ts_server, sizeof (double), 1, self->columns[3].data);
+  for (i = 0; ok && i < self->nvalues; i++) {
+    ok = col[i].width ?
+      col_read_fixed (&col[i], &self->values[i]) :
+      col_read_variable (self, &col[i], &self->values[i]);
+  }
+  if (!ok) {
+    logerror ("columnar: Could not read row %" PRIu64 " of segment %s\n", self->row, self->dir);
+    return -1;
+  }
+  self->row++;
+  return 1;
+}
+
+/** Close a segment opened for reading.
+ *
+ * \param self ColReader to close and free
+ */
+void
+col_reader_close (ColReader *self)
+{
+  if (self->columns) {
+    col_columns_close (self->columns, self->ncolumns);
+  }
+  if (self->values) {
+    oml_value_array_reset (self->values, self->nvalues);
+    oml_free (self->values);
+  }
+  if (self->buf) {
+    oml_free (self->buf);
+  }
+  if (self->dir) {
+    oml_free (self->dir);
+  }
+  oml_free (self);
+}
+
+/** Add or replace a pair in a list of key/value pairs.
+ *
+ * \param kv pointer to the list
+ * \param key key to set
+ * \param value value to set
+ * \return 0 on success, -1 otherwise
+ */
+static int
+col_kv_put (ColKeyValue **kv, const char *key, const char *value)
+{
+  ColKeyValue *it;
+  char *v = oml_strndup (value, strlen (value));
+
+  if (!v) {
+    return -1;
+  }
+  for (it = *kv; it; it = it->next) {
+    if (!strcmp (it->key, key)) {
+      oml_free (it->value);
+      it->value = v;
+      return 0;
+    }
+  }
+  if (!(it = oml_malloc (sizeof (ColKeyValue))) ||
+      !(it->key = oml_strndup (key, strlen (key)))) {
+    if (it) {
+      oml_free (it);
+    }
+    oml_free (v);
+    return -1;
+  }
+  it->value = v;
+  it->next = *kv;
+  *kv = it;
+  return 0;
+}
+
+/** Load a file of key/value pairs.
+ *
+ * The file has one tab-separated pair per line; later lines override
+ * earlier ones with the same key.
+ *
+ * \param path path of the file
+ * \return a list of ColKeyValue, to be freed with col_kv_free, or NULL if empty or absent
+ */
+ColKeyValue*
+col_kv_load (const char *path)
+{
+  ColKeyValue *kv = NULL;
+  char line[4096], *tab, *nl;
+  FILE *f = fopen (path, "r");
+
+  if (!f) {
+    return NULL;
+  }
+  while (fgets (line, sizeof (line), f)) {
+    if (!(nl = strchr (line, '\n')) || !(tab = strchr (line, '\t'))) {
+      logwarn ("columnar: Ignoring malformed line in %s\n", path);
+      continue;
+    }
+    *nl = '\0';
+    *tab = '\0';
+    col_kv_put (&kv, line, tab + 1);
+  }
+  fclose (f);
+  return kv;
+}
+
+/** Look up a key in a list of key/value pairs.
+ *
+ * \param kv list of ColKeyValue
+ * \param key key to look up
+ * \return the value, or NULL if absent
+ */
+const char*
+col_kv_get (ColKeyValue *kv, const char *key)
+{
+  for (; kv; kv = kv->next) {
+    if (!strcmp (kv->key, key)) {
+      return kv->value;
+    }
+  }
+  return NULL;
+}
+
+/** Set a key/value pair, and append it to a file.
+ *
+ * \param kv pointer to the list of ColKeyValue loaded from path
+ * \param path path of the file
+ * \param key key to set, which cannot contain tabs or newlines
+ * \param value value to set, which cannot contain newlines
+ * \return 0 on success, -1 otherwise
+ * \see col_kv_load
+ */
+int
+col_kv_set (ColKeyValue **kv, const char *path, const char *key, const char *value)
+{
+  FILE *f;
+  int ret;
+
+  if (strpbrk (key, "\t\n") || strchr (value, '\n') ||
+      strlen (key) + strlen (value) + 2 >= 4096) {
+    logerror ("columnar: Cannot store key '%s' in %s\n", key, path);
+    return -1;
+  }
+  if (!(f = fopen (path, "a"))) {
+    logerror ("columnar: Could not open %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  ret = fprintf (f, "%s\t%s\n", key, value) < 0;
+  if (fclose (f) || ret) {
+    logerror ("columnar: Could not write to %s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  return col_kv_put (kv, key, value);
+}
+
+/** Free a list of key/value pairs.
+ *
+ * \param kv list of ColKeyValue
+ */
+void
+col_kv_free (ColKeyValue *kv)
+{
+  ColKeyValue *next;
+
+  while (kv) {
+    next = kv->next;
+    oml_free (kv->key);
+    oml_free (kv->value);
+    oml_free (kv);
+    kv = next;
+  }
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
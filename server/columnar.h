@@ -0,0 +1,146 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file columnar.h
+ * \brief On-disk format of the columnar storage backend.
+ * \see columnar.c, columnar_adapter.c
+ */
+#ifndef COLUMNAR_H__
+#define COLUMNAR_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "oml2/omlc.h"
+#include "schema.h"
+
+/** Version of the on-disk format, stored in the metadata */
+#define COL_FORMAT_VERSION 1
+
+/** Suffix of database directories */
+#define COL_DB_SUFFIX ".col"
+/** Key/value file holding the experiment metadata set by the server */
+#define COL_METADATA_FILE "_experiment_metadata.kv"
+/** Key/value file mapping sender names to their IDs */
+#define COL_SENDERS_FILE "_senders.kv"
+/** Summary file written in a segment when it is sealed */
+#define COL_SUMMARY_FILE "summary"
+/** Sparse index file of a segment */
+#define COL_INDEX_FILE "index"
+/** Suffix of the offset file of variable-length columns */
+#define COL_OFFSETS_SUFFIX ".off"
+
+/** Number of rows between entries of the sparse index */
+#define COL_INDEX_STRIDE 1024
+/** Size of the stdio buffer of each column file [B] */
+#define COL_BUFFER_SIZE 16384
+
+/** Number of metadata columns preceding the schema's in every segment */
+#define COL_META_COLUMNS 4
+
+/** One entry of the sparse index of a segment */
+struct col_index_entry {
+  uint64_t row;       /**< row number in the segment */
+  double ts_server;   /**< oml_ts_server of that row */
+  int32_t sender_id;  /**< oml_sender_id of that row */
+  int32_t seq;        /**< oml_seq of that row */
+};
+
+/** Summary of a sealed segment */
+struct col_summary {
+  uint64_t rows;      /**< number of rows */
+  double ts_min;      /**< smallest oml_ts_server */
+  double ts_max;      /**< largest oml_ts_server */
+};
+
+/** One column file (and its offsets, for variable-length types) */
+typedef struct ColColumn {
+  OmlValueT type;     /**< type of the column */
+  int width;          /**< size of fixed-size elements, or 0 for variable-length ones [B] */
+  FILE *data;         /**< elements, or their concatenated content */
+  FILE *offsets;      /**< end offsets of the content of each element, if variable-length */
+  uint64_t offset;    /**< current end offset of the content */
+  size_t pending;     /**< offsets buffered since data was last flushed, when writing [B] */
+} ColColumn;
+
+/** Appends rows to the column files of a segment
+ *
+ * A ColWriter keeps all its files open: one per column, two for
+ * variable-length ones, and the index, i.e., between 5 + nfields and
+ * 5 + 2 * nfields file descriptors per table being written.
+ */
+typedef struct ColWriter {
+  char *dir;          /**< directory of the segment */
+  int ncolumns;       /**< number of columns, including the metadata columns */
+  ColColumn *columns; /**< columns, metadata columns first */
+  FILE *index;        /**< sparse index */
+  struct col_summary summary; /**< summary of the rows written so far */
+} ColWriter;
+
+/** Reads rows from the column files of a segment */
+typedef struct ColReader {
+  char *dir;          /**< directory of the segment */
+  int ncolumns;       /**< number of columns, including the metadata columns */
+  ColColumn *columns; /**< columns, metadata columns first */
+  uint64_t rows;      /**< number of complete rows in the segment */
+  uint64_t row;       /**< next row to read */
+
+  int32_t sender_id;  /**< oml_sender_id of the last row read */
+  int32_t seq;        /**< oml_seq of the last row read */
+  double ts_client;   /**< oml_ts_client of the last row read */
+  double ts_server;   /**< oml_ts_server of the last row read */
+  OmlValue *values;   /**< values of the last row read, one per field of the schema */
+  int nvalues;        /**< number of elements in values */
+
+  uint8_t *buf;       /**< buffer for variable-length content */
+  size_t bufsize;     /**< size of buf */
+} ColReader;
+
+/** Key/value pair of the metadata files */
+typedef struct ColKeyValue {
+  char *key;
+  char *value;
+  struct ColKeyValue *next;
+} ColKeyValue;
+
+char *col_path (const char *dir, const char *name);
+int col_mkdir (const char *path);
+int col_segments (const char *tabledir, unsigned int **ids);
+char *col_segment_dir (const char *tabledir, unsigned int id);
+
+ColWriter *col_writer_open (const char *dir, const struct schema *schema);
+int col_writer_append (ColWriter *self, int32_t sender_id, int32_t seq,
+    double ts_client, double ts_server, OmlValue *values, int nvalues);
+int col_writer_flush (ColWriter *self);
+int col_writer_seal (ColWriter *self);
+void col_writer_close (ColWriter *self);
+
+int col_summary_read (const char *dir, struct col_summary *summary);
+uint64_t col_index_find (const char *dir, double ts);
+
+ColReader *col_reader_open (const char *dir, const struct schema *schema);
+int col_reader_seek (ColReader *self, uint64_t row);
+int col_reader_next (ColReader *self);
+void col_reader_close (ColReader *self);
+
+ColKeyValue *col_kv_load (const char *path);
+const char *col_kv_get (ColKeyValue *kv, const char *key);
+int col_kv_set (ColKeyValue **kv, const char *path, const char *key, const char *value);
+void col_kv_free (ColKeyValue *kv);
+
+#endif /* COLUMNAR_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,544 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file columnar_adapter.c
+ * \brief Adapter code for the columnar storage backend.
+ *
+ * This backend does not use SQL: each DbTable is stored as append-only
+ * column files, in segments which are sealed after columnar_segment_rows
+ * rows or when the database is closed. The data can then be exported to
+ * SQLite3 or CSV with oml2-columnar-export(1).
+ *
+ * \see columnar.c
+ */
+#include <stdio.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "oml_util.h"
+#include "schema.h"
+#include "database.h"
+#include "table_descr.h"
+#include "database_adapter.h"
+#include "sqlite_adapter.h"
+#include "columnar_adapter.h"
+
+static char backend_name[] = "columnar";
+/* Shared with the SQLite3 backend \see sq3_dbdir_setup */
+extern char *sqlite_database_dir;
+
+/** Number of rows after which a segment is sealed */
+int columnar_segment_rows = DEFAULT_COL_SEGMENT_ROWS;
+
+static OmlValueT col_type_to_oml (const char *s);
+static const char *col_oml_to_type (OmlValueT type);
+static int col_stmt (Database* db, const char* stmt);
+static void col_release (Database* db);
+static int col_table_create (Database* db, DbTable* table, int shallow);
+static int col_table_create_meta (Database *db, const char *name);
+static int col_table_free (Database *database, DbTable* table);
+static int col_insert (Database *db, DbTable *table, int sender_id, int seq_no, double time_stamp, OmlValue *values, int value_count);
+static char* col_get_metadata (Database* database, const char* key);
+static int col_set_metadata (Database* database, const char* key, const char* value);
+static int col_add_sender_id (Database* database, const char* sender_id);
+static char* col_get_uri (Database *db, char *uri, size_t size);
+static TableDescr* col_get_table_list (Database *database, int *num_tables);
+
+/** Setup the columnar backend.
+ *
+ * Databases are stored in the same directory as SQLite3 ones.
+ *
+ * \return 0 on success, -1 otherwise
+ *
+ * \see database_setup_backend, sq3_dbdir_setup
+ */
+int
+col_backend_setup (void)
+{
+  sq3_dbdir_setup ();
+
+  /* See sq3_backend_setup for why access(2) is fine here */
+  if (access (sqlite_database_dir, R_OK | W_OK | X_OK) == -1) {
+    logerror ("columnar: Can't access database directory %s: %s\n",
+         sqlite_database_dir, strerror (errno));
+    return -1;
+  }
+  if (columnar_segment_rows <= 0) {
+    logerror ("columnar: Segments must contain at least one row\n");
+    return -1;
+  }
+
+  loginfo ("columnar: Creating columnar databases in %s\n", sqlite_database_dir);
+  logdebug ("columnar: Sealing segments every %d rows\n", columnar_segment_rows);
+
+  return 0;
+}
+
+/** Mapping from stored to OML types; the columnar backend uses the OML names.
+ * \see db_adapter_type_to_oml, oml_type_from_s
+ */
+static OmlValueT
+col_type_to_oml (const char *type)
+{
+  return oml_type_from_s (type);
+}
+
+/** Mapping from OML to stored types; the columnar backend uses the OML names.
+ * \see db_adapter_oml_to_type, oml_type_to_s
+ */
+static const char*
+col_oml_to_type (OmlValueT type)
+{
+  return oml_type_to_s (type);
+}
+
+/** Get the current time.
+ * \return the current time [ms since the Epoch]
+ */
+static uint64_t
+col_now_ms (void)
+{
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/** Create or open a columnar database and adapter structures
+ * \see db_adapter_create
+ */
+/* This function is exposed to the rest of the code for backend initialisation */
+int
+col_create_database (Database* db)
+{
+  ColDB *self;
+  ColKeyValue *kv;
+  char name[MAX_DB_NAME_SIZE + sizeof (COL_DB_SUFFIX) + 1];
+  int id;
+
+  snprintf (name, sizeof (name), "%s%s", db->name, COL_DB_SUFFIX);
+  if (!(self = oml_malloc (sizeof (ColDB))) ||
+      !(self->dir = col_path (sqlite_database_dir, name)) ||
+      col_mkdir (self->dir) ||
+      !(self->metadata_path = col_path (self->dir, COL_METADATA_FILE)) ||
+      !(self->senders_path = col_path (self->dir, COL_SENDERS_FILE))) {
+    logerror ("columnar:%s: Could not create database\n", db->name);
+    goto fail_exit;
+  }
+  loginfo ("columnar:%s: Opening database at '%s'\n", db->name, self->dir);
+
+  self->metadata = col_kv_load (self->metadata_path);
+  self->senders = col_kv_load (self->senders_path);
+  for (kv = self->senders; kv; kv = kv->next) {
+    id = atoi (kv->value);
+    if (id > self->sender_cnt) {
+      self->sender_cnt = id;
+    }
+  }
+  self->last_flush = col_now_ms ();
+
+  db->backend_name = backend_name;
+  db->o2t = col_oml_to_type;
+  db->t2o = col_type_to_oml;
+  db->stmt = col_stmt;
+  db->table_create = col_table_create;
+  db->table_create_meta = col_table_create_meta;
+  db->table_free = col_table_free;
+  db->release = col_release;
+  db->prepared_var = NULL; /* No SQL */
+  db->insert = col_insert;
+  db->add_sender_id = col_add_sender_id;
+  db->set_metadata = col_set_metadata;
+  db->get_metadata = col_get_metadata;
+  db->get_uri = col_get_uri;
+  db->get_table_list = col_get_table_list;
+
+  db->handle = self;
+
+  if (!col_kv_get (self->metadata, "columnar_format")) {
+    char version[16];
+    snprintf (version, sizeof (version), "%d", COL_FORMAT_VERSION);
+    col_set_metadata (db, "columnar_format", version);
+  }
+
+  return 0;
+
+fail_exit:
+  if (self) {
+    if (self->dir) { oml_free (self->dir); }
+    if (self->metadata_path) { oml_free (self->metadata_path); }
+    if (self->senders_path) { oml_free (self->senders_path); }
+    oml_free (self);
+  }
+  return -1;
+}
+
+/** Release the columnar database.
+ *
+ * The tables, and their segments, have already been released.
+ *
+ * \see db_adapter_release
+ */
+static void
+col_release (Database* db)
+{
+  ColDB *self = (ColDB*)db->handle;
+  col_kv_free (self->metadata);
+  col_kv_free (self->senders);
+  oml_free (self->metadata_path);
+  oml_free (self->senders_path);
+  oml_free (self->dir);
+  oml_free (self);
+  db->handle = NULL;
+}
+
+/** The columnar backend does not support SQL statements.
+ * \see db_adapter_stmt
+ */
+static int
+col_stmt (Database* db, const char* stmt)
+{
+  logwarn ("columnar:%s: SQL statements are not supported: %s\n", db->name, stmt);
+  return -1;
+}
+
+/** Create the adapter structures, and the directory, of a table.
+ *
+ * When not shallow, the schema of the table is also saved in the metadata.
+ *
+ * \see db_adapter_table_create
+ */
+static int
+col_table_create (Database* db, DbTable* table, int shallow)
+{
+  ColDB *coldb;
+  ColTable *coltable;
+  unsigned int *ids = NULL;
+  char *meta, key[MAX_TABLE_NAME_SIZE + 7];
+  int n;
+
+  if (db == NULL) {
+    logwarn ("columnar: Tried to create a table in a NULL database\n");
+    return -1;
+  }
+  if (table == NULL || table->schema == NULL) {
+    logwarn ("columnar:%s: No schema defined for table, cannot create\n", db->name);
+    return -1;
+  }
+  if (strchr (table->schema->name, '/') || table->schema->name[0] == '.') {
+    logerror ("columnar:%s: Invalid table name '%s'\n", db->name, table->schema->name);
+    return -1;
+  }
+  coldb = (ColDB*)db->handle;
+
+  if (table->handle != NULL) {
+    logwarn ("columnar:%s: BUG: Recreating ColTable handle for table %s\n",
+        db->name, table->schema->name);
+  }
+  if (!(coltable = oml_malloc (sizeof (ColTable))) ||
+      !(coltable->dir = col_path (coldb->dir, table->schema->name)) ||
+      col_mkdir (coltable->dir)) {
+    logerror ("columnar:%s: Could not create table '%s'\n", db->name, table->schema->name);
+    goto fail_exit;
+  }
+
+  /* Never append to an existing segment: it may not have been sealed properly */
+  if ((n = col_segments (coltable->dir, &ids)) < 0) {
+    logerror ("columnar:%s: Could not list segments of table '%s'\n", db->name, table->schema->name);
+    goto fail_exit;
+  } else if (n > 0) {
+    coltable->segment = ids[n - 1] + 1;
+    oml_free (ids);
+  }
+
+  if (!shallow) {
+    snprintf (key, sizeof (key), "table_%s", table->schema->name);
+    meta = schema_to_meta (table->schema);
+    if (!meta || col_set_metadata (db, key, meta)) {
+      logerror ("columnar:%s: Could not store schema of table '%s'\n", db->name, table->schema->name);
+      if (meta) { oml_free (meta); }
+      goto fail_exit;
+    }
+    oml_free (meta);
+  }
+
+  table->handle = coltable;
+  return 0;
+
+fail_exit:
+  if (coltable) {
+    if (coltable->dir) { oml_free (coltable->dir); }
+    oml_free (coltable);
+  }
+  return -1;
+}
+
+/** Create the metadata tables.
+ *
+ * The server's metadata and the senders are stored in key/value files;
+ * only the _experiment_metadata table, which clients can write to, needs to
+ * be created.
+ *
+ * \see db_adapter_table_create_meta, dba_meta_table_schema
+ */
+static int
+col_table_create_meta (Database *db, const char *name)
+{
+  const char *meta = dba_meta_table_schema (name);
+  struct schema *schema;
+  DbTable *table;
+  int ret = -1;
+
+  if (!strcmp (name, "_senders")) {
+    return 0;
+  } else if (!meta || !(schema = schema_from_meta (meta))) {
+    logwarn ("columnar:%s: No usable definition for default table %s\n", db->name, name);
+    return -1;
+  }
+
+  logdebug ("columnar:%s: Creating default table %s from schema '%s'\n", db->name, name, meta);
+  if ((table = database_create_table (db, schema))) {
+    ret = col_table_create (db, table, 0);
+    if (ret) {
+      db->first_table = table->next;
+      database_table_free (db, table);
+    }
+  }
+  schema_free (schema);
+  return ret;
+}
+
+/** Free a table, sealing its current segment.
+ * \see db_adapter_table_free
+ */
+static int
+col_table_free (Database *database, DbTable* table)
+{
+  ColTable *coltable = (ColTable*)table->handle;
+  int ret = 0;
+
+  if (coltable) {
+    if (coltable->writer && col_writer_seal (coltable->writer)) {
+      logwarn ("columnar:%s: Could not seal the last segment of table '%s'\n",
+          database->name, table->schema->name);
+      ret = -1;
+    }
+    oml_free (coltable->dir);
+    oml_free (coltable);
+    table->handle = NULL;
+  }
+  return ret;
+}
+
+/** Flush the current segments of all tables, if it has not been done recently.
+ *
+ * \param db Database to flush
+ * \param now current time [ms since the Epoch]
+ */
+static void
+col_flush_policy (Database *db, uint64_t now)
+{
+  ColDB *self = (ColDB*)db->handle;
+  ColTable *coltable;
+  DbTable *table;
+
+  if (now - self->last_flush < DEFAULT_COL_FLUSH_INTERVAL) {
+    return;
+  }
+  for (table = db->first_table; table; table = table->next) {
+    coltable = (ColTable*)table->handle;
+    if (coltable && coltable->writer) {
+      col_writer_flush (coltable->writer);
+    }
+  }
+  self->last_flush = now;
+}
+
+/** Append a sample to the current segment of a table.
+ *
+ * A new segment is opened if needed, and sealed once it contains
+ * columnar_segment_rows rows.
+ *
+ * \see db_adapter_insert
+ */
+static int
+col_insert (Database *db, DbTable *table, int sender_id, int seq_no, double time_stamp, OmlValue *values, int value_count)
+{
+  ColTable *coltable = (ColTable*)table->handle;
+  double time_stamp_server;
+  struct timeval tv;
+  char *dir;
+
+  gettimeofday (&tv, NULL);
+  time_stamp_server = tv.tv_sec - db->start_time + 0.000001 * tv.tv_usec;
+
+  if (!coltable->writer) {
+    if (!(dir = col_segment_dir (coltable->dir, coltable->segment))) {
+      return -1;
+    }
+    coltable->writer = col_writer_open (dir, table->schema);
+    oml_free (dir);
+    if (!coltable->writer) {
+      logerror ("columnar:%s: Could not open segment %u of table '%s'\n",
+          db->name, coltable->segment, table->schema->name);
+      return -1;
+    }
+    logdebug ("columnar:%s: Opened segment %u of table '%s'\n",
+        db->name, coltable->segment, table->schema->name);
+    coltable->segment++;
+  }
+
+  if (col_writer_append (coltable->writer, sender_id, seq_no, time_stamp, time_stamp_server,
+        values, value_count)) {
+    /* The columns may not be aligned anymore; start a new segment next time */
+    col_writer_close (coltable->writer);
+    coltable->writer = NULL;
+    return -1;
+  }
+
+  if (coltable->writer->summary.rows >= (uint64_t)columnar_segment_rows) {
+    col_writer_seal (coltable->writer);
+    coltable->writer = NULL;
+  }
+  col_flush_policy (db, (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000);
+
+  return 0;
+}
+
+/** Get data from the metadata file
+ * \see db_adapter_get_metadata
+ */
+static char*
+col_get_metadata (Database* database, const char* key)
+{
+  ColDB *self = (ColDB*)database->handle;
+  const char *value = col_kv_get (self->metadata, key);
+  return value ? oml_strndup (value, strlen (value)) : NULL;
+}
+
+/** Set data in the metadata file
+ * \see db_adapter_set_metadata
+ */
+static int
+col_set_metadata (Database* database, const char* key, const char* value)
+{
+  ColDB *self = (ColDB*)database->handle;
+  const char *old = col_kv_get (self->metadata, key);
+
+  if (old && !strcmp (old, value)) {
+    return 0;
+  }
+  return col_kv_set (&self->metadata, self->metadata_path, key, value);
+}
+
+/** Add a new sender to the database, returning its index.
+ * \see db_add_sender_id
+ */
+static int
+col_add_sender_id (Database* database, const char* sender_id)
+{
+  ColDB *self = (ColDB*)database->handle;
+  const char *id_str = col_kv_get (self->senders, sender_id);
+  char s[64];
+
+  if (id_str) {
+    return atoi (id_str);
+  }
+  snprintf (s, sizeof (s), "%d", ++self->sender_cnt);
+  if (col_kv_set (&self->senders, self->senders_path, sender_id, s)) {
+    logwarn ("columnar:%s: Could not store ID %s of sender '%s'\n", database->name, s, sender_id);
+  }
+  return self->sender_cnt;
+}
+
+/** Build a URI for this database.
+ *
+ * URI is of the form file:PATH/DATABASE.col
+ *
+ * \see db_adapter_get_uri
+ */
+static char*
+col_get_uri (Database *db, char *uri, size_t size)
+{
+  char fullpath[PATH_MAX+1];
+  if (snprintf (uri, size, "file:%s/%s%s\n", realpath (sqlite_database_dir, fullpath),
+        db->name, COL_DB_SUFFIX) >= size) {
+    return NULL;
+  }
+  return uri;
+}
+
+/** Get the list of tables of a columnar database from their schemas in the metadata.
+ * \see db_adapter_get_table_list
+ */
+static TableDescr*
+col_get_table_list (Database *database, int *num_tables)
+{
+  ColDB *self = (ColDB*)database->handle;
+  TableDescr *tables = NULL, *t;
+  struct schema *schema;
+  ColKeyValue *kv;
+
+  *num_tables = 0;
+  if (!self->metadata) {
+    logdebug ("columnar:%s: No metadata found, this is a new database\n", database->name);
+    return NULL;
+  }
+
+  for (kv = self->metadata; kv; kv = kv->next) {
+    if (strncmp (kv->key, "table_", 6)) {
+      continue;
+    }
+    if (!(schema = schema_from_meta (kv->value))) {
+      logerror ("columnar:%s: Could not parse schema '%s' for table %s\n",
+          database->name, kv->value, kv->key + 6);
+      goto fail_exit;
+    }
+    if (!(t = table_descr_new (kv->key + 6, schema))) {
+      schema_free (schema);
+      goto fail_exit;
+    }
+    t->next = tables;
+    tables = t;
+    (*num_tables)++;
+  }
+
+  /* Create a phony entry for the _senders table so
+   * server/database.c:database_init() doesn't try to create it */
+  if ((t = table_descr_new ("_senders", NULL))) {
+    t->next = tables;
+    tables = t;
+    (*num_tables)++;
+  }
+
+  return tables;
+
+fail_exit:
+  if (tables) {
+    table_descr_list_free (tables);
+  }
+  *num_tables = -1;
+  return NULL;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
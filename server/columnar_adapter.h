@@ -0,0 +1,58 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file columnar_adapter.h
+ * \brief Adapter for the columnar storage backend.
+ * \see columnar_adapter.c, columnar.h
+ */
+#ifndef COLUMNAR_ADAPTER_H_
+#define COLUMNAR_ADAPTER_H_
+
+#include <stdint.h>
+
+#include "database.h"
+#include "columnar.h"
+
+/** Default number of rows after which a segment is sealed \see columnar_segment_rows */
+#define DEFAULT_COL_SEGMENT_ROWS 1048576
+/** Maximum time between flushes of the column files [ms] */
+#define DEFAULT_COL_FLUSH_INTERVAL 1000
+
+typedef struct ColDB {
+  char *dir;                /**< directory of the database */
+  char *metadata_path;      /**< path of the metadata key/value file */
+  char *senders_path;       /**< path of the senders key/value file */
+  ColKeyValue *metadata;    /**< content of the metadata file */
+  ColKeyValue *senders;     /**< content of the senders file */
+  int sender_cnt;           /**< largest sender ID so far */
+  /** Time the column files were last flushed [ms since the Epoch] */
+  uint64_t last_flush;
+} ColDB;
+
+typedef struct ColTable {
+  char *dir;                /**< directory of the table */
+  ColWriter *writer;        /**< current segment, opened on the first insertion */
+  unsigned int segment;     /**< ID of the next segment to open */
+} ColTable;
+
+extern int columnar_segment_rows;
+
+int col_backend_setup (void);
+int col_create_database (Database* db);
+
+#endif /* COLUMNAR_ADAPTER_H_ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
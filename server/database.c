@@ -62,9 +62,13 @@
 #include "oml_value.h"
 #include "mem.h"
 #include "mstring.h"
+#include "text.h"
 #include "database.h"
+#include "database_adapter.h"
+#include "stats.h"
 #include "hook.h"
 #include "sqlite_adapter.h"
+#include "columnar_adapter.h"
 
 #if HAVE_LIBPQ
 #include <libpq-fe.h>
@@ -81,6 +85,7 @@ static struct db_backend
 } backends [] =
   {
     { "sqlite", sq3_create_database },
+    { "columnar", col_create_database },
 #if HAVE_LIBPQ
     { "postgresql", psql_create_database },
 #endif
@@ -89,6 +94,8 @@ static struct db_backend
 char* dbbackend = DEFAULT_DB_BACKEND;
 
 static Database *first_db = NULL;
+/** Lock protecting the list of open databases, and their reference counts */
+static pthread_mutex_t first_db_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /** Get the list of valid database backends.
  *
@@ -121,7 +128,7 @@ database_valid_backends ()
  * \param backend name of the selected backend
  * \return 0 on success, -1 otherwise
  *
- * \see sq3_backend_setup, psql_backend_setup
+ * \see sq3_backend_setup, col_backend_setup, psql_backend_setup
  */
 int
 database_setup_backend (const char* backend)
@@ -134,8 +141,12 @@ database_setup_backend (const char* backend)
     return -1;
   }
 
+  if (dba_indexes_setup ()) return -1;
+
   if (!strcmp (backend, "sqlite")) {
     if(sq3_backend_setup ()) return -1;
+  } else if (!strcmp (backend, "columnar")) {
+    if(col_backend_setup ()) return -1;
 #if HAVE_LIBPQ
   } else if (!strcmp (backend, "postgresql")) {
     if(psql_backend_setup ()) return -1;
@@ -195,22 +206,40 @@ database_create_function (const char *backend)
   return NULL;
 }
 
+/** Initialise the recursive lock of a Database
+ * \param self Database to initialise the lock of
+ * \see database_lock
+ */
+static void
+database_lock_init (Database *self)
+{
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&self->lock, &attr);
+  pthread_mutexattr_destroy (&attr);
+}
+
 /** Find a database instance for name.
  *
  * If no database with this name exists, a new one is created.
  *
+ * This function is safe to call from multiple threads.
+ *
  * \param name name of the database to find
  * \return a pointer to the database
  */
 Database*
 database_find (const char* name)
 {
+  pthread_mutex_lock (&first_db_lock);
   Database* db = first_db;
   while (db != NULL) {
     if (!strcmp(name, db->name)) {
       loginfo ("%s: Database already open (%d client%s)\n",
                 name, db->ref_count, db->ref_count>1?"s":"");
       db->ref_count++;
+      pthread_mutex_unlock (&first_db_lock);
       return db;
     }
     db = db->next;
@@ -222,14 +251,19 @@ database_find (const char* name)
   strncpy(self->name, name, MAX_DB_NAME_SIZE);
   self->ref_count = 1;
   self->create = database_create_function (dbbackend);
+  database_lock_init (self);
 
   if (self->create (self)) {
+    pthread_mutex_destroy (&self->lock);
     oml_free(self);
+    pthread_mutex_unlock (&first_db_lock);
     return NULL;
   }
 
   if (database_init (self) == -1) {
+    pthread_mutex_destroy (&self->lock);
     oml_free (self);
+    pthread_mutex_unlock (&first_db_lock);
     return NULL;
   }
 
@@ -250,6 +284,7 @@ database_find (const char* name)
   self->next = first_db;
   first_db = self;
 
+  pthread_mutex_unlock (&first_db_lock);
   return self;
 }
 /** One client no longer uses this database.
@@ -264,7 +299,11 @@ database_release(Database* self)
     logerror("NONE: Trying to release a NULL database.\n");
     return;
   }
-  if (--self->ref_count > 0) return; // still in use
+  pthread_mutex_lock (&first_db_lock);
+  if (--self->ref_count > 0) { // still in use
+    pthread_mutex_unlock (&first_db_lock);
+    return;
+  }
 
   // unlink DB
   Database* db_p = first_db;
@@ -275,12 +314,14 @@ database_release(Database* self)
   }
   if (db_p == NULL) {
     logerror("%s:  Trying to release an unknown database\n", self->name);
+    pthread_mutex_unlock (&first_db_lock);
     return;
   }
   if (prev_p == NULL)
     first_db = self->next; // was first
   else
     prev_p->next = self->next;
+  pthread_mutex_unlock (&first_db_lock);
 
   // no longer needed
   DbTable* t_p = self->first_table;
@@ -298,9 +339,40 @@ database_release(Database* self)
 
   database_hook_send_event(self, HOOK_CMD_DBCLOSED);
 
+  pthread_mutex_destroy (&self->lock);
   oml_free(self);
 }
 
+/** Acquire exclusive access to a Database.
+ *
+ * Clients of the same Database may be handled by different EventLoop threads;
+ * they need to hold this lock while manipulating the Database (e.g., tables,
+ * metadata or inserting data). The lock is recursive.
+ *
+ * \param self Database to lock
+ * \see database_unlock
+ */
+void
+database_lock(Database* self)
+{
+  if (self) {
+    pthread_mutex_lock (&self->lock);
+  }
+}
+
+/** Release exclusive access to a Database.
+ *
+ * \param self Database to unlock
+ * \see database_lock
+ */
+void
+database_unlock(Database* self)
+{
+  if (self) {
+    pthread_mutex_unlock (&self->lock);
+  }
+}
+
 /** Close all open databases
  *
  * Useful when exiting.
@@ -363,6 +435,14 @@ database_create_table (Database *database, const struct schema *schema)
     oml_free (table);
     return NULL;
   }
+  table->text_decoder = text_decoder_new (table->schema);
+  if (!table->text_decoder) {
+    schema_free (table->schema);
+    oml_free (table);
+    return NULL;
+  }
+  table->stats = stats_new (STATS_TABLE);
+  stats_register (table->stats, database->name, table->schema->name, NULL);
   table->next = database->first_table;
   database->first_table = table;
   return table;
@@ -476,6 +556,8 @@ database_table_free(Database *database, DbTable *table)
   if (database && table) {
     logdebug("%s: Freeing table '%s'\n", database->name, table->schema->name);
     schema_free (table->schema);
+    text_decoder_free (table->text_decoder);
+    stats_free (table->stats);
     oml_free(table);
   } else {
     logwarn("%s: Tried to free a NULL table (or database was NULL).\n",
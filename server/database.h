@@ -13,6 +13,8 @@
 #ifndef DATABASE_H_
 #define DATABASE_H_
 
+#include <pthread.h>
+
 #include "oml2/omlc.h"
 #include "mstring.h"
 #include "table_descr.h"
@@ -36,6 +38,8 @@
 
 struct Database;
 struct DbTable;
+struct text_decoder;
+struct IngestStats;
 typedef struct DbTable DbTable;
 typedef struct Database Database;
 
@@ -181,12 +185,39 @@ typedef int (*db_add_sender_id)(Database* db, const char* sender_id);
  */
 typedef TableDescr* (*db_adapter_get_table_list) (Database* db, int *num_tables);
 
+/** Function to create an index without blocking insertions into its table.
+ *
+ * It is called from a thread of its own, while rows are being inserted, so
+ * it must not use the connection of the Database, nor hold its lock.
+ *
+ * \param db Database containing the table
+ * \param table DbTable to index
+ * \param name name of the index
+ * \param columns comma-separated list of indexed columns
+ * \return 0 on success, -1 if the index could not be created
+ *
+ * \see dba_table_row_inserted
+ */
+typedef int (*db_adapter_create_index) (Database* db, DbTable* table, const char* name, const char* columns);
+
 /** One measurement table in a Database */
 struct DbTable {
   /** Schema for that table */
   struct schema*  schema;
   /** Opaque pointer to database implementation handle */
   void*           handle;
+  /** Conversions for text samples of that table \see text_decoder_new */
+  struct text_decoder* text_decoder;
+  /** Ingest counters of that table \see stats.h */
+  struct IngestStats* stats;
+  /** Rows inserted while the table was not indexed \see dba_table_row_inserted */
+  uint64_t        unindexed_rows;
+  /** Whether the secondary indexes have been created \see dba_table_create_indexes */
+  int             indexed;
+  /** Thread creating the indexes while rows are inserted, if has_indexer
+   * \see dba_table_row_inserted */
+  pthread_t       indexer;
+  int             has_indexer;
   /** Pointer to the next table in the linked list */
   struct DbTable* next;
 };
@@ -206,6 +237,15 @@ struct Database{
   time_t     start_time;
   /** Opaque pointer to database implementation handle */
   void*      handle;
+  /** Recursive lock serialising access from multiple EventLoop threads
+   * \see database_lock, database_unlock */
+  pthread_mutex_t lock;
+  /** Whether insert only queues rows for another thread, so they are not
+   * stored yet when it returns; no acknowledgement is then sent \see client_ack_start */
+  int        queued_inserts;
+  /** Clause appended to the CREATE TABLE statements of measurement tables
+   * (e.g., partitioning), or NULL \see dba_table_create_from_schema */
+  const char *table_create_clause;
 
   /** Pointer to OML-to-native type conversion function */
   db_adapter_oml_to_type o2t;
@@ -237,6 +277,9 @@ struct Database{
   db_add_sender_id   add_sender_id;
   /** Pointer to function to get a list of tables \see db_adapter_get_table_list */
   db_adapter_get_table_list get_table_list;
+  /** Pointer to function to create an index without blocking insertions, or
+   * NULL if the backend cannot \see db_adapter_create_index */
+  db_adapter_create_index create_index;
 
   /** Pointer to the next database in the linked list */
   struct Database* next;
@@ -257,6 +300,8 @@ Database *database_find(const char* name);
 int database_init (Database *self);
 void database_release(Database* database);
 void database_cleanup();
+void database_lock(Database* database);
+void database_unlock(Database* database);
 
 DbTable *database_find_table(Database* database, const char* name);
 DbTable *database_find_or_create_table(Database *database, struct schema *schema);
@@ -10,13 +10,44 @@
 /** \file database_adapter.h
  * \brief Generic functions for database adapters
  */
+#include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
 
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "mstring.h"
 #include "oml_util.h"
 #include "schema.h"
 #include "database.h"
 #include "database_adapter.h"
 
+/* Secondary indexes of measurement tables, created lazily, once the bulk of
+ * the data has been inserted \see dba_table_create_indexes */
+/** Comma-separated list of indexes to create (from index_types), NULL for none */
+char *db_indexes = NULL;
+/** Number of rows after which the indexes of a table are created, 0 to only
+ * create them when the database is closed */
+int db_index_rows = 0;
+
+/** Whether vectors are stored in the native binary format of the backend, rather
+ * than as JSON text, in new tables \see vector_to_le */
+int db_binary_vectors = 0;
+
+/** Secondary indexes which can be created on measurement tables */
+static struct {
+  /** Name of the index type, as used in db_indexes */
+  const char *name;
+  /** Suffix of the name of the index, after that of the table */
+  const char *suffix;
+  /** Indexed columns */
+  const char *columns;
+} index_types[] = {
+  { .name = "sender", .suffix = "sender_seq", .columns = "oml_sender_id, oml_seq" },
+  { .name = "time",   .suffix = "ts_server",  .columns = "oml_ts_server" },
+};
+
 /** Metadata tables */
 static struct {
   const char *name;
@@ -75,6 +106,17 @@ dba_table_create_from_schema (Database *db, const struct schema *schema)
         db->backend_name, db->name, schema_to_meta(schema));
     goto fail_exit;
   }
+  if (db->table_create_clause && !dba_is_meta_table (schema->name)) {
+    /* Insert the clause before the final ';' */
+    MString *clause = mstring_create ();
+    if (mstring_sprintf (clause, "%.*s %s;", (int)mstring_len (create) - 1,
+          mstring_buf (create), db->table_create_clause) == -1) {
+      mstring_delete (clause);
+      goto fail_exit;
+    }
+    mstring_delete (create);
+    create = clause;
+  }
   if (db->stmt(db, mstring_buf(create))) {
     goto fail_exit;
   }
@@ -136,6 +178,262 @@ dba_table_create_meta (Database *db, const char *name)
   return -1;
 }
 
+/** Get the schema of a metadata table, for backends which do not use SQL.
+ *
+ * \param name name of the metadata table
+ * \return the schema string (in the same format as the metadata), or NULL if the table is only defined in SQL
+ * \see schema_from_meta
+ */
+const char*
+dba_meta_table_schema (const char *name)
+{
+  int i = 0;
+  for (i = 0; i < LENGTH (meta_tables); i++) {
+    if (strcmp (meta_tables[i].name, name) == 0) {
+      return meta_tables[i].schema;
+    }
+  }
+  return NULL;
+}
+
+/** Check whether a table is one of the metadata tables
+ *
+ * \param name name of the table
+ * \return 1 if it is, 0 otherwise
+ */
+int
+dba_is_meta_table (const char *name)
+{
+  int i = 0;
+  for (i = 0; i < LENGTH (meta_tables); i++) {
+    if (strcmp (meta_tables[i].name, name) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Check whether an index type is in the comma-separated db_indexes list
+ *
+ * \param name name of the index type
+ * \return 1 if it is, 0 otherwise
+ */
+static int
+dba_index_selected (const char *name)
+{
+  const char *p = db_indexes;
+  size_t len = strlen (name);
+
+  while (p && *p) {
+    if (!strncmp (p, name, len) && (p[len] == ',' || p[len] == '\0')) {
+      return 1;
+    }
+    p = strchr (p, ',');
+    if (p) { p++; }
+  }
+  return 0;
+}
+
+/** Build the name of an object derived from a table, such as an index.
+ *
+ * The name is TABLE_SUFFIX. If that is longer than DBA_MAX_NAME_LENGTH, the
+ * table name is shortened, and followed by a hash of its full version, so
+ * tables with a long common prefix do not get the same derived names.
+ *
+ * \param[out] buf buffer of at least DBA_MAX_NAME_LENGTH + 1 bytes
+ * \param table name of the table
+ * \param suffix suffix identifying the object, shorter than DBA_MAX_NAME_LENGTH - 10
+ */
+void
+dba_derived_name (char *buf, const char *table, const char *suffix)
+{
+  size_t len = strlen (suffix);
+  uint32_t hash = 2166136261U;
+  const char *p;
+
+  if (strlen (table) + 1 + len <= DBA_MAX_NAME_LENGTH) {
+    snprintf (buf, DBA_MAX_NAME_LENGTH + 1, "%s_%s", table, suffix);
+    return;
+  }
+  /* 32-bit FNV-1a */
+  for (p = table; *p; p++) {
+    hash = (hash ^ (uint8_t)*p) * 16777619U;
+  }
+  snprintf (buf, DBA_MAX_NAME_LENGTH + 1, "%.*s_%08" PRIx32 "_%s",
+      (int)(DBA_MAX_NAME_LENGTH - len - 10), table, hash, suffix);
+}
+
+/** Check the index settings.
+ *
+ * \return 0 on success, -1 otherwise
+ * \see db_indexes, db_index_rows, database_setup_backend
+ */
+int
+dba_indexes_setup (void)
+{
+  const char *p = db_indexes;
+  size_t len;
+  int i, n = 0;
+
+  if (db_index_rows < 0) {
+    logerror ("Number of rows before creating indexes cannot be negative\n");
+    return -1;
+  }
+  while (p && *p) {
+    len = strcspn (p, ",");
+    for (i = 0; i < LENGTH (index_types); i++) {
+      if (strlen (index_types[i].name) == len && !strncmp (p, index_types[i].name, len)) {
+        break;
+      }
+    }
+    if (i == LENGTH (index_types)) {
+      logerror ("Unknown index '%.*s' (valid indexes: sender, time)\n", (int)len, p);
+      return -1;
+    }
+    n++;
+    p += len;
+    if (*p) { p++; }
+  }
+  if (n > 0) {
+    if (db_index_rows > 0) {
+      loginfo ("Indexing measurement tables (%s) after %d rows\n", db_indexes, db_index_rows);
+    } else {
+      loginfo ("Indexing measurement tables (%s) when closing databases\n", db_indexes);
+    }
+  }
+  return 0;
+}
+
+/** Create the secondary indexes of a measurement table, if not done yet.
+ *
+ * Maintaining indexes slows insertions down, so they are only created once
+ * the bulk of the data is in, and only once per DbTable. Existing indexes
+ * are kept. Any thread creating them while rows were inserted is waited for
+ * first, and the indexes it could not create are created here.
+ *
+ * This blocks insertions into the Database, so it should only be called
+ * when no more rows are expected, e.g., when freeing the table.
+ *
+ * \param db Database to work with
+ * \param table DbTable to index
+ * \return 0 on success, -1 otherwise
+ * \see db_indexes, dba_table_row_inserted, db_adapter_stmt
+ */
+int
+dba_table_create_indexes (Database *db, DbTable *table)
+{
+  char name[DBA_MAX_NAME_LENGTH + 1];
+  MString *create;
+  int i, ret = 0;
+
+  if (table->has_indexer) {
+    /* The indexer may be waiting for the current transaction to finish */
+    dba_reopen_transaction (db);
+    pthread_join (table->indexer, NULL);
+    table->has_indexer = 0;
+  }
+  if (table->indexed || !db_indexes || dba_is_meta_table (table->schema->name)) {
+    return 0;
+  }
+  /* Whatever happens, do not try again */
+  table->indexed = 1;
+
+  create = mstring_create ();
+  for (i = 0; i < LENGTH (index_types) && ret == 0; i++) {
+    if (!dba_index_selected (index_types[i].name)) {
+      continue;
+    }
+    dba_derived_name (name, table->schema->name, index_types[i].suffix);
+    mstring_set (create, "");
+    mstring_sprintf (create, "CREATE INDEX IF NOT EXISTS \"%s\" ON \"%s\" (%s);",
+        name, table->schema->name, index_types[i].columns);
+    logdebug ("%s:%s: Creating index on %s(%s)\n", db->backend_name, db->name,
+        table->schema->name, index_types[i].columns);
+    if (db->stmt (db, mstring_buf (create))) {
+      logwarn ("%s:%s: Could not index %s(%s)\n", db->backend_name, db->name,
+          table->schema->name, index_types[i].columns);
+      ret = -1;
+    }
+  }
+  mstring_delete (create);
+  return ret;
+}
+
+/** Arguments of dba_indexer */
+struct dba_indexer_args {
+  Database *db;
+  DbTable *table;
+};
+
+/** Thread creating the indexes of a table while rows are inserted into it.
+ *
+ * \param handle oml_malloc'd struct dba_indexer_args, freed here
+ * \return NULL
+ * \see dba_table_row_inserted, db_adapter_create_index
+ */
+static void*
+dba_indexer (void *handle)
+{
+  struct dba_indexer_args *args = (struct dba_indexer_args*)handle;
+  Database *db = args->db;
+  DbTable *table = args->table;
+  char name[DBA_MAX_NAME_LENGTH + 1];
+  int i;
+
+  oml_free (args);
+  for (i = 0; i < LENGTH (index_types); i++) {
+    if (!dba_index_selected (index_types[i].name)) {
+      continue;
+    }
+    dba_derived_name (name, table->schema->name, index_types[i].suffix);
+    logdebug ("%s:%s: Creating index on %s(%s) in the background\n", db->backend_name, db->name,
+        table->schema->name, index_types[i].columns);
+    if (db->create_index (db, table, name, index_types[i].columns)) {
+      logdebug ("%s:%s: Could not index %s(%s) yet, will do when closing\n", db->backend_name,
+          db->name, table->schema->name, index_types[i].columns);
+    }
+  }
+  return NULL;
+}
+
+/** Account for a row inserted into a table, and start creating its indexes
+ * once it has enough rows.
+ *
+ * The indexes are created by a thread of their own, if the backend can do so
+ * without blocking insertions (\see db_adapter_create_index); otherwise, as
+ * well as for the indexes this thread could not create, when the table is
+ * freed.
+ *
+ * \param db Database to work with
+ * \param table DbTable the row was inserted into
+ * \see db_index_rows, dba_table_create_indexes
+ */
+void
+dba_table_row_inserted (Database *db, DbTable *table)
+{
+  struct dba_indexer_args *args;
+
+  if (db_index_rows <= 0 || !db->create_index || table->indexed || table->has_indexer ||
+      ++table->unindexed_rows < (uint64_t)db_index_rows ||
+      !db_indexes || dba_is_meta_table (table->schema->name)) {
+    return;
+  }
+  if (!(args = oml_malloc (sizeof (struct dba_indexer_args)))) {
+    return;
+  }
+  args->db = db;
+  args->table = table;
+  if (pthread_create (&table->indexer, NULL, dba_indexer, args)) {
+    logwarn ("%s:%s: Could not start indexing %s, will do when closing\n", db->backend_name,
+        db->name, table->schema->name);
+    oml_free (args);
+    /* Do not try again for every row */
+    table->unindexed_rows = 0;
+    return;
+  }
+  table->has_indexer = 1;
+}
+
 /** Open a transaction with the database server.
  * \param db Database to work with
  * \return the success value of running the statement
@@ -20,6 +20,21 @@ int dba_table_create_from_meta (Database *db, const char *schema);
 int dba_table_create_from_schema (Database *db, const struct schema *schema);
 
 int dba_table_create_meta (Database *db, const char *name);
+const char *dba_meta_table_schema (const char *name);
+int dba_is_meta_table (const char *name);
+
+extern char *db_indexes;
+extern int db_index_rows;
+extern int db_binary_vectors;
+
+/** Maximal length of the names of tables, indexes and partitions; longer
+ * identifiers are truncated by PostgreSQL */
+#define DBA_MAX_NAME_LENGTH 63
+
+int dba_indexes_setup (void);
+void dba_derived_name (char *buf, const char *table, const char *suffix);
+int dba_table_create_indexes (Database *db, DbTable *table);
+void dba_table_row_inserted (Database *db, DbTable *table);
 
 int dba_begin_transaction (Database *db);
 int dba_end_transaction (Database *db);
@@ -82,6 +82,49 @@ client_event_inject(const char* address, uint32_t port, const char* oml_id, cons
   }
 }
 
+/** Inject the ingest statistics of a client into the monitoring OML server.
+ *
+ * \param domain      experimental domain of the client
+ * \param oml_id      sender ID of the client
+ * \param appname     application name of the client
+ * \param bytes       bytes received from the client so far
+ * \param rows        samples stored from the client so far
+ * \param bytes_rate  bytes received per second since the last report
+ * \param rows_rate   samples stored per second since the last report
+ * \param decode_time average time to decode a sample since the last report [us]
+ * \param insert_time average time to store a sample since the last report [us]
+ * \param insert_p50  median time to store a sample since the last report [us]
+ * \param insert_p99  99th percentile of that time [us]
+ * \param pending     bytes received but not processed yet
+ * \see stats_report
+ */
+void
+stats_client_inject(const char* domain, const char* oml_id, const char* appname, uint64_t bytes, uint64_t rows, double bytes_rate, double rows_rate, double decode_time, double insert_time, double insert_p50, double insert_p99, uint64_t pending)
+{
+  if(oml_enabled) {
+    oml_inject_client_stats(g_oml_mps_oml2_server->client_stats, domain, oml_id, appname, bytes, rows, bytes_rate, rows_rate, decode_time, insert_time, insert_p50, insert_p99, pending);
+  }
+}
+
+/** Inject the ingest statistics of a table into the monitoring OML server.
+ *
+ * \param domain      experimental domain of the table
+ * \param table       name of the table
+ * \param rows        samples stored in the table so far
+ * \param rows_rate   samples stored per second since the last report
+ * \param insert_time average time to store a sample since the last report [us]
+ * \param insert_p50  median time to store a sample since the last report [us]
+ * \param insert_p99  99th percentile of that time [us]
+ * \see stats_report
+ */
+void
+stats_table_inject(const char* domain, const char* table, uint64_t rows, double rows_rate, double insert_time, double insert_p50, double insert_p99)
+{
+  if(oml_enabled) {
+    oml_inject_table_stats(g_oml_mps_oml2_server->table_stats, domain, table, rows, rows_rate, insert_time, insert_p50, insert_p99);
+  }
+}
+
 /*
  Local Variables:
  mode: C
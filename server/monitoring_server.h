@@ -18,6 +18,10 @@ void oml_cleanup(void);
 
 void client_event_inject(const char* address, uint32_t port, const char* oml_id, const char* domain, const char* appname, const char* event, const char* message);
 
+void stats_client_inject(const char* domain, const char* oml_id, const char* appname, uint64_t bytes, uint64_t rows, double bytes_rate, double rows_rate, double decode_time, double insert_time, double insert_p50, double insert_p99, uint64_t pending);
+
+void stats_table_inject(const char* domain, const char* table, uint64_t rows, double rows_rate, double insert_time, double insert_p50, double insert_p99);
+
 #endif /*MONITORING_SERVER_H_*/
 
 /*
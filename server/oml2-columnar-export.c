@@ -0,0 +1,651 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file oml2-columnar-export.c
+ * \brief Export databases of the columnar backend to SQLite3 or CSV.
+ *
+ * The SQLite3 output has the same tables as the ones oml2-server creates
+ * with its SQLite3 backend. A single table can be exported as CSV instead.
+ * Only the rows within an oml_ts_server range can be exported, in which case
+ * the segment summaries and indexes are used to skip unneeded data.
+ *
+ * \see columnar.c, columnar_adapter.c
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h>
+#include <inttypes.h>
+#include <math.h>
+#include <popt.h>
+#include <sqlite3.h>
+#include <unistd.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "mstring.h"
+#include "json.h"
+#include "oml_value.h"
+#include "oml_util.h"
+#include "schema.h"
+#include "database.h"
+#include "columnar.h"
+
+#define V_STRING  "OML2 Columnar Export V%s\n"
+
+#define COPYRIGHT "Copyright 2013 NICTA\n"
+
+static char *output = NULL;
+static char *csv_table = NULL;
+static double start_ts = -HUGE_VAL;
+static double end_ts = HUGE_VAL;
+static int log_level = O_LOG_INFO;
+
+struct poptOption options[] = {
+  POPT_AUTOHELP
+  { "output", 'o', POPT_ARG_STRING, &output, 0, "File to write to (default: DOMAIN.sq3, or standard output for CSV)", "FILE" },
+  { "csv", '\0', POPT_ARG_STRING, &csv_table, 0, "Export this table as CSV rather than the whole database to SQLite3", "TABLE" },
+  { "start", '\0', POPT_ARG_DOUBLE, &start_ts, 0, "Only export rows with a later oml_ts_server", "SECONDS" },
+  { "end", '\0', POPT_ARG_DOUBLE, &end_ts, 0, "Only export rows with an earlier oml_ts_server", "SECONDS" },
+  { "debug-level", 'd', POPT_ARG_INT, &log_level, 0, "Increase debug level", "{1 .. 4}"  },
+  { "version", 'v', POPT_ARG_NONE, NULL, 'v', "Print version information and exit", NULL },
+  { NULL, 0, 0, NULL, 0, NULL, NULL }
+};
+
+/** Mapping between OML and SQLite3 data types, as used by oml2-server
+ * \see sq3_type_pair
+ */
+static db_typemap export_type_pair [] = {
+  { OML_DB_PRIMARY_KEY, "INTEGER PRIMARY KEY"},
+  { OML_LONG_VALUE,     "INTEGER"  },
+  { OML_INT32_VALUE,    "INTEGER"  },
+  { OML_UINT32_VALUE,   "UNSIGNED INTEGER" },
+  { OML_INT64_VALUE,    "BIGINT"  },
+  { OML_UINT64_VALUE,   "UNSIGNED BIGINT" },
+  { OML_DOUBLE_VALUE,   "REAL" },
+  { OML_STRING_VALUE,   "TEXT" },
+  { OML_BLOB_VALUE,     "BLOB" },
+  { OML_GUID_VALUE,     "UNSIGNED BIGINT" },
+  { OML_BOOL_VALUE,     "INTEGER" },
+  { OML_VECTOR_DOUBLE_VALUE, "TEXT" },
+  { OML_VECTOR_INT32_VALUE,  "TEXT" },
+  { OML_VECTOR_UINT32_VALUE, "TEXT" },
+  { OML_VECTOR_INT64_VALUE,  "TEXT" },
+  { OML_VECTOR_UINT64_VALUE, "TEXT" },
+  { OML_VECTOR_BOOL_VALUE,   "TEXT" },
+};
+
+/** Mapping from OML to SQLite3 types.
+ * \see db_adapter_oml_to_type
+ */
+static const char*
+export_oml_to_type (OmlValueT type)
+{
+  int i;
+  for (i = 0; i < LENGTH(export_type_pair); i++) {
+    if (export_type_pair[i].type == type) {
+      return export_type_pair[i].name;
+    }
+  }
+  return NULL;
+}
+
+/** Die showing an error message
+ * A newline is appended to the message.
+ *
+ * \param fmt format string
+ * \param ... arguments for fmt
+ */
+static void
+die (const char *fmt, ...)
+{
+  char buf[1024];
+
+  va_list va;
+  va_start (va, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, va);
+  va_end (va);
+
+  logerror("%s\n", buf);
+  exit (EXIT_FAILURE);
+}
+
+/** Callback for each exported row \see export_rows */
+typedef int (*export_row_cb) (ColReader *reader, void *arg);
+
+/** Call a function on all rows of a table within the requested time range.
+ *
+ * Sealed segments entirely out of the range are skipped, and the sparse index
+ * is used to skip the beginning of the others.
+ *
+ * \param dbdir directory of the database
+ * \param schema schema of the table
+ * \param cb function to call on each row
+ * \param arg argument to pass to cb
+ * \return the number of rows exported, or -1 on error
+ */
+static int64_t
+export_rows (const char *dbdir, const struct schema *schema, export_row_cb cb, void *arg)
+{
+  char *tabledir = col_path (dbdir, schema->name), *segdir;
+  struct col_summary summary;
+  unsigned int *ids = NULL;
+  ColReader *reader;
+  int64_t rows = 0;
+  int i, n, ret = 0;
+
+  if (!tabledir || (n = col_segments (tabledir, &ids)) < 0) {
+    logerror ("%s: Could not list segments\n", schema->name);
+    return -1;
+  }
+  for (i = 0; i < n && rows >= 0; i++) {
+    if (!(segdir = col_segment_dir (tabledir, ids[i]))) {
+      rows = -1;
+      break;
+    }
+    if (!col_summary_read (segdir, &summary) &&
+        (!summary.rows || summary.ts_max < start_ts || summary.ts_min > end_ts)) {
+      logdebug ("%s: Skipping segment %u\n", schema->name, ids[i]);
+      oml_free (segdir);
+      continue;
+    }
+    ret = 0;
+    if (!(reader = col_reader_open (segdir, schema)) ||
+        (start_ts > 0 && col_reader_seek (reader, col_index_find (segdir, start_ts)))) {
+      logerror ("%s: Could not read segment %u\n", schema->name, ids[i]);
+      rows = -1;
+    }
+    while (rows >= 0 && (ret = col_reader_next (reader)) > 0) {
+      if (reader->ts_server < start_ts || reader->ts_server > end_ts) {
+        continue;
+      }
+      if (cb (reader, arg)) {
+        rows = -1;
+      } else {
+        rows++;
+      }
+    }
+    if (reader) {
+      if (ret < 0) {
+        rows = -1;
+      }
+      col_reader_close (reader);
+    }
+    oml_free (segdir);
+  }
+
+  if (ids) { oml_free (ids); }
+  oml_free (tabledir);
+  return rows;
+}
+
+/** Write a string as a CSV field, quoting it if needed.
+ *
+ * \param s string to write
+ * \param out FILE to write to
+ */
+static void
+csv_string (const char *s, FILE *out)
+{
+  if (!strpbrk (s, ",\"\r\n")) {
+    fputs (s, out);
+    return;
+  }
+  fputc ('"', out);
+  for (; *s; s++) {
+    if (*s == '"') {
+      fputc ('"', out);
+    }
+    fputc (*s, out);
+  }
+  fputc ('"', out);
+}
+
+/** Write one value as a CSV field.
+ *
+ * Values are rendered as oml2-server stores them in SQLite3: booleans as
+ * integers, blobs in hexadecimal, and vectors as JSON arrays.
+ *
+ * \param v OmlValue to write
+ * \param out FILE to write to
+ */
+static void
+csv_value (OmlValue *v, FILE *out)
+{
+  OmlValueU *u = oml_value_get_value (v);
+  char *s = NULL;
+  ssize_t len = -1;
+  size_t i;
+
+  switch (oml_value_get_type (v)) {
+  case OML_DOUBLE_VALUE: fprintf (out, "%.*g", DBL_DIG, omlc_get_double (*u)); break;
+  case OML_LONG_VALUE:   fprintf (out, "%ld", omlc_get_long (*u)); break;
+  case OML_INT32_VALUE:  fprintf (out, "%" PRId32, omlc_get_int32 (*u)); break;
+  case OML_UINT32_VALUE: fprintf (out, "%" PRIu32, omlc_get_uint32 (*u)); break;
+  case OML_INT64_VALUE:  fprintf (out, "%" PRId64, omlc_get_int64 (*u)); break;
+  case OML_UINT64_VALUE: fprintf (out, "%" PRIu64, omlc_get_uint64 (*u)); break;
+  case OML_GUID_VALUE:   fprintf (out, "%" PRIu64, omlc_get_guid (*u)); break;
+  case OML_BOOL_VALUE:   fprintf (out, "%d", omlc_get_bool (*u) ? 1 : 0); break;
+  case OML_STRING_VALUE:
+    csv_string (omlc_get_string_ptr (*u) ? omlc_get_string_ptr (*u) : "", out);
+    break;
+  case OML_BLOB_VALUE:
+    fputs ("0x", out);
+    for (i = 0; i < omlc_get_blob_length (*u); i++) {
+      fprintf (out, "%02x", ((uint8_t*)omlc_get_blob_ptr (*u))[i]);
+    }
+    break;
+  case OML_VECTOR_DOUBLE_VALUE:
+    len = vector_double_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &s);
+    break;
+  case OML_VECTOR_INT32_VALUE:
+    len = vector_int32_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &s);
+    break;
+  case OML_VECTOR_UINT32_VALUE:
+    len = vector_uint32_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &s);
+    break;
+  case OML_VECTOR_INT64_VALUE:
+    len = vector_int64_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &s);
+    break;
+  case OML_VECTOR_UINT64_VALUE:
+    len = vector_uint64_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &s);
+    break;
+  case OML_VECTOR_BOOL_VALUE:
+    len = vector_bool_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &s);
+    break;
+  default:
+    break;
+  }
+  if (len != -1 && s) {
+    csv_string (s, out);
+  }
+  if (s) {
+    oml_free (s);
+  }
+}
+
+/** Write a row as CSV \see export_row_cb */
+static int
+csv_row (ColReader *reader, void *arg)
+{
+  FILE *out = (FILE*)arg;
+  int i;
+
+  fprintf (out, "%" PRId32 ",%" PRId32 ",%.*g,%.*g", reader->sender_id, reader->seq,
+      DBL_DIG, reader->ts_client, DBL_DIG, reader->ts_server);
+  for (i = 0; i < reader->nvalues; i++) {
+    fputc (',', out);
+    csv_value (&reader->values[i], out);
+  }
+  fputc ('\n', out);
+  return ferror (out) ? -1 : 0;
+}
+
+/** Export one table as CSV.
+ *
+ * \param dbdir directory of the database
+ * \param schema schema of the table
+ * \param out FILE to write to
+ * \return the number of rows exported, or -1 on error
+ */
+static int64_t
+export_csv (const char *dbdir, const struct schema *schema, FILE *out)
+{
+  int i;
+
+  fputs ("oml_sender_id,oml_seq,oml_ts_client,oml_ts_server", out);
+  for (i = 0; i < schema->nfields; i++) {
+    fputc (',', out);
+    csv_string (schema->fields[i].name, out);
+  }
+  fputc ('\n', out);
+  return export_rows (dbdir, schema, csv_row, out);
+}
+
+/** Bind one value to an SQLite3 statement, as oml2-server does.
+ *
+ * \param stmt prepared statement
+ * \param idx index of the variable to bind
+ * \param v OmlValue to bind
+ * \return an SQLite3 result code
+ * \see sq3_insert
+ */
+static int
+sqlite_bind (sqlite3_stmt *stmt, int idx, OmlValue *v)
+{
+  OmlValueU *u = oml_value_get_value (v);
+  char *json = NULL;
+  ssize_t len = -1;
+
+  switch (oml_value_get_type (v)) {
+  case OML_DOUBLE_VALUE: return sqlite3_bind_double (stmt, idx, omlc_get_double (*u));
+  case OML_LONG_VALUE:   return sqlite3_bind_int64 (stmt, idx, omlc_get_long (*u));
+  case OML_INT32_VALUE:  return sqlite3_bind_int (stmt, idx, omlc_get_int32 (*u));
+  case OML_UINT32_VALUE: return sqlite3_bind_int64 (stmt, idx, omlc_get_uint32 (*u));
+  case OML_INT64_VALUE:  return sqlite3_bind_int64 (stmt, idx, omlc_get_int64 (*u));
+  case OML_UINT64_VALUE: return sqlite3_bind_int64 (stmt, idx, (int64_t)omlc_get_uint64 (*u));
+  case OML_BOOL_VALUE:   return sqlite3_bind_int (stmt, idx, omlc_get_bool (*u) ? 1 : 0);
+  case OML_GUID_VALUE:
+    if (omlc_get_guid (*u) != UINT64_C(0)) {
+      return sqlite3_bind_int64 (stmt, idx, (int64_t)omlc_get_guid (*u));
+    }
+    return sqlite3_bind_null (stmt, idx);
+  case OML_STRING_VALUE:
+    return sqlite3_bind_text (stmt, idx, omlc_get_string_ptr (*u), -1, SQLITE_TRANSIENT);
+  case OML_BLOB_VALUE:
+    return sqlite3_bind_blob (stmt, idx, omlc_get_blob_ptr (*u), omlc_get_blob_length (*u),
+        SQLITE_TRANSIENT);
+  case OML_VECTOR_DOUBLE_VALUE:
+    len = vector_double_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &json);
+    break;
+  case OML_VECTOR_INT32_VALUE:
+    len = vector_int32_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &json);
+    break;
+  case OML_VECTOR_UINT32_VALUE:
+    len = vector_uint32_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &json);
+    break;
+  case OML_VECTOR_INT64_VALUE:
+    len = vector_int64_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &json);
+    break;
+  case OML_VECTOR_UINT64_VALUE:
+    len = vector_uint64_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &json);
+    break;
+  case OML_VECTOR_BOOL_VALUE:
+    len = vector_bool_to_json (omlc_get_vector_ptr (*u), omlc_get_vector_nof_elts (*u), &json);
+    break;
+  default:
+    return SQLITE_MISUSE;
+  }
+  if (len == -1) {
+    return sqlite3_bind_null (stmt, idx);
+  }
+  return sqlite3_bind_text (stmt, idx, json, len, oml_free);
+}
+
+/** Insert a row with a prepared statement \see export_row_cb */
+static int
+sqlite_row (ColReader *reader, void *arg)
+{
+  sqlite3_stmt *stmt = (sqlite3_stmt*)arg;
+  int i, res;
+
+  res = sqlite3_bind_int (stmt, 1, reader->sender_id) |
+    sqlite3_bind_int (stmt, 2, reader->seq) |
+    sqlite3_bind_double (stmt, 3, reader->ts_client) |
+    sqlite3_bind_double (stmt, 4, reader->ts_server);
+  for (i = 0; i < reader->nvalues && res == SQLITE_OK; i++) {
+    res = sqlite_bind (stmt, i + 5, &reader->values[i]);
+  }
+  if (res == SQLITE_OK) {
+    res = sqlite3_step (stmt) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+  }
+  if (res != SQLITE_OK) {
+    logerror ("Could not insert row: %s\n", sqlite3_errmsg (sqlite3_db_handle (stmt)));
+  }
+  sqlite3_reset (stmt);
+  return res == SQLITE_OK ? 0 : -1;
+}
+
+/** Run an SQL statement without results.
+ *
+ * \param conn SQLite3 connection
+ * \param sql statement to run
+ * \return 0 on success, -1 otherwise
+ */
+static int
+sqlite_exec (sqlite3 *conn, const char *sql)
+{
+  char *errmsg = NULL;
+  if (sqlite3_exec (conn, sql, NULL, NULL, &errmsg) != SQLITE_OK) {
+    logerror ("Error in SQL statement '%s': %s\n", sql, errmsg);
+    sqlite3_free (errmsg);
+    return -1;
+  }
+  return 0;
+}
+
+/** Insert all pairs of a key/value file into a table.
+ *
+ * \param conn SQLite3 connection
+ * \param sql INSERT statement with two variables
+ * \param kv list of ColKeyValue
+ * \return 0 on success, -1 otherwise
+ */
+static int
+sqlite_kv (sqlite3 *conn, const char *sql, ColKeyValue *kv)
+{
+  sqlite3_stmt *stmt;
+  int ret = 0;
+
+  if (sqlite3_prepare_v2 (conn, sql, -1, &stmt, NULL) != SQLITE_OK) {
+    logerror ("Could not prepare statement '%s': %s\n", sql, sqlite3_errmsg (conn));
+    return -1;
+  }
+  for (; kv && !ret; kv = kv->next) {
+    if (sqlite3_bind_text (stmt, 1, kv->key, -1, SQLITE_STATIC) != SQLITE_OK ||
+        sqlite3_bind_text (stmt, 2, kv->value, -1, SQLITE_STATIC) != SQLITE_OK ||
+        sqlite3_step (stmt) != SQLITE_DONE) {
+      logerror ("Could not insert '%s': %s\n", kv->key, sqlite3_errmsg (conn));
+      ret = -1;
+    }
+    sqlite3_reset (stmt);
+  }
+  sqlite3_finalize (stmt);
+  return ret;
+}
+
+/** Export one table to SQLite3.
+ *
+ * \param conn SQLite3 connection
+ * \param dbdir directory of the database
+ * \param schema schema of the table
+ * \return the number of rows exported, or -1 on error
+ */
+static int64_t
+export_sqlite_table (sqlite3 *conn, const char *dbdir, const struct schema *schema)
+{
+  MString *sql = schema_to_sql (schema, export_oml_to_type);
+  sqlite3_stmt *stmt = NULL;
+  int64_t rows = -1;
+  int i;
+
+  if (!sql || sqlite_exec (conn, mstring_buf (sql))) {
+    logerror ("%s: Could not create table\n", schema->name);
+    goto cleanup;
+  }
+
+  mstring_set (sql, "");
+  mstring_sprintf (sql, "INSERT INTO \"%s\" (oml_sender_id, oml_seq, oml_ts_client, oml_ts_server",
+      schema->name);
+  for (i = 0; i < schema->nfields; i++) {
+    mstring_sprintf (sql, ", \"%s\"", schema->fields[i].name);
+  }
+  mstring_cat (sql, ") VALUES (?, ?, ?, ?");
+  for (i = 0; i < schema->nfields; i++) {
+    mstring_cat (sql, ", ?");
+  }
+  mstring_cat (sql, ");");
+  if (sqlite3_prepare_v2 (conn, mstring_buf (sql), -1, &stmt, NULL) != SQLITE_OK) {
+    logerror ("Could not prepare statement '%s': %s\n", mstring_buf (sql), sqlite3_errmsg (conn));
+    goto cleanup;
+  }
+
+  rows = export_rows (dbdir, schema, sqlite_row, stmt);
+
+cleanup:
+  if (stmt) { sqlite3_finalize (stmt); }
+  if (sql) { mstring_delete (sql); }
+  return rows;
+}
+
+/** Export a whole database to SQLite3.
+ *
+ * \param dbdir directory of the database
+ * \param metadata content of its metadata file
+ * \param path SQLite3 file to create
+ * \return 0 on success, -1 otherwise
+ */
+static int
+export_sqlite (const char *dbdir, ColKeyValue *metadata, const char *path)
+{
+  char *senders_path = col_path (dbdir, COL_SENDERS_FILE);
+  ColKeyValue *senders = senders_path ? col_kv_load (senders_path) : NULL;
+  ColKeyValue *kv;
+  struct schema *schema;
+  sqlite3 *conn = NULL;
+  int64_t rows;
+  int ret = -1, have_meta = 0;
+
+  if (!access (path, F_OK)) {
+    logerror ("%s already exists, not overwriting it\n", path);
+    goto cleanup;
+  }
+  if (sqlite3_open (path, &conn) != SQLITE_OK) {
+    logerror ("Could not open %s: %s\n", path, sqlite3_errmsg (conn));
+    goto cleanup;
+  }
+  if (sqlite_exec (conn, "BEGIN TRANSACTION;") ||
+      sqlite_exec (conn, "CREATE TABLE _senders (name TEXT PRIMARY KEY, id INTEGER UNIQUE);") ||
+      sqlite_kv (conn, "INSERT INTO _senders (name, id) VALUES (?, ?);", senders)) {
+    goto cleanup;
+  }
+
+  for (kv = metadata; kv; kv = kv->next) {
+    if (strncmp (kv->key, "table_", 6)) {
+      continue;
+    }
+    if (!(schema = schema_from_meta (kv->value))) {
+      logerror ("Could not parse schema '%s'\n", kv->value);
+      goto cleanup;
+    }
+    have_meta |= !strcmp (schema->name, "_experiment_metadata");
+    rows = export_sqlite_table (conn, dbdir, schema);
+    if (rows >= 0) {
+      loginfo ("%s: Exported %" PRId64 " rows\n", schema->name, rows);
+    }
+    schema_free (schema);
+    if (rows < 0) {
+      goto cleanup;
+    }
+  }
+
+  if (!have_meta) {
+    logwarn ("No _experiment_metadata table found, not exporting the metadata\n");
+  } else if (sqlite_kv (conn, "INSERT INTO _experiment_metadata (key, value) VALUES (?, ?);",
+        metadata)) {
+    goto cleanup;
+  }
+  ret = sqlite_exec (conn, "END TRANSACTION;");
+
+cleanup:
+  if (conn) { sqlite3_close (conn); }
+  if (senders) { col_kv_free (senders); }
+  if (senders_path) { oml_free (senders_path); }
+  return ret;
+}
+
+int
+main (int argc, const char **argv)
+{
+  const char *dbdir, *meta, *domain;
+  char key[MAX_TABLE_NAME_SIZE + 7], *path, *default_output = NULL;
+  struct schema *schema;
+  ColKeyValue *metadata;
+  FILE *out = stdout;
+  int64_t rows;
+  size_t len;
+  int c, ret;
+
+  poptContext optCon = poptGetContext(NULL, argc, argv, options, 0);
+  poptSetOtherOptionHelp(optCon, "DATABASE.col");
+
+  while ((c = poptGetNextOpt(optCon)) >= 0) {
+    switch (c) {
+    case 'v':
+      printf(V_STRING, VERSION);
+      printf(COPYRIGHT);
+      return 0;
+    }
+  }
+
+  o_set_log_file ("-");
+  o_set_log_level (log_level);
+
+  if (c < -1) {
+    die ("%s: %s", poptBadOption (optCon, POPT_BADOPTION_NOALIAS), poptStrerror (c));
+  }
+  if (!(dbdir = poptGetArg (optCon))) {
+    poptPrintUsage (optCon, stderr, 0);
+    return EXIT_FAILURE;
+  }
+
+  path = col_path (dbdir, COL_METADATA_FILE);
+  if (!path || !(metadata = col_kv_load (path))) {
+    die ("%s does not look like a columnar database", dbdir);
+  }
+  oml_free (path);
+  if (!(meta = col_kv_get (metadata, "columnar_format")) || atoi (meta) != COL_FORMAT_VERSION) {
+    die ("%s: Unsupported format version %s", dbdir, meta ? meta : "(none)");
+  }
+
+  if (csv_table) {
+    snprintf (key, sizeof (key), "table_%s", csv_table);
+    if (!(meta = col_kv_get (metadata, key)) || !(schema = schema_from_meta (meta))) {
+      die ("%s: No table %s", dbdir, csv_table);
+    }
+    if (output && !(out = fopen (output, "w"))) {
+      die ("Could not open %s: %s", output, strerror (errno));
+    }
+    rows = export_csv (dbdir, schema, out);
+    ret = (fclose (out) || rows < 0) ? -1 : 0;
+    if (rows >= 0) {
+      loginfo ("%s: Exported %" PRId64 " rows\n", csv_table, rows);
+    }
+    schema_free (schema);
+
+  } else {
+    if (!output) {
+      /* DOMAIN.sq3, in the current directory */
+      len = strlen (dbdir);
+      while (len > 1 && dbdir[len - 1] == '/') {
+        len--;
+      }
+      for (domain = dbdir + len; domain > dbdir && domain[-1] != '/'; domain--);
+      len -= domain - dbdir;
+      if (len > strlen (COL_DB_SUFFIX) &&
+          !strncmp (domain + len - strlen (COL_DB_SUFFIX), COL_DB_SUFFIX, strlen (COL_DB_SUFFIX))) {
+        len -= strlen (COL_DB_SUFFIX);
+      }
+      default_output = oml_malloc (len + 5);
+      snprintf (default_output, len + 5, "%.*s.sq3", (int)len, domain);
+      output = default_output;
+    }
+    ret = export_sqlite (dbdir, metadata, output);
+    if (default_output) { oml_free (default_output); }
+  }
+
+  col_kv_free (metadata);
+  poptFreeContext (optCon);
+  return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -16,7 +16,7 @@
  * (it is backward compatible with versions 1--4) It listens on a TCP/IP socket
  * (0.0.0.0:3003 by default) for incoming connection from upstream Injection
  * Points or Processing Points, and stores the received data into an SQL
- * database. Currently, SQLite3 and PostgreSQL are supported as backends.
+ * database. Currently, SQLite3, PostgreSQL and columnar files are supported as backends.
  *
  * - \subpage datastorage
  * - \subpage timestamps
@@ -34,6 +34,7 @@
 #include <popt.h>
 #include <signal.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "oml2/omlc.h"
 #include "oml2/oml_writer.h"
@@ -45,7 +46,10 @@
 #include "hook.h"
 #include "client_handler.h"
 #include "database.h"
+#include "resume.h"
+#include "stats.h"
 #include "sqlite_adapter.h"
+#include "columnar_adapter.h"
 #include "monitoring_server.h"
 
 #define V_STRING  "OML2 Server V%s\n"
@@ -87,33 +91,79 @@ static int socket_timeout = 60;
 static char* logfile_name = NULL;
 static char* uidstr = NULL;
 static char* gidstr = NULL;
+static int nthreads = 1;
+static int stats_interval = 10;
+
+/** Set by the signal handler on SIGUSR1, and checked from the main EventLoop
+ * \see sighandler, signal_timer */
+static volatile sig_atomic_t dump_requested = 0;
+/** EventLoop of the main thread, stopped from the signal handler
+ * \see sighandler */
+static EventLoop *main_loop = NULL;
+/** EventLoops of the worker threads, to which clients are dispatched in a
+ * round-robin fashion when more than one thread is requested
+ * \see on_connect, workers_start */
+static EventLoop **worker_loops = NULL;
+/** Worker threads, running worker_loops */
+static pthread_t *workers = NULL;
+/** Number of worker threads actually started */
+static int nworkers = 0;
+/** Index of the worker to hand the next client over to */
+static int next_worker = 0;
 
 extern char* dbbackend;
 extern char *sqlite_database_dir;
+extern int sqlite_commit_rows;
+extern int sqlite_commit_bytes;
+extern int sqlite_commit_interval;
+extern char *sqlite_journal_mode;
+extern char *sqlite_synchronous;
+extern int sqlite_page_size;
+extern int sqlite_cache_size;
+extern int sqlite_writer_queue;
+extern char *db_indexes;
+extern int db_index_rows;
+extern int db_binary_vectors;
 #if HAVE_LIBPQ
 extern char *pg_host;
 extern char *pg_port;
 extern char *pg_user;
 extern char *pg_pass;
 extern char *pg_conninfo;
+extern int pg_partition_interval;
 #endif /* HAVE_LIBPQ */
 
 struct poptOption options[] = {
   POPT_AUTOHELP
   { "listen", 'l', POPT_ARG_STRING, &listen_service, 0, "Service to listen for TCP based clients", DEFAULT_PORT_STR},
   { "backend", 'b', POPT_ARG_STRING, &dbbackend, 0, "Database server backend", DEFAULT_DB_BACKEND},
-  { "data-dir", 'D', POPT_ARG_STRING, &sqlite_database_dir, 0, "Directory to store database files (sqlite)", "DIR" },
+  { "data-dir", 'D', POPT_ARG_STRING, &sqlite_database_dir, 0, "Directory to store database files (sqlite, columnar)", "DIR" },
+  { "sqlite-commit-rows", '\0', POPT_ARG_INT, &sqlite_commit_rows, 0, "Commit SQLite transactions after that many rows (0: unbounded)", "0" },
+  { "sqlite-commit-bytes", '\0', POPT_ARG_INT, &sqlite_commit_bytes, 0, "Commit SQLite transactions after about that much data (0: unbounded)", "0" },
+  { "sqlite-commit-interval", '\0', POPT_ARG_INT, &sqlite_commit_interval, 0, "Commit SQLite transactions at least every that many ms (0: unbounded)", "1000" },
+  { "sqlite-journal-mode", '\0', POPT_ARG_STRING, &sqlite_journal_mode, 0, "SQLite journal mode", "{DELETE,TRUNCATE,PERSIST,MEMORY,WAL,OFF}" },
+  { "sqlite-synchronous", '\0', POPT_ARG_STRING, &sqlite_synchronous, 0, "SQLite synchronous flag", "{OFF,NORMAL,FULL,EXTRA}" },
+  { "sqlite-page-size", '\0', POPT_ARG_INT, &sqlite_page_size, 0, "SQLite page size for new databases", "BYTES" },
+  { "sqlite-cache-size", '\0', POPT_ARG_INT, &sqlite_cache_size, 0, "SQLite cache size (pages, or KiB if negative)", "N" },
+  { "sqlite-writer-queue", '\0', POPT_ARG_INT, &sqlite_writer_queue, 0, "Write each SQLite database from its own thread, queueing up to N rows (0: from the event loops)", "0" },
+  { "indexes", '\0', POPT_ARG_STRING, &db_indexes, 0, "Secondary indexes to create on measurement tables", "{sender,time}" },
+  { "index-rows", '\0', POPT_ARG_INT, &db_index_rows, 0, "Create indexes after that many rows in a table (0: when closing the database)", "0" },
+  { "binary-vectors", '\0', POPT_ARG_NONE, &db_binary_vectors, 0, "Store vectors of new tables in binary rather than JSON (sqlite, postgresql)", NULL },
+  { "columnar-segment-rows", '\0', POPT_ARG_INT, &columnar_segment_rows, 0, "Seal columnar segments after that many rows", "1048576" },
 #if HAVE_LIBPQ
   { "pg-host", '\0', POPT_ARG_STRING, &pg_host, 0, "PostgreSQL server host to connect to", DEFAULT_PG_HOST },
   { "pg-port", '\0', POPT_ARG_STRING, &pg_port, 0, "PostgreSQL server port to connect to", DEFAULT_PG_PORT },
   { "pg-user", '\0', POPT_ARG_STRING, &pg_user, 0, "PostgreSQL user to connect as", DEFAULT_PG_USER },
   { "pg-pass", '\0', POPT_ARG_STRING, &pg_pass, 'p', "Password of the PostgreSQL user", DEFAULT_PG_PASS },
   { "pg-connect", '\0', POPT_ARG_STRING, &pg_conninfo, 'c', "PostgreSQL connection info string", "\"" DEFAULT_PG_CONNINFO "\""},
+  { "pg-partition-interval", '\0', POPT_ARG_INT, &pg_partition_interval, 0, "Partition new PostgreSQL tables every that many seconds of oml_ts_server (0: no partitioning)", "0" },
 #endif
   { "user", '\0', POPT_ARG_STRING, &uidstr, 0, "Change server's user id", "UID" },
   { "group", '\0', POPT_ARG_STRING, &gidstr, 0, "Change server's group id", "GID" },
   { "event-hook", 'H', POPT_ARG_STRING, &hook, 0, "Path to an event hook taking input on stdin", "HOOK" },
   { "timeout", 't', POPT_ARG_INT, &socket_timeout, 0, "Timeout after which idle receiving sockets are cleaned up to avoid resource exhaustion", "60"  },
+  { "threads", 'T', POPT_ARG_INT, &nthreads, 0, "Number of threads handling client connections", "1"  },
+  { "stats-interval", '\0', POPT_ARG_INT, &stats_interval, 0, "Report ingest statistics every that many seconds (0: never)", "10"  },
   { "debug-level", 'd', POPT_ARG_INT, &log_level, 0, "Increase debug level", "{1 .. 4}"  },
   { "logfile", '\0', POPT_ARG_STRING, &logfile_name, 0, "File to log to", DEFAULT_LOG_FILE },
   { "version", 'v', POPT_ARG_NONE, NULL, 'v', "Print version information and exit", NULL },
@@ -154,8 +204,11 @@ static void logging_setup (char *logfile, int level)
  *
  * Captures the following signals, and handles them thusly.
  * * SIGTERM: instruct the EventLoop to stop.
+ * * SIGUSR1: log the state of the EventLoop and the ingest statistics; as
+ *   this is not async-signal-safe, it is only requested here, and done from
+ *   the main EventLoop.
  *
- * \see eventloop_terminate()
+ * \see eventloop_terminate_loop(), signal_timer
  */
 static void sighandler(int signum)
 {
@@ -163,16 +216,46 @@ static void sighandler(int signum)
   case SIGINT:
   case SIGTERM:
     loginfo("Received signal %d, cleaning up and exiting\n", signum);
-    eventloop_terminate(signum);
+    eventloop_terminate_loop(main_loop, signum);
     break;
   case SIGUSR1:
-    eventloop_report(O_LOG_INFO);
+    dump_requested = 1;
     break;
   default:
     logwarn("Received unhandled signal %d\n", signum);
   }
 }
 
+/** Periodically check for requests from the signal handler.
+ *
+ * \param source TimerEvtSource which expired
+ * \param handle unused
+ * \see sighandler
+ */
+static void signal_timer(TimerEvtSource* source, void* handle)
+{
+  (void)source;
+  (void)handle;
+  if (dump_requested) {
+    dump_requested = 0;
+    eventloop_report(O_LOG_INFO);
+    stats_dump(O_LOG_INFO);
+  }
+}
+
+/** Periodically report the ingest statistics.
+ *
+ * \param source TimerEvtSource which expired
+ * \param handle unused
+ * \see stats_report
+ */
+static void stats_timer(TimerEvtSource* source, void* handle)
+{
+  (void)source;
+  (void)handle;
+  stats_report(stats_interval);
+}
+
 /** XXX: Type of a signal handler, as I'm not sure __sighandler_t from <signal.h> is portable */
 typedef void (*sh_t) (int);
 /** Actually install a new signal handler.
@@ -253,11 +336,30 @@ static void drop_privileges (const char *uidstr, const char *gidstr)
   }
 }
 
+/** Create a ClientHandler for a new Socket in the calling thread's EventLoop.
+ *
+ * This is run by worker threads, from their own EventLoop.
+ *
+ * \param handle Socket object created by accept()ing the connection
+ *
+ * \see on_connect, eventloop_post
+ */
+static void attach_client(void* handle)
+{
+  Socket *new_sock = (Socket*)handle;
+  (void)client_handler_new(new_sock);
+  logdebug("%s: New client attached to worker thread\n", new_sock->name);
+}
+
 /** Callback called when a new connection is received on the listening Socket.
  *
  * This function creates a ClientHandler to manage the data from this Socket.
  * The listening Socket would have been created using socket_server_new().
  *
+ * If worker threads are running, the Socket is handed over to the next one,
+ * in a round-robin fashion, which then creates the ClientHandler from its own
+ * EventLoop.
+ *
  * \param new_sock Socket object created by accept()ing the connection
  * \param handle pointer to opaque data passed when creating the listening Socket
  *
@@ -267,8 +369,97 @@ static void drop_privileges (const char *uidstr, const char *gidstr)
 static void on_connect(Socket* new_sock, void* handle)
 {
   (void)handle;
-  (void)client_handler_new(new_sock);
-  logdebug("%s: New client connected\n", new_sock->name);
+  if (nworkers > 0) {
+    int w = next_worker;
+    next_worker = (next_worker + 1) % nworkers;
+    if (eventloop_post(worker_loops[w], attach_client, new_sock)) {
+      logerror("%s: Could not hand new client over to thread %d, disconnecting\n",
+          new_sock->name, w);
+      socket_free(new_sock);
+      return;
+    }
+    logdebug("%s: New client connected, handled by thread %d\n", new_sock->name, w);
+
+  } else {
+    (void)client_handler_new(new_sock);
+    logdebug("%s: New client connected\n", new_sock->name);
+  }
+}
+
+/** Main function of worker threads.
+ *
+ * \param handle EventLoop to run in this thread
+ * \return NULL
+ */
+static void* worker_run(void* handle)
+{
+  EventLoop *loop = (EventLoop*)handle;
+
+  eventloop_attach(loop);
+  eventloop_set_socket_timeout(socket_timeout);
+  eventloop_run();
+
+  return NULL;
+}
+
+/** Start worker threads, each running their own EventLoop.
+ *
+ * Signals are blocked in the worker threads, so they are all delivered to the
+ * main thread.
+ *
+ * \param n number of threads to start
+ * \return the number of threads actually started
+ *
+ * \see workers_stop, on_connect
+ */
+static int workers_start(int n)
+{
+  sigset_t all, old;
+  int i;
+
+  worker_loops = oml_malloc(n * sizeof(EventLoop*));
+  workers = oml_malloc(n * sizeof(pthread_t));
+  if (!worker_loops || !workers) {
+    die("Could not allocate memory for %d worker threads\n", n);
+  }
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &old);
+  for (i = 0; i < n; i++) {
+    if (!(worker_loops[i] = eventloop_new())) {
+      logwarn("Could not create EventLoop for worker thread %d\n", i);
+      break;
+    }
+    if (pthread_create(&workers[i], NULL, worker_run, worker_loops[i])) {
+      logwarn("Could not start worker thread %d: %s\n", i, strerror(errno));
+      eventloop_free(worker_loops[i]);
+      break;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+  loginfo("Started %d thread%s to handle clients\n", i, i>1?"s":"");
+  return i;
+}
+
+/** Terminate all worker threads, and wait for them to exit.
+ *
+ * \see workers_start
+ */
+static void workers_stop(void)
+{
+  int i;
+
+  for (i = 0; i < nworkers; i++) {
+    eventloop_terminate_loop(worker_loops[i], SIGTERM);
+  }
+  for (i = 0; i < nworkers; i++) {
+    pthread_join(workers[i], NULL);
+    eventloop_free(worker_loops[i]);
+  }
+  nworkers = 0;
+  oml_free(worker_loops);
+  oml_free(workers);
 }
 
 int main(int argc, const char **argv)
@@ -324,6 +515,7 @@ int main(int argc, const char **argv)
   loginfo(COPYRIGHT);
 
   eventloop_init();
+  main_loop = eventloop_current();
   eventloop_set_socket_timeout(socket_timeout);
 
   Socket* server_sock;
@@ -341,15 +533,30 @@ int main(int argc, const char **argv)
   }
 
   signal_setup();
+  eventloop_every("signals", 1, signal_timer, NULL);
 
   hook_setup();
 
+  if (stats_interval > 0) {
+    eventloop_every("stats", stats_interval, stats_timer, NULL);
+  }
+
+  if (nthreads > 1) {
+    nworkers = workers_start(nthreads);
+  }
+
   eventloop_run();
 
+  if (nworkers > 0) {
+    workers_stop();
+  }
+
   signal_cleanup();
 
   hook_cleanup();
 
+  resume_cleanup();
+
   oml_cleanup();
 
   oml_memreport(O_LOG_INFO);
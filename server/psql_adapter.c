@@ -26,6 +26,7 @@
 #include "mstring.h"
 #include "guid.h"
 #include "json.h"
+#include "htonll.h"
 #include "oml_value.h"
 #include "oml_util.h"
 #include "database.h"
@@ -39,12 +40,15 @@ char *pg_port = DEFAULT_PG_PORT;
 char *pg_user = DEFAULT_PG_USER;
 char *pg_pass = DEFAULT_PG_PASS;
 char *pg_conninfo = DEFAULT_PG_CONNINFO;
+/** Range of oml_ts_server covered by each partition of measurement tables [s], 0 not to partition them */
+int pg_partition_interval = 0;
 
 /** Mapping between OML and PostgreSQL data types
  * \see psql_type_to_oml, psql_oml_to_type
  */
 static db_typemap psql_type_pair[] = {
   { OML_DB_PRIMARY_KEY, "SERIAL PRIMARY KEY"}, /* We might need BIGSERIAL at some point. */
+  { OML_DB_PRIMARY_KEY, "SERIAL"}, /* With partitioning, see psql_oml_to_type */
   { OML_LONG_VALUE,     "INT4" },
   { OML_DOUBLE_VALUE,   "FLOAT8" },
   { OML_STRING_VALUE,   "TEXT" },
@@ -64,6 +68,25 @@ static db_typemap psql_type_pair[] = {
   { OML_VECTOR_BOOL_VALUE,   "TEXT" },
 };
 
+/** Mapping of OML vector types to native PostgreSQL arrays, used instead of
+ * JSON text when db_binary_vectors is set
+ * \see psql_oml_to_type, psql_vector_to_array
+ */
+static db_typemap psql_array_type_pair[] = {
+  { OML_VECTOR_DOUBLE_VALUE, "FLOAT8[]" },
+  { OML_VECTOR_INT32_VALUE,  "INT4[]" },
+  { OML_VECTOR_UINT32_VALUE, "INT8[]" }, /* Promoted, as for scalars */
+  { OML_VECTOR_INT64_VALUE,  "INT8[]" },
+  { OML_VECTOR_UINT64_VALUE, "INT8[]" }, /* Stored as signed, as for scalars */
+  { OML_VECTOR_BOOL_VALUE,   "BOOLEAN[]" },
+};
+
+/* OIDs of the element types of arrays, from PostgreSQL's catalog/pg_type.h */
+#define PG_BOOLOID 16
+#define PG_INT8OID 20
+#define PG_INT4OID 23
+#define PG_FLOAT8OID 701
+
 static int sql_stmt(PsqlDB* self, const char* stmt);
 
 /* Functions needed by the Database struct */
@@ -82,6 +105,7 @@ static int psql_set_metadata (Database* database, const char* key, const char* v
 static int psql_add_sender_id(Database* database, const char* sender_id);
 static char* psql_get_uri(Database *db, char *uri, size_t size);
 static TableDescr* psql_get_table_list (Database *database, int *num_tables);
+static int psql_create_index (Database *db, DbTable *table, const char *name, const char *columns);
 
 static MString* psql_prepare_conninfo(const char *database, const char *host, const char *port, const char *user, const char *pass, const char *extra_conninfo);
 static char* psql_get_sender_id (Database* database, const char* name);
@@ -127,6 +151,14 @@ psql_backend_setup (void)
   loginfo ("psql: Sending experiment data to PostgreSQL server %s:%s as user '%s'\n",
            pg_host, pg_port, pg_user);
 
+  if (pg_partition_interval < 0) {
+    logerror ("psql: Partition interval cannot be negative\n");
+    return -1;
+  } else if (pg_partition_interval > 0) {
+    loginfo ("psql: Partitioning new measurement tables every %ds of oml_ts_server\n",
+        pg_partition_interval);
+  }
+
   conninfo = psql_prepare_conninfo("postgres", pg_host, pg_port, pg_user, pg_pass, pg_conninfo);
   PGconn *conn = PQconnectdb (mstring_buf (conninfo));
 
@@ -177,6 +209,11 @@ OmlValueT psql_type_to_oml (const char *type)
         return psql_type_pair[i].type;
     }
   }
+  for (i = 0; i < LENGTH(psql_array_type_pair); i++) {
+    if (strcmp (type, psql_array_type_pair[i].name) == 0) {
+        return psql_array_type_pair[i].type;
+    }
+  }
   logwarn("Unknown PostgreSQL type '%s', using OML_UNKNOWN_VALUE\n", type);
   return OML_UNKNOWN_VALUE;
 }
@@ -190,6 +227,18 @@ psql_oml_to_type (OmlValueT type)
   int i = 0;
   int n = LENGTH(psql_type_pair);
 
+  /* Unique constraints of partitioned tables must include the partition key */
+  if (type == OML_DB_PRIMARY_KEY && pg_partition_interval > 0) {
+    return "SERIAL";
+  }
+  if (db_binary_vectors && omlc_is_vector_type (type)) {
+    for (i = 0; i < LENGTH(psql_array_type_pair); i++) {
+      if (psql_array_type_pair[i].type == type) {
+        return psql_array_type_pair[i].name;
+      }
+    }
+  }
+
   for (i = 0; i < n; i++) {
     if (psql_type_pair[i].type == type) {
         return psql_type_pair[i].name;
@@ -324,6 +373,10 @@ psql_create_database(Database* db)
   db->set_metadata = psql_set_metadata;
   db->get_uri = psql_get_uri;
   db->get_table_list = psql_get_table_list;
+  db->create_index = psql_create_index;
+  if (pg_partition_interval > 0) {
+    db->table_create_clause = "PARTITION BY RANGE (oml_ts_server)";
+  }
 
   db->handle = self;
 
@@ -448,6 +501,29 @@ psql_table_create (Database *db, DbTable *table, int shallow)
 
   psqltable->insert_stmt = insert_name;
 
+  /* Tables created without binary vectors keep storing them as JSON */
+  MString *columns = mstring_create ();
+  mstring_sprintf (columns, "SELECT column_name FROM information_schema.columns "
+      "WHERE table_name='%s' AND data_type='ARRAY' LIMIT 1;", table->schema->name);
+  res = PQexec (psqldb->conn, mstring_buf (columns));
+  psqltable->binary_vectors = PQresultStatus (res) == PGRES_TUPLES_OK && PQntuples (res) > 0;
+  PQclear (res);
+  mstring_delete (columns);
+
+  if (pg_partition_interval > 0) {
+    /* Tables created without partitioning are kept as they are */
+    MString *query = mstring_create ();
+    /* to_regclass looks the table up in the same schemas as the other statements */
+    mstring_sprintf (query, "SELECT relname FROM pg_class "
+        "WHERE oid=to_regclass('\"%s\"') AND relkind='p';", table->schema->name);
+    res = PQexec (psqldb->conn, mstring_buf (query));
+    psqltable->partitioned = PQresultStatus (res) == PGRES_TUPLES_OK && PQntuples (res) > 0;
+    PQclear (res);
+    mstring_delete (query);
+    logdebug ("psql:%s: Table '%s' is%s partitioned\n", db->name, table->schema->name,
+        psqltable->partitioned ? "" : " not");
+  }
+
   if (insert) { mstring_delete (insert); }
   return 0;
 
@@ -460,22 +536,77 @@ fail_exit:
 
 /** Free a PostgreSQL table
  *
- * Parameter database is ignored in this implementation
+ * The table is indexed first, if not done yet.
  *
- * \see db_adapter_table_free
+ * \see db_adapter_table_free, dba_table_create_indexes
  */
 static int
 psql_table_free (Database *database, DbTable *table)
 {
-  (void)database;
   PsqlTable *psqltable = (PsqlTable*)table->handle;
   if (psqltable) {
+    dba_table_create_indexes (database, table);
     mstring_delete (psqltable->insert_stmt);
     oml_free (psqltable);
   }
   return 0;
 }
 
+/** Create an index on a connection of its own, without blocking insertions.
+ *
+ * Partitioned tables cannot be indexed concurrently, so they are only
+ * indexed when freed.  An index whose build failed is dropped, so it can be
+ * built again then.
+ *
+ * \see db_adapter_create_index, dba_table_create_indexes
+ */
+static int
+psql_create_index (Database *db, DbTable *table, const char *name, const char *columns)
+{
+  PsqlTable *psqltable = (PsqlTable*)table->handle;
+  MString *conninfo, *create;
+  PGconn *conn;
+  PGresult *res;
+  int ret = -1;
+
+  if (!psqltable || psqltable->partitioned) {
+    return -1;
+  }
+  conninfo = psql_prepare_conninfo (db->name, pg_host, pg_port, pg_user, pg_pass, pg_conninfo);
+  conn = PQconnectdb (mstring_buf (conninfo));
+  mstring_delete (conninfo);
+  if (PQstatus (conn) != CONNECTION_OK) {
+    logwarn ("psql:%s: Could not connect to create index %s: %s",
+        db->name, name, PQerrorMessage (conn));
+    PQfinish (conn);
+    return -1;
+  }
+  PQsetNoticeReceiver (conn, psql_receive_notice, db->name);
+
+  create = mstring_create ();
+  mstring_sprintf (create, "CREATE INDEX CONCURRENTLY IF NOT EXISTS \"%s\" ON \"%s\" (%s);",
+      name, table->schema->name, columns);
+  res = PQexec (conn, mstring_buf (create));
+  if (PQresultStatus (res) == PGRES_COMMAND_OK) {
+    ret = 0;
+  } else {
+    logwarn ("psql:%s: Could not create index %s: %s", db->name, name, PQerrorMessage (conn));
+    /* A failed concurrent build leaves an invalid index, which CREATE INDEX
+     * IF NOT EXISTS would keep when the table is freed */
+    PQclear (res);
+    mstring_set (create, "");
+    mstring_sprintf (create, "DROP INDEX CONCURRENTLY IF EXISTS \"%s\";", name);
+    res = PQexec (conn, mstring_buf (create));
+    if (PQresultStatus (res) != PGRES_COMMAND_OK) {
+      logwarn ("psql:%s: Could not drop invalid index %s: %s", db->name, name, PQerrorMessage (conn));
+    }
+  }
+  PQclear (res);
+  mstring_delete (create);
+  PQfinish (conn);
+  return ret;
+}
+
 /** Return a string suitable for an unbound variable is PostgreSQL.
  * \see db_adapter_prepared_var
  */
@@ -494,6 +625,137 @@ psql_prepared_var(Database *db, unsigned int order)
   return s;
 }
 
+/** Encode a vector as a one-dimensional PostgreSQL array, in binary format.
+ *
+ * The format is that of array_send(): a header with the number of
+ * dimensions, a flag for NULL elements, the OID of the element type and the
+ * size and lower bound of each dimension, followed by each element as its
+ * length and its value, all in network byte order.
+ *
+ * \param v OmlValue containing the vector
+ * \param[in,out] buf pointer to an oml_malloc()ed buffer, reallocated if too small
+ * \return the length of the encoded array [B], or -1 on error
+ * \see psql_array_type_pair, psql_insert
+ */
+static ssize_t
+psql_vector_to_array (OmlValue *v, char **buf)
+{
+  OmlValueU *u = oml_value_get_value (v);
+  size_t n = omlc_get_vector_nof_elts (*u);
+  size_t i, elt_sz;
+  uint32_t oid;
+  char *p;
+
+  switch (oml_value_get_type (v)) {
+  case OML_VECTOR_DOUBLE_VALUE: oid = PG_FLOAT8OID; elt_sz = 8; break;
+  case OML_VECTOR_INT32_VALUE:  oid = PG_INT4OID;   elt_sz = 4; break;
+  case OML_VECTOR_UINT32_VALUE:
+  case OML_VECTOR_INT64_VALUE:
+  case OML_VECTOR_UINT64_VALUE: oid = PG_INT8OID;   elt_sz = 8; break;
+  case OML_VECTOR_BOOL_VALUE:   oid = PG_BOOLOID;   elt_sz = 1; break;
+  default:
+    return -1;
+  }
+
+  size_t len = 3 * 4 + (n ? 2 * 4 : 0) + n * (4 + elt_sz);
+  if (oml_malloc_usable_size (*buf) < len) {
+    if (!(p = oml_realloc (*buf, len))) {
+      return -1;
+    }
+    *buf = p;
+  }
+
+#define PUT32(x) do { uint32_t _x = htonl ((uint32_t)(x)); memcpy (p, &_x, 4); p += 4; } while (0)
+#define PUT64(x) do { uint64_t _x = htonll ((uint64_t)(x)); memcpy (p, &_x, 8); p += 8; } while (0)
+  p = *buf;
+  PUT32 (n ? 1 : 0);  /* Dimensions */
+  PUT32 (0);          /* No NULL elements */
+  PUT32 (oid);
+  if (n) {
+    PUT32 (n);        /* Size of the dimension */
+    PUT32 (1);        /* Lower bound */
+  }
+  for (i = 0; i < n; i++) {
+    PUT32 (elt_sz);
+    switch (oml_value_get_type (v)) {
+    case OML_VECTOR_DOUBLE_VALUE: {
+      uint64_t bits;
+      memcpy (&bits, &((double*)omlc_get_vector_ptr (*u))[i], 8);
+      PUT64 (bits);
+      break;
+    }
+    case OML_VECTOR_INT32_VALUE:  PUT32 (((int32_t*)omlc_get_vector_ptr (*u))[i]); break;
+    case OML_VECTOR_UINT32_VALUE: PUT64 (((uint32_t*)omlc_get_vector_ptr (*u))[i]); break;
+    case OML_VECTOR_INT64_VALUE:  PUT64 (((int64_t*)omlc_get_vector_ptr (*u))[i]); break;
+    case OML_VECTOR_UINT64_VALUE: PUT64 (((uint64_t*)omlc_get_vector_ptr (*u))[i]); break;
+    default: *p++ = ((bool*)omlc_get_vector_ptr (*u))[i] ? 1 : 0; break;
+    }
+  }
+#undef PUT32
+#undef PUT64
+
+  return len;
+}
+
+/** Make sure the partition of a table for a given time exists.
+ *
+ * Partitions cover pg_partition_interval seconds of oml_ts_server each, and
+ * are named after their table and their index in time, e.g., table_p0.
+ *
+ * A new partition is created in a transaction of its own, after committing
+ * the current one, so an error does not abort the rows inserted so far, and
+ * the lock it takes on the table is released right away.
+ *
+ * \param db Database to work with
+ * \param table partitioned DbTable
+ * \param time_stamp_server time to find the partition for
+ * \return 0 on success, -1 otherwise
+ * \see pg_partition_interval, psql_insert, dba_derived_name
+ */
+static int
+psql_ensure_partition (Database *db, DbTable *table, double time_stamp_server)
+{
+  PsqlDB *psqldb = (PsqlDB*)db->handle;
+  PsqlTable *psqltable = (PsqlTable*)table->handle;
+  char suffix[32], name[DBA_MAX_NAME_LENGTH + 1];
+  MString *create;
+  int64_t k;
+  int ret;
+
+  if (time_stamp_server >= psqltable->partition_start &&
+      time_stamp_server < psqltable->partition_end) {
+    return 0;
+  }
+
+  k = (int64_t)floor (time_stamp_server / pg_partition_interval);
+  snprintf (suffix, sizeof (suffix), "p%" PRId64, k);
+  dba_derived_name (name, table->schema->name, suffix);
+  create = mstring_create ();
+  mstring_sprintf (create, "CREATE TABLE IF NOT EXISTS \"%s\" PARTITION OF \"%s\" "
+      "FOR VALUES FROM (%" PRId64 ") TO (%" PRId64 ");",
+      name, table->schema->name,
+      k * pg_partition_interval, (k + 1) * pg_partition_interval);
+  if (dba_end_transaction (db)) {
+    mstring_delete (create);
+    return -1;
+  }
+  ret = psql_stmt (db, mstring_buf (create));
+  mstring_delete (create);
+  if (dba_begin_transaction (db)) {
+    return -1;
+  }
+  psqldb->last_commit = time (NULL);
+
+  if (ret) {
+    logerror ("psql:%s: Could not create partition %" PRId64 " of table '%s'\n",
+        db->name, k, table->schema->name);
+    return -1;
+  }
+  psqltable->partition_start = k * pg_partition_interval;
+  psqltable->partition_end = (k + 1) * pg_partition_interval;
+  return 0;
+}
+
 /** Insert value in the PostgreSQL database.
  * \see db_adapter_insert
  */
@@ -503,7 +765,7 @@ psql_insert(Database* db, DbTable* table, int sender_id, int seq_no, double time
   PsqlDB* psqldb = (PsqlDB*)db->handle;
   PsqlTable* psqltable = (PsqlTable*)table->handle;
   PGresult* res;
-  int i;
+  int i, ret = -1;
   double time_stamp_server;
   const char* insert_stmt = mstring_buf (psqltable->insert_stmt);
   unsigned char *escaped_blob;
@@ -535,11 +797,16 @@ psql_insert(Database* db, DbTable* table, int sender_id, int seq_no, double time
 
   if (tv.tv_sec > psqldb->last_commit) {
     if (dba_reopen_transaction (db) == -1) {
-      return -1;
+      goto cleanup;
     }
     psqldb->last_commit = tv.tv_sec;
   }
 
+  if (psqltable->partitioned &&
+      psql_ensure_partition (db, table, time_stamp_server) == -1) {
+    goto cleanup;
+  }
+
   sprintf(paramValues[3],"%.8f",time_stamp_server);
   paramLength[3] = 0;
   paramFormat[3] = 0;
@@ -549,7 +816,18 @@ psql_insert(Database* db, DbTable* table, int sender_id, int seq_no, double time
     struct schema_field *field = &table->schema->fields[i];
     if (oml_value_get_type(v) != field->type) {
       logerror("psql:%s: Value %d type mismatch for table '%s'\n", db->name, i, table->schema->name);
-      return -1;
+      goto cleanup;
+    }
+    if (psqltable->binary_vectors && omlc_is_vector_type (field->type)) {
+      ssize_t len = psql_vector_to_array (v, &paramValues[4+i]);
+      if (len < 0) {
+        logerror("psql:%s: Could not encode vector in field %d of table '%s'\n",
+            db->name, i, table->schema->name);
+        goto cleanup;
+      }
+      paramLength[4+i] = len;
+      paramFormat[4+i] = 1;
+      continue;
     }
     switch (field->type) {
     case OML_LONG_VALUE: sprintf(paramValues[4+i],"%i",(int)v->value.longValue); break;
@@ -570,12 +848,14 @@ psql_insert(Database* db, DbTable* table, int sender_id, int seq_no, double time
                            /* XXX: 512 char is the size allocated above. Nasty. */
                            if (eblob_len > 512) {
                              logdebug("psql:%s: Reallocating %d bytes for big blob\n", db->name, eblob_len);
-                             paramValues[4+i] = oml_realloc(paramValues[4+i], eblob_len);
-                             if (!paramValues[4+i]) {
+                             char *p = oml_realloc(paramValues[4+i], eblob_len);
+                             if (!p) {
                                logerror("psql:%s: Could not realloc()at memory for escaped blob in field %d of table '%s'\n",
                                    db->name, i, table->schema->name);
-                               return -1;
+                               PQfreemem(escaped_blob);
+                               goto cleanup;
                              }
+                             paramValues[4+i] = p;
                            }
                            snprintf(paramValues[4+i], eblob_len, "%s", escaped_blob);
                            PQfreemem(escaped_blob);
@@ -584,6 +864,7 @@ psql_insert(Database* db, DbTable* table, int sender_id, int seq_no, double time
                            if(v->value.guidValue != OMLC_GUID_NULL) {
                              sprintf(paramValues[4+i],"%" PRId64, (int64_t)(v->value.guidValue));
                            } else {
+                             oml_free(paramValues[4+i]);
                              paramValues[4+i] = NULL;
                            }
                            break;
@@ -610,7 +891,7 @@ psql_insert(Database* db, DbTable* table, int sender_id, int seq_no, double time
     default:
       logerror("psql:%s: Unknown type %d in col '%s' of table '%s'; this is probably a bug\n",
           db->name, field->type, field->name, table->schema->name);
-      return -1;
+      goto cleanup;
     }
     paramLength[4+i] = 0;
     paramFormat[4+i] = 0;
@@ -625,15 +906,17 @@ psql_insert(Database* db, DbTable* table, int sender_id, int seq_no, double time
     logerror("psql:%s: INSERT INTO '%s' failed: %s", /* PQerrorMessage strings already have '\n' */
         db->name, table->schema->name, PQerrorMessage(psqldb->conn));
     PQclear(res);
-    return -1;
+    goto cleanup;
   }
   PQclear(res);
+  dba_table_row_inserted (db, table);
+  ret = 0;
 
+cleanup:
   for (i=0;i<4+value_count;i++) {
     oml_free(paramValues[i]);
   }
-
-  return 0;
+  return ret;
 }
 
 /** Do a key-value style select on a database table.
@@ -28,8 +28,13 @@ typedef struct PsqlDB {
 
 typedef struct PsqlTable {
   MString *insert_stmt; /* Named statement for inserting into this table */
+  int partitioned;      /* Whether the table is partitioned by oml_ts_server */
+  int binary_vectors;   /* Whether vectors are stored as arrays rather than JSON */
+  double partition_start, partition_end; /* Range of the last partition used */
 } PsqlTable;
 
+extern int pg_partition_interval;
+
 int psql_backend_setup ();
 int psql_create_database (Database* db);
 
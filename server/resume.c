@@ -0,0 +1,280 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file resume.c
+ * \brief Keep track of the samples stored from each client instance.
+ *
+ * Clients which lose their connection resend the data the server did not
+ * acknowledge after reconnecting. For those which asked for
+ * acknowledgements, the server remembers, for each of their streams, the
+ * sequence number up to which all samples were stored, and which of the
+ * RESUME_WINDOW following ones were. It acknowledges the former, so the
+ * clients keep, and resend, any sample it does not have yet, and skips the
+ * samples it already has when they are received again.
+ *
+ * A client instance is identified by its domain, sender ID and start time.
+ * Its state outlives the Databases and ClientHandlers, but not the server:
+ * it is kept in memory, and forgotten RESUME_STATE_TTL seconds after its last
+ * connection went away.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "resume.h"
+
+static ResumeState *first_state = NULL;
+/** Lock protecting the list of states, and their reference counts */
+static pthread_mutex_t first_state_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Free a ResumeState.
+ *
+ * \param state ResumeState to free
+ */
+static void
+resume_state_free (ResumeState *state)
+{
+  pthread_mutex_destroy (&state->lock);
+  oml_free (state->domain);
+  oml_free (state->sender);
+  if (state->streams)
+    oml_free (state->streams);
+  oml_free (state);
+}
+
+/** Free the unused states which expired.
+ *
+ * The caller must hold first_state_lock.
+ *
+ * \param now current time
+ */
+static void
+resume_state_expire (time_t now)
+{
+  ResumeState **it = &first_state;
+  ResumeState *state;
+
+  while ((state = *it)) {
+    if (state->refs == 0 && difftime (now, state->last_used) > RESUME_STATE_TTL) {
+      logdebug ("%s:%s:%d: Forgetting stored sequence numbers\n",
+          state->domain, state->sender, state->start_time);
+      *it = state->next;
+      resume_state_free (state);
+    } else {
+      it = &state->next;
+    }
+  }
+}
+
+/** Find, or create, the state of a client instance.
+ *
+ * \param domain experimental domain of the client
+ * \param sender sender ID of the client
+ * \param start_time start time of the client
+ * \return a ResumeState, to be released with resume_state_release, or NULL on error
+ * \see resume_state_release
+ */
+ResumeState*
+resume_state_find (const char *domain, const char *sender, int start_time)
+{
+  ResumeState *state;
+
+  pthread_mutex_lock (&first_state_lock);
+  resume_state_expire (time (NULL));
+
+  for (state = first_state; state; state = state->next) {
+    if (state->start_time == start_time &&
+        !strcmp (state->sender, sender) && !strcmp (state->domain, domain)) {
+      break;
+    }
+  }
+
+  if (!state && (state = oml_malloc (sizeof (ResumeState)))) {
+    memset (state, 0, sizeof (ResumeState));
+    state->domain = oml_strndup (domain, strlen (domain));
+    state->sender = oml_strndup (sender, strlen (sender));
+    state->start_time = start_time;
+    pthread_mutex_init (&state->lock, NULL);
+    if (!state->domain || !state->sender) {
+      resume_state_free (state);
+      state = NULL;
+    } else {
+      state->next = first_state;
+      first_state = state;
+    }
+  }
+
+  if (state) {
+    state->refs++;
+  } else {
+    logerror ("%s:%s: Could not allocate memory to track stored sequence numbers\n",
+        domain, sender);
+  }
+  pthread_mutex_unlock (&first_state_lock);
+
+  return state;
+}
+
+/** Release a ResumeState obtained with resume_state_find.
+ *
+ * The state is kept for RESUME_STATE_TTL seconds after its last release, in
+ * case the client reconnects.
+ *
+ * \param state ResumeState to release
+ * \see resume_state_find
+ */
+void
+resume_state_release (ResumeState *state)
+{
+  pthread_mutex_lock (&first_state_lock);
+  state->refs--;
+  time (&state->last_used);
+  pthread_mutex_unlock (&first_state_lock);
+}
+
+/** Test whether a sample is marked as stored in the window of a stream */
+#define RESUME_BIT_ISSET(s, seqno) \
+  ((s)->stored[((unsigned)(seqno) % RESUME_WINDOW) / 32] & (1u << ((unsigned)(seqno) % 32)))
+/** Mark, or unmark, a sample as stored in the window of a stream */
+#define RESUME_BIT_SET(s, seqno) \
+  ((s)->stored[((unsigned)(seqno) % RESUME_WINDOW) / 32] |= (1u << ((unsigned)(seqno) % 32)))
+#define RESUME_BIT_CLEAR(s, seqno) \
+  ((s)->stored[((unsigned)(seqno) % RESUME_WINDOW) / 32] &= ~(1u << ((unsigned)(seqno) % 32)))
+
+/** Get the sequence number up to which all samples of a stream were stored.
+ *
+ * \param state ResumeState of the client
+ * \param stream index of the stream
+ * \return the sequence number, or 0 if nothing was stored yet
+ */
+int
+resume_state_seqno (ResumeState *state, int stream)
+{
+  int seqno = 0;
+
+  pthread_mutex_lock (&state->lock);
+  if (stream >= 0 && stream < state->nstreams) {
+    seqno = state->streams[stream].seqno;
+  }
+  pthread_mutex_unlock (&state->lock);
+
+  return seqno;
+}
+
+/** Check whether a sample of a stream has already been stored.
+ *
+ * \param state ResumeState of the client
+ * \param stream index of the stream
+ * \param seqno sequence number of the sample
+ * \return 1 if the sample was stored, 0 otherwise
+ */
+int
+resume_state_stored (ResumeState *state, int stream, int seqno)
+{
+  ResumeStream *s;
+  int stored = 0;
+
+  pthread_mutex_lock (&state->lock);
+  if (stream >= 0 && stream < state->nstreams) {
+    s = &state->streams[stream];
+    stored = seqno <= s->seqno ||
+      (seqno - s->seqno <= RESUME_WINDOW && RESUME_BIT_ISSET (s, seqno));
+  }
+  pthread_mutex_unlock (&state->lock);
+
+  return stored;
+}
+
+/** Record that a sample of a stream has been stored.
+ *
+ * The sequence number up to which all samples were stored only moves past
+ * a missing sample once it is stored too. Gaps which are never filled (e.g.,
+ * left by samples the client dropped when its buffers were full) are given
+ * up on when a sample more than RESUME_WINDOW past them is stored.
+ *
+ * \param state ResumeState of the client
+ * \param stream index of the stream
+ * \param seqno sequence number of the stored sample
+ * \return 0 on success, -1 on error
+ */
+int
+resume_state_update (ResumeState *state, int stream, int seqno)
+{
+  ResumeStream *streams, *s;
+  int n;
+
+  if (stream < 0) {
+    return -1;
+  }
+
+  pthread_mutex_lock (&state->lock);
+  if (stream >= state->nstreams) {
+    n = stream + 1 > 2 * state->nstreams ? stream + 1 : 2 * state->nstreams;
+    if (!(streams = oml_realloc (state->streams, n * sizeof (ResumeStream)))) {
+      pthread_mutex_unlock (&state->lock);
+      return -1;
+    }
+    memset (streams + state->nstreams, 0, (n - state->nstreams) * sizeof (ResumeStream));
+    state->streams = streams;
+    state->nstreams = n;
+  }
+
+  s = &state->streams[stream];
+  if (seqno > s->seqno) {
+    if (seqno - s->seqno > RESUME_WINDOW) {
+      logdebug ("%s:%s:%d: Not waiting for samples %d to %d of stream %d any more\n",
+          state->domain, state->sender, state->start_time,
+          s->seqno + 1, seqno - RESUME_WINDOW, stream);
+      if (seqno - s->seqno >= 2 * RESUME_WINDOW) {
+        memset (s->stored, 0, sizeof (s->stored));
+        s->seqno = seqno - RESUME_WINDOW;
+      }
+      while (s->seqno < seqno - RESUME_WINDOW) {
+        s->seqno++;
+        RESUME_BIT_CLEAR (s, s->seqno);
+      }
+    }
+    RESUME_BIT_SET (s, seqno);
+    while (RESUME_BIT_ISSET (s, s->seqno + 1)) {
+      s->seqno++;
+      RESUME_BIT_CLEAR (s, s->seqno);
+    }
+  }
+  pthread_mutex_unlock (&state->lock);
+
+  return 0;
+}
+
+/** Forget the state of all client instances. */
+void
+resume_cleanup (void)
+{
+  ResumeState *state;
+
+  pthread_mutex_lock (&first_state_lock);
+  while ((state = first_state)) {
+    if (state->refs > 0) {
+      logwarn ("%s:%s:%d: Sequence numbers still in use on cleanup\n",
+          state->domain, state->sender, state->start_time);
+    }
+    first_state = state->next;
+    resume_state_free (state);
+  }
+  pthread_mutex_unlock (&first_state_lock);
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,66 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file resume.h
+ * \brief Sequence numbers stored for each client instance.
+ * \see resume.c, ack.h
+ */
+#ifndef RESUME_H__
+#define RESUME_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+/** How long [s] the state of a client instance is kept after its last
+ * connection went away */
+#define RESUME_STATE_TTL (24 * 3600)
+
+/** Number of samples past a gap remembered while waiting for it to be filled */
+#define RESUME_WINDOW 1024
+
+/** Samples stored from one stream of a client instance */
+typedef struct ResumeStream {
+  int seqno;          /**< sequence number up to which all samples were stored */
+  /** samples stored after seqno, one bit per sequence number modulo RESUME_WINDOW */
+  uint32_t stored[RESUME_WINDOW / 32];
+} ResumeStream;
+
+/** Sequence numbers stored from one client instance, across its connections */
+typedef struct ResumeState {
+  char *domain;       /**< experimental domain of the client */
+  char *sender;       /**< sender ID of the client */
+  int start_time;     /**< start time of the client, telling its instances apart */
+
+  pthread_mutex_t lock; /**< protects nstreams and streams */
+  int nstreams;       /**< number of elements in streams */
+  ResumeStream *streams; /**< samples stored from each stream */
+
+  int refs;           /**< number of ClientHandlers using this state */
+  time_t last_used;   /**< time at which the last ClientHandler released it */
+  struct ResumeState *next;
+} ResumeState;
+
+ResumeState *resume_state_find (const char *domain, const char *sender, int start_time);
+void resume_state_release (ResumeState *state);
+int resume_state_seqno (ResumeState *state, int stream);
+int resume_state_stored (ResumeState *state, int stream, int seqno);
+int resume_state_update (ResumeState *state, int stream, int seqno);
+void resume_cleanup (void);
+
+#endif /* RESUME_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -14,7 +14,10 @@
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sqlite3.h>
 #include <time.h>
 #include <sys/time.h>
@@ -26,6 +29,7 @@
 #include "mstring.h"
 #include "htonll.h"
 #include "json.h"
+#include "vector.h"
 #include "guid.h"
 #include "oml_value.h"
 #include "oml_util.h"
@@ -39,6 +43,34 @@ static char backend_name[] = "sqlite";
 /* Cannot be static due to testsuite */
 char *sqlite_database_dir = NULL;
 
+/* Commit policy; a transaction is committed as soon as any non-zero bound is
+ * reached \see sq3_commit_policy */
+/** Maximum number of rows per transaction, 0 for unbounded */
+int sqlite_commit_rows = 0;
+/** Maximum approximate amount of data per transaction [B], 0 for unbounded */
+int sqlite_commit_bytes = 0;
+/** Maximum time between commits [ms], 0 for unbounded */
+int sqlite_commit_interval = DEFAULT_SQ3_COMMIT_INTERVAL;
+
+/* Tuning PRAGMAs applied when opening databases, if set \see sq3_pragmas */
+/** Journal mode (e.g., WAL) \see https://www.sqlite.org/pragma.html#pragma_journal_mode */
+char *sqlite_journal_mode = NULL;
+/** Synchronous flag (e.g., NORMAL) \see https://www.sqlite.org/pragma.html#pragma_synchronous */
+char *sqlite_synchronous = NULL;
+/** Page size [B], 0 for SQLite's default \see https://www.sqlite.org/pragma.html#pragma_page_size */
+int sqlite_page_size = 0;
+/** Cache size [pages, or KiB if negative], 0 for SQLite's default \see https://www.sqlite.org/pragma.html#pragma_cache_size */
+int sqlite_cache_size = 0;
+
+/** Number of rows queued for the writer thread of each database, 0 to insert
+ * synchronously from the event loop \see sq3_writer */
+int sqlite_writer_queue = 0;
+
+/** Valid values for sqlite_journal_mode \see sq3_backend_setup */
+static const char *sq3_journal_modes[] = { "DELETE", "TRUNCATE", "PERSIST", "MEMORY", "WAL", "OFF" };
+/** Valid values for sqlite_synchronous \see sq3_backend_setup */
+static const char *sq3_synchronous_modes[] = { "OFF", "NORMAL", "FULL", "EXTRA" };
+
 /** Mapping between OML and SQLite3 data types
  * \see sq3_type_to_oml, sq3_oml_to_type
  */
@@ -57,7 +89,8 @@ static db_typemap sq3_type_pair [] = {
                                         Instead, Boolean values are stored as integers 0 (false) and 1 (true)."
                                         [0] https://www.sqlite.org/datatype3.html */
 
-  /* Vector types are rendered as JSON-format text */
+  /* Vector types are rendered as JSON-format text, unless stored as BLOBs
+   * (see sq3_oml_to_type) */
   { OML_VECTOR_DOUBLE_VALUE, "TEXT" },
   { OML_VECTOR_INT32_VALUE,  "TEXT" },
   { OML_VECTOR_UINT32_VALUE, "TEXT" },
@@ -78,6 +111,8 @@ static int sq3_table_create (Database* db, DbTable* table, int shallow);
 static int sq3_table_free (Database *database, DbTable* table);
 static char *sq3_prepared_var(Database *db, unsigned int order);
 static int sq3_insert(Database *db, DbTable *table, int sender_id, int seq_no, double time_stamp, OmlValue *values, int value_count);
+static int sq3_insert_row(Database *db, DbTable *table, int sender_id, int seq_no, double time_stamp, double time_stamp_server, OmlValue *values, int value_count, uint64_t now);
+static void* sq3_writer (void *handle);
 static char* sq3_get_key_value (Database* database, const char* table, const char* key_column, const char* value_column, const char* key);
 static int sq3_set_key_value (Database* database, const char* table, const char* key_column, const char* value_column, const char* key, const char* value);
 static char* sq3_get_metadata (Database* database, const char* key);
@@ -115,6 +150,29 @@ sq3_dbdir_setup (void)
   }
 }
 
+/** Check that a mode string is one of a list of valid values.
+ *
+ * The comparison is case-insensitive. This also ensures that only safe
+ * values are later used to build PRAGMA statements.
+ *
+ * \param mode string to check
+ * \param valid array of valid values
+ * \param n number of elements in valid
+ * \return 1 if mode is valid, 0 otherwise
+ * \see sq3_backend_setup
+ */
+static int
+sq3_valid_mode (const char *mode, const char **valid, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    if (!strcasecmp (mode, valid[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
 /** Setup the SQLite3 backend.
  *
  * \return 0 on success, -1 otherwise
@@ -150,7 +208,36 @@ sq3_backend_setup (void)
     return -1;
   }
 
+  if (sqlite_journal_mode &&
+      !sq3_valid_mode (sqlite_journal_mode, sq3_journal_modes, LENGTH(sq3_journal_modes))) {
+    logerror ("sqlite: Invalid journal mode '%s'\n", sqlite_journal_mode);
+    return -1;
+  }
+  if (sqlite_synchronous &&
+      !sq3_valid_mode (sqlite_synchronous, sq3_synchronous_modes, LENGTH(sq3_synchronous_modes))) {
+    logerror ("sqlite: Invalid synchronous flag '%s'\n", sqlite_synchronous);
+    return -1;
+  }
+  if (sqlite_commit_rows < 0 || sqlite_commit_bytes < 0 || sqlite_commit_interval < 0) {
+    logerror ("sqlite: Commit policy bounds cannot be negative\n");
+    return -1;
+  }
+  if (sqlite_writer_queue < 0) {
+    logerror ("sqlite: Writer queue length cannot be negative\n");
+    return -1;
+  }
+  if (sqlite_writer_queue > 0 && !sqlite3_threadsafe ()) {
+    logerror ("sqlite: SQLite library not built thread-safe, cannot use writer threads\n");
+    return -1;
+  }
+
   loginfo ("sqlite: Creating SQLite3 databases in %s\n", sqlite_database_dir);
+  logdebug ("sqlite: Committing every %d rows, %d B or %d ms (0: unbounded)\n",
+      sqlite_commit_rows, sqlite_commit_bytes, sqlite_commit_interval);
+  if (sqlite_writer_queue > 0) {
+    loginfo ("sqlite: Writing each database from its own thread, queueing up to %d rows\n",
+        sqlite_writer_queue);
+  }
 
   return 0;
 }
@@ -182,6 +269,10 @@ sq3_oml_to_type (OmlValueT type)
   int i = 0;
   int n = LENGTH(sq3_type_pair);
 
+  if (db_binary_vectors && omlc_is_vector_type (type)) {
+    return "BLOB"; /* \see vector_to_le */
+  }
+
   for (i = 0; i < n; i++) {
     if (sq3_type_pair[i].type == type) {
         return sq3_type_pair[i].name;
@@ -215,7 +306,126 @@ sql_stmt(Sq3DB* self, const char* stmt)
 static int
 sq3_stmt(Database* db, const char* stmt)
 {
- return sql_stmt((Sq3DB*)db->handle, stmt);
+  Sq3DB* self = (Sq3DB*)db->handle;
+  int ret;
+  pthread_mutex_lock (&self->conn_lock);
+  ret = sql_stmt(self, stmt);
+  pthread_mutex_unlock (&self->conn_lock);
+  return ret;
+}
+
+/** Apply the tuning PRAGMAs to a newly opened database connection.
+ *
+ * The page size is set first, as it cannot be changed anymore once the
+ * database is in WAL mode.
+ *
+ * \param self Sq3DB to set up
+ * \param name name of the database, for logging
+ * \return 0 on success, -1 otherwise
+ * \see sqlite_page_size, sqlite_journal_mode, sqlite_synchronous, sqlite_cache_size
+ */
+static int
+sq3_pragmas (Sq3DB *self, const char *name)
+{
+  MString *pragma = mstring_create ();
+  int ret = 0;
+
+  if (sqlite_page_size > 0) {
+    mstring_set (pragma, "");
+    mstring_sprintf (pragma, "PRAGMA page_size=%d;", sqlite_page_size);
+    ret |= sql_stmt (self, mstring_buf (pragma));
+  }
+  if (sqlite_journal_mode) {
+    mstring_set (pragma, "");
+    mstring_sprintf (pragma, "PRAGMA journal_mode=%s;", sqlite_journal_mode);
+    ret |= sql_stmt (self, mstring_buf (pragma));
+  }
+  if (sqlite_synchronous) {
+    mstring_set (pragma, "");
+    mstring_sprintf (pragma, "PRAGMA synchronous=%s;", sqlite_synchronous);
+    ret |= sql_stmt (self, mstring_buf (pragma));
+  }
+  if (sqlite_cache_size != 0) {
+    mstring_set (pragma, "");
+    mstring_sprintf (pragma, "PRAGMA cache_size=%d;", sqlite_cache_size);
+    ret |= sql_stmt (self, mstring_buf (pragma));
+  }
+  mstring_delete (pragma);
+
+  if (ret) {
+    logwarn ("sqlite:%s: Some PRAGMAs could not be applied\n", name);
+  }
+  return ret;
+}
+
+/** Get the current wall-clock time in milliseconds.
+ *
+ * \param tv current time, as returned by gettimeofday(2)
+ * \return the time [ms] since the Epoch
+ */
+static inline uint64_t
+sq3_ms (struct timeval *tv)
+{
+  return (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+/** Commit the current transaction if any bound of the commit policy has been reached.
+ *
+ * \param db Database to work with
+ * \param now current time [ms since the Epoch]
+ * \return 0 on success, -1 otherwise
+ * \see sqlite_commit_rows, sqlite_commit_bytes, sqlite_commit_interval
+ */
+static int
+sq3_commit_policy (Database *db, uint64_t now)
+{
+  Sq3DB* self = (Sq3DB*)db->handle;
+
+  if (self->pending_rows == 0) {
+    /* Nothing to commit, just restart the clock */
+    self->last_commit = now;
+    return 0;
+  }
+
+  if ((sqlite_commit_rows > 0 && self->pending_rows >= sqlite_commit_rows) ||
+      (sqlite_commit_bytes > 0 && self->pending_bytes >= (size_t)sqlite_commit_bytes) ||
+      (sqlite_commit_interval > 0 && now - self->last_commit >= (uint64_t)sqlite_commit_interval)) {
+    logdebug ("sqlite:%s: Committing %d rows (~%zuB) after %" PRIu64 "ms\n",
+        db->name, self->pending_rows, self->pending_bytes, now - self->last_commit);
+    if (dba_reopen_transaction (db) == -1) {
+      return -1;
+    }
+    self->last_commit = now;
+    self->pending_rows = 0;
+    self->pending_bytes = 0;
+  }
+  return 0;
+}
+
+/** Estimate the amount of data an OmlValue will take in the database.
+ *
+ * \param v OmlValue to consider
+ * \return an approximate size [B]
+ * \see sq3_commit_policy
+ */
+static size_t
+sq3_value_size (OmlValue *v)
+{
+  switch (oml_value_get_type (v)) {
+  case OML_STRING_VALUE:
+    return omlc_get_string_length (*oml_value_get_value (v));
+  case OML_BLOB_VALUE:
+    return omlc_get_blob_length (*oml_value_get_value (v));
+  case OML_VECTOR_DOUBLE_VALUE:
+  case OML_VECTOR_INT32_VALUE:
+  case OML_VECTOR_UINT32_VALUE:
+  case OML_VECTOR_INT64_VALUE:
+  case OML_VECTOR_UINT64_VALUE:
+  case OML_VECTOR_BOOL_VALUE:
+    return 8 * v->value.vectorValue.nof_elts;
+  default:
+    return 8;
+  }
 }
 
 /** Create an SQLite3 database and adapter structures
@@ -243,8 +453,16 @@ sq3_create_database(Database* db)
   }
 
   Sq3DB* self = oml_malloc(sizeof(Sq3DB));
+  pthread_mutexattr_t attr;
+  struct timeval tv;
+  gettimeofday (&tv, NULL);
   self->conn = conn;
-  self->last_commit = time (NULL);
+  self->last_commit = sq3_ms (&tv);
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init (&self->conn_lock, &attr);
+  pthread_mutexattr_destroy (&attr);
+  sq3_pragmas (self, db->name);
   db->backend_name = backend_name;
   db->o2t = sq3_oml_to_type;
   db->t2o = sq3_type_to_oml;
@@ -264,9 +482,79 @@ sq3_create_database(Database* db)
   db->handle = self;
 
   dba_begin_transaction (db);
+
+  if (sqlite_writer_queue > 0) {
+    self->queue_size = sqlite_writer_queue;
+    self->queue = oml_malloc (self->queue_size * sizeof (Sq3Row));
+    pthread_mutex_init (&self->queue_lock, NULL);
+    pthread_cond_init (&self->queue_nonempty, NULL);
+    pthread_cond_init (&self->queue_nonfull, NULL);
+    if (!self->queue || pthread_create (&self->writer, NULL, sq3_writer, db)) {
+      logwarn ("sqlite:%s: Could not start writer thread, inserting synchronously\n", db->name);
+      pthread_cond_destroy (&self->queue_nonfull);
+      pthread_cond_destroy (&self->queue_nonempty);
+      pthread_mutex_destroy (&self->queue_lock);
+      if (self->queue) { oml_free (self->queue); }
+      self->queue = NULL;
+    } else {
+      self->has_writer = 1;
+      db->queued_inserts = 1;
+    }
+  }
   return 0;
 }
 
+/** Wait for the writer thread to have inserted all queued rows.
+ *
+ * \param self Sq3DB to work with
+ * \see sq3_writer
+ */
+static void
+sq3_writer_drain (Sq3DB *self)
+{
+  if (!self->has_writer) {
+    return;
+  }
+  pthread_mutex_lock (&self->queue_lock);
+  while (self->queue_count > 0) {
+    pthread_cond_wait (&self->queue_nonfull, &self->queue_lock);
+  }
+  pthread_mutex_unlock (&self->queue_lock);
+}
+
+/** Stop the writer thread, after it has inserted all queued rows, and free the queue.
+ *
+ * \param self Sq3DB to work with
+ * \see sq3_writer
+ */
+static void
+sq3_writer_stop (Sq3DB *self)
+{
+  int i;
+
+  if (!self->has_writer) {
+    return;
+  }
+  pthread_mutex_lock (&self->queue_lock);
+  self->stop = 1;
+  pthread_cond_signal (&self->queue_nonempty);
+  pthread_mutex_unlock (&self->queue_lock);
+  pthread_join (self->writer, NULL);
+  self->has_writer = 0;
+
+  pthread_cond_destroy (&self->queue_nonfull);
+  pthread_cond_destroy (&self->queue_nonempty);
+  pthread_mutex_destroy (&self->queue_lock);
+  for (i = 0; i < self->queue_size; i++) {
+    if (self->queue[i].values) {
+      oml_value_array_reset (self->queue[i].values, self->queue[i].values_size);
+      oml_free (self->queue[i].values);
+    }
+  }
+  oml_free (self->queue);
+  self->queue = NULL;
+}
+
 /** Release the SQLite3 database.
  * \see db_adapter_release
  */
@@ -274,17 +562,67 @@ static void
 sq3_release(Database* db)
 {
   Sq3DB* self = (Sq3DB*)db->handle;
+  sq3_writer_stop (self);
   dba_end_transaction (db);
   sqlite3_close(self->conn);
+  pthread_mutex_destroy (&self->conn_lock);
   oml_free(self);
   db->handle = NULL;
 }
 
+/** Find out whether the vectors of a table are stored as BLOBs.
+ *
+ * Tables created before binary vectors were enabled, or after they were
+ * disabled, keep storing them as JSON, so this depends on the declared type
+ * of the columns rather than on db_binary_vectors.
+ *
+ * \param db Database containing the table
+ * \param table DbTable to check
+ * \return 1 if the vector columns are BLOBs, 0 otherwise
+ * \see db_binary_vectors, sq3_bind_vector
+ */
+static int
+sq3_has_binary_vectors (Database *db, DbTable *table)
+{
+  Sq3DB* sq3db = (Sq3DB*)db->handle;
+  struct schema *schema = table->schema;
+  sqlite3_stmt *stmt;
+  MString *select;
+  const char *decltype;
+  int i, j, ret = 0;
+
+  for (i = 0; i < schema->nfields && !omlc_is_vector_type (schema->fields[i].type); i++);
+  if (i == schema->nfields) {
+    return 0;
+  }
+
+  select = mstring_create ();
+  mstring_sprintf (select, "SELECT * FROM \"%s\" LIMIT 0;", schema->name);
+  if (sqlite3_prepare_v2 (sq3db->conn, mstring_buf (select), -1, &stmt, 0) == SQLITE_OK) {
+    for (j = 0; j < sqlite3_column_count (stmt); j++) {
+      if (!strcmp (sqlite3_column_name (stmt, j), schema->fields[i].name)) {
+        decltype = sqlite3_column_decltype (stmt, j);
+        ret = decltype && !strcmp (decltype, "BLOB");
+        break;
+      }
+    }
+    sqlite3_finalize (stmt);
+  }
+  mstring_delete (select);
+
+  logdebug ("sqlite:%s: Storing vectors of table '%s' as %s\n", db->name,
+      schema->name, ret ? "BLOBs" : "JSON");
+  return ret;
+}
+
 /** Create the adapter structures required for the SQLite3 adapter
- * \see db_adapter_table_create
+ *
+ * The caller must hold the connection lock.
+ *
+ * \see sq3_table_create, db_adapter_table_create
  */
 static int
-sq3_table_create (Database* db, DbTable* table, int shallow)
+sq3_table_create_locked (Database* db, DbTable* table, int shallow)
 {
   MString *insert = NULL;
   Sq3DB* sq3db = NULL;
@@ -318,6 +656,11 @@ sq3_table_create (Database* db, DbTable* table, int shallow)
         table->schema->name);
   }
   sq3table = (Sq3Table*)oml_malloc(sizeof(Sq3Table));
+  if (!sq3table) {
+    logerror("sqlite:%s: Could not allocate memory for table '%s'\n",
+        db->name, table->schema->name);
+    goto fail_exit;
+  }
   table->handle = sq3table;
 
   /* XXX: Should not be done here, see #1056 */
@@ -334,34 +677,75 @@ sq3_table_create (Database* db, DbTable* table, int shallow)
         db->name, mstring_buf(insert), sqlite3_errmsg(sq3db->conn));
     goto fail_exit;
   }
+  sq3table->binary_vectors = sq3_has_binary_vectors (db, table);
+  sq3table->json = oml_malloc (table->schema->nfields * sizeof (char*));
+  if (!sq3table->json) {
+    logerror("sqlite:%s: Could not allocate vector buffers for table '%s'\n",
+        db->name, table->schema->name);
+    goto fail_exit;
+  }
 
   if (insert) { mstring_delete (insert); }
   return 0;
 
  fail_exit:
   if (insert) { mstring_delete (insert); }
-  if (sq3table) { oml_free (sq3table); }
+  if (sq3table) {
+    sqlite3_finalize (sq3table->insert_stmt);
+    oml_free (sq3table);
+    table->handle = NULL;
+  }
   return -1;
 }
 
+/** Create the adapter structures for a table, holding the connection lock
+ * \see sq3_table_create_locked, db_adapter_table_create
+ */
+static int
+sq3_table_create (Database* db, DbTable* table, int shallow)
+{
+  Sq3DB* self;
+  int ret;
+  if (db == NULL || db->handle == NULL) {
+    return sq3_table_create_locked (db, table, shallow);
+  }
+  self = (Sq3DB*)db->handle;
+  pthread_mutex_lock (&self->conn_lock);
+  ret = sq3_table_create_locked (db, table, shallow);
+  pthread_mutex_unlock (&self->conn_lock);
+  return ret;
+}
+
 /** Free an SQLite3 table
  *
- * Parameter database is ignored in this implementation
+ * Rows still queued for the writer thread are inserted first, and the
+ * table is then indexed, if not done yet.
  *
- * \see db_adapter_table_free, sqlite3_finalize
+ * \see db_adapter_table_free, dba_table_create_indexes, sqlite3_finalize
  */
 static int
 sq3_table_free (Database *database, DbTable* table)
 {
-  (void)database;
+  Sq3DB* self = (Sq3DB*)database->handle;
   Sq3Table* sq3table = (Sq3Table*)table->handle;
   int ret = 0;
   if (sq3table) {
+    sq3_writer_drain (self);
+    dba_table_create_indexes (database, table);
+    pthread_mutex_lock (&self->conn_lock);
     ret = sqlite3_finalize (sq3table->insert_stmt);
+    pthread_mutex_unlock (&self->conn_lock);
     if (ret != SQLITE_OK) {
       logwarn("sqlite:%s: Couldn't finalise statement for table '%s' (database error)\n",
           database->name, table->schema->name);
     }
+    if (sq3table->json) {
+      int i;
+      for (i = 0; i < table->schema->nfields; i++) {
+        oml_free (sq3table->json[i]);
+      }
+      oml_free (sq3table->json);
+    }
     oml_free (sq3table);
   }
   return ret;
@@ -388,29 +772,274 @@ sq3_prepared_var(Database *db, unsigned int order)
   return s;
 }
 
+/** Copy a value into a queued row, reusing the storage of the previous one.
+ *
+ * Empty strings, blobs or vectors may have no storage at all, which
+ * oml_value_duplicate() refuses; they are simply cleared in the copy.
+ *
+ * \param dst OmlValue of the queued row
+ * \param src OmlValue to copy
+ * \return 0 on success, -1 otherwise
+ * \see oml_value_duplicate, oml_value_clear
+ */
+static int
+sq3_row_set_value (OmlValue *dst, OmlValue *src)
+{
+  OmlValueU *u = oml_value_get_value (src);
+  int empty = 0;
+
+  switch (oml_value_get_type (src)) {
+  case OML_STRING_VALUE:
+    empty = !omlc_get_string_ptr (*u);
+    break;
+  case OML_BLOB_VALUE:
+    empty = !omlc_get_blob_ptr (*u);
+    break;
+  case OML_VECTOR_DOUBLE_VALUE:
+  case OML_VECTOR_INT32_VALUE:
+  case OML_VECTOR_UINT32_VALUE:
+  case OML_VECTOR_INT64_VALUE:
+  case OML_VECTOR_UINT64_VALUE:
+  case OML_VECTOR_BOOL_VALUE:
+    empty = !omlc_get_vector_ptr (*u);
+    break;
+  default:
+    break;
+  }
+
+  if (empty) {
+    oml_value_set_type (dst, oml_value_get_type (src));
+    return oml_value_clear (dst);
+  }
+  return oml_value_duplicate (dst, src);
+}
+
+/** Queue a row for the writer thread.
+ *
+ * The values are copied, so the caller can reuse them as soon as this
+ * returns. This blocks while the queue is full.
+ *
+ * \param db Database to insert into
+ * \param table DbTable to insert into
+ * \param sender_id, seq_no, time_stamp, time_stamp_server metadata of the row
+ * \param values OmlValues to insert
+ * \param value_count number of values
+ * \return 0 on success, -1 otherwise
+ * \see sq3_writer, sq3_insert
+ */
+static int
+sq3_enqueue (Database *db, DbTable *table, int sender_id, int seq_no,
+    double time_stamp, double time_stamp_server, OmlValue *values, int value_count)
+{
+  Sq3DB* self = (Sq3DB*)db->handle;
+  Sq3Row *row;
+  OmlValue *v;
+  int i, ret = 0;
+
+  pthread_mutex_lock (&self->queue_lock);
+  while (self->queue_count == self->queue_size) {
+    pthread_cond_wait (&self->queue_nonfull, &self->queue_lock);
+  }
+  /* The slot after the last queued row is not used by the writer thread */
+  row = &self->queue[(self->queue_head + self->queue_count) % self->queue_size];
+
+  if (row->values_size < value_count) {
+    v = oml_realloc (row->values, value_count * sizeof (OmlValue));
+    if (!v) {
+      logerror ("sqlite:%s: Could not allocate memory to queue row %d for table '%s'\n",
+          db->name, seq_no, table->schema->name);
+      pthread_mutex_unlock (&self->queue_lock);
+      return -1;
+    }
+    oml_value_array_init (v + row->values_size, value_count - row->values_size);
+    row->values = v;
+    row->values_size = value_count;
+  }
+  for (i = 0; i < value_count && ret == 0; i++) {
+    ret = sq3_row_set_value (&row->values[i], &values[i]);
+  }
+  if (ret) {
+    logerror ("sqlite:%s: Could not copy row %d for table '%s'\n",
+        db->name, seq_no, table->schema->name);
+  } else {
+    row->table = table;
+    row->sender_id = sender_id;
+    row->seq_no = seq_no;
+    row->time_stamp = time_stamp;
+    row->time_stamp_server = time_stamp_server;
+    row->value_count = value_count;
+    self->queue_count++;
+    pthread_cond_signal (&self->queue_nonempty);
+  }
+  pthread_mutex_unlock (&self->queue_lock);
+
+  return ret;
+}
+
+/** Writer thread of an SQLite3 database.
+ *
+ * Rows queued by sq3_insert() are inserted in batches, under the connection
+ * lock, so clients of different databases are written to in parallel. As no
+ * new row may come to trigger it, the commit interval is also enforced here.
+ *
+ * \param handle Database to write to
+ * \return NULL
+ * \see sqlite_writer_queue, sq3_enqueue, sq3_commit_policy
+ */
+static void*
+sq3_writer (void *handle)
+{
+  Database *db = (Database*)handle;
+  Sq3DB *self = (Sq3DB*)db->handle;
+  struct timeval tv;
+  struct timespec deadline;
+  uint64_t due;
+  Sq3Row *row;
+  int head, n, i;
+
+  pthread_mutex_lock (&self->queue_lock);
+  while (1) {
+    while (self->queue_count == 0 && !self->stop) {
+      /* The transaction state belongs to the connection */
+      pthread_mutex_unlock (&self->queue_lock);
+      pthread_mutex_lock (&self->conn_lock);
+      due = self->pending_rows > 0 ? self->last_commit + sqlite_commit_interval : 0;
+      pthread_mutex_unlock (&self->conn_lock);
+      pthread_mutex_lock (&self->queue_lock);
+      if (self->queue_count > 0 || self->stop) {
+        break;
+      }
+
+      if (due > 0 && sqlite_commit_interval > 0) {
+        deadline.tv_sec = due / 1000;
+        deadline.tv_nsec = (due % 1000) * 1000000;
+        if (pthread_cond_timedwait (&self->queue_nonempty, &self->queue_lock, &deadline) == ETIMEDOUT) {
+          pthread_mutex_unlock (&self->queue_lock);
+          gettimeofday (&tv, NULL);
+          pthread_mutex_lock (&self->conn_lock);
+          sq3_commit_policy (db, sq3_ms (&tv));
+          pthread_mutex_unlock (&self->conn_lock);
+          pthread_mutex_lock (&self->queue_lock);
+        }
+      } else {
+        pthread_cond_wait (&self->queue_nonempty, &self->queue_lock);
+      }
+    }
+    if (self->queue_count == 0) {
+      break; /* Stopping, and nothing left to write */
+    }
+    head = self->queue_head;
+    n = self->queue_count;
+    pthread_mutex_unlock (&self->queue_lock);
+
+    pthread_mutex_lock (&self->conn_lock);
+    for (i = 0; i < n; i++) {
+      row = &self->queue[(head + i) % self->queue_size];
+      gettimeofday (&tv, NULL);
+      /* Errors are reported by sq3_insert_row, and the row dropped */
+      sq3_insert_row (db, row->table, row->sender_id, row->seq_no,
+          row->time_stamp, row->time_stamp_server, row->values, row->value_count,
+          sq3_ms (&tv));
+    }
+    pthread_mutex_unlock (&self->conn_lock);
+
+    pthread_mutex_lock (&self->queue_lock);
+    self->queue_head = (head + n) % self->queue_size;
+    self->queue_count -= n;
+    pthread_cond_broadcast (&self->queue_nonfull);
+  }
+  pthread_mutex_unlock (&self->queue_lock);
+
+  logdebug ("sqlite:%s: Writer thread done\n", db->name);
+  return NULL;
+}
+
+/** Bind a vector to an insertion statement as a packed little-endian BLOB.
+ *
+ * On little-endian hosts, the elements of the vector are bound in place, as
+ * its OmlValue outlives the execution of the statement; otherwise, SQLite
+ * copies their converted version.
+ *
+ * \param stmt statement to bind the vector to
+ * \param idx index of the parameter
+ * \param v OmlValue containing the vector
+ * \return the result of sqlite3_bind_blob()
+ * \see vector_to_le, sq3_has_binary_vectors
+ */
+static int
+sq3_bind_vector (sqlite3_stmt *stmt, int idx, OmlValue *v)
+{
+  void *scratch = NULL;
+  size_t len;
+  const void *data = vector_to_le (oml_value_get_value (v), oml_value_get_type (v), &len, &scratch);
+  int res;
+
+  if (!data) {
+    return SQLITE_ERROR;
+  }
+  res = sqlite3_bind_blob (stmt, idx, data, len, scratch ? SQLITE_TRANSIENT : SQLITE_STATIC);
+  if (scratch) { oml_free (scratch); }
+  return res;
+}
+
 /** Insert value in the SQLite3 database.
- * \see db_adapter_insert
- * XXX: This function actively does text protocol interpretation, see #1088
+ *
+ * If the database has a writer thread, the row is only queued for it;
+ * otherwise, it is inserted right away.
+ *
+ * \see db_adapter_insert, sq3_enqueue, sq3_insert_row
  */
 static int
 sq3_insert(Database *db, DbTable *table, int sender_id, int seq_no, double time_stamp, OmlValue *values, int value_count)
 {
   Sq3DB* sq3db = (Sq3DB*)db->handle;
-  Sq3Table* sq3table = (Sq3Table*)table->handle;
-  int i;
   double time_stamp_server;
-  sqlite3_stmt* stmt = sq3table->insert_stmt;
-  char *json = NULL;
-  ssize_t json_sz;
   struct timeval tv;
+  int ret;
   gettimeofday(&tv, NULL);
   time_stamp_server = tv.tv_sec - db->start_time + 0.000001 * tv.tv_usec;
 
-  if (tv.tv_sec > sq3db->last_commit) {
-    if (dba_reopen_transaction (db) == -1) {
-      return -1;
-    }
-    sq3db->last_commit = tv.tv_sec;
+  if (sq3db->has_writer) {
+    return sq3_enqueue (db, table, sender_id, seq_no, time_stamp, time_stamp_server,
+        values, value_count);
+  }
+
+  pthread_mutex_lock (&sq3db->conn_lock);
+  ret = sq3_insert_row (db, table, sender_id, seq_no, time_stamp, time_stamp_server,
+      values, value_count, sq3_ms (&tv));
+  pthread_mutex_unlock (&sq3db->conn_lock);
+  return ret;
+}
+
+/** Bind and insert one row in the SQLite3 database, committing the current
+ * transaction as required.
+ *
+ * The caller must hold the connection lock.
+ *
+ * \param db Database to insert into
+ * \param table DbTable to insert into
+ * \param sender_id, seq_no, time_stamp, time_stamp_server metadata of the row
+ * \param values OmlValues to insert
+ * \param value_count number of values
+ * \param now current time [ms since the Epoch]
+ * \return 0 on success, -1 otherwise
+ * \see sq3_insert, sq3_commit_policy
+ * XXX: This function actively does text protocol interpretation, see #1088
+ */
+static int
+sq3_insert_row(Database *db, DbTable *table, int sender_id, int seq_no, double time_stamp,
+    double time_stamp_server, OmlValue *values, int value_count, uint64_t now)
+{
+  Sq3DB* sq3db = (Sq3DB*)db->handle;
+  Sq3Table* sq3table = (Sq3Table*)table->handle;
+  int i;
+  sqlite3_stmt* stmt = sq3table->insert_stmt;
+  ssize_t json_sz;
+
+  size_t row_bytes = 4 * 8; /* Metadata columns */
+
+  if (sq3_commit_policy (db, now) == -1) {
+    return -1;
   }
 
   //  o_log(O_LOG_DEBUG2, "sq3_insert(%s): insert row %d \n",
@@ -507,51 +1136,71 @@ sq3_insert(Database *db, DbTable *table, int sender_id, int seq_no, double time_
       res = sqlite3_bind_int(stmt, idx, (int)omlc_get_bool(*oml_value_get_value(v)));
       break;
 
+      /* The JSON buffers of the table are not touched until the statement
+       * is bound again, so SQLite does not need to copy them */
     case OML_VECTOR_DOUBLE_VALUE:
-      json = NULL;
-      json_sz = vector_double_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &json);
+      if (sq3table->binary_vectors) {
+        res = sq3_bind_vector (stmt, idx, v);
+        break;
+      }
+      json_sz = vector_double_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &sq3table->json[i]);
       if(-1 != json_sz)
-        res = sqlite3_bind_text(stmt, idx, json, json_sz, oml_free);
+        res = sqlite3_bind_text(stmt, idx, sq3table->json[i], json_sz, SQLITE_STATIC);
       else
         res = sqlite3_bind_null(stmt, idx);
       break;
     case OML_VECTOR_INT32_VALUE:
-      json = NULL;
-      json_sz = vector_int32_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &json);
+      if (sq3table->binary_vectors) {
+        res = sq3_bind_vector (stmt, idx, v);
+        break;
+      }
+      json_sz = vector_int32_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &sq3table->json[i]);
       if(-1 != json_sz)
-        res = sqlite3_bind_text(stmt, idx, json, json_sz, oml_free);
+        res = sqlite3_bind_text(stmt, idx, sq3table->json[i], json_sz, SQLITE_STATIC);
       else
         res = sqlite3_bind_null(stmt, idx);
       break;
     case OML_VECTOR_UINT32_VALUE:
-      json = NULL;
-      json_sz = vector_uint32_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &json);
+      if (sq3table->binary_vectors) {
+        res = sq3_bind_vector (stmt, idx, v);
+        break;
+      }
+      json_sz = vector_uint32_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &sq3table->json[i]);
       if(-1 != json_sz)
-        res = sqlite3_bind_text(stmt, idx, json, json_sz, oml_free);
+        res = sqlite3_bind_text(stmt, idx, sq3table->json[i], json_sz, SQLITE_STATIC);
       else
         res = sqlite3_bind_null(stmt, idx);
       break;
     case OML_VECTOR_INT64_VALUE:
-      json = NULL;
-      json_sz = vector_int64_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &json);
+      if (sq3table->binary_vectors) {
+        res = sq3_bind_vector (stmt, idx, v);
+        break;
+      }
+      json_sz = vector_int64_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &sq3table->json[i]);
       if(-1 != json_sz)
-        res = sqlite3_bind_text(stmt, idx, json, json_sz, oml_free);
+        res = sqlite3_bind_text(stmt, idx, sq3table->json[i], json_sz, SQLITE_STATIC);
       else
         res = sqlite3_bind_null(stmt, idx);
       break;
     case OML_VECTOR_UINT64_VALUE:
-      json = NULL;
-      json_sz = vector_uint64_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &json);
+      if (sq3table->binary_vectors) {
+        res = sq3_bind_vector (stmt, idx, v);
+        break;
+      }
+      json_sz = vector_uint64_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &sq3table->json[i]);
       if(-1 != json_sz)
-        res = sqlite3_bind_text(stmt, idx, json, json_sz, oml_free);
+        res = sqlite3_bind_text(stmt, idx, sq3table->json[i], json_sz, SQLITE_STATIC);
       else
         res = sqlite3_bind_null(stmt, idx);
       break;
     case OML_VECTOR_BOOL_VALUE:
-      json = NULL;
-      json_sz = vector_bool_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &json);
+      if (sq3table->binary_vectors) {
+        res = sq3_bind_vector (stmt, idx, v);
+        break;
+      }
+      json_sz = vector_bool_to_json(v->value.vectorValue.ptr, v->value.vectorValue.nof_elts, &sq3table->json[i]);
       if(-1 != json_sz)
-        res = sqlite3_bind_text(stmt, idx, json, json_sz, oml_free);
+        res = sqlite3_bind_text(stmt, idx, sq3table->json[i], json_sz, SQLITE_STATIC);
       else
         res = sqlite3_bind_null(stmt, idx);
       break;
@@ -567,6 +1216,7 @@ sq3_insert(Database *db, DbTable *table, int sender_id, int seq_no, double time_
       sqlite3_reset (stmt);
       return -1;
     }
+    row_bytes += sq3_value_size (v);
   }
 
   if (sqlite3_step(stmt) != SQLITE_DONE) {
@@ -575,7 +1225,17 @@ sq3_insert(Database *db, DbTable *table, int sender_id, int seq_no, double time_
     sqlite3_reset(stmt);
     return -1;
   }
-  return sqlite3_reset(stmt);
+  sq3db->pending_rows++;
+  sq3db->pending_bytes += row_bytes;
+  sqlite3_reset(stmt);
+  dba_table_row_inserted (db, table);
+
+  /* Check the size bounds right away, rather than waiting for the next row */
+  if ((sqlite_commit_rows > 0 && sq3db->pending_rows >= sqlite_commit_rows) ||
+      (sqlite_commit_bytes > 0 && sq3db->pending_bytes >= (size_t)sqlite_commit_bytes)) {
+    return sq3_commit_policy (db, now);
+  }
+  return 0;
 }
 
 /** Do a key-value style select on a database table.
@@ -629,8 +1289,10 @@ sq3_get_key_value (Database* database, const char* table, const char* key_column
   int nrows;
   int ncols;
 
+  pthread_mutex_lock (&sq3db->conn_lock);
   int ret = sqlite3_get_table (sq3db->conn, mstring_buf(stmt), &result,
                                &nrows, &ncols, &errmsg);
+  pthread_mutex_unlock (&sq3db->conn_lock);
 
   if (ret != SQLITE_OK) {
     logerror("sqlite:%s: Error in SELECT statement '%s': %s\n", database->name, mstring_buf (stmt), errmsg);
@@ -677,7 +1339,6 @@ sq3_set_key_value (Database* database, const char* table,
                    const char* key_column, const char* value_column,
                    const char* key, const char* value)
 {
-  Sq3DB* sq3db = (Sq3DB*) database->handle;
   char stmt[512];
   size_t n;
   char* check_value = sq3_get_key_value (database, table, key_column, value_column, key);
@@ -703,7 +1364,7 @@ sq3_set_key_value (Database* database, const char* table,
     return -1;
   }
 
-  if (sql_stmt (sq3db, stmt)) {
+  if (sq3_stmt (database, stmt)) {
     logwarn("sqlite:%s: Key-value update failed for %s='%s' in %s(%s, %s) (database error)\n",
             database->name, key, value, table, key_column, value_column);
     return -1;
@@ -780,10 +1441,13 @@ sq3_get_uri(Database *db, char *uri, size_t size)
 }
 
 /** Get a list of tables in an SQLite3 database
- * \see db_adapter_get_table_list
+ *
+ * The caller must hold the connection lock.
+ *
+ * \see sq3_get_table_list, db_adapter_get_table_list
  */
 static TableDescr*
-sq3_get_table_list (Database *database, int *num_tables)
+sq3_get_table_list_locked (Database *database, int *num_tables)
 {
   Sq3DB *self = database->handle;
   TableDescr *tables = NULL, *t = NULL;
@@ -922,6 +1586,20 @@ fail_exit:
   return NULL;
 }
 
+/** Get a list of tables in an SQLite3 database, holding the connection lock
+ * \see sq3_get_table_list_locked, db_adapter_get_table_list
+ */
+static TableDescr*
+sq3_get_table_list (Database *database, int *num_tables)
+{
+  Sq3DB *self = database->handle;
+  TableDescr *tables;
+  pthread_mutex_lock (&self->conn_lock);
+  tables = sq3_get_table_list_locked (database, num_tables);
+  pthread_mutex_unlock (&self->conn_lock);
+  return tables;
+}
+
 /** Get the sender_id for a given name in the _senders table.
  *
  * \param name name of the sender
@@ -992,7 +1670,9 @@ sq3_get_max_value (Database* database, const char* table, const char* column_nam
       return -1;
     }
 
+  pthread_mutex_lock (&sq3db->conn_lock);
   int ret = sqlite3_get_table (sq3db->conn, stmt, &result, &nrows, &ncols, &errmsg);
+  pthread_mutex_unlock (&sq3db->conn_lock);
 
   if (ret != SQLITE_OK)
     {
@@ -10,19 +10,73 @@
 #ifndef SQLITE_ADAPTER_H_
 #define SQLITE_ADAPTER_H_
 
+#include <pthread.h>
 #include <sqlite3.h>
 #include "database.h"
 
+/** Default maximum time between commits [ms] \see sqlite_commit_interval */
+#define DEFAULT_SQ3_COMMIT_INTERVAL 1000
+
+/** A row waiting in the queue of a writer thread \see sq3_writer */
+typedef struct Sq3Row {
+  DbTable*  table;
+  int       sender_id;
+  int       seq_no;
+  double    time_stamp;
+  double    time_stamp_server;
+  /** Copy of the values; the storage is reused from one row to the next */
+  OmlValue* values;
+  int       value_count;
+  /** Number of initialised elements in values */
+  int       values_size;
+} Sq3Row;
+
 typedef struct Sq3DB {
   sqlite3*  conn;
   int       sender_cnt;
-  time_t    last_commit;
+  /** Time the current transaction was started [ms since the Epoch] */
+  uint64_t  last_commit;
+  /** Number of rows inserted in the current transaction */
+  int       pending_rows;
+  /** Approximate amount of data inserted in the current transaction [B] */
+  size_t    pending_bytes;
+
+  /** Serialises the use of conn between the event loops and the writer thread */
+  pthread_mutex_t conn_lock;
+
+  /* Writer thread and its queue, if sqlite_writer_queue > 0 \see sq3_writer */
+  int       has_writer;
+  pthread_t writer;
+  /** Protects the queue indices and the stop flag */
+  pthread_mutex_t queue_lock;
+  /** Signalled when rows are queued, or the writer should stop */
+  pthread_cond_t  queue_nonempty;
+  /** Signalled when rows have been written */
+  pthread_cond_t  queue_nonfull;
+  Sq3Row*   queue;
+  /** Number of slots in queue */
+  int       queue_size;
+  int       queue_head;
+  int       queue_count;
+  int       stop;
 } Sq3DB;
 
 typedef struct Sq3Table {
   sqlite3_stmt* insert_stmt;  // prepared insert statement
+  int binary_vectors;         // whether vectors are stored as BLOBs rather than JSON
+  char** json;                // per-field buffers for the JSON representation of vectors, reused across rows
 } Sq3Table;
 
+extern int sqlite_commit_rows;
+extern int sqlite_commit_bytes;
+extern int sqlite_commit_interval;
+extern char *sqlite_journal_mode;
+extern char *sqlite_synchronous;
+extern int sqlite_page_size;
+extern int sqlite_cache_size;
+extern int sqlite_writer_queue;
+
+void sq3_dbdir_setup (void);
 int sq3_backend_setup (void);
 int sq3_create_database (Database* db);
 
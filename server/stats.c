@@ -0,0 +1,350 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file stats.c
+ * \brief Measure the ingest throughput and latency of the server.
+ *
+ * Each ClientHandler and DbTable has an IngestStats, updated with cheap
+ * counters as data is received, decoded and stored. Once the domain of their
+ * owner is known, they are registered in a global list, which is
+ * periodically reported through the server's own measurement points (see
+ * stats_report and oml2-server.rb), and logged on SIGUSR1 (see stats_dump).
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "stats.h"
+#ifndef NOOML
+#include "monitoring_server.h"
+#endif
+
+static IngestStats *first_stats = NULL;
+/** Lock protecting the list of registered statistics */
+static pthread_mutex_t first_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Create a new, unregistered, set of ingest counters.
+ *
+ * \param kind what the counters are about
+ * \return an oml_malloc'd IngestStats, to be freed with stats_free, or NULL on error
+ * \see stats_register, stats_free
+ */
+IngestStats*
+stats_new (enum StatsKind kind)
+{
+  IngestStats *stats = oml_malloc (sizeof (IngestStats));
+  if (stats) {
+    memset (stats, 0, sizeof (IngestStats));
+    stats->kind = kind;
+  }
+  return stats;
+}
+
+/** Remove a set of counters from the list of reported statistics.
+ *
+ * The caller must hold first_stats_lock.
+ *
+ * \param stats IngestStats to remove
+ */
+static void
+stats_unlink (IngestStats *stats)
+{
+  IngestStats **it = &first_stats;
+
+  while (*it && *it != stats) {
+    it = &(*it)->next;
+  }
+  if (*it) {
+    *it = stats->next;
+  }
+  stats->registered = 0;
+}
+
+/** Label a set of ingest counters, and add it to the reported statistics.
+ *
+ * Counters can be registered again, e.g., when a client redefines its
+ * domain, in which case their labels are updated.
+ *
+ * \param stats IngestStats to register
+ * \param domain experimental domain of their owner
+ * \param name sender ID of a client, or name of a table
+ * \param app application name of a client, or NULL
+ * \return 0 on success, -1 on error
+ */
+int
+stats_register (IngestStats *stats, const char *domain, const char *name, const char *app)
+{
+  char *d, *n, *a = NULL;
+
+  if (!stats || !domain || !name) {
+    return -1;
+  }
+  d = oml_strndup (domain, strlen (domain));
+  n = oml_strndup (name, strlen (name));
+  if (app) {
+    a = oml_strndup (app, strlen (app));
+  }
+  if (!d || !n || (app && !a)) {
+    logwarn ("%s: Could not allocate memory for the statistics of '%s'\n", domain, name);
+    if (d) oml_free (d);
+    if (n) oml_free (n);
+    if (a) oml_free (a);
+    return -1;
+  }
+
+  pthread_mutex_lock (&first_stats_lock);
+  if (stats->domain) oml_free (stats->domain);
+  if (stats->name) oml_free (stats->name);
+  if (stats->app) oml_free (stats->app);
+  stats->domain = d;
+  stats->name = n;
+  stats->app = a;
+  if (!stats->registered) {
+    stats->next = first_stats;
+    first_stats = stats;
+    stats->registered = 1;
+  }
+  pthread_mutex_unlock (&first_stats_lock);
+
+  return 0;
+}
+
+/** Unregister and free a set of ingest counters.
+ *
+ * \param stats IngestStats to free (can be NULL)
+ * \see stats_new
+ */
+void
+stats_free (IngestStats *stats)
+{
+  if (!stats) {
+    return;
+  }
+  if (stats->registered) {
+    pthread_mutex_lock (&first_stats_lock);
+    stats_unlink (stats);
+    pthread_mutex_unlock (&first_stats_lock);
+  }
+  if (stats->domain) oml_free (stats->domain);
+  if (stats->name) oml_free (stats->name);
+  if (stats->app) oml_free (stats->app);
+  oml_free (stats);
+}
+
+/** Get the current time for the timing of ingest operations.
+ *
+ * \return a monotonic time [ns]
+ */
+uint64_t
+stats_now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Account for the storage of a sample.
+ *
+ * \param stats IngestStats to update, or NULL
+ * \param ns time spent storing the sample [ns]
+ * \param ok whether the sample was actually stored
+ */
+void
+stats_add_insert (IngestStats *stats, uint64_t ns, int ok)
+{
+  int bucket = 0;
+  uint64_t us = ns / 1000;
+
+  if (!stats) {
+    return;
+  }
+  while (us && bucket < STATS_HIST_BUCKETS - 1) {
+    us >>= 1;
+    bucket++;
+  }
+  stats_atomic_add (stats->insert_hist[bucket], 1);
+  stats_atomic_add (stats->insert_ns, ns);
+  if (ok) {
+    stats_atomic_add (stats->rows, 1);
+  }
+}
+
+/** Copy the counters of a set of statistics, as they are being updated.
+ *
+ * Each counter is read atomically, but not all of them together, so they may
+ * be a few rows apart.  The last_* fields, only used by the reporter, are
+ * copied as they are.
+ *
+ * \param stats IngestStats to read
+ * \param[out] copy IngestStats to copy the labels and counters into
+ * \see stats_atomic_get
+ */
+static void
+stats_read (IngestStats *stats, IngestStats *copy)
+{
+  int i;
+
+  /* The counters are being updated, so the struct cannot be copied at once */
+  copy->kind = stats->kind;
+  copy->domain = stats->domain;
+  copy->name = stats->name;
+  copy->app = stats->app;
+  copy->last_bytes = stats->last_bytes;
+  copy->last_rows = stats->last_rows;
+  copy->last_decode_ns = stats->last_decode_ns;
+  copy->last_insert_ns = stats->last_insert_ns;
+  memcpy (copy->last_hist, stats->last_hist, sizeof (copy->last_hist));
+  copy->bytes = stats_atomic_get (stats->bytes);
+  copy->rows = stats_atomic_get (stats->rows);
+  copy->decode_ns = stats_atomic_get (stats->decode_ns);
+  copy->insert_ns = stats_atomic_get (stats->insert_ns);
+  copy->pending = stats_atomic_get (stats->pending);
+  for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+    copy->insert_hist[i] = stats_atomic_get (stats->insert_hist[i]);
+  }
+}
+
+/** Estimate a quantile of the insertion times from a histogram.
+ *
+ * The estimate is the upper bound of the bucket containing the quantile, and
+ * is therefore within a factor of two of the actual value.
+ *
+ * \param hist histogram of the insertion times
+ * \param last earlier state of hist to subtract, or NULL
+ * \param q quantile to estimate, in [0;1]
+ * \return the estimated quantile [us], or 0 if the histogram is empty
+ */
+double
+stats_quantile (const uint32_t *hist, const uint32_t *last, double q)
+{
+  uint64_t total = 0, count = 0, rank;
+  int i;
+
+  for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+    total += hist[i] - (last ? last[i] : 0);
+  }
+  if (!total) {
+    return 0.;
+  }
+  rank = (uint64_t)(q * total);
+  if (rank >= total) {
+    rank = total - 1;
+  }
+  for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+    count += hist[i] - (last ? last[i] : 0);
+    if (count > rank) {
+      break;
+    }
+  }
+  return (double)((uint64_t)1 << i);
+}
+
+/** Report the ingest statistics accumulated since the previous report.
+ *
+ * Statistics which did not change are not reported, so idle clients do not
+ * add to the load. This is meant to be called periodically from the main
+ * EventLoop.
+ *
+ * \param interval time since the previous report [s]
+ * \see stats_client_inject, stats_table_inject
+ */
+void
+stats_report (int interval)
+{
+  IngestStats *it, copy, *s = &copy;
+  uint64_t bytes, rows, decode_ns, insert_ns;
+  double p50, p99;
+
+  if (interval <= 0) {
+    interval = 1;
+  }
+
+  pthread_mutex_lock (&first_stats_lock);
+  for (it = first_stats; it; it = it->next) {
+    stats_read (it, s);
+    bytes = s->bytes - s->last_bytes;
+    rows = s->rows - s->last_rows;
+    decode_ns = s->decode_ns - s->last_decode_ns;
+    insert_ns = s->insert_ns - s->last_insert_ns;
+    if (!bytes && !rows && !insert_ns) {
+      continue;
+    }
+    p50 = stats_quantile (s->insert_hist, s->last_hist, .5);
+    p99 = stats_quantile (s->insert_hist, s->last_hist, .99);
+
+#ifndef NOOML
+    if (s->kind == STATS_CLIENT) {
+      stats_client_inject (s->domain, s->name, s->app ? s->app : "", s->bytes, s->rows,
+          (double)bytes / interval, (double)rows / interval,
+          rows ? decode_ns / 1000. / rows : 0., rows ? insert_ns / 1000. / rows : 0.,
+          p50, p99, s->pending);
+    } else {
+      stats_table_inject (s->domain, s->name, s->rows, (double)rows / interval,
+          rows ? insert_ns / 1000. / rows : 0., p50, p99);
+    }
+#else
+    (void)p50;
+    (void)p99;
+    (void)decode_ns;
+#endif
+
+    it->last_bytes += bytes;
+    it->last_rows += rows;
+    it->last_decode_ns += decode_ns;
+    it->last_insert_ns += insert_ns;
+    memcpy (it->last_hist, s->insert_hist, sizeof (it->last_hist));
+  }
+  pthread_mutex_unlock (&first_stats_lock);
+}
+
+/** Log the ingest statistics accumulated since their owners were created.
+ *
+ * This is called from the main EventLoop on SIGUSR1.
+ *
+ * \param level log level to use
+ */
+void
+stats_dump (int level)
+{
+  IngestStats *it, copy, *s = &copy;
+
+  pthread_mutex_lock (&first_stats_lock);
+  for (it = first_stats; it; it = it->next) {
+    stats_read (it, s);
+    if (s->kind == STATS_CLIENT) {
+      o_log (level, "%s:%s:%s: %" PRIu64 " rows, %" PRIu64 " bytes, %zu pending;"
+          " decode %.1fus/row, insert %.1fus/row (p50 %.0fus, p99 %.0fus)\n",
+          s->domain, s->name, s->app ? s->app : "", s->rows, s->bytes, s->pending,
+          s->rows ? s->decode_ns / 1000. / s->rows : 0.,
+          s->rows ? s->insert_ns / 1000. / s->rows : 0.,
+          stats_quantile (s->insert_hist, NULL, .5),
+          stats_quantile (s->insert_hist, NULL, .99));
+    } else {
+      o_log (level, "%s:%s: %" PRIu64 " rows; insert %.1fus/row (p50 %.0fus, p99 %.0fus)\n",
+          s->domain, s->name, s->rows,
+          s->rows ? s->insert_ns / 1000. / s->rows : 0.,
+          stats_quantile (s->insert_hist, NULL, .5),
+          stats_quantile (s->insert_hist, NULL, .99));
+    }
+  }
+  pthread_mutex_unlock (&first_stats_lock);
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
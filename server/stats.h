@@ -0,0 +1,101 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA).
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License
+ * in LICENSE.TXT or at http://opensource.org/licenses/MIT. By
+ * downloading or using this software you accept the terms and the
+ * liability disclaimer in the License.
+ */
+/** \file stats.h
+ * \brief Ingest counters of the ClientHandlers and DbTables.
+ * \see stats.c
+ */
+#ifndef STATS_H__
+#define STATS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** Number of buckets of the insertion time histograms; bucket i counts
+ * insertions which took less than 2^i us (and at least 2^(i-1) us, for i>0) */
+#define STATS_HIST_BUCKETS 24
+
+/** What a set of ingest counters is about */
+enum StatsKind {
+  STATS_CLIENT, /**< one ClientHandler */
+  STATS_TABLE,  /**< one DbTable */
+};
+
+/** Ingest counters of a ClientHandler or a DbTable.
+ *
+ * Counters are updated atomically by the threads handling their owner, and
+ * read atomically by the reporter (see stats_read), but not all together, so
+ * reports may be a few rows off.
+ */
+typedef struct IngestStats {
+  enum StatsKind kind;
+  char *domain;       /**< experimental domain, once known */
+  char *name;         /**< sender ID of a client, or name of a table */
+  char *app;          /**< application name of a client */
+
+  uint64_t bytes;     /**< bytes received */
+  uint64_t rows;      /**< samples stored */
+  uint64_t decode_ns; /**< time spent decoding samples */
+  uint64_t insert_ns; /**< time spent storing samples */
+  uint32_t insert_hist[STATS_HIST_BUCKETS]; /**< histogram of insertion times */
+  size_t pending;     /**< bytes received but not processed yet */
+
+  /* Counters at the time of the previous report, see stats_report */
+  uint64_t last_bytes;
+  uint64_t last_rows;
+  uint64_t last_decode_ns;
+  uint64_t last_insert_ns;
+  uint32_t last_hist[STATS_HIST_BUCKETS];
+
+  int registered;     /**< whether this is in the list of reported statistics */
+  struct IngestStats *next;
+} IngestStats;
+
+IngestStats *stats_new (enum StatsKind kind);
+void stats_free (IngestStats *stats);
+int stats_register (IngestStats *stats, const char *domain, const char *name, const char *app);
+
+uint64_t stats_now (void);
+void stats_add_insert (IngestStats *stats, uint64_t ns, int ok);
+double stats_quantile (const uint32_t *hist, const uint32_t *last, double q);
+
+void stats_report (int interval);
+void stats_dump (int level);
+
+/** Atomically add to a counter shared with the reporter */
+#define stats_atomic_add(counter, n) __sync_fetch_and_add (&(counter), (n))
+/** Atomically read a counter shared with its updaters */
+#define stats_atomic_get(counter) __sync_fetch_and_add (&(counter), 0)
+
+/** Account for received bytes.
+ * \param stats IngestStats to update, or NULL
+ * \param n number of bytes
+ */
+#define stats_add_bytes(stats, n) do { if (stats) stats_atomic_add ((stats)->bytes, (n)); } while (0)
+/** Account for the time spent decoding a sample.
+ * \param stats IngestStats to update, or NULL
+ * \param start stats_now() before decoding
+ */
+#define stats_add_decode(stats, start) do { if (stats) stats_atomic_add ((stats)->decode_ns, stats_now () - (start)); } while (0)
+/** Set the amount of data received but not processed yet.
+ * \param stats IngestStats to update, or NULL
+ * \param n number of bytes
+ */
+#define stats_set_pending(stats, n) do { if (stats) __sync_lock_test_and_set (&(stats)->pending, (n)); } while (0)
+
+#endif /* STATS_H__ */
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
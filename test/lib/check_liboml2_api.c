@@ -10,7 +10,9 @@
 /** \file  check_liboml2_api.c
  * \brief Test the user-visible OML API.
  */
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #include <check.h>
 
 #include "ocomm/o_log.h"
@@ -224,6 +226,83 @@ START_TEST(test_api_metadata)
 }
 END_TEST
 
+START_TEST(test_api_batch)
+{
+  OmlMPDef batchdef [] = {
+    { "i", OML_INT32_VALUE },
+    { "d", OML_DOUBLE_VALUE },
+    { "label", OML_STRING_VALUE },
+    { NULL, (OmlValueT)0 }
+  };
+  const char* argv[] = {
+    __FUNCTION__,
+    "--oml-id", __FUNCTION__,
+    "--oml-domain", __FILE__,
+    "--oml-collect", "file:test_api_batch",
+    "--oml-samples", "4",
+    "--oml-log-level", "2"};
+  int argc = 11;
+  OmlMP *batch_mp, *scalar_mp;
+  OmlValueU values[10 * 3];
+  char line[256], rows[2][4][128] = { { "" } };
+  int nrows[2] = { 0, 0 };
+  int i, stream, seq;
+  FILE *f;
+
+  o_set_log_level (2);
+  logdebug("%s\n", __FUNCTION__);
+
+  omlc_zero_array(values, 10 * 3);
+  for (i = 0; i < 10; i++) {
+    omlc_set_int32(values[3 * i], i * i - 20);
+    omlc_set_double(values[3 * i + 1], i * .25);
+    omlc_set_string(values[3 * i + 2], i % 2 ? "odd" : "even");
+  }
+
+  /* The file writer appends to previous output */
+  unlink("test_api_batch");
+  fail_if(omlc_init("app", &argc, argv, NULL), "Error initialising OML");
+  batch_mp = omlc_add_mp("batch", batchdef);
+  scalar_mp = omlc_add_mp("scalar", batchdef);
+  fail_unless(omlc_inject_batch(batch_mp, values, 10),
+      "omlc_inject_batch() succeeded before omlc_start was called");
+  fail_if(omlc_start(), "Error starting OML");
+
+  fail_unless(omlc_inject_batch(batch_mp, NULL, 10), "omlc_inject_batch() accepted NULL values");
+  fail_unless(omlc_inject_batch(batch_mp, values, -1), "omlc_inject_batch() accepted a negative count");
+  fail_if(omlc_inject_batch(batch_mp, values, 0), "omlc_inject_batch() failed for an empty batch");
+
+  /* Batches split across sample windows */
+  fail_if(omlc_inject_batch(batch_mp, values, 3), "omlc_inject_batch() failed");
+  fail_if(omlc_inject_batch(batch_mp, values + 3 * 3, 7), "omlc_inject_batch() failed");
+  for (i = 0; i < 10; i++) {
+    fail_if(omlc_inject(scalar_mp, values + 3 * i), "omlc_inject() failed");
+  }
+  fail_if(omlc_close(), "Error closing OML");
+
+  /* Both MPs must have reported the same tuples, after the same number of
+   * samples, the last one when closing */
+  f = fopen("test_api_batch", "r");
+  fail_if(f == NULL, "Could not open output file");
+  while (fgets(line, sizeof(line), f)) {
+    char *tuple;
+    /* Streams 0 and 1 are for metadata and instrumentation */
+    if (sscanf(line, "%*f\t%d\t%d\t", &stream, &seq) != 2 || stream < 2 || stream > 3) {
+      continue;
+    }
+    fail_unless(nrows[stream - 2] < 4, "Too many tuples for stream %d", stream);
+    tuple = strchr(strchr(strchr(line, '\t') + 1, '\t') + 1, '\t') + 1;
+    strncpy(rows[stream - 2][nrows[stream - 2]++], tuple, sizeof(rows[0][0]) - 1);
+  }
+  fclose(f);
+
+  fail_unless(nrows[0] == 3 && nrows[1] == 3, "Expected 3 tuples per MP, got %d and %d", nrows[0], nrows[1]);
+  for (i = 0; i < nrows[0]; i++) {
+    fail_if(strcmp(rows[0][i], rows[1][i]), "Tuple %d differs: '%s' vs. '%s'", i, rows[0][i], rows[1][i]);
+  }
+}
+END_TEST
+
 Suite*
 api_suite (void)
 {
@@ -239,6 +318,7 @@ api_suite (void)
   TCase* tc_api_func = tcase_create("ApiFunctions");
   tcase_add_test(tc_api_func, test_api_basic);
   tcase_add_test(tc_api_func, test_api_metadata);
+  tcase_add_test(tc_api_func, test_api_batch);
   suite_add_tcase (s, tc_api_func);
 
   return s;
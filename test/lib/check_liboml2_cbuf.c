@@ -633,6 +633,29 @@ START_TEST (test_cbuf_create)
 }
 END_TEST
 
+START_TEST (test_cbuf_write_cursor_full_page)
+{
+  CBuffer *cbuf = cbuf_create (8);
+  struct cbuffer_cursor first, second;
+
+  cbuf_write_cursor (cbuf, &first);
+  fail_unless (cbuf_write (cbuf, "abcdefgh", 8) == 8);
+
+  /* The first page is full; the cursor should point to the next one */
+  cbuf_write_cursor (cbuf, &second);
+  fail_if (second.page == first.page, "Write cursor left on a full page");
+  fail_unless (second.index == 0, "Write cursor not at the start of the new page: %zu", second.index);
+  fail_unless (cbuf_write (cbuf, "ijk", 3) == 3);
+
+  /* Consuming the first message recycles its page, which shouldn't affect the second */
+  cbuf_consume_cursor (&first, 8);
+  fail_unless (cbuf_cursor_page_remaining (&second) == 3);
+  fail_unless (strncmp (cbuf_cursor_pointer (&second), "ijk", 3) == 0);
+
+  cbuf_destroy (cbuf);
+}
+END_TEST
+
 Suite*
 cbuf_suite (void)
 {
@@ -643,6 +666,7 @@ cbuf_suite (void)
 
   /* Add tests to "Mbuf" */
   tcase_add_test (tc_cbuf, test_cbuf_create);
+  tcase_add_test (tc_cbuf, test_cbuf_write_cursor_full_page);
 
   suite_add_tcase (s, tc_cbuf);
 
@@ -221,6 +221,92 @@ START_TEST (test_config_multi_collect)
 }
 END_TEST
 
+/** Check that streams with a <deadband /> only report changes of their field */
+START_TEST (test_config_deadband)
+{
+  OmlMP *mp;
+  OmlValueU v[2];
+  char buf[1024], name[64], names[5][64], reported[5][64];
+  const char *streams[] = { "abs", "rel", "change", "silence" };
+  const char *expected[] = { "10 13 9 20 ", "10 20 ", "10 11 12 13 9 20 ", "10 20 " };
+  uint32_t values[] = { 10, 11, 12, 13, 9, 9, 20 };
+  char config[] = "<omlc domain='check_liboml2_config' id='test_config_deadband'>\n"
+                  "  <collect url='file:test_config_deadband' encoding='text'>\n"
+                  "    <stream mp='test_config_deadband' name='abs' samples='1'>\n"
+                  "      <deadband field='f1' absolute='2' />\n"
+                  "    </stream>\n"
+                  "    <stream mp='test_config_deadband' name='rel' samples='1'>\n"
+                  "      <deadband field='f1' relative='0.5' />\n"
+                  "    </stream>\n"
+                  "    <stream mp='test_config_deadband' name='change' samples='1'>\n"
+                  "      <deadband field='f1' />\n"
+                  "    </stream>\n"
+                  "    <stream mp='test_config_deadband' name='silence' samples='1'>\n"
+                  "      <deadband field='f1' absolute='1000' silence='0.05' />\n"
+                  "    </stream>\n"
+                  "  </collect>\n"
+                  "</omlc>";
+  unsigned int i, j, stream, f1;
+  FILE *fp;
+
+  logdebug("%s\n", __FUNCTION__);
+
+  MAKEOMLCMDLINE(argc, argv, "file:test_config_deadband");
+  argv[1] = "--oml-config";
+  argv[2] = "test_config_deadband.xml";
+  argc = 3;
+
+  fp = fopen (argv[2], "w");
+  fail_unless(fp != NULL, "Could not create configuration file %s: %s", argv[2], strerror(errno));
+  fail_unless(fwrite(config, sizeof(config), 1, fp) == 1,
+      "Could not write configuration in file %s: %s", argv[2], strerror(errno));
+  fclose(fp);
+
+  unlink("test_config_deadband");
+
+  fail_if(omlc_init(__FUNCTION__, &argc, argv, NULL),
+      "Could not initialise OML");
+  mp = omlc_add_mp(__FUNCTION__, mp_def);
+  fail_if(mp==NULL, "Could not add MP");
+  fail_if(omlc_start(), "Could not start OML");
+
+  for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    if (i == sizeof(values) / sizeof(values[0]) - 1) {
+      usleep(100000); /* Longer than the silence */
+    }
+    omlc_set_uint32(v[0], values[i]);
+    omlc_set_uint32(v[1], i);
+    fail_if(omlc_inject(mp, v), "Injection failed");
+  }
+
+  omlc_close();
+
+  fp = fopen(__FUNCTION__, "r");
+  fail_unless(fp != NULL, "Output file %s missing", __FUNCTION__);
+
+  memset(names, 0, sizeof(names));
+  memset(reported, 0, sizeof(reported));
+  while(fgets(buf, sizeof(buf), fp)) {
+    if (sscanf(buf, "schema: %u %63s", &stream, name) == 2 && stream < 5) {
+      strcpy(names[stream], name);
+
+    } else if (sscanf(buf, "%*f\t%u\t%*u\t%u", &stream, &f1) == 2 && stream < 5) {
+      snprintf(reported[stream] + strlen(reported[stream]),
+          sizeof(reported[0]) - strlen(reported[stream]), "%u ", f1);
+    }
+  }
+  fclose(fp);
+
+  for (i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+    snprintf(buf, sizeof(buf), "%s_%s", __FUNCTION__, streams[i]);
+    for (j = 0; j < 5 && strcmp(names[j], buf); j++);
+    fail_unless(j < 5, "Stream %s not found", streams[i]);
+    fail_unless(!strcmp(reported[j], expected[i]),
+        "Stream %s reported '%s', not '%s'", streams[i], reported[j], expected[i]);
+  }
+}
+END_TEST
+
 Suite*
 config_suite (void)
 {
@@ -231,6 +317,7 @@ config_suite (void)
   tcase_add_test (tc_config, test_config_metadata);
   tcase_add_test (tc_config, test_config_empty_collect);
   tcase_add_test (tc_config, test_config_multi_collect);
+  tcase_add_test (tc_config, test_config_deadband);
 
   suite_add_tcase (s, tc_config);
 
@@ -26,6 +26,7 @@
 #include <check.h>
 
 #include "oml2/omlc.h"
+#include "ocomm/o_log.h"
 #include "filter/factory.h"
 #include "filter/average_filter.h"
 #include "filter/first_filter.h"
@@ -33,7 +34,13 @@
 #include "filter/stddev_filter.h"
 #include "filter/sum_filter.h"
 #include "filter/delta_filter.h"
+#include "filter/quantile_filter.h"
+#include "filter/hdrhist_filter.h"
+#include "filter/stats_filter.h"
 #include "oml2/oml_writer.h"
+#include "oml_value.h"
+#include "mem.h"
+#include "sketch.h"
 #include "check_util.h"
 
 typedef struct OmlAvgFilterInstanceData AvgInstanceData;
@@ -431,6 +438,414 @@ START_TEST (test_filter_delta_output)
 }
 END_TEST
 
+/********************************************************************************/
+/*                         QUANTILE FILTER TESTS                                */
+/********************************************************************************/
+
+/* Last values written by a filter to capture_writer */
+static OmlValue *captured_values;
+static int captured_count;
+
+static int
+capture_out (OmlWriter* writer, OmlValue* values, int value_count)
+{
+  (void)writer;
+  captured_values = values;
+  captured_count = value_count;
+  return 0;
+}
+
+static void
+set_string_property (OmlFilter* f, const char* name, const char* value, int expected)
+{
+  OmlValue v;
+
+  oml_value_init (&v);
+  oml_value_set_type (&v, OML_STRING_VALUE);
+  omlc_set_string_copy (*oml_value_get_value (&v), value, strlen (value));
+  fail_unless (f->set (f, name, &v) == expected,
+      "Setting property %s to '%s' did not return %d", name, value, expected);
+  oml_value_reset (&v);
+}
+
+static void
+input_int32_range (OmlFilter* f, int from, int to)
+{
+  OmlValue v;
+  int i;
+
+  oml_value_init (&v);
+  oml_value_set_type (&v, OML_INT32_VALUE);
+  for (i = from; i <= to; i++) {
+    omlc_set_int32 (*oml_value_get_value (&v), i);
+    fail_unless (f->input (f, &v) == 0);
+  }
+}
+
+START_TEST (test_filter_quantile_create)
+{
+  OmlFilter* f = NULL;
+  char* name;
+  OmlValueT type;
+
+  f = create_filter ("quantile", "lat", OML_INT32_VALUE, 2);
+
+  fail_if (f == NULL);
+  fail_if (f->instance_data == NULL);
+  fail_unless (f->output_count == 3);
+  fail_unless (f->meta (f, 2, &name, &type) == 0);
+  fail_unless (!strcmp (name, "p99") && type == OML_DOUBLE_VALUE);
+  fail_unless (f->meta (f, 3, &name, &type) == -1);
+
+  fail_unless (destroy_filter (f) == NULL);
+
+  o_set_log_level (-1);
+  f = create_filter ("quantile", "lat", OML_STRING_VALUE, 2);
+  fail_unless (f->instance_data == NULL, "Quantile filter accepted string inputs");
+  destroy_filter (f);
+}
+END_TEST
+
+START_TEST (test_filter_quantile_output)
+{
+  OmlFilter* f = create_filter ("quantile", "lat", OML_INT32_VALUE, 2);
+  OmlWriter w;
+  char* name;
+  int i;
+  double expected [] = { 500., 990., 999., 1000. };
+
+  memset (&w, 0, sizeof (w));
+  w.out = capture_out;
+
+  o_set_log_level (-1);
+  set_string_property (f, "percentiles", "p50,p99,p999,p100", 0);
+  set_string_property (f, "percentiles", "p50,x99", -1);
+  set_string_property (f, "percentiles", "", -1);
+  set_string_property (f, "precision", "3", 0);
+  set_string_property (f, "precision", "5", -1);
+  set_string_property (f, "buckets", "8192", 0);
+  set_string_property (f, "unknown", "1", -1);
+
+  fail_unless (f->output_count == 4);
+  fail_unless (f->meta (f, 2, &name, NULL) == 0 && !strcmp (name, "p999"));
+
+  input_int32_range (f, 1, 1000);
+  f->output (f, &w);
+  f->newwindow (f);
+
+  fail_unless (captured_count == 4);
+  for (i = 0; i < 4; i++) {
+    double q = omlc_get_double (*oml_value_get_value (&captured_values[i]));
+    fail_unless (oml_value_get_type (&captured_values[i]) == OML_DOUBLE_VALUE);
+    fail_unless (fabs (q - expected[i]) <= .001 * expected[i],
+        "Percentile %d: expected %g, got %g", i, expected[i], q);
+  }
+
+  /* Empty window */
+  f->output (f, &w);
+  fail_unless (captured_count == 4);
+  fail_unless (isnan (omlc_get_double (*oml_value_get_value (&captured_values[0]))));
+
+  fail_unless (destroy_filter (f) == NULL);
+}
+END_TEST
+
+/********************************************************************************/
+/*                         HDRHIST FILTER TESTS                                 */
+/********************************************************************************/
+
+START_TEST (test_filter_hdrhist_output)
+{
+  OmlFilter* f = create_filter ("hdrhist", "lat", OML_INT32_VALUE, 2);
+  OmlWriter w;
+  OmlValueU* blob;
+  Sketch* s;
+  int i;
+
+  memset (&w, 0, sizeof (w));
+  w.out = capture_out;
+
+  fail_unless (f->output_count == 4);
+  set_string_property (f, "precision", "3", 0);
+
+  /* Two windows, whose sketches merge to that of the whole range */
+  Sketch* merged = NULL;
+  for (i = 0; i < 2; i++) {
+    input_int32_range (f, 1 + 500 * i, 500 * (i + 1));
+    f->output (f, &w);
+    f->newwindow (f);
+
+    fail_unless (captured_count == 4);
+    fail_unless (omlc_get_uint64 (*oml_value_get_value (&captured_values[0])) == 500);
+    fail_unless (omlc_get_double (*oml_value_get_value (&captured_values[1])) == 1 + 500 * i);
+    fail_unless (omlc_get_double (*oml_value_get_value (&captured_values[2])) == 500 * (i + 1));
+    fail_unless (oml_value_get_type (&captured_values[3]) == OML_BLOB_VALUE);
+
+    blob = oml_value_get_value (&captured_values[3]);
+    s = sketch_decode (omlc_get_blob_ptr (*blob), omlc_get_blob_length (*blob));
+    fail_if (s == NULL, "Could not decode sketch from window %d", i);
+    if (merged) {
+      fail_if (sketch_merge (merged, s));
+      oml_free (s);
+    } else {
+      merged = s;
+    }
+  }
+
+  fail_unless (merged->count == 1000);
+  fail_unless (fabs (sketch_quantile (merged, .99) - 990.) <= 1.,
+      "Merged p99 %g", sketch_quantile (merged, .99));
+  oml_free (merged);
+
+  fail_unless (destroy_filter (f) == NULL);
+}
+END_TEST
+
+/********************************************************************************/
+/*                         STATS FILTER TESTS                                   */
+/********************************************************************************/
+
+START_TEST (test_filter_stats_create)
+{
+  static const char* names [] = { "avg", "min", "max", "stddev", "variance" };
+  OmlFilter* f = NULL;
+  char* name;
+  OmlValueT type;
+  int i;
+
+  f = create_filter ("stats", "rtt", OML_INT32_VALUE, 2);
+
+  fail_if (f == NULL);
+  fail_if (f->instance_data == NULL);
+  fail_unless (f->input_batch != NULL);
+
+  /* Same columns as the avg and stddev filters */
+  fail_unless (f->output_count == 5);
+  for (i = 0; i < 5; i++) {
+    fail_unless (f->meta (f, i, &name, &type) == 0);
+    fail_unless (!strcmp (name, names[i]) && type == OML_DOUBLE_VALUE,
+        "Output %d is %s, not %s", i, name, names[i]);
+  }
+  fail_unless (f->meta (f, 5, &name, &type) == -1);
+
+  fail_unless (destroy_filter (f) == NULL);
+
+  o_set_log_level (-1);
+  f = create_filter ("stats", "rtt", OML_STRING_VALUE, 2);
+  fail_unless (f->instance_data == NULL, "Stats filter accepted string inputs");
+  destroy_filter (f);
+}
+END_TEST
+
+START_TEST (test_filter_stats_output)
+{
+  OmlFilter* f = create_filter ("stats", "rtt", OML_INT32_VALUE, 2);
+  OmlFilter* avg = create_filter ("avg", "rtt", OML_INT32_VALUE, 2);
+  OmlFilter* stddev = create_filter ("stddev", "rtt", OML_INT32_VALUE, 2);
+  OmlWriter w;
+  OmlValue* values;
+  char* name;
+  int i;
+  double expected [] = { 55., 5.5, 1., 10., 55. / 6, sqrt (55. / 6) };
+
+  memset (&w, 0, sizeof (w));
+  w.out = capture_out;
+
+  /* The default outputs are exactly those of the separate filters */
+  input_int32_range (f, -500, 1000);
+  input_int32_range (avg, -500, 1000);
+  input_int32_range (stddev, -500, 1000);
+  f->output (f, &w);
+  values = captured_values;
+  avg->output (avg, &w);
+  for (i = 0; i < 3; i++) {
+    fail_unless (omlc_get_double (*oml_value_get_value (&values[i])) ==
+        omlc_get_double (*oml_value_get_value (&captured_values[i])),
+        "Output %d differs from that of the avg filter", i);
+  }
+  stddev->output (stddev, &w);
+  for (i = 0; i < 2; i++) {
+    fail_unless (omlc_get_double (*oml_value_get_value (&values[3 + i])) ==
+        omlc_get_double (*oml_value_get_value (&captured_values[i])),
+        "Output %d differs from that of the stddev filter", 3 + i);
+  }
+
+  o_set_log_level (-1);
+  set_string_property (f, "stats", "count,sum,mean,min,max,var,stddev", 0);
+  set_string_property (f, "stats", "avg,unknown", -1);
+  set_string_property (f, "stats", "avg,mean", -1);
+  set_string_property (f, "stats", "", -1);
+  set_string_property (f, "unknown", "avg", -1);
+
+  fail_unless (f->output_count == 7);
+  fail_unless (f->meta (f, 0, &name, NULL) == 0 && !strcmp (name, "count"));
+  fail_unless (f->meta (f, 2, &name, NULL) == 0 && !strcmp (name, "avg"));
+  fail_unless (f->meta (f, 5, &name, NULL) == 0 && !strcmp (name, "variance"));
+
+  /* Changing the outputs starts a new window */
+  input_int32_range (f, 1, 10);
+  f->output (f, &w);
+  f->newwindow (f);
+
+  fail_unless (captured_count == 7);
+  fail_unless (oml_value_get_type (&captured_values[0]) == OML_UINT64_VALUE);
+  fail_unless (omlc_get_uint64 (*oml_value_get_value (&captured_values[0])) == 10);
+  for (i = 1; i < 7; i++) {
+    double v = omlc_get_double (*oml_value_get_value (&captured_values[i]));
+    fail_unless (fabs (v - expected[i - 1]) <= 1e-12 * expected[i - 1],
+        "Output %d: expected %g, got %g", i, expected[i - 1], v);
+  }
+
+  /* Empty window */
+  f->output (f, &w);
+  fail_unless (omlc_get_uint64 (*oml_value_get_value (&captured_values[0])) == 0);
+  fail_unless (omlc_get_double (*oml_value_get_value (&captured_values[1])) == 0.);
+  fail_unless (isnan (omlc_get_double (*oml_value_get_value (&captured_values[6]))));
+
+  /* Without variance */
+  set_string_property (f, "stats", "max,count", 0);
+  fail_unless (f->output_count == 2);
+  input_int32_range (f, 1, 10);
+  f->output (f, &w);
+  fail_unless (omlc_get_double (*oml_value_get_value (&captured_values[0])) == 10.);
+  fail_unless (omlc_get_uint64 (*oml_value_get_value (&captured_values[1])) == 10);
+
+  fail_unless (destroy_filter (f) == NULL);
+  destroy_filter (avg);
+  destroy_filter (stddev);
+}
+END_TEST
+
+/********************************************************************************/
+/*                         BATCH INPUT TESTS                                    */
+/********************************************************************************/
+
+#define BATCH_SAMPLES 1000
+
+/* Check that feeding samples in batches gives the same output as one by one */
+static void
+check_filter_batch (const char* name, OmlValueT type)
+{
+  static const int chunks [] = { 1, 7, 300, 2, BATCH_SAMPLES };
+  union {
+    int32_t i32[BATCH_SAMPLES];
+    int64_t i64[BATCH_SAMPLES];
+    uint64_t u64[BATCH_SAMPLES];
+    double d[BATCH_SAMPLES];
+  } batch;
+  OmlFilter* scalar = create_filter (name, "scalar", type, 0);
+  OmlFilter* batched = create_filter (name, "batched", type, 0);
+  OmlWriter w;
+  OmlValue v;
+  int window, i, j, n;
+
+  fail_if (batched->input_batch == NULL, "No batch input for filter %s", name);
+  memset (&w, 0, sizeof (w));
+  w.out = capture_out;
+  oml_value_init (&v);
+  oml_value_set_type (&v, type);
+
+  for (window = 0; window < 2; window++) {
+    for (i = 0; i < BATCH_SAMPLES; i++) {
+      /* Irregular values, larger than 2^53 for 64-bit integers */
+      int64_t x = (int64_t)((i * 7919 + window * 104729) % 1009) - 500;
+      switch (type) {
+      case OML_INT32_VALUE:
+        batch.i32[i] = (int32_t)x;
+        omlc_set_int32 (*oml_value_get_value (&v), batch.i32[i]);
+        break;
+      case OML_INT64_VALUE:
+        batch.i64[i] = x * ((int64_t)1 << 54) + i;
+        omlc_set_int64 (*oml_value_get_value (&v), batch.i64[i]);
+        break;
+      case OML_UINT64_VALUE:
+        batch.u64[i] = (uint64_t)(x + 500) * ((uint64_t)1 << 54) + i;
+        omlc_set_uint64 (*oml_value_get_value (&v), batch.u64[i]);
+        break;
+      default:
+        batch.d[i] = x / 3.;
+        omlc_set_double (*oml_value_get_value (&v), batch.d[i]);
+        break;
+      }
+      fail_unless (scalar->input (scalar, &v) == 0);
+    }
+
+    for (i = j = 0; i < BATCH_SAMPLES; i += n, j++) {
+      n = chunks[j % (sizeof (chunks) / sizeof (chunks[0]))];
+      if (n > BATCH_SAMPLES - i) n = BATCH_SAMPLES - i;
+      switch (type) {
+      case OML_INT32_VALUE: fail_unless (batched->input_batch (batched, batch.i32 + i, n) == 0); break;
+      case OML_INT64_VALUE: fail_unless (batched->input_batch (batched, batch.i64 + i, n) == 0); break;
+      case OML_UINT64_VALUE: fail_unless (batched->input_batch (batched, batch.u64 + i, n) == 0); break;
+      default: fail_unless (batched->input_batch (batched, batch.d + i, n) == 0); break;
+      }
+    }
+    fail_unless (batched->input_batch (batched, batch.d, 0) == 0);
+
+    scalar->output (scalar, &w);
+    batched->output (batched, &w);
+    fail_unless (scalar->output_count == batched->output_count);
+    for (i = 0; i < scalar->output_count; i++) {
+      OmlValue* expected = &scalar->result[i];
+      OmlValue* got = &batched->result[i];
+      fail_unless (oml_value_get_type (expected) == oml_value_get_type (got));
+      if (oml_value_get_type (expected) == OML_DOUBLE_VALUE) {
+        double e = omlc_get_double (*oml_value_get_value (expected));
+        double g = omlc_get_double (*oml_value_get_value (got));
+        fail_unless (fabs (e - g) <= 1e-12 * fabs (e) + 1e-12,
+            "Filter %s on %s, window %d, output %d: expected %.17g, got %.17g",
+            name, oml_type_to_s (type), window, i, e, g);
+      } else {
+        OmlValueU* e = oml_value_get_value (expected);
+        OmlValueU* g = oml_value_get_value (got);
+        fail_unless (omlc_get_int32 (*e) == omlc_get_int32 (*g) &&
+            omlc_get_int64 (*e) == omlc_get_int64 (*g) &&
+            omlc_get_uint64 (*e) == omlc_get_uint64 (*g),
+            "Filter %s on %s, window %d, output %d differs", name, oml_type_to_s (type), window, i);
+      }
+    }
+    scalar->newwindow (scalar);
+    batched->newwindow (batched);
+  }
+
+  oml_value_reset (&v);
+  destroy_filter (scalar);
+  destroy_filter (batched);
+}
+
+START_TEST (test_filter_batch)
+{
+  static const char* names [] = { "avg", "sum", "stddev", "first", "last", "delta", "stats" };
+  static const OmlValueT types [] = {
+    OML_INT32_VALUE, OML_INT64_VALUE, OML_UINT64_VALUE, OML_DOUBLE_VALUE,
+  };
+  int i, j;
+
+  for (i = 0; i < (int)(sizeof (names) / sizeof (names[0])); i++) {
+    for (j = 0; j < (int)(sizeof (types) / sizeof (types[0])); j++) {
+      check_filter_batch (names[i], types[j]);
+    }
+  }
+}
+END_TEST
+
+START_TEST (test_filter_batch_to_double)
+{
+  uint64_t u[] = { 0, UINT64_MAX };
+  int32_t i32[] = { -1, 2, -3 };
+  double buf[OMLF_BATCH_SIZE];
+  const double* d;
+
+  d = omlf_batch_to_double (OML_INT32_VALUE, i32, 1, 2, buf);
+  fail_unless (d == buf && d[0] == 2. && d[1] == -3.);
+  d = omlf_batch_to_double (OML_UINT64_VALUE, u, 0, 2, buf);
+  fail_unless (d[1] == 18446744073709551615.);
+  d = omlf_batch_to_double (OML_DOUBLE_VALUE, buf, 1, 1, NULL);
+  fail_unless (d == buf + 1, "Doubles were copied");
+  fail_unless (omlf_batch_to_double (OML_STRING_VALUE, buf, 0, 1, buf) == NULL);
+}
+END_TEST
+
 /********************************************************************************/
 /*                         MAIN TEST SUITE                                      */
 /********************************************************************************/
@@ -448,6 +863,10 @@ filters_suite (void)
   TCase* tc_filter_stddev = tcase_create ("FilterStddev");
   TCase* tc_filter_sum = tcase_create ("FilterSum");
   TCase* tc_filter_delta= tcase_create ("FilterDelta");
+  TCase* tc_filter_quantile = tcase_create ("FilterQuantile");
+  TCase* tc_filter_hdrhist = tcase_create ("FilterHdrhist");
+  TCase* tc_filter_stats = tcase_create ("FilterStats");
+  TCase* tc_filter_batch = tcase_create ("FilterBatch");
 
   /* Setup fixtures */
   tcase_add_checked_fixture (tc_filter,       filter_setup, filter_teardown);
@@ -457,6 +876,10 @@ filters_suite (void)
   tcase_add_checked_fixture (tc_filter_stddev,filter_setup, filter_teardown);
   tcase_add_checked_fixture (tc_filter_sum,filter_setup, filter_teardown);
   tcase_add_checked_fixture (tc_filter_delta,filter_setup, filter_teardown);
+  tcase_add_checked_fixture (tc_filter_quantile, filter_setup, filter_teardown);
+  tcase_add_checked_fixture (tc_filter_hdrhist, filter_setup, filter_teardown);
+  tcase_add_checked_fixture (tc_filter_stats, filter_setup, filter_teardown);
+  tcase_add_checked_fixture (tc_filter_batch, filter_setup, filter_teardown);
 
   /* Add tests to test case "FilterCore" */
   tcase_add_test (tc_filter, test_filter_create);
@@ -484,6 +907,21 @@ filters_suite (void)
   tcase_add_test (tc_filter_delta, test_filter_delta_create);
   tcase_add_test (tc_filter_delta, test_filter_delta_output);
 
+  /* Add tests to test case "FilterQuantile" */
+  tcase_add_test (tc_filter_quantile, test_filter_quantile_create);
+  tcase_add_test (tc_filter_quantile, test_filter_quantile_output);
+
+  /* Add tests to test case "FilterHdrhist" */
+  tcase_add_test (tc_filter_hdrhist, test_filter_hdrhist_output);
+
+  /* Add tests to test case "FilterStats" */
+  tcase_add_test (tc_filter_stats, test_filter_stats_create);
+  tcase_add_test (tc_filter_stats, test_filter_stats_output);
+
+  /* Add tests to test case "FilterBatch" */
+  tcase_add_test (tc_filter_batch, test_filter_batch);
+  tcase_add_test (tc_filter_batch, test_filter_batch_to_double);
+
   /* Add the test cases to this test suite */
   suite_add_tcase (s, tc_filter);
   suite_add_tcase (s, tc_filter_avg);
@@ -492,6 +930,10 @@ filters_suite (void)
   suite_add_tcase (s, tc_filter_stddev);
   suite_add_tcase (s, tc_filter_sum);
   suite_add_tcase (s, tc_filter_delta);
+  suite_add_tcase (s, tc_filter_quantile);
+  suite_add_tcase (s, tc_filter_hdrhist);
+  suite_add_tcase (s, tc_filter_stats);
+  suite_add_tcase (s, tc_filter_batch);
 
   return s;
 }
@@ -241,6 +241,33 @@ START_TEST (test_mbuf_write_null)
 }
 END_TEST
 
+START_TEST (test_mbuf_write_advance)
+{
+  const char s[] = "abcdefgh";
+  MBuffer* mbuf = mbuf_create ();
+  size_t length = mbuf_length (mbuf);
+
+  fail_if (mbuf_write_advance (NULL, 1) != -1);
+
+  fail_if (mbuf_check_resize (mbuf, sizeof (s)) != 0);
+  memcpy (mbuf_wrptr (mbuf), s, sizeof (s));
+  fail_if (mbuf_write_advance (mbuf, sizeof (s)) != 0);
+
+  fail_if (mbuf->fill != sizeof (s));
+  fail_if (mbuf->wrptr - mbuf->base != sizeof (s));
+  fail_if (mbuf->rdptr != mbuf->base);
+  fail_if (mbuf->wr_remaining != length - sizeof (s));
+  fail_if (mbuf->rd_remaining != sizeof (s));
+  fail_if (strcmp ((char*)mbuf_rdptr (mbuf), s) != 0);
+
+  /* Cannot advance past the end of the buffer */
+  fail_if (mbuf_write_advance (mbuf, mbuf->wr_remaining + 1) != -1);
+  fail_if (mbuf->fill != sizeof (s));
+
+  mbuf_destroy (mbuf);
+}
+END_TEST
+
 START_TEST (test_mbuf_read)
 {
   char s[8192];
@@ -614,6 +641,57 @@ START_TEST (test_mbuf_repack_message)
 }
 END_TEST
 
+START_TEST (test_mbuf_make_room)
+{
+  uint8_t buf[512];
+  MBuffer* mbuf = mbuf_create ();
+  size_t length = mbuf_length (mbuf);
+  size_t i;
+
+  memset (buf, 'a', sizeof (buf));
+
+  /* One consumed message, followed by the start of another */
+  fail_if (mbuf_write (mbuf, buf, 400) != 0);
+  fail_if (mbuf_read_skip (mbuf, 400) != 0);
+  fail_if (mbuf_consume_message (mbuf) != 0);
+  memset (buf, 'b', sizeof (buf));
+  fail_if (mbuf_write (mbuf, buf, 50) != 0);
+  fail_if (mbuf_read_skip (mbuf, 10) != 0);
+
+  /* Enough room already: nothing moves */
+  fail_if (mbuf_make_room (mbuf, 20) != 0);
+  fail_unless (mbuf_message_offset (mbuf) == 400);
+
+  /* The partial message is moved to reclaim the consumed space */
+  fail_if (mbuf_make_room (mbuf, 200) != 0);
+  fail_unless (mbuf_length (mbuf) == length);
+  fail_unless (mbuf->msgptr == mbuf->base);
+  fail_unless (mbuf->rdptr == mbuf->base + 10);
+  fail_unless (mbuf_fill (mbuf) == 50);
+  fail_unless (mbuf_wr_remaining (mbuf) >= 200);
+  fail_unless (mbuf->base[0] == 'b' && mbuf->base[49] == 'b');
+
+  /* Nothing to reclaim: the buffer grows instead */
+  fail_if (mbuf_make_room (mbuf, length) != 0);
+  fail_unless (mbuf_length (mbuf) >= 50 + length);
+  fail_unless (mbuf_fill (mbuf) == 50);
+
+  /* A large message arriving in small pieces doesn't make the buffer grow
+   * much larger than itself */
+  mbuf_clear2 (mbuf, 0);
+  for (i = 0; i < 256; i++) {
+    fail_if (mbuf_make_room (mbuf, sizeof (buf)) != 0);
+    fail_if (mbuf_write (mbuf, buf, sizeof (buf)) != 0);
+  }
+  fail_unless (mbuf_fill (mbuf) == 256 * sizeof (buf));
+  fail_unless (mbuf_length (mbuf) <= 2 * 256 * sizeof (buf));
+
+  fail_if (mbuf_make_room (NULL, 1) != -1);
+
+  mbuf_destroy (mbuf);
+}
+END_TEST
+
 Suite*
 mbuf_suite (void)
 {
@@ -630,6 +708,7 @@ mbuf_suite (void)
   tcase_add_test (tc_mbuf, test_mbuf_resize_contents);
   tcase_add_test (tc_mbuf, test_mbuf_write);
   tcase_add_test (tc_mbuf, test_mbuf_write_null);
+  tcase_add_test (tc_mbuf, test_mbuf_write_advance);
   tcase_add_test (tc_mbuf, test_mbuf_read);
   tcase_add_test (tc_mbuf, test_mbuf_read_null);
   tcase_add_test (tc_mbuf, test_mbuf_begin_read);
@@ -639,6 +718,7 @@ mbuf_suite (void)
   tcase_add_test (tc_mbuf, test_mbuf_consume_message);
   tcase_add_test (tc_mbuf, test_mbuf_repack);
   tcase_add_test (tc_mbuf, test_mbuf_repack_message);
+  tcase_add_test (tc_mbuf, test_mbuf_make_room);
 
 
   suite_add_tcase (s, tc_mbuf);
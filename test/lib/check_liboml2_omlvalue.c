@@ -340,6 +340,67 @@ START_TEST (test_string)
 }
 END_TEST
 
+START_TEST (test_clear)
+{
+  char *test = "a test string";
+  char *shorter = "test";
+  char *ptr;
+  OmlValue v;
+  OmlValueU vu;
+  size_t bcount;
+
+  oml_value_init(&v);
+  omlc_zero(vu);
+
+  /* Strings keep their storage, which is reused for shorter ones */
+  omlc_set_const_string(vu, test);
+  oml_value_set(&v, &vu, OML_STRING_VALUE);
+  ptr = omlc_get_string_ptr(*oml_value_get_value(&v));
+  bcount = xmembytes();
+
+  oml_value_clear(&v);
+  fail_unless(oml_value_get_type(&v) == OML_STRING_VALUE,
+      "OmlValue type not kept by oml_value_clear() (%d)", oml_value_get_type(&v));
+  fail_unless(xmembytes() == bcount,
+      "OmlValue string was freed by oml_value_clear() (%d allocated instead of %d)",
+      xmembytes(), bcount);
+  fail_unless(omlc_get_string_length(*oml_value_get_value(&v)) == 0,
+      "Cleared OmlValue string length not 0 (%d)", omlc_get_string_length(*oml_value_get_value(&v)));
+  fail_unless(omlc_get_string_ptr(*oml_value_get_value(&v))[0] == '\0',
+      "Cleared OmlValue string not empty");
+
+  omlc_set_const_string(vu, shorter);
+  oml_value_set(&v, &vu, OML_STRING_VALUE);
+  fail_unless(omlc_get_string_ptr(*oml_value_get_value(&v)) == ptr,
+      "OmlValue string storage not reused after oml_value_clear()");
+  fail_unless(xmembytes() == bcount,
+      "OmlValue string storage reallocated after oml_value_clear() (%d allocated instead of %d)",
+      xmembytes(), bcount);
+  fail_if(strcmp(omlc_get_string_ptr(*oml_value_get_value(&v)), shorter),
+      "OmlValue string mismatch after reuse ('%s' instead of '%s')",
+      omlc_get_string_ptr(*oml_value_get_value(&v)), shorter);
+
+  /* Constant strings are not owned, and just dropped */
+  oml_value_reset(&v);
+  omlc_set_const_string(*oml_value_get_value(&v), test);
+  v.type = OML_STRING_VALUE;
+  oml_value_clear(&v);
+  fail_unless(omlc_get_string_ptr(*oml_value_get_value(&v)) == NULL,
+      "Cleared constant OmlValue string not dropped");
+
+  /* Intrinsic values are zeroed */
+  omlc_zero(vu);
+  omlc_set_int64(vu, 42);
+  oml_value_set(&v, &vu, OML_INT64_VALUE);
+  oml_value_clear(&v);
+  fail_unless(oml_value_get_type(&v) == OML_INT64_VALUE);
+  fail_unless(omlc_get_int64(*oml_value_get_value(&v)) == 0,
+      "Cleared OmlValue int64 not 0 (%" PRId64 ")", omlc_get_int64(*oml_value_get_value(&v)));
+
+  oml_value_reset(&v);
+}
+END_TEST
+
 START_TEST (test_blob)
 {
   char *str = "this is a string subtly disguised as a blob";
@@ -433,6 +494,7 @@ omlvalue_suite (void)
   tcase_add_test (tc_omlvalue, test_intrinsic);
   tcase_add_test (tc_omlvalue, test_string);
   tcase_add_test (tc_omlvalue, test_blob);
+  tcase_add_test (tc_omlvalue, test_clear);
   tcase_add_loop_test (tc_omlvalue, test_bool_loop, 0, LENGTH(booltest));
 
   suite_add_tcase (s, tc_omlvalue);
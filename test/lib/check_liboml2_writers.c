@@ -25,9 +25,16 @@
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <check.h>
 
+#include "ocomm/o_log.h"
 #include "mbuf.h"
+#include "ack.h"
 #include "client.h"
 #include "oml_util.h"
 
@@ -111,6 +118,97 @@ START_TEST (test_fw_create_buffered)
 }
 END_TEST
 
+/** Receive data from a connection until some length, or nothing more comes.
+ *
+ * \param fd connected socket
+ * \param buf buffer to receive into, NUL-terminated on return
+ * \param length size of buf
+ * \return the number of bytes received
+ */
+static size_t
+net_recv(int fd, char *buf, size_t length)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  size_t got = 0;
+  ssize_t n;
+
+  while (got < length - 1 && poll(&pfd, 1, 500) > 0 &&
+      (n = recv(fd, buf + got, length - 1 - got, 0)) > 0) {
+    got += n;
+  }
+  buf[got] = '\0';
+  return got;
+}
+
+START_TEST (test_net_stream_resume)
+{
+  char header[] = "protocol: 4\ncontent: text\n\n";
+  char lines[] = "1.0\t1\t1\ta\n" "2.0\t1\t2\tb\n" "3.0\t1\t3\tc\n" "4.0\t1\t4\td\n";
+  char line5[] = "5.0\t1\t5\te\n";
+  char lines56[] = "5.0\t1\t5\te\n" "6.0\t1\t6\tf\n";
+  char expected[256], buf[256], port[8];
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  struct linger linger = { 1, 0 };
+  MBuffer *acks = mbuf_create();
+  OmlOutStream *os;
+  int lfd, fd;
+
+  o_set_log_level(-1);
+  signal(SIGPIPE, SIG_IGN);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  lfd = socket(AF_INET, SOCK_STREAM, 0);
+  fail_if(lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) || listen(lfd, 2) ||
+      getsockname(lfd, (struct sockaddr*)&addr, &addrlen), "Could not listen");
+  snprintf(port, sizeof(port), "%d", ntohs(addr.sin_port));
+
+  os = net_stream_new("tcp", "127.0.0.1", port);
+  fail_if(os == NULL);
+
+  /* First connection: samples 1 to 2 are acknowledged... */
+  fail_unless(os->write(os, (uint8_t*)lines, strlen(lines), (uint8_t*)header, strlen(header)) == strlen(lines));
+  fd = accept(lfd, NULL, NULL);
+  fail_if(fd < 0, "Connection not accepted");
+  snprintf(expected, sizeof(expected), "%s: %d\n%s%s", ACK_HEADER_KEY, ACK_PROTOCOL_VERSION, header, lines);
+  net_recv(fd, buf, sizeof(buf));
+  fail_unless(!strcmp(buf, expected), "Unexpected data on first connection: '%s'", buf);
+  ack_write_end(acks);
+  ack_write(acks, 1, 2);
+  fail_unless(send(fd, mbuf_rdptr(acks), mbuf_rd_remaining(acks), 0) == (ssize_t)mbuf_rd_remaining(acks));
+  usleep(100000);
+
+  /* ...and read while writing sample 5 */
+  fail_unless(os->write(os, (uint8_t*)line5, strlen(line5), (uint8_t*)header, strlen(header)) == strlen(line5));
+  net_recv(fd, buf, sizeof(buf));
+  fail_unless(!strcmp(buf, line5), "Unexpected data: '%s'", buf);
+
+  /* The connection breaks */
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+  close(fd);
+  usleep(100000);
+  fail_unless(os->write(os, (uint8_t*)lines56, strlen(lines56), (uint8_t*)header, strlen(header)) == 0,
+      "Write succeeded on a broken connection");
+
+  /* Samples 3 to 5 are sent again after reconnecting, and only 6 of what the
+   * writer retries after them */
+  fail_unless(os->write(os, (uint8_t*)lines56, strlen(lines56), (uint8_t*)header, strlen(header)) == strlen(lines56));
+  fd = accept(lfd, NULL, NULL);
+  fail_if(fd < 0, "Connection not accepted");
+  snprintf(expected, sizeof(expected), "%s: %d\n%s%s%s%s", ACK_HEADER_KEY, ACK_PROTOCOL_VERSION, header,
+      lines + strlen(lines) / 2, line5, lines56 + strlen(line5));
+  net_recv(fd, buf, sizeof(buf));
+  fail_unless(!strcmp(buf, expected), "Unexpected data after reconnecting: '%s', expected '%s'", buf, expected);
+
+  os->close(os);
+  close(fd);
+  close(lfd);
+  mbuf_destroy(acks);
+}
+END_TEST
+
 Suite*
 writers_suite (void)
 {
@@ -119,14 +217,17 @@ writers_suite (void)
   /* Test cases */
   /*TCase* tc_bw = tcase_create ("BfWr");*/
   TCase* tc_fw = tcase_create ("FileWr");
+  TCase* tc_nw = tcase_create ("NetWr");
 
   /* Add tests */
   /*tcase_add_test (tc_bw, test_bw_create);*/
 
   tcase_add_test (tc_fw, test_fw_create_buffered);
+  tcase_add_test (tc_nw, test_net_stream_resume);
 
   /*suite_add_tcase (s, tc_bw);*/
   suite_add_tcase (s, tc_fw);
+  suite_add_tcase (s, tc_nw);
   return s;
 }
 
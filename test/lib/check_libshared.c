@@ -36,10 +36,13 @@ main (void)
   SRunner *sr = srunner_create (mstring_suite ());
   srunner_add_suite (sr, base64_suite ());
   srunner_add_suite (sr, json_suite ());
+  srunner_add_suite (sr, vector_suite ());
+  srunner_add_suite (sr, sketch_suite ());
   srunner_add_suite (sr, string_utils_suite ());
   srunner_add_suite (sr, util_suite ());
   srunner_add_suite (sr, headers_suite ());
   srunner_add_suite (sr, marshal_suite ());
+  srunner_add_suite (sr, scan_suite ());
 
   srunner_run_all (sr, CK_ENV);
   number_failed += srunner_ntests_failed (sr);
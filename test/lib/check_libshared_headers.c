@@ -24,6 +24,7 @@ static struct {
   { "start_time", H_START_TIME },
   { "start-time", H_START_TIME },
   { "domain", H_DOMAIN },
+  { "ack", H_ACK },
 
   { "protocolx", H_NONE },
   { "experiment-idx", H_NONE },
@@ -34,6 +35,7 @@ static struct {
   { "start_timex", H_NONE },
   { "start-timex", H_NONE },
   { "domaine", H_NONE },
+  { "ackx", H_NONE },
 
   /*
   { "protocol", H_NONE},
@@ -82,6 +84,7 @@ static struct {
   { "start_time: 123456690", { H_START_TIME, "123456690", NULL }, 0, 0 },
   { "start-time: 123456690", { H_START_TIME, "123456690", NULL }, 0, 0 },
   { "domain: abc", { H_DOMAIN, "abc", NULL }, 0, 0 },
+  { "ack: 1", { H_ACK, "1", NULL }, 0, 1 },
   { "", { H_NONE, NULL, NULL }, 1, 1 },
   { " ", { H_NONE, NULL, NULL }, 1, 1 },
   { NULL, { H_NONE, NULL, NULL }, 1, 1 },
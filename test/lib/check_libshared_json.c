@@ -9,7 +9,9 @@
  */
 
 #include <check.h>
+#include <float.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "json.h"
@@ -126,8 +128,8 @@ START_TEST(vector_double_test_precision)
   ck_assert_int_ne(-1, n);
   ck_assert_ptr_ne(NULL, s);
 
-  /* test output is as expected */
-  const char *expected = "[ 1.23456789012346, 2.34567890123457, 3.45678901234568 ]";
+  /* test output is as expected: as many digits as needed to read the same values back */
+  const char *expected = "[ 1.234567890123456, 2.345678901234567, 3.456789012345678 ]";
   ck_assert_int_eq(strlen(expected), n);
   ck_assert_uint_eq('\0', s[n]);
   ck_assert_str_eq(expected, s);
@@ -135,6 +137,101 @@ START_TEST(vector_double_test_precision)
 }
 END_TEST
 
+START_TEST(vector_double_test_notation)
+{
+  const double v[] = {
+    0., -0., 1., -100., 0.1, 1e-4, 1.5e-5, 123456789012345., 1e15, -2.5e300,
+    1./3, 5e-324, DBL_MAX
+  };
+  char *s = NULL;
+  ssize_t n = vector_double_to_json(v, sizeof(v)/sizeof(v[0]), &s);
+
+  /* same notation as %.15g, but without losing precision */
+  const char *expected = "[ 0, -0, 1, -100, 0.1, 0.0001, 1.5e-05, 123456789012345, 1e+15, "
+    "-2.5e+300, 0.3333333333333333, 5e-324, 1.7976931348623157e+308 ]";
+  ck_assert_int_eq(strlen(expected), n);
+  ck_assert_str_eq(expected, s);
+  oml_free(s);
+}
+END_TEST
+
+START_TEST(vector_double_test_roundtrip)
+{
+  char buf[JSON_DOUBLE_MAXLEN + 1];
+  uint64_t bits = 88172645463325252ULL;
+  int i;
+
+  for(i = 0; i < 100000; i++) {
+    double d, r;
+    size_t n;
+
+    /* xorshift, to go over the whole range of doubles */
+    bits ^= bits << 13;
+    bits ^= bits >> 7;
+    bits ^= bits << 17;
+    memcpy(&d, &bits, sizeof(d));
+    if(isnan(d) || isinf(d))
+      continue;
+
+    n = json_format_double(buf, d);
+    fail_unless(n <= JSON_DOUBLE_MAXLEN, "%.17g formatted as %zu characters", d, n);
+    buf[n] = '\0';
+    r = strtod(buf, NULL);
+    fail_if(memcmp(&d, &r, sizeof(d)), "%.17g formatted as %s, read back as %.17g", d, buf, r);
+  }
+}
+END_TEST
+
+START_TEST(vector_int_test)
+{
+  const int32_t v32[] = { 0, -1, 9, 10, 99, 100, INT32_MIN, INT32_MAX };
+  const uint32_t vu32[] = { 0, UINT32_MAX };
+  const int64_t v64[] = { INT64_MIN, -1234567890123LL, INT64_MAX };
+  const uint64_t vu64[] = { 1, UINT64_MAX };
+  char *s = NULL;
+
+  ck_assert_int_ne(-1, vector_int32_to_json(v32, sizeof(v32)/sizeof(v32[0]), &s));
+  ck_assert_str_eq("[ 0, -1, 9, 10, 99, 100, -2147483648, 2147483647 ]", s);
+  ck_assert_int_ne(-1, vector_uint32_to_json(vu32, sizeof(vu32)/sizeof(vu32[0]), &s));
+  ck_assert_str_eq("[ 0, 4294967295 ]", s);
+  ck_assert_int_ne(-1, vector_int64_to_json(v64, sizeof(v64)/sizeof(v64[0]), &s));
+  ck_assert_str_eq("[ -9223372036854775808, -1234567890123, 9223372036854775807 ]", s);
+  ck_assert_int_ne(-1, vector_uint64_to_json(vu64, sizeof(vu64)/sizeof(vu64[0]), &s));
+  ck_assert_str_eq("[ 1, 18446744073709551615 ]", s);
+  oml_free(s);
+}
+END_TEST
+
+START_TEST(vector_bool_test)
+{
+  const bool v[] = { true, false, false };
+  char *s = NULL;
+  ssize_t n = vector_bool_to_json(v, sizeof(v)/sizeof(v[0]), &s);
+
+  ck_assert_str_eq("[ true, false, false ]", s);
+  ck_assert_int_eq(strlen(s), n);
+  oml_free(s);
+}
+END_TEST
+
+START_TEST(vector_test_buffer_reuse)
+{
+  const int32_t big[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  const int32_t small[] = { 42 };
+  char *s = NULL, *prev;
+
+  ck_assert_int_ne(-1, vector_int32_to_json(big, sizeof(big)/sizeof(big[0]), &s));
+  prev = s;
+  /* a large enough buffer is reused as is, and the shorter output properly terminated */
+  ck_assert_int_eq(6, vector_int32_to_json(small, 1, &s));
+  ck_assert_ptr_eq(prev, s);
+  ck_assert_str_eq("[ 42 ]", s);
+  ck_assert_int_eq(0, vector_int32_to_json(small, 0, &s));
+  ck_assert_str_eq("", s);
+  oml_free(s);
+}
+END_TEST
+
 
 Suite*
 json_suite(void)
@@ -148,6 +245,11 @@ json_suite(void)
   tcase_add_test(tc_core, zero_sized_vector_double_tiny_output);
   tcase_add_test(tc_core, single_elt_vector_double_tiny_output);
   tcase_add_test(tc_core, vector_double_test_precision);
+  tcase_add_test(tc_core, vector_double_test_notation);
+  tcase_add_test(tc_core, vector_double_test_roundtrip);
+  tcase_add_test(tc_core, vector_int_test);
+  tcase_add_test(tc_core, vector_bool_test);
+  tcase_add_test(tc_core, vector_test_buffer_reuse);
   suite_add_tcase(s, tc_core);
   return s;
 }
@@ -1242,6 +1242,55 @@ START_TEST(test_marshal_unmarshal_vector_double)
 }
 END_TEST
 
+START_TEST(test_marshal_unmarshal_vector_reuse)
+{
+  int32_t elts[] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  size_t nelts[] = { 8, 2, 0, 5 };
+  size_t i, j;
+  void *storage;
+  int result;
+
+  MBuffer* mbuf = mbuf_create();
+  marshal_init(mbuf, OMB_DATA_P);
+  result = marshal_measurements (mbuf, 98, 99, 100.0);
+  fail_if(-1 == result);
+
+  OmlValueU out;
+  omlc_zero(out);
+  for (i = 0; i < LENGTH(nelts); i++) {
+    omlc_set_vector_int32(out, elts, nelts[i]);
+    fail_unless(1 == marshal_value(mbuf, OML_VECTOR_INT32_VALUE, &out));
+  }
+  omlc_free_vector(out);
+  marshal_finalize (mbuf);
+
+  OmlBinaryHeader header;
+  result = unmarshal_init (mbuf, &header);
+  fail_unless(1 == result);
+
+  /* Subsequent vectors which fit reuse the storage of the first one */
+  OmlValue in;
+  oml_value_init(&in);
+  for (i = 0; i < LENGTH(nelts); i++) {
+    oml_value_clear(&in);
+    fail_unless(1 == unmarshal_value(mbuf, &in));
+    if (i == 0) {
+      storage = omlc_get_vector_ptr(in.value);
+    } else {
+      fail_unless(omlc_get_vector_ptr(in.value) == storage,
+                  "Vector storage not reused for vector %d", i);
+    }
+    fail_unless(OML_VECTOR_INT32_VALUE == oml_value_get_type(&in));
+    fail_unless(omlc_get_vector_nof_elts(in.value) == nelts[i]);
+    fail_unless(omlc_get_vector_length(in.value) == nelts[i] * sizeof(int32_t));
+    for (j = 0; j < nelts[i]; j++)
+      fail_unless(((int32_t*)omlc_get_vector_ptr(in.value))[j] == elts[j]);
+  }
+  oml_value_reset(&in);
+  mbuf_destroy(mbuf);
+}
+END_TEST
+
 START_TEST(test_marshal_unmarshal_vector_int32)
 {
   size_t i;
@@ -1837,6 +1886,7 @@ marshal_suite (void)
   tcase_add_test (tc_marshal, test_marshal_unmarshal_bool);
   tcase_add_test (tc_marshal, test_marshal_unmarshal_vector_double);
   tcase_add_test (tc_marshal, test_marshal_unmarshal_vector_int32);
+  tcase_add_test (tc_marshal, test_marshal_unmarshal_vector_reuse);
   tcase_add_test (tc_marshal, test_marshal_unmarshal_vector_int64);
   tcase_add_test (tc_marshal, test_marshal_unmarshal_vector_bool);
 
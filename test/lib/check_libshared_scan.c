@@ -0,0 +1,110 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+
+#include <check.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+
+static const char *variants[] = { "scalar", "sse2", "avx2" };
+
+/* Reference implementations */
+static const uint8_t*
+ref_byte (const uint8_t *buf, size_t len, uint8_t c)
+{
+  return memchr (buf, c, len);
+}
+
+static const uint8_t*
+ref_pair (const uint8_t *buf, size_t len, uint8_t c)
+{
+  size_t i;
+  for (i = 1; i < len; i++)
+    if (buf[i] == c && buf[i-1] == c)
+      return &buf[i-1];
+  return NULL;
+}
+
+START_TEST(test_scan_select)
+{
+  fail_unless(scan_select (NULL) == 0);
+  fail_unless(scan_name () != NULL);
+  fail_unless(scan_select ("scalar") == 0);
+  fail_unless(strcmp (scan_name (), "scalar") == 0);
+  fail_unless(scan_select ("nonexistent") == -1);
+  fail_unless(strcmp (scan_name (), "scalar") == 0);
+  scan_select (NULL);
+}
+END_TEST
+
+START_TEST(test_scan_variants)
+{
+  uint8_t buf[256];
+  size_t i, start, len;
+  unsigned int v;
+
+  /* Sparse delimiters, at every alignment and length around the vector
+   * sizes, including at the very end of the buffer */
+  srandom (1);
+  for (v = 0; v < sizeof (variants) / sizeof (variants[0]); v++) {
+    if (scan_select (variants[v]) == -1)
+      continue;
+
+    for (i = 0; i < 200; i++) {
+      size_t j;
+      for (j = 0; j < sizeof (buf); j++)
+        buf[j] = random () % 64 ? random () % 0xAA : (random () % 2 ? '\n' : 0xAA);
+
+      for (start = 0; start < 33; start++) {
+        for (len = 0; start + len <= sizeof (buf); len += 1 + len / 8) {
+          fail_unless(scan_byte (buf + start, len, '\n') == ref_byte (buf + start, len, '\n'),
+                      "%s: scan_byte mismatch at offset %zu, length %zu", variants[v], start, len);
+          fail_unless(scan_pair (buf + start, len, 0xAA) == ref_pair (buf + start, len, 0xAA),
+                      "%s: scan_pair mismatch at offset %zu, length %zu", variants[v], start, len);
+        }
+      }
+    }
+
+    /* A pair straddling two vectors, and a lone byte at the end of one */
+    memset (buf, 0, sizeof (buf));
+    buf[15] = buf[16] = 0xAA;
+    buf[31] = 0xAA;
+    fail_unless(scan_pair (buf, sizeof (buf), 0xAA) == buf + 15, "%s", variants[v]);
+    fail_unless(scan_pair (buf + 16, sizeof (buf) - 16, 0xAA) == NULL, "%s", variants[v]);
+    buf[sizeof (buf) - 1] = 0xAA;
+    buf[sizeof (buf) - 2] = 0xAA;
+    fail_unless(scan_pair (buf + 16, sizeof (buf) - 16, 0xAA) == buf + sizeof (buf) - 2, "%s", variants[v]);
+    fail_unless(scan_byte (buf, 1, 0xAA) == NULL, "%s", variants[v]);
+  }
+  scan_select (NULL);
+}
+END_TEST
+
+Suite*
+scan_suite(void)
+{
+  Suite *s = suite_create("scan");
+  TCase *tc_core = tcase_create("scan");
+  tcase_add_test(tc_core, test_scan_select);
+  tcase_add_test(tc_core, test_scan_variants);
+  suite_add_tcase(s, tc_core);
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
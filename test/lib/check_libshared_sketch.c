@@ -0,0 +1,234 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+
+#include <check.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ocomm/o_log.h"
+#include "sketch.h"
+#include "mem.h"
+
+#define NSAMPLES 100000
+/* Enough buckets for the range of sketch_accuracy at the highest precision */
+#define ACCURACY_BUCKETS 65536
+
+static int
+cmp_double (const void *a, const void *b)
+{
+  double da = *(const double*)a, db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+/* Check that a quantile estimate is within the relative precision of the sketch */
+static void
+check_quantile (const Sketch *s, const double *sorted, int n, double q, double max_error)
+{
+  double exact = sorted[(int)(q * (n - 1))];
+  double estimate = sketch_quantile (s, q);
+
+  fail_unless(fabs (estimate - exact) <= max_error * fabs (exact),
+      "Quantile %g: expected %g within %g, got %g", q, exact, max_error, estimate);
+}
+
+START_TEST(sketch_accuracy)
+{
+  static double values[NSAMPLES];
+  static const double qs[] = { 0.01, 0.1, 0.5, 0.9, 0.99, 0.999 };
+  static uint64_t storage[SKETCH_STORAGE_SIZE (ACCURACY_BUCKETS) / sizeof (uint64_t)];
+  uint32_t x = 2463534242U;
+  Sketch s;
+  int digits, i, j;
+
+  for (digits = 1; digits <= SKETCH_MAX_DIGITS; digits++) {
+    fail_if(sketch_init (&s, sketch_precision (digits), ACCURACY_BUCKETS, storage),
+        "Could not initialise sketch with %d digits", digits);
+    fail_unless(isnan (sketch_quantile (&s, .5)), "Empty sketch has a median");
+
+    for (i = 0; i < NSAMPLES; i++) {
+      /* Log-normal-ish, latency-like values, with a few negative ones */
+      x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+      values[i] = exp ((x % 100000) / 30000.) * (i % 50 ? 1 : -1);
+      sketch_add (&s, values[i]);
+    }
+    sketch_add (&s, NAN);
+    ck_assert_int_eq(NSAMPLES, s.count);
+
+    qsort (values, NSAMPLES, sizeof (double), cmp_double);
+    for (j = 0; j < (int)(sizeof (qs) / sizeof (qs[0])); j++) {
+      check_quantile (&s, values, NSAMPLES, qs[j], pow (10, -digits));
+    }
+    fail_unless(sketch_quantile (&s, 0.) == values[0], "Minimum not exact");
+    fail_unless(sketch_quantile (&s, 1.) == values[NSAMPLES - 1], "Maximum not exact");
+  }
+}
+END_TEST
+
+START_TEST(sketch_merge_combined)
+{
+  uint64_t storage[3][SKETCH_STORAGE_SIZE (SKETCH_DEFAULT_BUCKETS) / sizeof (uint64_t)];
+  Sketch a, b, all, other;
+  double q;
+  int i;
+
+  sketch_init (&a, sketch_precision (2), SKETCH_DEFAULT_BUCKETS, storage[0]);
+  sketch_init (&b, sketch_precision (2), SKETCH_DEFAULT_BUCKETS, storage[1]);
+  sketch_init (&all, sketch_precision (2), SKETCH_DEFAULT_BUCKETS, storage[2]);
+
+  for (i = -500; i < 2000; i++) {
+    sketch_add (i % 3 ? &a : &b, i * 1.5);
+    sketch_add (&all, i * 1.5);
+  }
+  fail_if(sketch_merge (&a, &b), "Could not merge sketches");
+
+  ck_assert_int_eq(all.count, a.count);
+  ck_assert_int_eq(all.zero_count, a.zero_count);
+  fail_unless(a.min == all.min && a.max == all.max, "Invalid merged range");
+  for (q = 0.; q <= 1.; q += 0.05) {
+    fail_unless(sketch_quantile (&a, q) == sketch_quantile (&all, q),
+        "Merged quantile %g differs: %g != %g", q, sketch_quantile (&a, q), sketch_quantile (&all, q));
+  }
+
+  o_set_log_level (-1);
+  sketch_init (&other, sketch_precision (3), SKETCH_DEFAULT_BUCKETS, storage[1]);
+  sketch_add (&other, 1.);
+  ck_assert_int_eq(-1, sketch_merge (&a, &other));
+}
+END_TEST
+
+START_TEST(sketch_bounded)
+{
+  uint64_t storage[SKETCH_STORAGE_SIZE (16) / sizeof (uint64_t)];
+  Sketch s;
+  uint64_t total = 0;
+  int i;
+
+  sketch_init (&s, sketch_precision (2), 16, storage);
+  for (i = 0; i < 1000; i++) {
+    sketch_add (&s, pow (1.1, i));
+    sketch_add (&s, pow (1.1, 999 - i));
+  }
+  ck_assert_int_eq(16, s.positive.len);
+  for (i = 0; i < s.positive.len; i++) {
+    total += s.positive.counts[i];
+  }
+  ck_assert_int_eq(2000, total);
+
+  /* The largest values are still accurate, the smallest ones collapsed */
+  fail_unless(fabs (sketch_quantile (&s, .999) - pow (1.1, 998)) <= .01 * pow (1.1, 998),
+      "Largest values not accurate after collapsing");
+  fail_unless(sketch_quantile (&s, 0.) == 1., "Minimum not kept");
+}
+END_TEST
+
+START_TEST(sketch_roundtrip)
+{
+  uint64_t storage[SKETCH_STORAGE_SIZE (SKETCH_DEFAULT_BUCKETS) / sizeof (uint64_t)];
+  uint8_t *buf = NULL;
+  Sketch s, *d;
+  ssize_t len;
+  double q;
+  int i;
+
+  sketch_init (&s, sketch_precision (3), SKETCH_DEFAULT_BUCKETS, storage);
+
+  /* Empty sketches survive too */
+  len = sketch_encode (&s, &buf);
+  fail_unless(len > 0, "Could not encode empty sketch");
+  d = sketch_decode (buf, len);
+  fail_if(d == NULL, "Could not decode empty sketch");
+  ck_assert_int_eq(0, d->count);
+  oml_free (d);
+
+  for (i = -100; i < 10000; i++) {
+    sketch_add (&s, i / 7.);
+  }
+  len = sketch_encode (&s, &buf);
+  fail_unless(len > 0, "Could not encode sketch");
+  fail_unless((size_t)len < (s.positive.len + s.negative.len) * 3 + 64,
+      "Serialised sketch of %d bytes is not compact", (int)len);
+
+  d = sketch_decode (buf, len);
+  fail_if(d == NULL, "Could not decode sketch");
+  ck_assert_int_eq(s.precision, d->precision);
+  ck_assert_int_eq(s.count, d->count);
+  ck_assert_int_eq(s.zero_count, d->zero_count);
+  for (q = 0.; q <= 1.; q += 0.01) {
+    fail_unless(sketch_quantile (&s, q) == sketch_quantile (d, q),
+        "Decoded quantile %g differs: %g != %g", q, sketch_quantile (&s, q), sketch_quantile (d, q));
+  }
+
+  /* Decoded sketches can be merged with others */
+  fail_if(sketch_merge (d, &s), "Could not merge decoded sketch");
+  ck_assert_int_eq(2 * s.count, d->count);
+
+  oml_free (d);
+  oml_free (buf);
+}
+END_TEST
+
+START_TEST(sketch_invalid)
+{
+  uint64_t storage[SKETCH_STORAGE_SIZE (SKETCH_DEFAULT_BUCKETS) / sizeof (uint64_t)];
+  uint8_t *buf = NULL;
+  Sketch s;
+  ssize_t len, i;
+
+  o_set_log_level (-1);
+  ck_assert_int_eq(-1, sketch_precision (0));
+  ck_assert_int_eq(-1, sketch_precision (SKETCH_MAX_DIGITS + 1));
+  ck_assert_int_eq(-1, sketch_init (&s, 2, 0, storage));
+
+  sketch_init (&s, sketch_precision (2), SKETCH_DEFAULT_BUCKETS, storage);
+  for (i = 1; i < 100; i++) {
+    sketch_add (&s, i);
+  }
+  len = sketch_encode (&s, &buf);
+
+  /* Truncated */
+  for (i = 0; i < len; i++) {
+    fail_unless(sketch_decode (buf, i) == NULL, "Sketch truncated to %d bytes decoded", (int)i);
+  }
+  /* Unknown version */
+  buf[0] = 2;
+  fail_unless(sketch_decode (buf, len) == NULL, "Sketch of unknown version decoded");
+  buf[0] = 1;
+  /* Inconsistent count */
+  buf[2]++;
+  fail_unless(sketch_decode (buf, len) == NULL, "Inconsistent sketch decoded");
+
+  oml_free (buf);
+}
+END_TEST
+
+Suite*
+sketch_suite(void)
+{
+  Suite *s = suite_create("sketch");
+  TCase *tc_core = tcase_create("sketch_tests");
+  tcase_add_test(tc_core, sketch_accuracy);
+  tcase_add_test(tc_core, sketch_merge_combined);
+  tcase_add_test(tc_core, sketch_bounded);
+  tcase_add_test(tc_core, sketch_roundtrip);
+  tcase_add_test(tc_core, sketch_invalid);
+  suite_add_tcase(s, tc_core);
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
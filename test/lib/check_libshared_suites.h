@@ -29,10 +29,13 @@
 extern Suite* base64_suite (void);
 extern Suite* string_utils_suite (void);
 extern Suite* json_suite (void);
+extern Suite* vector_suite (void);
+extern Suite* sketch_suite (void);
 extern Suite* mstring_suite (void);
 extern Suite* util_suite (void);
 extern Suite* headers_suite (void);
 extern Suite* marshal_suite (void);
+extern Suite* scan_suite (void);
 
 #endif /* CHECK_LIBOML2_SUITES_H__ */
 
@@ -0,0 +1,130 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+
+#include <check.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "oml_value.h"
+#include "vector.h"
+#include "mem.h"
+
+START_TEST(vector_double_layout)
+{
+  double d[] = { 1.0, -2.5 };
+  const unsigned char expected[] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf0, 0x3f,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x04, 0xc0,
+  };
+  OmlValue v;
+  void *scratch = NULL;
+  const void *le;
+  size_t len;
+
+  oml_value_init (&v);
+  oml_value_set_type (&v, OML_VECTOR_DOUBLE_VALUE);
+  omlc_set_vector_double (*oml_value_get_value (&v), d, 2);
+
+  le = vector_to_le (oml_value_get_value (&v), OML_VECTOR_DOUBLE_VALUE, &len, &scratch);
+  ck_assert_ptr_ne(NULL, le);
+  ck_assert_uint_eq(sizeof (expected), len);
+  fail_if(memcmp (expected, le, len), "Doubles not stored as little-endian IEEE 754");
+
+  oml_value_reset (&v);
+  oml_free (scratch);
+}
+END_TEST
+
+START_TEST(vector_roundtrip)
+{
+  int32_t i32[] = { 0, -1, 0x12345678 };
+  bool b[] = { true, false, true, true };
+  uint64_t u64[] = { 0xfedcba9876543210ULL };
+  struct {
+    OmlValueT type;
+    const void *data;
+    size_t n;
+    size_t size;
+  } cases[] = {
+    { OML_VECTOR_INT32_VALUE, i32, 3, sizeof (i32[0]) },
+    { OML_VECTOR_BOOL_VALUE, b, 4, sizeof (b[0]) },
+    { OML_VECTOR_UINT64_VALUE, u64, 1, sizeof (u64[0]) },
+  };
+  OmlValue v, w;
+  void *scratch = NULL;
+  const void *le;
+  size_t len, i;
+
+  oml_value_init (&v);
+  oml_value_init (&w);
+  for (i = 0; i < sizeof (cases) / sizeof (cases[0]); i++) {
+    oml_value_set_type (&v, cases[i].type);
+    _omlc_set_vector_copy (*oml_value_get_value (&v), cases[i].data, cases[i].n, cases[i].size);
+
+    le = vector_to_le (oml_value_get_value (&v), cases[i].type, &len, &scratch);
+    ck_assert_ptr_ne(NULL, le);
+    ck_assert_uint_eq(cases[i].n * vector_le_elt_size (cases[i].type), len);
+
+    ck_assert_int_eq(0, vector_from_le (&w, cases[i].type, le, len));
+    ck_assert_int_eq(cases[i].type, oml_value_get_type (&w));
+    ck_assert_uint_eq(cases[i].n, omlc_get_vector_nof_elts (*oml_value_get_value (&w)));
+    fail_if(memcmp (cases[i].data, omlc_get_vector_ptr (*oml_value_get_value (&w)),
+          cases[i].n * cases[i].size), "Vector of %s changed in roundtrip",
+        oml_type_to_s (cases[i].type));
+  }
+
+  /* Empty vectors, whose data may be NULL */
+  ck_assert_int_eq(0, vector_from_le (&w, OML_VECTOR_DOUBLE_VALUE, NULL, 0));
+  ck_assert_uint_eq(0, omlc_get_vector_nof_elts (*oml_value_get_value (&w)));
+  oml_value_set_type (&v, OML_VECTOR_DOUBLE_VALUE);
+  _omlc_set_vector_copy (*oml_value_get_value (&v), "", 0, sizeof (double));
+  le = vector_to_le (oml_value_get_value (&v), OML_VECTOR_DOUBLE_VALUE, &len, &scratch);
+  ck_assert_ptr_ne(NULL, le);
+  ck_assert_uint_eq(0, len);
+
+  oml_value_reset (&v);
+  oml_value_reset (&w);
+  oml_free (scratch);
+}
+END_TEST
+
+START_TEST(vector_invalid)
+{
+  double d = 1.;
+  OmlValue v;
+
+  oml_value_init (&v);
+  ck_assert_int_eq(0, vector_le_elt_size (OML_DOUBLE_VALUE));
+  ck_assert_int_eq(-1, vector_from_le (&v, OML_VECTOR_DOUBLE_VALUE, &d, 7));
+  ck_assert_int_eq(-1, vector_from_le (&v, OML_INT32_VALUE, &d, 4));
+  oml_value_reset (&v);
+}
+END_TEST
+
+Suite*
+vector_suite(void)
+{
+  Suite *s = suite_create("vector");
+  TCase *tc_core = tcase_create("vector_tests");
+  tcase_add_test(tc_core, vector_double_layout);
+  tcase_add_test(tc_core, vector_roundtrip);
+  tcase_add_test(tc_core, vector_invalid);
+  suite_add_tcase(s, tc_core);
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
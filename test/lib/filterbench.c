@@ -0,0 +1,159 @@
+/*
+ * Copyright 2013 National ICT Australia Limited (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file filterbench.c
+ * \brief Measure the throughput of the batch inputs of the built-in filters.
+ *
+ * The same samples are fed to two instances of each filter supporting
+ * oml_filter_input_batch, one sample at a time through an OmlValue, as
+ * omlc_inject() does, and in batches of OMLF_BATCH_SIZE contiguous samples,
+ * as omlc_inject_batch() does. Each sampling window holds SAMPLES samples,
+ * and is output to a writer discarding them.
+ *
+ * Usage: filterbench [-n iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ocomm/o_log.h"
+#include "oml2/omlc.h"
+#include "oml2/oml_filter.h"
+#include "oml_value.h"
+#include "filter/factory.h"
+
+#define SAMPLES 100000
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+discard_out (OmlWriter* writer, OmlValue* values, int value_count)
+{
+  (void)writer;
+  (void)values;
+  (void)value_count;
+  return 0;
+}
+
+/** Feed one window of samples to a filter, one at a time */
+static void
+run_scalar (OmlFilter* f, OmlWriter* w, OmlValueT type, const void* samples)
+{
+  OmlValue v;
+  OmlValueU u;
+  int i;
+
+  oml_value_init (&v);
+  omlc_zero (u);
+  for (i = 0; i < SAMPLES; i++) {
+    if (type == OML_INT32_VALUE) {
+      omlc_set_int32 (u, ((const int32_t*)samples)[i]);
+    } else {
+      omlc_set_double (u, ((const double*)samples)[i]);
+    }
+    oml_value_set (&v, &u, type);
+    f->input (f, &v);
+  }
+  f->output (f, w);
+  f->newwindow (f);
+  oml_value_reset (&v);
+}
+
+/** Feed one window of samples to a filter, in batches */
+static void
+run_batch (OmlFilter* f, OmlWriter* w, OmlValueT type, const void* samples)
+{
+  size_t size = type == OML_INT32_VALUE ? sizeof (int32_t) : sizeof (double);
+  int i, n;
+
+  for (i = 0; i < SAMPLES; i += n) {
+    n = SAMPLES - i < OMLF_BATCH_SIZE ? SAMPLES - i : OMLF_BATCH_SIZE;
+    f->input_batch (f, (const char*)samples + i * size, n);
+  }
+  f->output (f, w);
+  f->newwindow (f);
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *filters[] = { "avg", "sum", "stddev", "first", "last", "delta", "stats" };
+  const OmlValueT types[] = { OML_INT32_VALUE, OML_DOUBLE_VALUE };
+  static int32_t i32[SAMPLES];
+  static double d[SAMPLES];
+  int iterations = 100;
+  size_t i, j;
+  int k;
+  OmlWriter w;
+
+  o_set_log_level (O_LOG_ERROR);
+
+  if (argc > 2 && strcmp (argv[1], "-n") == 0) {
+    iterations = atoi (argv[2]);
+  }
+
+  for (k = 0; k < SAMPLES; k++) {
+    i32[k] = (k * 7919) % 1009 - 500;
+    d[k] = i32[k] / 3.;
+  }
+  memset (&w, 0, sizeof (w));
+  w.out = discard_out;
+  register_builtin_filters ();
+
+  printf ("# %-8s %-7s %12s %12s %8s\n", "filter", "type", "scalar ns/S", "batch ns/S", "speedup");
+  for (i = 0; i < sizeof (filters) / sizeof (filters[0]); i++) {
+    for (j = 0; j < sizeof (types) / sizeof (types[0]); j++) {
+      const void *samples = types[j] == OML_INT32_VALUE ? (const void*)i32 : (const void*)d;
+      OmlFilter *scalar = create_filter (filters[i], "scalar", types[j], 0);
+      OmlFilter *batch = create_filter (filters[i], "batch", types[j], 0);
+      double start, scalar_time, batch_time;
+
+      if (!scalar || !batch || !batch->input_batch) {
+        fprintf (stderr, "%s: no batch input for %s\n", filters[i], oml_type_to_s (types[j]));
+        return 1;
+      }
+
+      start = now ();
+      for (k = 0; k < iterations; k++) {
+        run_scalar (scalar, &w, types[j], samples);
+      }
+      scalar_time = (now () - start) / iterations;
+
+      start = now ();
+      for (k = 0; k < iterations; k++) {
+        run_batch (batch, &w, types[j], samples);
+      }
+      batch_time = (now () - start) / iterations;
+
+      printf ("  %-8s %-7s %12.2f %12.2f %8.1f\n", filters[i], oml_type_to_s (types[j]),
+          scalar_time / SAMPLES * 1e9, batch_time / SAMPLES * 1e9, scalar_time / batch_time);
+
+      destroy_filter (scalar);
+      destroy_filter (batch);
+    }
+  }
+
+  return 0;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,297 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file check_ack_protocol.c
+ * \brief Tests the acknowledgement of stored samples, and the skipping of those received again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+#include <sqlite3.h>
+
+#include "ocomm/o_log.h"
+#include "oml_util.h"
+#include "mem.h"
+#include "mbuf.h"
+#include "ack.h"
+#include "database.h"
+#include "resume.h"
+#include "client_handler.h"
+#include "sqlite_adapter.h"
+#include "check_server.h"
+
+extern char *dbbackend;
+extern char *sqlite_database_dir;
+
+/* Prototypes of functions to test */
+
+void
+client_callback(SockEvtSource* source, void* handle, void* buf, int buf_size);
+void
+client_ack_timer(TimerEvtSource* source, void* handle);
+
+START_TEST(test_ack_lines)
+{
+  MBuffer *mbuf = mbuf_create();
+  int stream = -1, seqno = -1;
+
+  ack_write(mbuf, 1, 42);
+  ack_write(mbuf, 3, 7);
+  ack_write_end(mbuf);
+  mbuf_print(mbuf, "nack: 1\n");
+  mbuf_print(mbuf, "%s: 2", ACK_HEADER_KEY);
+
+  fail_unless(ack_read(mbuf, &stream, &seqno) == ACK_SEQNO);
+  fail_unless(stream == 1 && seqno == 42, "Invalid ack: expected 1 42, got %d %d", stream, seqno);
+  fail_unless(ack_read(mbuf, &stream, &seqno) == ACK_SEQNO);
+  fail_unless(stream == 3 && seqno == 7, "Invalid ack: expected 3 7, got %d %d", stream, seqno);
+  fail_unless(ack_read(mbuf, &stream, &seqno) == ACK_END, "End of acknowledgements not detected");
+  fail_unless(ack_read(mbuf, &stream, &seqno) == ACK_INVALID, "Malformed line not detected");
+  fail_unless(ack_read(mbuf, &stream, &seqno) == ACK_MORE, "Incomplete line not detected");
+
+  mbuf_print(mbuf, " 5\n");
+  fail_unless(ack_read(mbuf, &stream, &seqno) == ACK_SEQNO);
+  fail_unless(stream == 2 && seqno == 5, "Invalid ack: expected 2 5, got %d %d", stream, seqno);
+  fail_unless(mbuf_rd_remaining(mbuf) == 0);
+
+  mbuf_destroy(mbuf);
+}
+END_TEST
+
+/** Connect a ClientHandler asking for acknowledgements, and send it text samples.
+ *
+ * \param name name of the ClientHandler
+ * \param source fake SockEvtSource for the ClientHandler
+ * \param domain experimental domain
+ * \param start_time start time of the client
+ * \param first sequence number of the first sample to send
+ * \param last sequence number of the last sample to send
+ * \return the ClientHandler
+ */
+static ClientHandler*
+ack_client(const char *name, SockEvtSource *source, const char *domain, int start_time, int first, int last)
+{
+  ClientHandler *ch;
+  char h[300];
+  char s[50];
+  int i;
+
+  ch = check_server_prepare_client_handler(name, source);
+
+  snprintf(h, sizeof(h), "protocol: 4\n%s: %d\ndomain: %s\nstart-time: %d\nsender-id: sender\n"
+      "app-name: %s\nschema: 1 ack_table size:uint32\n\n",
+      ACK_HEADER_KEY, ACK_PROTOCOL_VERSION, domain, start_time, __FUNCTION__);
+  client_callback(source, ch, h, strlen(h));
+  fail_unless(ch->state == C_TEXT_DATA, "Inconsistent state: expected %d, got %d", C_TEXT_DATA, ch->state);
+  fail_unless(ch->ack, "Acknowledgements not enabled");
+
+  for (i = first; i <= last; i++) {
+    snprintf(s, sizeof(s), "%f\t1\t%d\t%d\n", 1.5 * i, i, i);
+    client_callback(source, ch, s, strlen(s));
+  }
+
+  return ch;
+}
+
+START_TEST(test_ack_resume)
+{
+  ClientHandler *ch1, *ch2, *ch3;
+  Database *db;
+  sqlite3_stmt *stmt;
+  SockEvtSource source;
+  int stream, seqno;
+
+  char domain[] = "ack-test";
+  char dbname[sizeof(domain)+3];
+  char select[] = "select count(*), count(distinct oml_seq), max(oml_seq) from ack_table;";
+  int rc;
+
+  o_set_log_level(-1);
+  logdebug("%s\n", __FUNCTION__);
+
+  snprintf(dbname, sizeof(dbname), "%s.sq3", domain);
+  unlink(dbname);
+
+  memset(&source, 0, sizeof(SockEvtSource));
+  source.name = "ack socket";
+
+  /* Nothing stored yet: only the end of the first acknowledgements */
+  ch1 = ack_client("test_ack_resume1", &source, domain, 1332132092, 1, 3);
+  fail_unless(ack_read(ch1->ack_out, &stream, &seqno) == ACK_END,
+      "Unexpected acknowledgements on first connection");
+  client_ack_timer(NULL, ch1);
+  fail_unless(ack_read(ch1->ack_out, &stream, &seqno) == ACK_SEQNO, "Stored samples not acknowledged");
+  fail_unless(stream == 1 && seqno == 3, "Invalid ack: expected 1 3, got %d %d", stream, seqno);
+  client_ack_timer(NULL, ch1);
+  fail_unless(ack_read(ch1->ack_out, &stream, &seqno) == ACK_MORE, "Samples acknowledged twice");
+
+  /* Same client instance, reconnecting while the old connection is still
+   * open, and resending some samples */
+  ch2 = ack_client("test_ack_resume2", &source, domain, 1332132092, 2, 5);
+  fail_unless(ack_read(ch2->ack_out, &stream, &seqno) == ACK_SEQNO, "Resume point not sent");
+  fail_unless(stream == 1 && seqno == 3, "Invalid resume point: expected 1 3, got %d %d", stream, seqno);
+  fail_unless(ack_read(ch2->ack_out, &stream, &seqno) == ACK_END);
+
+  /* Another instance of the same sender starts over */
+  ch3 = ack_client("test_ack_resume3", &source, domain, 1332132099, 1, 1);
+  fail_unless(ack_read(ch3->ack_out, &stream, &seqno) == ACK_END,
+      "Unexpected acknowledgements for a new client instance");
+
+  check_server_destroy_client_handler(ch1);
+  check_server_destroy_client_handler(ch2);
+  check_server_destroy_client_handler(ch3);
+
+  logdebug("Checking recorded data in %s.sq3\n", domain);
+  db = database_find(domain);
+  fail_if(db == NULL || ((Sq3DB*)(db->handle))->conn == NULL , "Cannot open SQLite3 database");
+  rc = sqlite3_prepare_v2(((Sq3DB*)(db->handle))->conn, select, -1, &stmt, 0);
+  fail_unless(rc == 0, "Preparation of statement `%s' failed; rc=%d", select, rc);
+  rc = sqlite3_step(stmt);
+  fail_unless(rc == 100, "Step of statement `%s' failed; rc=%d", select, rc);
+  fail_unless(sqlite3_column_int(stmt, 0) == 6,
+      "Invalid number of rows: expected 6, got %d", sqlite3_column_int(stmt, 0));
+  fail_unless(sqlite3_column_int(stmt, 1) == 5,
+      "Invalid number of sequence numbers: expected 5, got %d", sqlite3_column_int(stmt, 1));
+  fail_unless(sqlite3_column_int(stmt, 2) == 5,
+      "Invalid last sequence number: expected 5, got %d", sqlite3_column_int(stmt, 2));
+  sqlite3_finalize(stmt);
+
+  database_release(db);
+}
+END_TEST
+
+START_TEST(test_ack_gaps)
+{
+  ClientHandler *ch1, *ch2, *ch3;
+  Database *db;
+  sqlite3_stmt *stmt;
+  SockEvtSource source;
+  int stream, seqno;
+
+  char domain[] = "ack-gap-test";
+  char dbname[sizeof(domain)+3];
+  char select[] = "select count(*), count(distinct oml_seq) from ack_table;";
+  int rc;
+
+  o_set_log_level(-1);
+  logdebug("%s\n", __FUNCTION__);
+
+  snprintf(dbname, sizeof(dbname), "%s.sq3", domain);
+  unlink(dbname);
+
+  memset(&source, 0, sizeof(SockEvtSource));
+  source.name = "ack socket";
+
+  /* Sample 3 goes missing: only what comes before is acknowledged */
+  ch1 = ack_client("test_ack_gaps1", &source, domain, 1332132092, 1, 2);
+  ch2 = ack_client("test_ack_gaps2", &source, domain, 1332132092, 4, 5);
+  fail_unless(ack_read(ch2->ack_out, &stream, &seqno) == ACK_SEQNO, "Resume point not sent");
+  fail_unless(stream == 1 && seqno == 2, "Invalid resume point: expected 1 2, got %d %d", stream, seqno);
+  client_ack_timer(NULL, ch2);
+  fail_unless(ack_read(ch2->ack_out, &stream, &seqno) == ACK_END);
+  fail_unless(ack_read(ch2->ack_out, &stream, &seqno) == ACK_MORE, "Samples after a gap acknowledged");
+
+  /* It is sent again, along with those after it, which are skipped */
+  ch3 = ack_client("test_ack_gaps3", &source, domain, 1332132092, 3, 5);
+  fail_unless(ack_read(ch3->ack_out, &stream, &seqno) == ACK_SEQNO);
+  fail_unless(ack_read(ch3->ack_out, &stream, &seqno) == ACK_END);
+  client_ack_timer(NULL, ch3);
+  fail_unless(ack_read(ch3->ack_out, &stream, &seqno) == ACK_SEQNO, "Filled gap not acknowledged");
+  fail_unless(stream == 1 && seqno == 5, "Invalid ack: expected 1 5, got %d %d", stream, seqno);
+
+  check_server_destroy_client_handler(ch1);
+  check_server_destroy_client_handler(ch2);
+  check_server_destroy_client_handler(ch3);
+
+  db = database_find(domain);
+  fail_if(db == NULL || ((Sq3DB*)(db->handle))->conn == NULL , "Cannot open SQLite3 database");
+  rc = sqlite3_prepare_v2(((Sq3DB*)(db->handle))->conn, select, -1, &stmt, 0);
+  fail_unless(rc == 0, "Preparation of statement `%s' failed; rc=%d", select, rc);
+  rc = sqlite3_step(stmt);
+  fail_unless(rc == 100, "Step of statement `%s' failed; rc=%d", select, rc);
+  fail_unless(sqlite3_column_int(stmt, 0) == 5 && sqlite3_column_int(stmt, 1) == 5,
+      "Invalid rows: expected 5 distinct, got %d (%d distinct)",
+      sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+  sqlite3_finalize(stmt);
+
+  database_release(db);
+}
+END_TEST
+
+START_TEST(test_resume_window)
+{
+  ResumeState *state;
+  int i, far = 5 + RESUME_WINDOW + 3;
+
+  o_set_log_level(-1);
+
+  state = resume_state_find("resume-window-test", "sender", 1332132092);
+  fail_if(state == NULL, "Could not create state");
+  fail_unless(resume_state_seqno(state, 2) == 0 && !resume_state_stored(state, 2, 1),
+      "Unknown stream has stored samples");
+
+  resume_state_update(state, 2, 1);
+  resume_state_update(state, 2, 2);
+  resume_state_update(state, 2, 4);
+  resume_state_update(state, 2, 5);
+  fail_unless(resume_state_seqno(state, 2) == 2, "Expected seqno 2, got %d", resume_state_seqno(state, 2));
+  fail_unless(!resume_state_stored(state, 2, 3), "Missing sample reported as stored");
+  fail_unless(resume_state_stored(state, 2, 4) && resume_state_stored(state, 2, 1),
+      "Stored samples not reported as such");
+
+  /* A sample too far ahead gives up on the gap */
+  resume_state_update(state, 2, far);
+  fail_unless(resume_state_seqno(state, 2) == far - RESUME_WINDOW,
+      "Expected seqno %d, got %d", far - RESUME_WINDOW, resume_state_seqno(state, 2));
+  fail_unless(!resume_state_stored(state, 2, far - 1) && resume_state_stored(state, 2, far),
+      "Window not moved along");
+
+  for (i = far - RESUME_WINDOW + 1; i < far; i++) {
+    resume_state_update(state, 2, i);
+  }
+  fail_unless(resume_state_seqno(state, 2) == far, "Expected seqno %d, got %d", far, resume_state_seqno(state, 2));
+
+  /* Well past the window */
+  resume_state_update(state, 2, 10 * RESUME_WINDOW);
+  fail_unless(resume_state_seqno(state, 2) == 9 * RESUME_WINDOW &&
+      !resume_state_stored(state, 2, 9 * RESUME_WINDOW + 1), "Window not moved along");
+
+  resume_state_release(state);
+}
+END_TEST
+
+Suite*
+ack_protocol_suite (void)
+{
+  Suite* s = suite_create ("Acknowledgement protocol");
+
+  dbbackend = "sqlite";
+  sqlite_database_dir = ".";
+
+  TCase* tc_ack = tcase_create ("Acknowledgements");
+  tcase_add_test (tc_ack, test_ack_lines);
+  tcase_add_test (tc_ack, test_ack_resume);
+  tcase_add_test (tc_ack, test_ack_gaps);
+  tcase_add_test (tc_ack, test_resume_window);
+  suite_add_tcase (s, tc_ack);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -88,6 +88,34 @@ START_TEST(test_bin_find_sync)
 }
 END_TEST
 
+START_TEST(test_bin_read_msg_start_short)
+{
+  MBuffer *mbuf = mbuf_create();
+  struct oml_message msg;
+  /* OMB_DATA_P message with seqno 42, timestamp 0, and one int32 */
+  uint8_t data[] = { 0xaa, 0xaa, 0x1, 0x0, 0x12, 0x1, 0x0,
+    0x5, 0x0, 0x0, 0x0, 0x2a,
+    0x2, 0x0, 0x0, 0x0, 0x0, 0x0,
+    0x5, 0x0, 0x0, 0x0, 0x7, };
+  size_t i;
+
+  /* Incomplete messages, including an empty buffer, need more data */
+  for (i = 0; i < sizeof(data); i++) {
+    mbuf_clear(mbuf);
+    mbuf_write(mbuf, data, i);
+    fail_unless(bin_read_msg_start(&msg, mbuf) == 0,
+                "Incomplete message of %d bytes not reported as such", i);
+  }
+
+  mbuf_clear(mbuf);
+  mbuf_write(mbuf, data, sizeof(data));
+  fail_unless(bin_read_msg_start(&msg, mbuf) == sizeof(data));
+  fail_unless(msg.seqno == 42);
+
+  mbuf_destroy(mbuf);
+}
+END_TEST
+
 START_TEST(test_binary_resync)
 {
   ClientHandler *ch;
@@ -581,6 +609,7 @@ Suite* binary_protocol_suite (void)
   TCase *tc_bin_sync = tcase_create ("Sync");
   tcase_add_test (tc_bin_sync, test_find_sync);
   tcase_add_test (tc_bin_sync, test_bin_find_sync);
+  tcase_add_test (tc_bin_sync, test_bin_read_msg_start_short);
   tcase_add_test (tc_bin_sync, test_binary_resync);
   suite_add_tcase (s, tc_bin_sync);
 
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file check_binary_vectors.c
+ * \brief Tests the storage of vectors in binary form.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <check.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "schema.h"
+#include "database.h"
+#include "database_adapter.h"
+#include "vector.h"
+
+extern char *dbbackend;
+extern char *sqlite_database_dir;
+
+/** Insert a row with a vector of two doubles, n and -n, into a new or existing table */
+static void
+insert_vector (const char *meta, int n)
+{
+  struct schema *schema = schema_from_meta (meta);
+  double d[2] = { n, -n };
+  Database *db;
+  DbTable *table;
+  OmlValue value;
+
+  db = database_find ("binary-vectors-test");
+  fail_if(db == NULL, "Could not create database");
+  table = database_find_or_create_table (db, schema);
+  fail_if(table == NULL, "Could not create table");
+
+  oml_value_init (&value);
+  oml_value_set_type (&value, OML_VECTOR_DOUBLE_VALUE);
+  omlc_set_vector_double (*oml_value_get_value (&value), d, 2);
+  fail_if(db->insert (db, table, db->add_sender_id (db, "sender"), n, 1. * n, &value, 1),
+      "Could not insert vector %d", n);
+  oml_value_reset (&value);
+
+  database_release (db);
+  schema_free (schema);
+}
+
+START_TEST(test_binary_vectors_sqlite)
+{
+  sqlite3 *conn;
+  sqlite3_stmt *stmt;
+  OmlValue value;
+  double *d;
+  int i;
+
+  o_set_log_level(-1);
+  unlink ("binary-vectors-test.sq3");
+  dbbackend = "sqlite";
+  sqlite_database_dir = ".";
+
+  db_binary_vectors = 1;
+  insert_vector ("1 binary v:[double]", 1);
+  db_binary_vectors = 0;
+  insert_vector ("2 json v:[double]", 2);
+  /* Existing tables keep their format, whatever the option */
+  insert_vector ("1 binary v:[double]", 3);
+  db_binary_vectors = 1;
+  insert_vector ("2 json v:[double]", 4);
+  db_binary_vectors = 0;
+
+  fail_unless(sqlite3_open ("binary-vectors-test.sq3", &conn) == SQLITE_OK, "Could not open database");
+
+  fail_unless(sqlite3_prepare_v2 (conn, "SELECT oml_seq, typeof(v), v FROM binary ORDER BY oml_seq;",
+        -1, &stmt, NULL) == SQLITE_OK, "Could not query binary table");
+  oml_value_init (&value);
+  for (i = 1; sqlite3_step (stmt) == SQLITE_ROW; i += 2) {
+    fail_unless(sqlite3_column_int (stmt, 0) == i, "Unexpected row %d", sqlite3_column_int (stmt, 0));
+    fail_unless(!strcmp ((const char*)sqlite3_column_text (stmt, 1), "blob"),
+        "Vector %d stored as %s", i, sqlite3_column_text (stmt, 1));
+    fail_if(vector_from_le (&value, OML_VECTOR_DOUBLE_VALUE, sqlite3_column_blob (stmt, 2),
+          sqlite3_column_bytes (stmt, 2)), "Could not decode vector %d", i);
+    d = omlc_get_vector_ptr (*oml_value_get_value (&value));
+    fail_unless(omlc_get_vector_nof_elts (*oml_value_get_value (&value)) == 2 && d[0] == i && d[1] == -i,
+        "Invalid vector %d", i);
+  }
+  fail_unless(i == 5, "Missing rows in binary table");
+  oml_value_reset (&value);
+  sqlite3_finalize (stmt);
+
+  fail_unless(sqlite3_prepare_v2 (conn, "SELECT COUNT(*) FROM json WHERE typeof(v)='text';",
+        -1, &stmt, NULL) == SQLITE_OK, "Could not query JSON table");
+  fail_unless(sqlite3_step (stmt) == SQLITE_ROW && sqlite3_column_int (stmt, 0) == 2,
+      "Vectors not stored as JSON in existing table");
+  sqlite3_finalize (stmt);
+
+  sqlite3_close (conn);
+}
+END_TEST
+
+Suite*
+binary_vectors_suite (void)
+{
+  Suite* s = suite_create ("Binary vectors");
+
+  TCase* tc_binary_vectors = tcase_create ("Binary vectors");
+  tcase_add_test (tc_binary_vectors, test_binary_vectors_sqlite);
+  suite_add_tcase (s, tc_binary_vectors);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
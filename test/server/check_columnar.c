@@ -0,0 +1,258 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file check_columnar.c
+ * \brief Tests the columnar storage backend.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <check.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "schema.h"
+#include "database.h"
+#include "columnar.h"
+#include "columnar_adapter.h"
+
+extern char *dbbackend;
+extern char *sqlite_database_dir;
+
+#define ROUNDTRIP_ROWS (2 * COL_INDEX_STRIDE + 10)
+
+/** Append a row to the roundtrip segment, whose string offset is past its content */
+static int
+columnar_append_partial (const char *dir)
+{
+  const char *fixed[] = { "oml_sender_id", "oml_seq", "oml_ts_client", "oml_ts_server", "i", "g" };
+  const size_t widths[] = { 4, 4, 8, 8, 4, 8 };
+  const char *variable[] = { "s", "b", "v" };
+  uint8_t zero[8] = { 0 };
+  uint64_t end;
+  char path[64];
+  FILE *f;
+  size_t i;
+
+  for (i = 0; i < sizeof (fixed) / sizeof (fixed[0]); i++) {
+    snprintf (path, sizeof (path), "%s/%s", dir, fixed[i]);
+    if (!(f = fopen (path, "ab")) || fwrite (zero, widths[i], 1, f) != 1 || fclose (f)) {
+      return -1;
+    }
+  }
+  for (i = 0; i < sizeof (variable) / sizeof (variable[0]); i++) {
+    snprintf (path, sizeof (path), "%s/%s%s", dir, variable[i], COL_OFFSETS_SUFFIX);
+    if (!(f = fopen (path, "r+b")) || fseek (f, -(long)sizeof (end), SEEK_END) ||
+        fread (&end, sizeof (end), 1, f) != 1 || fseek (f, 0, SEEK_END)) {
+      return -1;
+    }
+    end += i == 0 ? 100 : 0;
+    if (fwrite (&end, sizeof (end), 1, f) != 1 || fclose (f)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+START_TEST(test_columnar_roundtrip)
+{
+  const char *dir = "columnar-segment";
+  struct schema *schema = schema_from_meta ("1 roundtrip i:int32 d:double s:string b:blob v:[double] g:guid");
+  struct col_summary summary;
+  OmlValue values[6];
+  ColWriter *writer;
+  ColReader *reader;
+  double vec[3];
+  char str[32];
+  int i, ret;
+
+  o_set_log_level(-1);
+  system ("rm -rf columnar-segment");
+  fail_unless(schema != NULL, "Could not parse schema");
+
+  writer = col_writer_open (dir, schema);
+  fail_if(writer == NULL, "Could not open segment for writing");
+
+  oml_value_array_init (values, 6);
+  for (i = 0; i < ROUNDTRIP_ROWS; i++) {
+    snprintf (str, sizeof (str), "row %d", i);
+    vec[0] = i; vec[1] = -i; vec[2] = .5 * i;
+    omlc_set_int32 (*oml_value_get_value (&values[0]), i);
+    oml_value_set_type (&values[0], OML_INT32_VALUE);
+    omlc_set_double (*oml_value_get_value (&values[1]), 1.5 * i);
+    oml_value_set_type (&values[1], OML_DOUBLE_VALUE);
+    oml_value_set_type (&values[2], OML_STRING_VALUE);
+    omlc_set_string_copy (*oml_value_get_value (&values[2]), str, strlen (str));
+    oml_value_set_type (&values[3], OML_BLOB_VALUE);
+    omlc_set_blob (*oml_value_get_value (&values[3]), str, i % 5);
+    oml_value_set_type (&values[4], OML_VECTOR_DOUBLE_VALUE);
+    omlc_set_vector_double (*oml_value_get_value (&values[4]), vec, i % 4);
+    omlc_set_guid (*oml_value_get_value (&values[5]), (uint64_t)i << 40);
+    oml_value_set_type (&values[5], OML_GUID_VALUE);
+
+    fail_if(col_writer_append (writer, 1, i, i, 10. + i, values, 6), "Could not append row %d", i);
+  }
+  fail_unless(col_writer_append (writer, 1, i, i, 10. + i, values, 5) == -1,
+      "Row with the wrong number of values accepted");
+  oml_value_array_reset (values, 6);
+  fail_if(col_writer_seal (writer), "Could not seal segment");
+
+  fail_if(col_summary_read (dir, &summary), "Could not read summary");
+  fail_unless(summary.rows == ROUNDTRIP_ROWS, "Invalid row count: expected %d, got %d",
+      ROUNDTRIP_ROWS, (int)summary.rows);
+  fail_unless(summary.ts_min == 10. && summary.ts_max == 10. + ROUNDTRIP_ROWS - 1,
+      "Invalid time range [%f;%f]", summary.ts_min, summary.ts_max);
+
+  /* Index entries at rows 0, 1024 and 2048 */
+  fail_unless(col_index_find (dir, 5.) == 0, "Index lookup before the first row not at 0");
+  fail_unless(col_index_find (dir, 10. + COL_INDEX_STRIDE + 1) == COL_INDEX_STRIDE,
+      "Invalid index lookup: expected %d, got %d", COL_INDEX_STRIDE,
+      (int)col_index_find (dir, 10. + COL_INDEX_STRIDE + 1));
+
+  reader = col_reader_open (dir, schema);
+  fail_if(reader == NULL, "Could not open segment for reading");
+  fail_unless(reader->rows == ROUNDTRIP_ROWS, "Invalid readable row count %d", (int)reader->rows);
+  fail_if(col_reader_seek (reader, COL_INDEX_STRIDE + 3), "Could not seek");
+  for (i = COL_INDEX_STRIDE + 3; (ret = col_reader_next (reader)) > 0; i++) {
+    OmlValueU *v = oml_value_get_value (&reader->values[0]);
+    snprintf (str, sizeof (str), "row %d", i);
+    fail_unless(reader->seq == i && reader->ts_server == 10. + i, "Invalid metadata in row %d", i);
+    fail_unless(omlc_get_int32 (*v) == i, "Invalid int32 in row %d", i);
+    fail_unless(omlc_get_double (*oml_value_get_value (&reader->values[1])) == 1.5 * i, "Invalid double in row %d", i);
+    fail_unless(!strcmp (omlc_get_string_ptr (*oml_value_get_value (&reader->values[2])), str),
+        "Invalid string in row %d: %s", i, omlc_get_string_ptr (*oml_value_get_value (&reader->values[2])));
+    fail_unless(omlc_get_blob_length (*oml_value_get_value (&reader->values[3])) == (size_t)(i % 5) &&
+        !memcmp (omlc_get_blob_ptr (*oml_value_get_value (&reader->values[3])), str, i % 5),
+        "Invalid blob in row %d", i);
+    fail_unless(omlc_get_vector_nof_elts (*oml_value_get_value (&reader->values[4])) == i % 4,
+        "Invalid vector length in row %d", i);
+    if (i % 4 > 2) {
+      fail_unless(((double*)omlc_get_vector_ptr (*oml_value_get_value (&reader->values[4])))[2] == .5 * i,
+          "Invalid vector element in row %d", i);
+    }
+    fail_unless(omlc_get_guid (*oml_value_get_value (&reader->values[5])) == (uint64_t)i << 40,
+        "Invalid GUID in row %d", i);
+  }
+  fail_unless(ret == 0, "Error reading segment");
+  fail_unless(i == ROUNDTRIP_ROWS, "Read %d rows rather than %d", i, ROUNDTRIP_ROWS);
+  col_reader_close (reader);
+
+  /* A partially written row is ignored */
+  FILE *f = fopen ("columnar-segment/d", "ab");
+  fwrite (&summary.ts_min, sizeof (double), 1, f);
+  fclose (f);
+  reader = col_reader_open (dir, schema);
+  fail_unless(reader->rows == ROUNDTRIP_ROWS, "Partial row counted");
+  col_reader_close (reader);
+
+  /* ...even if all its offsets were written but not all its content */
+  fail_if(columnar_append_partial (dir), "Could not append partial row");
+  reader = col_reader_open (dir, schema);
+  fail_if(reader == NULL, "Could not open segment with partial content");
+  fail_unless(reader->rows == ROUNDTRIP_ROWS, "Row with partial content counted: %d rows", (int)reader->rows);
+  fail_if(col_reader_seek (reader, ROUNDTRIP_ROWS - 1), "Could not seek to the last row");
+  fail_unless(col_reader_next (reader) == 1, "Could not read the last complete row");
+  fail_unless(col_reader_next (reader) == 0, "Row with partial content read");
+  col_reader_close (reader);
+
+  schema_free (schema);
+}
+END_TEST
+
+START_TEST(test_columnar_backend)
+{
+  struct schema *schema = schema_from_meta ("1 columnar_table n:uint32 name:string");
+  Database *db;
+  DbTable *table;
+  OmlValue values[2];
+  unsigned int *ids;
+  char *meta;
+  int i, id;
+
+  o_set_log_level(-1);
+  system ("rm -rf columnar-test.col");
+  dbbackend = "columnar";
+  sqlite_database_dir = ".";
+  columnar_segment_rows = 3;
+
+  db = database_find ("columnar-test");
+  fail_if(db == NULL, "Could not create columnar database");
+  fail_unless(database_find_table (db, "_experiment_metadata") != NULL, "No _experiment_metadata table");
+  db->set_metadata (db, "start_time", "1332132092");
+  id = db->add_sender_id (db, "sender");
+  fail_unless(id == 1, "Invalid sender ID %d", id);
+  fail_unless(db->add_sender_id (db, "sender") == 1, "Sender ID not remembered");
+  fail_unless(db->stmt (db, "SELECT 1;") == -1, "SQL statement accepted");
+
+  table = database_find_or_create_table (db, schema);
+  fail_if(table == NULL, "Could not create table");
+
+  oml_value_array_init (values, 2);
+  oml_value_set_type (&values[0], OML_UINT32_VALUE);
+  oml_value_set_type (&values[1], OML_STRING_VALUE);
+  for (i = 0; i < 5; i++) {
+    omlc_set_uint32 (*oml_value_get_value (&values[0]), i);
+    omlc_set_string_copy (*oml_value_get_value (&values[1]), "x", 1);
+    fail_if(db->insert (db, table, id, i, 1. * i, values, 2), "Could not insert row %d", i);
+  }
+  database_release (db);
+
+  /* 3 rows in the first (sealed) segment, 2 in the second, sealed on release */
+  fail_unless(col_segments ("columnar-test.col/columnar_table", &ids) == 2, "Invalid segment count");
+  oml_free (ids);
+
+  db = database_find ("columnar-test");
+  fail_if(db == NULL, "Could not reopen columnar database");
+  meta = db->get_metadata (db, "start_time");
+  fail_unless(meta && !strcmp (meta, "1332132092"), "Invalid start_time %s", meta);
+  oml_free (meta);
+  fail_unless(db->add_sender_id (db, "other") == 2, "Sender IDs not restored");
+
+  table = database_find_table (db, "columnar_table");
+  fail_if(table == NULL, "Table not restored from the metadata");
+  fail_if(db->insert (db, table, id, 5, 5., values, 2), "Could not insert after reopening");
+  oml_value_array_reset (values, 2);
+  database_release (db);
+
+  /* Existing segments are never appended to */
+  fail_unless(col_segments ("columnar-test.col/columnar_table", &ids) == 3, "Invalid segment count");
+  fail_unless(ids[2] == 2, "Invalid new segment ID %u", ids[2]);
+  oml_free (ids);
+
+  schema_free (schema);
+  columnar_segment_rows = DEFAULT_COL_SEGMENT_ROWS;
+  dbbackend = "sqlite";
+}
+END_TEST
+
+Suite*
+columnar_suite (void)
+{
+  Suite* s = suite_create ("Columnar");
+
+  TCase* tc_columnar = tcase_create ("Columnar");
+  tcase_add_test (tc_columnar, test_columnar_roundtrip);
+  tcase_add_test (tc_columnar, test_columnar_backend);
+  suite_add_tcase (s, tc_columnar);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
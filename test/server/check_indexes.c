@@ -0,0 +1,146 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file check_indexes.c
+ * \brief Tests the lazy creation of secondary indexes on measurement tables.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <check.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "schema.h"
+#include "database.h"
+#include "database_adapter.h"
+
+extern char *dbbackend;
+extern char *sqlite_database_dir;
+
+/** Count the indexes of an SQLite3 database matching a name pattern, -1 on error */
+static int
+count_indexes (const char *path, const char *pattern)
+{
+  sqlite3 *conn;
+  sqlite3_stmt *stmt;
+  int n = -1;
+
+  if (sqlite3_open (path, &conn) != SQLITE_OK) {
+    return -1;
+  }
+  if (sqlite3_prepare_v2 (conn, "SELECT COUNT(*) FROM sqlite_master WHERE type='index' AND name LIKE ?;",
+        -1, &stmt, NULL) == SQLITE_OK) {
+    sqlite3_bind_text (stmt, 1, pattern, -1, SQLITE_STATIC);
+    if (sqlite3_step (stmt) == SQLITE_ROW) {
+      n = sqlite3_column_int (stmt, 0);
+    }
+    sqlite3_finalize (stmt);
+  }
+  sqlite3_close (conn);
+  return n;
+}
+
+START_TEST(test_indexes_lazy)
+{
+  struct schema *schema1 = schema_from_meta ("1 busy n:uint32");
+  struct schema *schema2 = schema_from_meta ("2 quiet n:uint32");
+  Database *db;
+  DbTable *busy, *quiet;
+  OmlValue value;
+  int i, id;
+
+  o_set_log_level(-1);
+  unlink ("indexes-test.sq3");
+  dbbackend = "sqlite";
+  sqlite_database_dir = ".";
+  db_indexes = "time,sender";
+  db_index_rows = 3;
+  fail_if(dba_indexes_setup (), "Valid index list rejected");
+
+  db = database_find ("indexes-test");
+  fail_if(db == NULL, "Could not create database");
+  id = db->add_sender_id (db, "sender");
+  busy = database_find_or_create_table (db, schema1);
+  quiet = database_find_or_create_table (db, schema2);
+  fail_if(busy == NULL || quiet == NULL, "Could not create tables");
+
+  oml_value_init (&value);
+  oml_value_set_type (&value, OML_UINT32_VALUE);
+  for (i = 0; i < 5; i++) {
+    omlc_set_uint32 (*oml_value_get_value (&value), i);
+    fail_if(db->insert (db, busy, id, i, 1. * i, &value, 1), "Could not insert row %d", i);
+    /* SQLite3 cannot index without blocking insertions */
+    fail_if(busy->indexed || busy->has_indexer, "Table indexed while inserting row %d", i + 1);
+  }
+  fail_if(db->insert (db, quiet, id, 0, 0., &value, 1), "Could not insert row");
+  fail_if(quiet->indexed, "Table indexed too early");
+  database_release (db);
+
+  fail_unless(count_indexes ("indexes-test.sq3", "busy_%") == 2, "Invalid number of indexes on busy table");
+  fail_unless(count_indexes ("indexes-test.sq3", "quiet_%") == 2, "Quiet table not indexed when closing");
+  fail_unless(count_indexes ("indexes-test.sq3", "busy_ts_server") == 1, "Invalid index name");
+  fail_unless(count_indexes ("indexes-test.sq3", "_experiment_metadata_%") == 0, "Metadata table indexed");
+
+  db_indexes = "time,unknown";
+  fail_unless(dba_indexes_setup () == -1, "Unknown index accepted");
+
+  schema_free (schema1);
+  schema_free (schema2);
+  db_indexes = NULL;
+  db_index_rows = 0;
+}
+END_TEST
+
+START_TEST(test_indexes_names)
+{
+  const char *prefix = "a_rather_long_measurement_point_name_from_some_application";
+  char table1[128], table2[128], name1[DBA_MAX_NAME_LENGTH + 1], name2[DBA_MAX_NAME_LENGTH + 1];
+
+  dba_derived_name (name1, "short", "sender_seq");
+  fail_if(strcmp (name1, "short_sender_seq"), "Short name changed to %s", name1);
+
+  snprintf (table1, sizeof (table1), "%s_%s", prefix, "received");
+  snprintf (table2, sizeof (table2), "%s_%s", prefix, "sent");
+  dba_derived_name (name1, table1, "sender_seq");
+  dba_derived_name (name2, table2, "sender_seq");
+  fail_unless(strlen (name1) <= DBA_MAX_NAME_LENGTH && strlen (name2) <= DBA_MAX_NAME_LENGTH,
+      "Names too long: %s, %s", name1, name2);
+  fail_unless(strcmp (name1, name2), "Tables with the same prefix got the same index name %s", name1);
+  fail_unless(!strncmp (name1, prefix, 20), "Name %s does not start like its table", name1);
+  fail_unless(!strcmp (name1 + strlen (name1) - strlen ("_sender_seq"), "_sender_seq"),
+      "Name %s does not end with its suffix", name1);
+}
+END_TEST
+
+Suite*
+indexes_suite (void)
+{
+  Suite* s = suite_create ("Indexes");
+
+  TCase* tc_indexes = tcase_create ("Indexes");
+  tcase_add_test (tc_indexes, test_indexes_lazy);
+  tcase_add_test (tc_indexes, test_indexes_names);
+  suite_add_tcase (s, tc_indexes);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,151 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file check_ingest_stats.c
+ * \brief Tests the ingest counters of the ClientHandlers and DbTables.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "mbuf.h"
+#include "database.h"
+#include "client_handler.h"
+#include "stats.h"
+#include "check_server.h"
+
+extern char *dbbackend;
+extern char *sqlite_database_dir;
+
+/* Prototypes of functions to test */
+
+void
+client_callback(SockEvtSource* source, void* handle, void* buf, int buf_size);
+
+START_TEST(test_stats_quantile)
+{
+  IngestStats *stats = stats_new (STATS_TABLE);
+  uint32_t last[STATS_HIST_BUCKETS];
+  int i;
+
+  fail_unless(stats_quantile (stats->insert_hist, NULL, .5) == 0., "Empty histogram has a median");
+
+  /* 198 fast insertions (<1us), one of about 100us and one of about 1s */
+  for (i = 0; i < 198; i++) {
+    stats_add_insert (stats, 500, 1);
+  }
+  stats_add_insert (stats, 100000, 1);
+  stats_add_insert (stats, 1000000000, 0);
+
+  fail_unless(stats->rows == 199, "Invalid row count: expected 199, got %d", (int)stats->rows);
+  fail_unless(stats_quantile (stats->insert_hist, NULL, .5) == 1.,
+      "Invalid median: expected 1, got %f", stats_quantile (stats->insert_hist, NULL, .5));
+  fail_unless(stats_quantile (stats->insert_hist, NULL, .99) == 128.,
+      "Invalid 99th percentile: expected 128, got %f", stats_quantile (stats->insert_hist, NULL, .99));
+  fail_unless(stats_quantile (stats->insert_hist, NULL, 1.) == (double)(1 << 20),
+      "Invalid maximum: expected %d, got %f", 1 << 20, stats_quantile (stats->insert_hist, NULL, 1.));
+
+  /* Only what happened since last is considered */
+  memcpy (last, stats->insert_hist, sizeof (last));
+  stats_add_insert (stats, 3000, 1);
+  fail_unless(stats_quantile (stats->insert_hist, last, .99) == 4.,
+      "Invalid 99th percentile: expected 4, got %f", stats_quantile (stats->insert_hist, last, .99));
+
+  stats_free (stats);
+}
+END_TEST
+
+START_TEST(test_stats_client)
+{
+  ClientHandler *ch;
+  SockEvtSource source;
+  char domain[] = "stats-test";
+  char dbname[sizeof(domain)+3];
+  char h[200];
+  char s[50];
+  int i, len = 0;
+
+  o_set_log_level(-1);
+  logdebug("%s\n", __FUNCTION__);
+
+  snprintf(dbname, sizeof(dbname), "%s.sq3", domain);
+  unlink(dbname);
+
+  memset(&source, 0, sizeof(SockEvtSource));
+  source.name = "stats socket";
+
+  ch = check_server_prepare_client_handler("test_stats_client", &source);
+  fail_unless(ch->stats != NULL, "No statistics for ClientHandler");
+
+  snprintf(h, sizeof(h), "protocol: 4\ndomain: %s\nstart-time: 1332132092\nsender-id: sender\n"
+      "app-name: app\nschema: 1 stats_table size:uint32\n\n", domain);
+  client_callback(&source, ch, h, strlen(h));
+  len += strlen(h);
+  fail_unless(ch->state == C_TEXT_DATA, "Inconsistent state: expected %d, got %d", C_TEXT_DATA, ch->state);
+  fail_unless(ch->stats->registered, "Statistics of ClientHandler not registered");
+  fail_unless(!strcmp(ch->stats->domain, domain) && !strcmp(ch->stats->name, "sender") &&
+      !strcmp(ch->stats->app, "app"), "Invalid labels %s:%s:%s",
+      ch->stats->domain, ch->stats->name, ch->stats->app);
+
+  for (i = 1; i <= 3; i++) {
+    snprintf(s, sizeof(s), "%f\t1\t%d\t%d\n", 1.5 * i, i, i);
+    client_callback(&source, ch, s, strlen(s));
+    len += strlen(s);
+  }
+  /* An incomplete sample stays pending */
+  client_callback(&source, ch, "4.5\t1\t", 6);
+  len += 6;
+
+  fail_unless(ch->stats->bytes == (uint64_t)len, "Invalid byte count: expected %d, got %d",
+      len, (int)ch->stats->bytes);
+  fail_unless(ch->stats->rows == 3, "Invalid row count: expected 3, got %d", (int)ch->stats->rows);
+  fail_unless(ch->stats->pending == 6, "Invalid pending bytes: expected 6, got %d", (int)ch->stats->pending);
+  fail_unless(ch->tables[1]->stats->rows == 3, "Invalid table row count: expected 3, got %d",
+      (int)ch->tables[1]->stats->rows);
+  fail_unless(!strcmp(ch->tables[1]->stats->name, "stats_table"), "Invalid table label %s",
+      ch->tables[1]->stats->name);
+
+  stats_report (1);
+  fail_unless(ch->stats->last_rows == 3 && ch->stats->last_bytes == (uint64_t)len,
+      "Reported counters not remembered");
+
+  database_release (ch->database);
+  check_server_destroy_client_handler(ch);
+}
+END_TEST
+
+Suite*
+ingest_stats_suite (void)
+{
+  Suite* s = suite_create ("Ingest statistics");
+
+  dbbackend = "sqlite";
+  sqlite_database_dir = ".";
+
+  TCase* tc_stats = tcase_create ("Statistics");
+  tcase_add_test (tc_stats, test_stats_quantile);
+  tcase_add_test (tc_stats, test_stats_client);
+  suite_add_tcase (s, tc_stats);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
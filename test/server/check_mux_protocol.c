@@ -0,0 +1,185 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file check_mux_protocol.c
+ * \brief Tests the demultiplexing of connections carrying several clients.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <check.h>
+#include <sqlite3.h>
+
+#include "ocomm/o_log.h"
+#include "oml_util.h"
+#include "mem.h"
+#include "mbuf.h"
+#include "mux.h"
+#include "database.h"
+#include "client_handler.h"
+#include "sqlite_adapter.h"
+#include "check_server.h"
+
+extern char *dbbackend;
+extern char *sqlite_database_dir;
+
+/* Prototypes of functions to test */
+
+void
+client_callback(SockEvtSource* source, void* handle, void* buf, int buf_size);
+
+/** Count the logical clients of a multiplexed ClientHandler */
+static int
+mux_count_children(ClientHandler *ch)
+{
+  int n = 0;
+  ClientHandler *it;
+  for (it = ch->mux_children; it; it = it->mux_next) {
+    n++;
+  }
+  return n;
+}
+
+START_TEST(test_mux_frame)
+{
+  uint8_t buf[MUX_HEADER_SIZE];
+  struct mux_frame frame;
+
+  fail_unless(mux_frame_header_write(buf, MUX_DATA, 0x01020304, 42) == MUX_HEADER_SIZE);
+  fail_unless(mux_frame_header_read(buf, MUX_HEADER_SIZE - 1, &frame) == 0,
+      "Incomplete frame header not detected");
+  fail_unless(mux_frame_header_read(buf, MUX_HEADER_SIZE, &frame) == MUX_HEADER_SIZE);
+  fail_unless(frame.type == MUX_DATA, "Invalid frame type: expected %d, got %d", MUX_DATA, frame.type);
+  fail_unless(frame.channel == 0x01020304, "Invalid channel: expected %u, got %u", 0x01020304, frame.channel);
+  fail_unless(frame.length == 42, "Invalid length: expected %u, got %u", 42, frame.length);
+
+  buf[0] = 0;
+  fail_unless(mux_frame_header_read(buf, MUX_HEADER_SIZE, &frame) == -1,
+      "Invalid frame type not detected");
+  mux_frame_header_write(buf, MUX_DATA, 1, MUX_MAX_PAYLOAD + 1);
+  fail_unless(mux_frame_header_read(buf, MUX_HEADER_SIZE, &frame) == -1,
+      "Oversized frame not detected");
+}
+END_TEST
+
+START_TEST(test_mux_demux)
+{
+  ClientHandler *ch;
+  Database *db;
+  sqlite3_stmt *stmt;
+  SockEvtSource source;
+  MBuffer *mbuf;
+
+  char domain[] = "mux-test";
+  char dbname[sizeof(domain)+3];
+  char table[] = "mux_table";
+  char h[200];
+  char s[50];
+  char select[200];
+  int i, rc;
+
+  o_set_log_level(-1);
+  logdebug("%s\n", __FUNCTION__);
+
+  snprintf(dbname, sizeof(dbname), "%s.sq3", domain);
+  unlink(dbname);
+
+  snprintf(select, sizeof(select), "select count(distinct oml_sender_id), count(*) from %s;", table);
+
+  memset(&source, 0, sizeof(SockEvtSource));
+  source.name = "mux socket";
+  ch = check_server_prepare_client_handler("test_mux_demux", &source);
+
+  /* Two clients, each sending its headers and one sample on its own channel,
+   * interleaved on the same connection */
+  mbuf = mbuf_create();
+  mbuf_print(mbuf, "%s: %d\n", MUX_HEADER_KEY, MUX_PROTOCOL_VERSION);
+  for (i = 1; i <= 2; i++) {
+    snprintf(h, sizeof(h), "sender%d", i);
+    mux_frame_write(mbuf, MUX_OPEN, i, h, strlen(h));
+  }
+  for (i = 1; i <= 2; i++) {
+    snprintf(h, sizeof(h), "protocol: 4\ndomain: %s\nstart-time: 1332132092\nsender-id: sender%d\n"
+        "app-name: %s\nschema: 1 %s size:uint32\n\n", domain, i, __FUNCTION__, table);
+    mux_frame_write(mbuf, MUX_DATA, i, h, strlen(h));
+  }
+  for (i = 1; i <= 2; i++) {
+    snprintf(s, sizeof(s), "%f\t1\t%d\t%d\n", 1.5 * i, 1, i);
+    mux_frame_write(mbuf, MUX_DATA, i, s, strlen(s));
+  }
+
+  /* Feed the connection in two pieces, splitting a frame */
+  client_callback(&source, ch, mbuf_rdptr(mbuf), 10);
+  fail_unless(ch->state == C_MUX, "Inconsistent state: expected %d, got %d", C_MUX, ch->state);
+  client_callback(&source, ch, mbuf_rdptr(mbuf) + 10, mbuf_fill(mbuf) - 10);
+
+  fail_unless(mux_count_children(ch) == 2,
+      "Unexpected number of logical clients: expected 2, got %d", mux_count_children(ch));
+  fail_unless(ch->mux_children->state == C_TEXT_DATA,
+      "Inconsistent logical client state: expected %d, got %d", C_TEXT_DATA, ch->mux_children->state);
+  fail_if(ch->mux_children->database == NULL);
+  fail_if(ch->mux_children->sender_name == NULL);
+
+  /* Close the first channel */
+  mbuf_clear(mbuf);
+  mux_frame_write(mbuf, MUX_CLOSE, 1, NULL, 0);
+  client_callback(&source, ch, mbuf_rdptr(mbuf), mbuf_fill(mbuf));
+  fail_unless(mux_count_children(ch) == 1,
+      "Unexpected number of logical clients after MUX_CLOSE: expected 1, got %d", mux_count_children(ch));
+  fail_unless(ch->mux_children->mux_channel == 2);
+
+  mbuf_destroy(mbuf);
+  while (ch->mux_children) {
+    client_handler_free(ch->mux_children);
+  }
+  check_server_destroy_client_handler(ch);
+
+  logdebug("Checking recorded data in %s.sq3\n", domain);
+  db = database_find(domain);
+  fail_if(db == NULL || ((Sq3DB*)(db->handle))->conn == NULL , "Cannot open SQLite3 database");
+  rc = sqlite3_prepare_v2(((Sq3DB*)(db->handle))->conn, select, -1, &stmt, 0);
+  fail_unless(rc == 0, "Preparation of statement `%s' failed; rc=%d", select, rc);
+  rc = sqlite3_step(stmt);
+  fail_unless(rc == 100, "Step of statement `%s' failed; rc=%d", select, rc);
+  fail_unless(sqlite3_column_int(stmt, 0) == 2,
+      "Invalid number of senders: expected 2, got %d", sqlite3_column_int(stmt, 0));
+  fail_unless(sqlite3_column_int(stmt, 1) == 2,
+      "Invalid number of rows: expected 2, got %d", sqlite3_column_int(stmt, 1));
+  sqlite3_finalize(stmt);
+
+  database_release(db);
+}
+END_TEST
+
+Suite*
+mux_protocol_suite (void)
+{
+  Suite* s = suite_create ("Multiplexing protocol");
+
+  dbbackend = "sqlite";
+  sqlite_database_dir = ".";
+
+  TCase* tc_mux = tcase_create ("Multiplexing");
+  tcase_add_test (tc_mux, test_mux_frame);
+  tcase_add_test (tc_mux, test_mux_demux);
+  suite_add_tcase (s, tc_mux);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,275 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file Tests the proxy's forwarding of binary streams with splice(2) and tee(2). */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <check.h>
+
+#include "ocomm/o_log.h"
+#include "ocomm/o_socket.h"
+#include "ocomm/o_eventloop.h"
+#include "mem.h"
+#include "mbuf.h"
+#include "oml_value.h"
+#include "marshal.h"
+#include "proxy_client.h"
+#include "session.h"
+
+#define PASSTHROUGH_FILE "passthrough-test.bin"
+
+/** Messages sent before passthrough can start, and once it has */
+#define PASSTHROUGH_QUEUED 5
+#define PASSTHROUGH_SPLICED 2000
+
+/** Give up after this many ticks of the test timer */
+#define PASSTHROUGH_MAX_TICKS 1000
+
+/** State shared with the EventLoop callbacks */
+static struct {
+  Session session;
+  Client *client;
+  int downstream_port;
+
+  int upstream;           // Socket of the OML client, sending to the proxy
+  int listener;           // Listening socket of the downstream server
+  int downstream;         // Connection accepted by the downstream server
+
+  MBuffer *sent;          // Everything sent by the OML client
+  size_t headers;         // Length of the headers in sent
+  MBuffer *received;      // Everything received by the downstream server
+  size_t expected;        // Amount of data after the headers expected downstream
+
+  int phase;
+  int ticks;
+  int spliced;            // Whether passthrough was active when the last data arrived
+} pt;
+
+/** Read callback of the proxy, as client_callback in oml2-proxy-server.c */
+static void
+passthrough_read (SockEvtSource *source, void *handle, void *buf, int buf_size)
+{
+  Client *client = (Client*)handle;
+
+  proxy_message_loop (source->name, client, buf, buf_size);
+  mbuf_repack_message (client->mbuf);
+  fwrite (buf, sizeof (char), buf_size, client->file);
+  client_sender_kick (client);
+}
+
+/** Connection callback of the proxy, as on_client_connect in oml2-proxy-server.c */
+static void
+passthrough_connect (Socket *sock, void *handle)
+{
+  (void)handle;
+  pt.client = client_new (sock, 4096, PASSTHROUGH_FILE, pt.downstream_port, "127.0.0.1");
+  pt.client->session = &pt.session;
+  pt.client->recv_event = eventloop_on_read_in_channel (sock, passthrough_read, NULL, pt.client);
+}
+
+/** Queue some binary messages from the OML client */
+static void
+passthrough_marshal (int first, int count)
+{
+  MBuffer *mbuf = mbuf_create ();
+  OmlValue v;
+  int i;
+
+  oml_value_init (&v);
+  for (i = first; i < first + count; i++) {
+    oml_value_set_type (&v, OML_INT32_VALUE);
+    omlc_set_int32 (*oml_value_get_value (&v), i);
+    mbuf_clear (mbuf);
+    marshal_init (mbuf, OMB_DATA_P);
+    marshal_measurements (mbuf, 1, i, i * 0.001);
+    marshal_values (mbuf, &v, 1);
+    marshal_finalize (mbuf);
+    mbuf_write (pt.sent, mbuf_rdptr (mbuf), mbuf_rd_remaining (mbuf));
+    fail_if (send (pt.upstream, mbuf_rdptr (mbuf), mbuf_rd_remaining (mbuf), 0) !=
+             (ssize_t)mbuf_rd_remaining (mbuf), "Could not send message %d", i);
+  }
+  oml_value_reset (&v);
+  mbuf_destroy (mbuf);
+  pt.expected = mbuf_fill (pt.sent) - pt.headers;
+}
+
+/** Find the length of the headers in a buffer, including the empty line */
+static size_t
+passthrough_headers_length (MBuffer *mbuf)
+{
+  char *buf = (char*)mbuf_buffer (mbuf);
+  size_t i;
+
+  for (i = 1; i < mbuf_fill (mbuf); i++) {
+    if (buf[i - 1] == '\n' && buf[i] == '\n') {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+/** Timer acting as the downstream server, and driving the OML client */
+static void
+passthrough_tick (TimerEvtSource *source, void *handle)
+{
+  char buf[4096];
+  size_t headers;
+  ssize_t result;
+  (void)source;
+  (void)handle;
+
+  if (pt.downstream < 0) {
+    pt.downstream = accept (pt.listener, NULL, NULL);
+    if (pt.downstream >= 0) {
+      fcntl (pt.downstream, F_SETFL, fcntl (pt.downstream, F_GETFL) | O_NONBLOCK);
+    }
+  }
+  if (pt.downstream >= 0) {
+    while ((result = recv (pt.downstream, buf, sizeof (buf), 0)) > 0) {
+      mbuf_write (pt.received, (uint8_t*)buf, result);
+    }
+  }
+
+  headers = passthrough_headers_length (pt.received);
+  if (headers > 0 && mbuf_fill (pt.received) - headers >= pt.expected) {
+    if (pt.phase == 0) {
+      /* The queue has been sent, so the rest can be spliced through */
+      pt.phase = 1;
+      passthrough_marshal (PASSTHROUGH_QUEUED + 1, PASSTHROUGH_SPLICED);
+    } else {
+      pt.spliced = pt.client->passthrough;
+      eventloop_stop (1);
+    }
+  }
+
+  if (++pt.ticks > PASSTHROUGH_MAX_TICKS) {
+    eventloop_stop (2);
+  }
+}
+
+START_TEST(test_passthrough_splice)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof (addr);
+  const char *headers = "protocol: 4\ndomain: passthrough\nstart-time: 1332132092\n"
+    "sender-id: sender\napp-name: passthrough\nschema: 1 pt i:int32\ncontent: binary\n\n";
+  Socket *server;
+  MBuffer *file;
+  FILE *f;
+  size_t length;
+  char buf[4096];
+
+  memset (&pt, 0, sizeof (pt));
+  pt.session.state = ProxyState_SENDING;
+  pt.session.zero_copy = 1;
+  pt.downstream = -1;
+  pt.sent = mbuf_create ();
+  pt.received = mbuf_create ();
+  unlink (PASSTHROUGH_FILE);
+
+  eventloop_init ();
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  pt.listener = socket (AF_INET, SOCK_STREAM, 0);
+  fail_if (pt.listener < 0);
+  fail_if (bind (pt.listener, (struct sockaddr*)&addr, sizeof (addr)) != 0);
+  fail_if (listen (pt.listener, 1) != 0);
+  fail_if (getsockname (pt.listener, (struct sockaddr*)&addr, &addrlen) != 0);
+  fcntl (pt.listener, F_SETFL, fcntl (pt.listener, F_GETFL) | O_NONBLOCK);
+  pt.downstream_port = ntohs (addr.sin_port);
+
+  server = socket_server_new ("passthrough", "127.0.0.1", "0", passthrough_connect, NULL);
+  fail_if (server == NULL, "Could not create proxy socket");
+  addrlen = sizeof (addr);
+  fail_if (getsockname (socket_get_sockfd (server), (struct sockaddr*)&addr, &addrlen) != 0);
+
+  pt.upstream = socket (AF_INET, SOCK_STREAM, 0);
+  fail_if (connect (pt.upstream, (struct sockaddr*)&addr, sizeof (addr)) != 0,
+           "Could not connect to proxy: %s", strerror (errno));
+
+  mbuf_write (pt.sent, (uint8_t*)headers, strlen (headers));
+  pt.headers = strlen (headers);
+  fail_if (send (pt.upstream, headers, strlen (headers), 0) != (ssize_t)strlen (headers));
+  passthrough_marshal (1, PASSTHROUGH_QUEUED);
+
+  eventloop_every_ms ("passthrough", 10, passthrough_tick, NULL);
+  fail_unless (eventloop_run () == 1, "Timed out after receiving %zu/%zu bytes downstream",
+               mbuf_fill (pt.received), pt.headers + pt.expected);
+
+  fail_if (pt.client == NULL);
+#ifdef __linux__
+  fail_unless (pt.spliced, "Data was not spliced through");
+#endif
+  fail_unless (pt.client->pass_inflight == 0 && pt.client->pass_unsent == 0,
+               "Data still in flight: %zu copied, %zu unsent",
+               pt.client->pass_inflight, pt.client->pass_unsent);
+  fail_unless (pt.client->pass_queued == 0 && pt.client->pass_ready == 0,
+               "Inconsistent pipe accounting: %zu bytes queued, %zu ready",
+               pt.client->pass_queued, pt.client->pass_ready);
+
+  /* Everything after the headers reached the downstream server unchanged */
+  length = passthrough_headers_length (pt.received);
+  fail_unless (mbuf_fill (pt.received) - length == pt.expected,
+               "Expected %zu bytes downstream, got %zu", pt.expected, mbuf_fill (pt.received) - length);
+  fail_unless (!memcmp (mbuf_buffer (pt.received) + length, mbuf_buffer (pt.sent) + pt.headers, pt.expected),
+               "Data forwarded downstream differs from data sent");
+
+  /* ...and everything, headers included, was written to the file */
+  fflush (pt.client->file);
+  file = mbuf_create ();
+  f = fopen (PASSTHROUGH_FILE, "r");
+  fail_if (f == NULL);
+  while ((length = fread (buf, 1, sizeof (buf), f)) > 0) {
+    mbuf_write (file, (uint8_t*)buf, length);
+  }
+  fclose (f);
+  fail_unless (mbuf_fill (file) == mbuf_fill (pt.sent),
+               "Expected %zu bytes in file, got %zu", mbuf_fill (pt.sent), mbuf_fill (file));
+  fail_unless (!memcmp (mbuf_buffer (file), mbuf_buffer (pt.sent), mbuf_fill (file)),
+               "Data written to file differs from data sent");
+
+  close (pt.upstream);
+  close (pt.downstream);
+  close (pt.listener);
+  mbuf_destroy (file);
+  mbuf_destroy (pt.sent);
+  mbuf_destroy (pt.received);
+}
+END_TEST
+
+Suite*
+passthrough_suite (void)
+{
+  Suite* s = suite_create ("Passthrough");
+
+  TCase* tc_passthrough = tcase_create ("Passthrough");
+  tcase_set_timeout (tc_passthrough, 30);
+  tcase_add_test (tc_passthrough, test_passthrough_splice);
+  suite_add_tcase (s, tc_passthrough);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
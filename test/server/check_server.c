@@ -52,6 +52,7 @@ check_server_prepare_client_handler(const char* name, SockEvtSource *source) {
   ch->state = C_HEADER;
   ch->content = C_TEXT_DATA;
   ch->mbuf = mbuf_create ();
+  ch->stats = stats_new (STATS_CLIENT);
   ch->socket = NULL;
   ch->event = source;
   strncpy (ch->name, name, MAX_STRING_SIZE);
@@ -69,6 +70,13 @@ void
 check_server_destroy_client_handler(ClientHandler* ch)
 {
   mbuf_destroy(ch->mbuf);
+  if (ch->ack_out)
+    mbuf_destroy(ch->ack_out);
+  if (ch->ack_sent)
+    oml_free(ch->ack_sent);
+  if (ch->resume)
+    resume_state_release(ch->resume);
+  stats_free(ch->stats);
   oml_free(ch);
 }
 
@@ -80,6 +88,15 @@ main (void)
   o_set_log_file ("check_server_oml.log");
   SRunner *sr = srunner_create (text_protocol_suite ());
   srunner_add_suite (sr, binary_protocol_suite ());
+  srunner_add_suite (sr, mux_protocol_suite ());
+  srunner_add_suite (sr, ack_protocol_suite ());
+  srunner_add_suite (sr, ingest_stats_suite ());
+  srunner_add_suite (sr, columnar_suite ());
+  srunner_add_suite (sr, sqlite_writer_suite ());
+  srunner_add_suite (sr, indexes_suite ());
+  srunner_add_suite (sr, binary_vectors_suite ());
+  srunner_add_suite (sr, passthrough_suite ());
+  srunner_add_suite (sr, spool_suite ());
   //  srunner_add_suite (sr, database_suite ()); /* For example ... */
 
   srunner_run_all (sr, CK_ENV);
@@ -28,6 +28,15 @@
 
 extern Suite* text_protocol_suite (void);
 extern Suite* binary_protocol_suite (void);
+extern Suite* mux_protocol_suite (void);
+extern Suite* ack_protocol_suite (void);
+extern Suite* ingest_stats_suite (void);
+extern Suite* columnar_suite (void);
+extern Suite* sqlite_writer_suite (void);
+extern Suite* indexes_suite (void);
+extern Suite* binary_vectors_suite (void);
+extern Suite* passthrough_suite (void);
+extern Suite* spool_suite (void);
 
 #endif /* CHECK_LIBOML2_SUITES_H__ */
 
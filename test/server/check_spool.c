@@ -0,0 +1,282 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file Tests the proxy's on-disk overflow of message queues. */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <check.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "message.h"
+#include "message_queue.h"
+#include "message_spool.h"
+#include "proxy_client.h"
+#include "session.h"
+
+#define SPOOL_FILE "spool-test.spool"
+#define SPOOL_CLIENT_FILE "spool-client.bin"
+#define SPOOL_CLIENT_SPOOL SPOOL_CLIENT_FILE ".spool"
+
+/** Length of the messages given to the receiver, dividing the CBuffer page size */
+#define SPOOL_MESSAGE_LENGTH 32
+
+/** Fill a message with content depending on its sequence number.
+ *
+ * \param seqno sequence number of the message
+ * \param[out] msg description of the message
+ * \param[out] buf buffer for the message
+ * \param length length of the message, at most sizeof(buf)
+ */
+static void
+spool_message (int seqno, struct oml_message *msg, char *buf, size_t length)
+{
+  size_t i;
+
+  memset (msg, 0, sizeof (*msg));
+  msg->stream = seqno % 3;
+  msg->seqno = seqno;
+  msg->timestamp = seqno * .5;
+  msg->type = MSG_BINARY;
+  msg->length = length;
+  for (i = 0; i < length; i++) {
+    buf[i] = (char)(seqno + i);
+  }
+}
+
+/** Size of a file, or -1 if it does not exist */
+static off_t
+spool_file_size (const char *path)
+{
+  struct stat st;
+  return stat (path, &st) ? -1 : st.st_size;
+}
+
+/** Check that the next message of a spool is the expected one */
+static void
+spool_check_shift (struct msg_spool *spool, int seqno, size_t length)
+{
+  struct oml_message msg, expected;
+  char data[1024], *buf = NULL;
+
+  spool_message (seqno, &expected, data, length);
+  fail_unless (msg_spool_shift (spool, &msg, &buf) == (int)length,
+               "Could not read message %d back", seqno);
+  fail_unless (msg.seqno == expected.seqno && msg.stream == expected.stream &&
+               msg.timestamp == expected.timestamp && msg.length == length,
+               "Message %d read back as %u (stream %d, length %u)",
+               seqno, msg.seqno, msg.stream, msg.length);
+  fail_unless (!memcmp (buf, data, length), "Content of message %d differs", seqno);
+}
+
+START_TEST(test_spool_order)
+{
+  struct msg_spool *spool;
+  struct oml_message msg;
+  char data[1024], *buf;
+  size_t bytes = 0;
+  int i, next = 0;
+
+  o_set_log_level (-1);
+  unlink (SPOOL_FILE);
+  spool = msg_spool_create (SPOOL_FILE);
+  fail_if (spool == NULL, "Could not create spool");
+  fail_unless (spool_file_size (SPOOL_FILE) == -1, "Spool file created before being needed");
+  fail_unless (msg_spool_shift (spool, &msg, &buf) == 0, "Message read from an empty spool");
+
+  /* More than the readahead, with messages of various lengths */
+  for (i = 0; i < 500; i++) {
+    spool_message (i, &msg, data, 1 + (i * 37) % 1000);
+    fail_if (msg_spool_append (spool, &msg, data, msg.length), "Could not append message %d", i);
+    bytes += msg.length;
+  }
+  fail_unless (spool->count == 500 && spool->bytes == bytes,
+               "Spool has %zu messages (%zu bytes), expected 500 (%zu bytes)",
+               spool->count, spool->bytes, bytes);
+  fail_unless (spool_file_size (SPOOL_FILE) > (off_t)bytes, "Messages not written to the spool file");
+
+  /* Messages appended while reading back come after the others */
+  for (; next < 250; next++) {
+    spool_check_shift (spool, next, 1 + (next * 37) % 1000);
+  }
+  for (; i < 600; i++) {
+    spool_message (i, &msg, data, 1 + (i * 37) % 1000);
+    fail_if (msg_spool_append (spool, &msg, data, msg.length), "Could not append message %d", i);
+  }
+  for (; next < 600; next++) {
+    spool_check_shift (spool, next, 1 + (next * 37) % 1000);
+  }
+  fail_unless (spool->count == 0 && spool->bytes == 0, "Spool not empty after reading everything back");
+  fail_unless (msg_spool_shift (spool, &msg, &buf) == 0, "Message read from an emptied spool");
+  fail_unless (spool_file_size (SPOOL_FILE) == 0, "Spool file not truncated once emptied");
+
+  /* ...and the file is reused from its start */
+  spool_message (i, &msg, data, 10);
+  fail_if (msg_spool_append (spool, &msg, data, msg.length), "Could not append to an emptied spool");
+  spool_check_shift (spool, i, 10);
+
+  msg_spool_destroy (spool);
+  fail_unless (spool_file_size (SPOOL_FILE) == -1, "Spool file not removed");
+}
+END_TEST
+
+START_TEST(test_spool_write_failure)
+{
+  struct msg_spool *spool;
+  struct oml_message msg;
+  char data[64];
+
+  o_set_log_level (-1);
+  unlink (SPOOL_FILE);
+  spool = msg_spool_create (SPOOL_FILE);
+  fail_if (spool == NULL, "Could not create spool");
+  spool_message (1, &msg, data, sizeof (data));
+  fail_if (msg_spool_append (spool, &msg, data, msg.length), "Could not append message");
+
+  /* Writing the header fails */
+  close (spool->fd);
+  spool->fd = open (SPOOL_FILE, O_RDONLY);
+  fail_if (spool->fd < 0, "Could not reopen spool file");
+  spool_message (2, &msg, data, sizeof (data));
+  fail_unless (msg_spool_append (spool, &msg, data, msg.length) == -1,
+               "Message appended to a read-only spool");
+  fail_unless (spool->count == 1 && spool->bytes == sizeof (data) &&
+               spool->write_offset == (off_t)(sizeof (msg) + sizeof (data)),
+               "Failed append accounted for");
+
+  /* What was spooled before is still there */
+  close (spool->fd);
+  spool->fd = open (SPOOL_FILE, O_RDWR);
+  fail_if (spool->fd < 0, "Could not reopen spool file");
+  spool_check_shift (spool, 1, sizeof (data));
+
+  msg_spool_destroy (spool);
+
+  /* The spool file cannot be created */
+  spool = msg_spool_create ("nonexistent-directory/" SPOOL_FILE);
+  fail_if (spool == NULL, "Could not create spool");
+  fail_unless (msg_spool_append (spool, &msg, data, msg.length) == -1,
+               "Message appended to a spool without a file");
+  fail_unless (spool->count == 0, "Failed append accounted for");
+  msg_spool_destroy (spool);
+}
+END_TEST
+
+START_TEST(test_spool_client)
+{
+  Session session;
+  Client *client;
+  struct msg_queue_node *head;
+  struct oml_message msg;
+  char data[SPOOL_MESSAGE_LENGTH];
+  int i;
+
+  o_set_log_level (-1);
+  unlink (SPOOL_CLIENT_SPOOL);
+  memset (&session, 0, sizeof (session));
+  session.memory_limit = 3 * SPOOL_MESSAGE_LENGTH;
+
+  client = client_new (NULL, 4096, SPOOL_CLIENT_FILE, 3003, "127.0.0.1");
+  fail_if (client == NULL, "Could not create client");
+  client->session = &session;
+
+  /* Messages go to disk past the memory limit... */
+  for (i = 0; i < 10; i++) {
+    spool_message (i, &msg, data, sizeof (data));
+    store_received_message (client, &msg, data, sizeof (data));
+    fail_if (session.memory_used > session.memory_limit,
+             "Memory limit exceeded after message %d: %zu bytes", i, session.memory_used);
+  }
+  fail_unless (client->messages->length == 3, "%zu messages in memory, expected 3",
+               client->messages->length);
+  fail_unless (client->spool != NULL && client->spool->count == 7,
+               "Messages not spooled past the memory limit");
+  fail_unless (spool_file_size (SPOOL_CLIENT_SPOOL) > 0, "Spool file not written");
+
+  /* ...and come back in order as the queue is consumed */
+  for (i = 0; i < 10; i++) {
+    spool_message (i, &msg, data, sizeof (data));
+    head = msg_queue_head (client->messages);
+    fail_if (head == NULL, "Message %d missing", i);
+    fail_unless (head->msg->seqno == (uint32_t)i, "Got message %u instead of %d", head->msg->seqno, i);
+    fail_unless (cbuf_cursor_page_remaining (&head->cursor) >= sizeof (data) &&
+                 !memcmp (cbuf_cursor_pointer (&head->cursor), data, sizeof (data)),
+                 "Content of message %d differs", i);
+    client_message_consume (client);
+    fail_if (session.memory_used > session.memory_limit,
+             "Memory limit exceeded after reloading message %d", i);
+  }
+  fail_unless (client->messages->length == 0 && client->spool->count == 0,
+               "Messages left after consuming everything");
+  fail_unless (session.memory_used == 0, "%zu bytes still accounted for", session.memory_used);
+
+  client_free (client);
+  fail_unless (spool_file_size (SPOOL_CLIENT_SPOOL) == -1, "Spool file not removed");
+  unlink (SPOOL_CLIENT_FILE);
+}
+END_TEST
+
+START_TEST(test_spool_client_failure)
+{
+  Session session;
+  Client *client;
+  struct oml_message msg;
+  char data[SPOOL_MESSAGE_LENGTH];
+  int i;
+
+  o_set_log_level (-1);
+  memset (&session, 0, sizeof (session));
+  session.memory_limit = SPOOL_MESSAGE_LENGTH;
+
+  /* The spool cannot be written next to the output file */
+  client = client_new (NULL, 4096, "nonexistent-directory/" SPOOL_CLIENT_FILE, 3003, "127.0.0.1");
+  fail_if (client == NULL, "Could not create client");
+  client->session = &session;
+
+  for (i = 0; i < 5; i++) {
+    spool_message (i, &msg, data, sizeof (data));
+    store_received_message (client, &msg, data, sizeof (data));
+  }
+  fail_unless (client->messages->length == 5, "Messages lost when the spool could not be written");
+  fail_unless (client->spool == NULL || client->spool->count == 0, "Failed appends accounted for");
+
+  for (i = 0; i < 5; i++) {
+    client_message_consume (client);
+  }
+  fail_unless (session.memory_used == 0, "%zu bytes still accounted for", session.memory_used);
+  client_free (client);
+}
+END_TEST
+
+Suite*
+spool_suite (void)
+{
+  Suite* s = suite_create ("Spool");
+
+  TCase* tc_spool = tcase_create ("Spool");
+  tcase_add_test (tc_spool, test_spool_order);
+  tcase_add_test (tc_spool, test_spool_write_failure);
+  tcase_add_test (tc_spool, test_spool_client);
+  tcase_add_test (tc_spool, test_spool_client_failure);
+  suite_add_tcase (s, tc_spool);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file check_sqlite_writer.c
+ * \brief Tests the writer threads of the SQLite3 backend.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+#include <check.h>
+
+#include "ocomm/o_log.h"
+#include "mem.h"
+#include "oml_value.h"
+#include "schema.h"
+#include "database.h"
+#include "sqlite_adapter.h"
+
+extern char *dbbackend;
+extern char *sqlite_database_dir;
+
+#define WRITER_ROWS 100
+
+/** Count the rows of a table in an SQLite3 database, -1 on error */
+static int
+count_rows (const char *path, const char *table)
+{
+  sqlite3 *conn;
+  sqlite3_stmt *stmt;
+  char sql[64];
+  int n = -1;
+
+  snprintf (sql, sizeof (sql), "SELECT COUNT(*), SUM(n) FROM %s;", table);
+  if (sqlite3_open (path, &conn) != SQLITE_OK) {
+    return -1;
+  }
+  if (sqlite3_prepare_v2 (conn, sql, -1, &stmt, NULL) == SQLITE_OK) {
+    if (sqlite3_step (stmt) == SQLITE_ROW &&
+        sqlite3_column_int (stmt, 1) == WRITER_ROWS * (WRITER_ROWS - 1) / 2) {
+      n = sqlite3_column_int (stmt, 0);
+    }
+    sqlite3_finalize (stmt);
+  }
+  sqlite3_close (conn);
+  return n;
+}
+
+START_TEST(test_sqlite_writer)
+{
+  struct schema *schema = schema_from_meta ("1 writer_table n:uint32 name:string v:[int32]");
+  Database *db;
+  DbTable *table;
+  OmlValue values[3];
+  int32_t vec[2] = { 1, 2 };
+  char name[16];
+  int i, id, n;
+
+  o_set_log_level(-1);
+  unlink ("sqlite-writer-test.sq3");
+  dbbackend = "sqlite";
+  sqlite_database_dir = ".";
+  sqlite_writer_queue = 4;
+
+  db = database_find ("sqlite-writer-test");
+  fail_if(db == NULL, "Could not create database");
+  fail_unless(((Sq3DB*)db->handle)->has_writer, "No writer thread started");
+  id = db->add_sender_id (db, "sender");
+  table = database_find_or_create_table (db, schema);
+  fail_if(table == NULL, "Could not create table");
+
+  oml_value_array_init (values, 3);
+  oml_value_set_type (&values[0], OML_UINT32_VALUE);
+  oml_value_set_type (&values[1], OML_STRING_VALUE);
+  oml_value_set_type (&values[2], OML_VECTOR_INT32_VALUE);
+  for (i = 0; i < WRITER_ROWS; i++) {
+    snprintf (name, sizeof (name), "row %d", i);
+    omlc_set_uint32 (*oml_value_get_value (&values[0]), i);
+    /* The values are reused straight away, so they must have been copied */
+    omlc_set_string_copy (*oml_value_get_value (&values[1]), name, strlen (name));
+    omlc_set_vector_int32 (*oml_value_get_value (&values[2]), vec, i % 3);
+    fail_if(db->insert (db, table, id, i, 1. * i, values, 3), "Could not queue row %d", i);
+  }
+  oml_value_array_reset (values, 3);
+
+  /* Metadata can be accessed while the writer thread is working */
+  db->set_metadata (db, "writer", "test");
+  database_release (db);
+
+  n = count_rows ("sqlite-writer-test.sq3", "writer_table");
+  fail_unless(n == WRITER_ROWS, "Expected %d rows, found %d", WRITER_ROWS, n);
+
+  schema_free (schema);
+  sqlite_writer_queue = 0;
+}
+END_TEST
+
+Suite*
+sqlite_writer_suite (void)
+{
+  Suite* s = suite_create ("SQLiteWriter");
+
+  TCase* tc_writer = tcase_create ("SQLiteWriter");
+  tcase_add_test (tc_writer, test_sqlite_writer);
+  suite_add_tcase (s, tc_writer);
+
+  return s;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
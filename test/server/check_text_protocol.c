@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <math.h>
+#include <errno.h>
 #include <check.h>
 #include <sqlite3.h>
 #include <libgen.h>
@@ -23,6 +24,8 @@
 #include "oml_util.h"
 #include "mem.h"
 #include "mbuf.h"
+#include "oml_value.h"
+#include "text.h"
 #include "database.h"
 #include "client_handler.h"
 #include "sqlite_adapter.h"
@@ -529,6 +532,77 @@ START_TEST(test_text_metadata)
 }
 END_TEST
 
+/* Representations which may or may not take the fast conversion paths */
+static const char *decoder_reps[] = {
+  "0", "-0", "+12", "007", "0x1F", " 5", "12abc", "999999999", "1234567890",
+  "-2147483648", "4294967295", "-1", "18446744073709551615", "123456789012345678",
+  "1e3", "0.1", "-13.37", "1.096202", "123456789012345", "1234567890123456",
+  "0.000000000000001", ".5", "5.", ".", "-", "inf", "NAN", "", "a\\tb\\\\c", "\\x",
+};
+
+START_TEST(test_text_decoder)
+{
+  OmlValueT types[] = { OML_INT32_VALUE, OML_UINT32_VALUE, OML_INT64_VALUE,
+    OML_UINT64_VALUE, OML_DOUBLE_VALUE, OML_STRING_VALUE, OML_BOOL_VALUE };
+  struct schema_field field = { "val", types[_i] };
+  struct schema schema = { "decoder", &field, 1, 1 };
+  struct text_decoder *decoder = text_decoder_new (&schema);
+  OmlValue expected, actual;
+  char buf[64], *fields[1] = { buf };
+  size_t i;
+  int rc;
+
+  fail_if (decoder == NULL);
+  oml_value_init (&expected);
+  oml_value_init (&actual);
+
+  /* The same OmlValue is reused for all conversions, as the server does */
+  for (i = 0; i < LENGTH (decoder_reps); i++) {
+    oml_value_reset (&expected);
+    oml_value_set_type (&expected, types[_i]);
+    errno = 0;
+    rc = oml_value_from_s (&expected, decoder_reps[i]);
+
+    /* Out of range values are rejected either way */
+    strncpy (buf, decoder_reps[i], sizeof (buf));
+    errno = 0;
+    fail_unless ((text_decoder_decode (decoder, fields, &actual) < 0) == (rc == -1),
+                 "'%s' not rejected consistently", decoder_reps[i]);
+    fail_unless (oml_value_get_type (&actual) == types[_i]);
+    if (rc == -1)
+      continue;
+
+    switch (types[_i]) {
+    case OML_DOUBLE_VALUE:
+      fail_unless ((isnan (omlc_get_double (*oml_value_get_value (&expected))) &&
+                    isnan (omlc_get_double (*oml_value_get_value (&actual)))) ||
+                   !memcmp (oml_value_get_value (&expected), oml_value_get_value (&actual), sizeof (double)),
+                   "'%s' decoded as %.17g, not %.17g", decoder_reps[i],
+                   omlc_get_double (*oml_value_get_value (&actual)),
+                   omlc_get_double (*oml_value_get_value (&expected)));
+      break;
+    case OML_STRING_VALUE:
+      fail_unless (!strcmp (omlc_get_string_ptr (*oml_value_get_value (&expected)),
+                            omlc_get_string_ptr (*oml_value_get_value (&actual))),
+                   "'%s' decoded as '%s', not '%s'", decoder_reps[i],
+                   omlc_get_string_ptr (*oml_value_get_value (&actual)),
+                   omlc_get_string_ptr (*oml_value_get_value (&expected)));
+      break;
+    default:
+      fail_unless (oml_value_to_double (&expected) == oml_value_to_double (&actual) &&
+                   !memcmp (oml_value_get_value (&expected), oml_value_get_value (&actual), sizeof (uint64_t)),
+                   "'%s' decoded as %g, not %g", decoder_reps[i],
+                   oml_value_to_double (&actual), oml_value_to_double (&expected));
+      break;
+    }
+  }
+
+  oml_value_reset (&expected);
+  oml_value_reset (&actual);
+  text_decoder_free (decoder);
+}
+END_TEST
+
 Suite*
 text_protocol_suite (void)
 {
@@ -540,6 +614,7 @@ text_protocol_suite (void)
   TCase* tc_text_insert = tcase_create ("Text insert");
   tcase_add_test (tc_text_insert, test_text_insert);
   tcase_add_loop_test (tc_text_insert, test_text_types, 0, LENGTH (type_tests));
+  tcase_add_loop_test (tc_text_insert, test_text_decoder, 0, 7);
   suite_add_tcase (s, tc_text_insert);
 
   TCase* tc_text_flex = tcase_create ("Text flexibility");
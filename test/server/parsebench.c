@@ -0,0 +1,507 @@
+/*
+ * Copyright 2013 National ICT Australia (NICTA)
+ *
+ * This software may be used and distributed solely under the terms of
+ * the MIT license (License).  You should find a copy of the License in
+ * COPYING or at http://opensource.org/licenses/MIT. By downloading or
+ * using this software you accept the terms and the liability disclaimer
+ * in the License.
+ */
+/** \file parsebench.c
+ * \brief Measure the throughput of the message parsers.
+ *
+ * Each trace is a stream as sent by a client (e.g., a proxy result file, or
+ * the output of a client writing to file:), headers included. Its messages
+ * are framed as the proxy does, feeding the data in 64kiB pieces, then
+ * scanned for delimiters as the server does. This is repeated with each
+ * variant of the scanning kernels supported by the CPU.
+ *
+ * The samples of text traces are then also converted to OmlValues, both with
+ * the generic oml_value_from_s, as the server used to, and with the
+ * text_decoder of their schema.
+ *
+ * The samples of binary traces are unmarshalled into the same OmlValues,
+ * either reset between samples, releasing their storage as the server used
+ * to, or only cleared, so strings, blobs and vectors reuse it.
+ *
+ * Without traces, a binary and a text one are generated, with the same
+ * 100000 samples of an int32, a double and a short string, as well as a text
+ * one using the representations of each type tested in check_text_protocol.c,
+ * and a binary one with four strings and a vector of doubles per sample.
+ *
+ * Usage: parsebench [-n iterations] [trace...]
+ */
+#define _GNU_SOURCE /* memmem(3) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "ocomm/o_log.h"
+#include "oml2/omlc.h"
+#include "mbuf.h"
+#include "marshal.h"
+#include "oml_value.h"
+#include "schema.h"
+#include "binary.h"
+#include "text.h"
+#include "scan.h"
+
+#define CHUNK_SIZE (64 * 1024)
+#define SAMPLES 100000
+#define MAX_SCHEMAS 16
+#define MAX_FIELDS 64
+
+enum trace_kind {
+  TRACE_BINARY,
+  TRACE_TEXT,
+  TRACE_FIXTURES,
+  TRACE_STRINGS,
+};
+
+struct trace {
+  const char *name;
+  int binary;
+  uint8_t *data;  /* Whole trace, headers included */
+  size_t length;
+  size_t body;    /* Offset of the first message */
+  struct schema *schemas[MAX_SCHEMAS];
+  struct text_decoder *decoders[MAX_SCHEMAS];
+};
+
+/* Representations of each type, as in check_text_protocol.c:type_tests */
+static const char fixtures_schema[] =
+  "2 fixtures i32:int32 u32:uint32 i64:int64 u64:uint64 d:double dn:double s:string b:bool";
+static const char *fixtures[][8] = {
+  { "-2147483647", "2147483647", "-9223372036854775807", "9223372036854775807",
+    "13.37", "NAN", "string", "FaLsE" },
+  { "1", "2", "3", "4", "1.096202", "", "", "1" },
+};
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** Find the end of the headers, and the content type */
+static int
+trace_parse_headers (struct trace *trace)
+{
+  const char *end = memmem (trace->data, trace->length, "\n\n", 2);
+
+  if (end == NULL) {
+    fprintf (stderr, "%s: no end of headers found\n", trace->name);
+    return -1;
+  }
+  const char *line, *eol;
+  char meta[1024];
+  struct schema *schema;
+
+  trace->body = (const uint8_t*)end + 2 - trace->data;
+  trace->binary = memmem (trace->data, trace->body, "content: binary", 15) != NULL;
+
+  for (line = (const char*)trace->data; line < end; line = eol + 1) {
+    eol = memchr (line, '\n', end + 1 - line);
+    if (strncmp (line, "schema: ", 8) || eol - line - 8 >= (int)sizeof (meta))
+      continue;
+    memcpy (meta, line + 8, eol - line - 8);
+    meta[eol - line - 8] = '\0';
+    schema = schema_from_meta (meta);
+    if (schema && schema->index >= 0 && schema->index < MAX_SCHEMAS) {
+      trace->schemas[schema->index] = schema;
+      trace->decoders[schema->index] = text_decoder_new (schema);
+    }
+  }
+
+  return 0;
+}
+
+static int
+trace_load (struct trace *trace, const char *path)
+{
+  FILE *f = fopen (path, "r");
+  size_t size = CHUNK_SIZE, n;
+
+  if (f == NULL) {
+    fprintf (stderr, "%s: %s\n", path, strerror (errno));
+    return -1;
+  }
+  trace->name = path;
+  trace->data = malloc (size);
+  trace->length = 0;
+  while (trace->data && (n = fread (trace->data + trace->length, 1, size - trace->length, f)) > 0) {
+    trace->length += n;
+    if (trace->length == size)
+      trace->data = realloc (trace->data, size *= 2);
+  }
+  fclose (f);
+  if (trace->data == NULL) {
+    fprintf (stderr, "%s: out of memory\n", path);
+    return -1;
+  }
+
+  return trace_parse_headers (trace);
+}
+
+/** Generate a trace of SAMPLES samples of (int32, double, string), or of
+ * the fixtures */
+static int
+trace_generate (struct trace *trace, enum trace_kind kind)
+{
+  MBuffer *mbuf = mbuf_create ();
+  OmlValue v[5];
+  OmlValueU u;
+  char s[64];
+  int i, j;
+
+  int binary = kind == TRACE_BINARY || kind == TRACE_STRINGS;
+  double vector[8];
+
+  mbuf_print (mbuf, "protocol: 4\ndomain: bench\nstart-time: 1\nsender-id: s\napp-name: a\n"
+              "schema: 1 bench_mp i:int32 d:double s:string\nschema: %s\n"
+              "schema: 3 strings_mp host:string iface:string state:string note:string v:[double]\n"
+              "content: %s\n\n",
+              fixtures_schema, binary ? "binary" : "text");
+  oml_value_array_init (v, 5);
+  for (i = 0; i < SAMPLES; i++) {
+    double ts = i * 0.001;
+
+    snprintf (s, sizeof (s), "sample%d", i);
+    if (kind == TRACE_FIXTURES) {
+      mbuf_print (mbuf, "%f\t2\t%d", ts, i + 1);
+      for (j = 0; j < 8; j++)
+        mbuf_print (mbuf, "\t%s", fixtures[i % 2][j]);
+      mbuf_print (mbuf, "\n");
+    } else if (kind == TRACE_STRINGS) {
+      const char *strings[] = { s, "wlan0", i % 3 ? "associated" : "disassociated",
+        i % 2 ? "link quality above threshold" : "" };
+      snprintf (s, sizeof (s), "node%03d.testbed.example.org", i % 200);
+      for (j = 0; j < 4; j++) {
+        omlc_zero (u);
+        omlc_set_const_string (u, strings[j]);
+        oml_value_set (&v[j], &u, OML_STRING_VALUE);
+      }
+      for (j = 0; j < 8; j++)
+        vector[j] = i + j * 0.125;
+      omlc_zero (u);
+      omlc_set_vector_double (u, vector, 1 + i % 8);
+      oml_value_set (&v[4], &u, OML_VECTOR_DOUBLE_VALUE);
+      omlc_free_vector (u);
+      if (marshal_init (mbuf, OMB_DATA_P) == -1 ||
+          marshal_measurements (mbuf, 3, i + 1, ts) == -1 ||
+          marshal_values (mbuf, v, 5) == -1 ||
+          marshal_finalize (mbuf) == -1)
+        return -1;
+    } else if (kind == TRACE_BINARY) {
+      omlc_zero (u);
+      omlc_set_int32 (u, i);
+      oml_value_set (&v[0], &u, OML_INT32_VALUE);
+      omlc_set_double (u, i * 1.5);
+      oml_value_set (&v[1], &u, OML_DOUBLE_VALUE);
+      omlc_zero (u);
+      omlc_set_const_string (u, s);
+      oml_value_set (&v[2], &u, OML_STRING_VALUE);
+      if (marshal_init (mbuf, OMB_DATA_P) == -1 ||
+          marshal_measurements (mbuf, 1, i + 1, ts) == -1 ||
+          marshal_values (mbuf, v, 3) == -1 ||
+          marshal_finalize (mbuf) == -1)
+        return -1;
+    } else {
+      mbuf_print (mbuf, "%f\t1\t%d\t%d\t%f\t%s\n", ts, i + 1, i, i * 1.5, s);
+    }
+  }
+
+  oml_value_array_reset (v, 5);
+
+  trace->name = kind == TRACE_BINARY ? "generated binary" :
+    kind == TRACE_TEXT ? "generated text" :
+    kind == TRACE_FIXTURES ? "generated fixtures" : "generated strings";
+  trace->length = mbuf_fill (mbuf);
+  trace->data = malloc (trace->length);
+  if (trace->data == NULL)
+    return -1;
+  memcpy (trace->data, mbuf_buffer (mbuf), trace->length);
+  mbuf_destroy (mbuf);
+
+  return trace_parse_headers (trace);
+}
+
+/** Frame all messages of a trace as the proxy does.
+ * \return the number of messages found, or -1 on error */
+static long
+bench_frame (struct trace *trace, MBuffer *mbuf)
+{
+  msg_start_fn msg_start = trace->binary ? bin_read_msg_start : text_read_msg_start;
+  struct oml_message msg;
+  size_t offset = trace->body, n;
+  long count = 0;
+  int length;
+
+  mbuf_clear2 (mbuf, 0);
+  while (offset < trace->length) {
+    n = trace->length - offset < CHUNK_SIZE ? trace->length - offset : CHUNK_SIZE;
+    if (mbuf_make_room (mbuf, n) == -1 || mbuf_write (mbuf, trace->data + offset, n) == -1)
+      return -1;
+    offset += n;
+
+    while ((length = msg_start (&msg, mbuf)) > 0) {
+      mbuf_reset_read (mbuf);
+      mbuf_read_skip (mbuf, length);
+      mbuf_consume_message (mbuf);
+      count++;
+    }
+    if (length == -1) {
+      fprintf (stderr, "%s: protocol error after %ld messages\n", trace->name, count);
+      return -1;
+    }
+    mbuf_reset_read (mbuf);
+  }
+
+  return count;
+}
+
+/** Scan a trace for delimiters as the server does: sync bytes for binary
+ * data, lines then fields for text.
+ * \return the number of delimiters found */
+static long
+bench_scan (struct trace *trace)
+{
+  const uint8_t *p = trace->data + trace->body, *end = trace->data + trace->length;
+  const uint8_t *q, *eol;
+  long count = 0;
+
+  if (trace->binary) {
+    while ((q = scan_pair (p, end - p, 0xAA)) != NULL) {
+      count++;
+      p = q + 2;
+    }
+  } else {
+    while ((eol = scan_byte (p, end - p, '\n')) != NULL) {
+      while ((q = scan_byte (p, eol - p, '\t')) != NULL) {
+        count++;
+        p = q + 1;
+      }
+      count++;
+      p = eol + 1;
+    }
+  }
+
+  return count;
+}
+
+/** Unmarshal all samples of a binary trace into one array of OmlValues per
+ * schema, as the server does, either resetting or clearing them beforehand.
+ * \return the number of samples unmarshalled, or -1 on error */
+static long
+bench_unmarshal (struct trace *trace, MBuffer *mbuf, OmlValue values[][MAX_FIELDS], int clear)
+{
+  OmlBinaryHeader header;
+  size_t length = trace->length - trace->body;
+  long count = 0;
+
+  mbuf_clear2 (mbuf, 0);
+  if (mbuf_make_room (mbuf, length) == -1 || mbuf_write (mbuf, trace->data + trace->body, length) == -1)
+    return -1;
+
+  while (bin_find_sync (mbuf) >= 0 && unmarshal_init (mbuf, &header) > 0) {
+    if (header.stream < 0 || header.stream >= MAX_SCHEMAS)
+      return -1;
+    if (clear)
+      oml_value_array_clear (values[header.stream], MAX_FIELDS);
+    else
+      oml_value_array_reset (values[header.stream], MAX_FIELDS);
+    if (unmarshal_measurements (mbuf, &header, values[header.stream], MAX_FIELDS) < 0)
+      return -1;
+    mbuf_consume_message (mbuf);
+    count++;
+  }
+
+  return count;
+}
+
+/** Convert all samples of a text trace to OmlValues, with their schema's
+ * text_decoder, or as the server used to.
+ * \return the number of samples converted */
+static long
+bench_decode (struct trace *trace, char *scratch, OmlValue *values, int use_decoder)
+{
+  char *p = scratch, *end = scratch + trace->length - trace->body;
+  char *eol, *tab, *fields[MAX_FIELDS];
+  struct schema *schema;
+  long count = 0;
+  int64_t n;
+  int nfields, table_index, i;
+  double ts;
+
+  /* The fields are modified in place */
+  memcpy (scratch, trace->data + trace->body, end - scratch);
+
+  for (; (eol = (char*)scan_byte ((uint8_t*)p, end - p, '\n')) != NULL; p = eol + 1) {
+    *eol = '\0';
+    for (nfields = 0; nfields < MAX_FIELDS; nfields++) {
+      fields[nfields] = p;
+      if ((tab = (char*)scan_byte ((uint8_t*)p, eol - p, '\t')) == NULL)
+        break;
+      *tab = '\0';
+      p = tab + 1;
+    }
+    nfields++;
+
+    if (use_decoder) {
+      if (text_parse_double (fields[0], &ts) == -1)
+        ts = atof (fields[0]);
+      table_index = text_parse_integer (fields[1], 9, &n) == 0 ? n : atol (fields[1]);
+    } else {
+      ts = atof (fields[0]);
+      table_index = atol (fields[1]);
+    }
+    if (nfields < 3 || table_index < 0 || table_index >= MAX_SCHEMAS ||
+        !(schema = trace->schemas[table_index]) || schema->nfields != nfields - 3)
+      continue;
+
+    if (use_decoder) {
+      if (text_decoder_decode (trace->decoders[table_index], &fields[3], values) < 0)
+        continue;
+    } else {
+      oml_value_array_reset (values, schema->nfields);
+      for (i = 0; i < schema->nfields; i++) {
+        oml_value_set_type (&values[i], schema->fields[i].type);
+        oml_value_from_s (&values[i], fields[i + 3]);
+      }
+    }
+    count += ts >= 0;
+  }
+
+  return count;
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *variants[] = { "scalar", "sse2", "avx2" };
+  struct trace *traces;
+  int ntraces = 0, iterations = 10;
+  int i, j, v;
+  MBuffer *mbuf = mbuf_create ();
+
+  o_set_log_level (O_LOG_ERROR);
+
+  if (argc > 2 && strcmp (argv[1], "-n") == 0) {
+    iterations = atoi (argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+
+  traces = calloc (argc > 1 ? argc - 1 : 4, sizeof (struct trace));
+  if (argc > 1) {
+    for (i = 1; i < argc; i++)
+      if (trace_load (&traces[ntraces], argv[i]) == 0)
+        ntraces++;
+  } else if (trace_generate (&traces[0], TRACE_BINARY) == 0 &&
+             trace_generate (&traces[1], TRACE_TEXT) == 0 &&
+             trace_generate (&traces[2], TRACE_FIXTURES) == 0 &&
+             trace_generate (&traces[3], TRACE_STRINGS) == 0) {
+    ntraces = 4;
+  }
+  if (ntraces == 0)
+    return 1;
+
+  printf ("# %-20s %-6s %-7s %10s %10s %10s %10s\n",
+          "trace", "type", "scan", "messages", "frame MB/s", "Mmsg/s", "scan MB/s");
+  for (i = 0; i < ntraces; i++) {
+    struct trace *t = &traces[i];
+    double mb = (t->length - t->body) / 1e6;
+
+    for (v = 0; v < (int)(sizeof (variants) / sizeof (variants[0])); v++) {
+      double start, frame_time, scan_time;
+      long messages = 0;
+
+      if (scan_select (variants[v]) == -1)
+        continue;
+
+      start = now ();
+      for (j = 0; j < iterations && messages >= 0; j++)
+        messages = bench_frame (t, mbuf);
+      frame_time = (now () - start) / iterations;
+      if (messages < 0)
+        return 1;
+
+      start = now ();
+      for (j = 0; j < iterations; j++)
+        bench_scan (t);
+      scan_time = (now () - start) / iterations;
+
+      printf ("  %-20.20s %-6s %-7s %10ld %10.1f %10.2f %10.1f\n",
+              t->name, t->binary ? "binary" : "text", variants[v], messages,
+              mb / frame_time, messages / frame_time / 1e6, mb / scan_time);
+    }
+  }
+
+  printf ("\n# %-20s %10s %14s %14s\n", "trace", "samples", "generic kS/s", "decoder kS/s");
+  scan_select (NULL);
+  for (i = 0; i < ntraces; i++) {
+    struct trace *t = &traces[i];
+    char *scratch;
+    OmlValue values[MAX_FIELDS];
+    double start, time[2];
+    long samples = 0;
+    int d;
+
+    if (t->binary)
+      continue;
+    scratch = malloc (t->length - t->body);
+    oml_value_array_init (values, MAX_FIELDS);
+    for (d = 0; d < 2; d++) {
+      start = now ();
+      for (j = 0; j < iterations; j++)
+        samples = bench_decode (t, scratch, values, d);
+      time[d] = (now () - start) / iterations;
+    }
+    oml_value_array_reset (values, MAX_FIELDS);
+    free (scratch);
+
+    printf ("  %-20.20s %10ld %14.1f %14.1f\n",
+            t->name, samples, samples / time[0] / 1e3, samples / time[1] / 1e3);
+  }
+
+  printf ("\n# %-20s %10s %14s %14s\n", "trace", "samples", "reset kS/s", "clear kS/s");
+  for (i = 0; i < ntraces; i++) {
+    struct trace *t = &traces[i];
+    static OmlValue values[MAX_SCHEMAS][MAX_FIELDS];
+    double start, time[2];
+    long samples = 0;
+    int c;
+
+    if (!t->binary)
+      continue;
+    oml_value_array_init (&values[0][0], MAX_SCHEMAS * MAX_FIELDS);
+    for (c = 0; c < 2; c++) {
+      start = now ();
+      for (j = 0; j < iterations && samples >= 0; j++)
+        samples = bench_unmarshal (t, mbuf, values, c);
+      time[c] = (now () - start) / iterations;
+    }
+    oml_value_array_reset (&values[0][0], MAX_SCHEMAS * MAX_FIELDS);
+    if (samples < 0)
+      return 1;
+
+    printf ("  %-20.20s %10ld %14.1f %14.1f\n",
+            t->name, samples, samples / time[0] / 1e3, samples / time[1] / 1e3);
+  }
+
+  mbuf_destroy (mbuf);
+  return 0;
+}
+
+/*
+ Local Variables:
+ mode: C
+ tab-width: 2
+ indent-tabs-mode: nil
+ End:
+ vim: sw=2:sts=2:expandtab
+*/
@@ -0,0 +1,120 @@
+#!/bin/bash
+#
+# This script is a load test of the oml2-server's multi-threaded mode.
+#
+# It spawns a server with several client-handling threads (--threads), and
+# many concurrent blob-generating clients, all reporting into the same
+# experiment database but with distinct sender IDs.
+#
+# Once done, the script checks that each sender's rows were all stored.
+#
+# It gives the number of failed senders as its return status. It purposefully
+# doesn't clean up after itself (see Makefile's CLEANLOCAL target) to allow for
+# forensic inspection in case of failures.
+#
+# Can be run manually as
+#  srcdir=. top_builddir=../.. TIMEOUT=`which timeout` ./run-many.sh [NCLIENTS [NTHREADS]]
+
+nclients=${1:-32}
+nthreads=${2:-4}
+
+dir=sq3_many
+loglevel=1
+nblobs=100
+
+port=$((RANDOM + 32766))
+exp=blobgen_many
+db=${dir}/${exp}.sq3
+
+## Start a daemon and wait for a pattern to appear in its log, or exit
+# startdaemon LOGFILE PATTERN DAEMON ARGS...
+startdaemon() {
+	log=$1
+	shift
+	pattern=$1
+	shift
+	prog=$(basename $1)
+	rest="$@"
+	$rest >>$log 2>&1 &
+	pid=$!
+	echo -n "# $prog=$pid" >&2
+	sleep 1
+	i=0
+	while ! grep -q "$pattern" "$log" ; do
+		echo -n "." >&2
+		if ! kill -0 ${pid} 2>/dev/null; then
+			echo
+			echo "Bail out! $prog is dead" >&2
+			exit 1
+		elif [ $((i++)) -gt 10 ]; then
+			echo
+			echo "Bail out! Giving up on $prog" >&2
+			exit 1
+		fi
+		sleep 1
+	done
+	echo >&2
+	echo $pid
+}
+
+## Do the real work below
+echo "# $0: $nclients clients, $nthreads server threads (logs in ${PWD}/$dir/)" >&2
+
+rm -rf $dir
+mkdir $dir
+
+# Start server
+server_pid=`startdaemon ${dir}/server.log "EventLoop" ${top_builddir}/server/oml2-server \
+	-d $loglevel --logfile - -l $port --data-dir=${dir} --threads=$nthreads`
+
+if [ ! -z "${TIMEOUT}" ]; then
+	TIMEOUT="${TIMEOUT} 60s"
+else
+	echo "# $0: timeout(1) utility not found; this test might hang indefinitely" >&2
+fi
+
+# Start all clients concurrently, each in its own directory as blobgen dumps
+# its blobs in the current one
+cpids=
+for c in `seq 1 $nclients`; do
+	mkdir ${dir}/c$c
+	(cd ${dir}/c$c && ${TIMEOUT} ../../blobgen -n $nblobs \
+		--oml-id c$c --oml-domain ${exp} --oml-collect localhost:$port \
+		--oml-log-level $loglevel --oml-log-file client.log) &
+	cpids="$cpids $!"
+done
+
+cfail=0
+for p in $cpids; do
+	wait $p || cfail=$((cfail + 1))
+done
+if [ ! $cfail = 0 ]; then
+	echo "Bail out! $cfail clients failed generating blobs" >&2
+	kill -9 $server_pid
+	exit $cfail
+fi
+
+# Stop oml2-server
+sleep 5
+echo -n "# $0: Terminating oml2-server ($server_pid)" >&2
+kill $server_pid
+while kill -0 $server_pid 2>/dev/null; do echo -n '.'; sleep 1; done # Wait for the oml2-server to have exited properly
+echo
+
+# Check that all rows from each sender made it to the database
+echo "# $0: Checking that server stored all data from each client..." >&2
+echo "1..$nclients"
+fail=$nclients
+ntests=0
+for c in `seq 1 $nclients`; do
+	n=$(sqlite3 $db "SELECT COUNT(*) FROM blobgen_blobmp AS b JOIN _senders AS s ON b.oml_sender_id=s.id WHERE s.name='c$c'" 2>>${dir}/db.log)
+	if [ "x$n" = "x$nblobs" ]; then
+		echo "ok $((++ntests)) - c$c: $n rows"
+		fail=$((fail - 1))
+	else
+		echo "not ok $((++ntests)) - c$c: ${n:-no} rows, expected $nblobs"
+	fi
+done
+echo "# $0: $fail/$nclients tests failed" >&2
+
+exit $fail
@@ -17,6 +17,11 @@
 #
 # Can be run manually as
 #  srcdir=. top_builddir=../.. POSTGRES=`which postgres` TIMEOUT=`which timeout` VERSION=`git describe` ./run.sh
+#
+# It can also serve as a rough ingestion benchmark, e.g., to compare storage
+# tuning options, with extra oml2-server parameters in SERVEROPTS and more blobs
+# in NBLOBS; the client run time is reported as a TAP comment, e.g.,
+#  SERVEROPTS="--sqlite-journal-mode=WAL --sqlite-synchronous=NORMAL --sqlite-commit-rows=1000" NBLOBS=10000 ./run.sh
 
 backend=${1:-sq3}
 long=$2
@@ -28,7 +33,7 @@ if [ "x$long" = "x--long" ]; then
 fi
 
 loglevel=1
-nblobs=100
+nblobs=${NBLOBS:-100}
 nmeta=2
 
 ntests=0
@@ -180,7 +185,7 @@ backendparams=`${backend}_params $dir $exp`
 
 # Start server
 server_pid=`startdaemon ${dir}/server.log "EventLoop" ${top_builddir}/server/oml2-server \
-	-d $loglevel --logfile - -l $port $backendparams`
+	-d $loglevel --logfile - -l $port $backendparams ${SERVEROPTS}`
 
 # Start client
 cd ${dir}
@@ -189,10 +194,13 @@ if [ ! -z "${TIMEOUT}" ]; then
 else
 	echo "# $0: timeout(1) utility not found; this test might hang indefinitely" >&2
 fi
+start=$(date +%s%N)
 ${TIMEOUT} ../blobgen -h -n $nblobs $longopt \
 	--oml-id a --oml-domain ${exp} --oml-collect localhost:$port --oml-bufsize 110000 \
 	--oml-log-level $loglevel --oml-log-file client.log
 ret=$?
+end=$(date +%s%N)
+echo "# $0 ($backend): client sent $nblobs blobs in $(((end - start) / 1000000))ms${SERVEROPTS:+ (server options: ${SERVEROPTS})}" >&2
 if [ ! $ret = 0 ]; then
 	if [ $ret = 124 ]; then
 		echo "Bail out! Timeout generating blobs"; >&2